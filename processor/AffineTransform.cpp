@@ -0,0 +1,127 @@
+#include <cmath>
+#include <stdexcept>
+#include "AffineTransform.h"
+#include "TrapezoidBuffer.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define AFFINE_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+// Точки обрабатываются как непрерывный массив пар (x, y)
+static_assert(sizeof(Point) == 2 * sizeof(double), "Point должен состоять ровно из двух double");
+
+AffineTransform::AffineTransform(double a, double b, double c, double d, double e, double f)
+    : a(a), b(b), c(c), d(d), e(e), f(f) {}
+
+AffineTransform AffineTransform::translation(double dx, double dy) {
+    return AffineTransform(1, 0, dx, 0, 1, dy);
+}
+
+AffineTransform AffineTransform::rotation(double angle, const Point& center) {
+    double cos_a = std::cos(angle), sin_a = std::sin(angle);
+    return translation(center.x, center.y) * AffineTransform(cos_a, -sin_a, 0, sin_a, cos_a, 0) * translation(-center.x, -center.y);
+}
+
+AffineTransform AffineTransform::scaling(double sx, double sy, const Point& center) {
+    return AffineTransform(sx, 0, center.x - sx * center.x, 0, sy, center.y - sy * center.y);
+}
+
+AffineTransform AffineTransform::mirrorX(double axis_y) {
+    return AffineTransform(1, 0, 0, 0, -1, 2 * axis_y);
+}
+
+AffineTransform AffineTransform::mirrorY(double axis_x) {
+    return AffineTransform(-1, 0, 2 * axis_x, 0, 1, 0);
+}
+
+AffineTransform AffineTransform::operator*(const AffineTransform& other) const {
+    return AffineTransform(a * other.a + b * other.d, a * other.b + b * other.e, a * other.c + b * other.f + c,
+                           d * other.a + e * other.d, d * other.b + e * other.e, d * other.c + e * other.f + f);
+}
+
+Point AffineTransform::apply(const Point& point) const {
+    return Point(a * point.x + b * point.y + c, d * point.x + e * point.y + f);
+}
+
+double AffineTransform::determinant() const {
+    return a * e - b * d;
+}
+
+bool AffineTransform::flips_orientation() const {
+    return determinant() < 0;
+}
+
+AffineTransform AffineTransform::inverse() const {
+    double det = determinant();
+    if (det == 0 || !std::isfinite(det)) {
+        throw std::invalid_argument("Вырожденное преобразование не имеет обратного");
+    }
+    return AffineTransform(e / det, -b / det, (b * f - e * c) / det,
+                           -d / det, a / det, (d * c - a * f) / det);
+}
+
+namespace {
+
+    void applyScalar(const AffineTransform& t, double* xy, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            double x = xy[2 * i], y = xy[2 * i + 1];
+            xy[2 * i] = t.a * x + t.b * y + t.c;
+            xy[2 * i + 1] = t.d * x + t.e * y + t.f;
+        }
+    }
+
+#ifdef AFFINE_KERNELS_X86
+
+    // Одна точка на регистр: [x, y] -> [x, x] * [a, d] + [y, y] * [b, e] + [c, f]
+    __attribute__((target("sse2")))
+    void applySSE2(const AffineTransform& t, double* xy, size_t count) {
+        __m128d m1 = _mm_setr_pd(t.a, t.d), m2 = _mm_setr_pd(t.b, t.e), shift = _mm_setr_pd(t.c, t.f);
+        for (size_t i = 0; i < count; ++i) {
+            __m128d v = _mm_loadu_pd(xy + 2 * i);
+            __m128d xs = _mm_unpacklo_pd(v, v), ys = _mm_unpackhi_pd(v, v);
+            _mm_storeu_pd(xy + 2 * i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(xs, m1), _mm_mul_pd(ys, m2)), shift));
+        }
+    }
+
+    // Две точки на регистр
+    __attribute__((target("avx2")))
+    void applyAVX2(const AffineTransform& t, double* xy, size_t count) {
+        __m256d m1 = _mm256_setr_pd(t.a, t.d, t.a, t.d), m2 = _mm256_setr_pd(t.b, t.e, t.b, t.e);
+        __m256d shift = _mm256_setr_pd(t.c, t.f, t.c, t.f);
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            __m256d v = _mm256_loadu_pd(xy + 2 * i);
+            __m256d xs = _mm256_permute_pd(v, 0x0), ys = _mm256_permute_pd(v, 0xF);
+            _mm256_storeu_pd(xy + 2 * i, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(xs, m1), _mm256_mul_pd(ys, m2)), shift));
+        }
+        applyScalar(t, xy + 2 * i, count - i);
+    }
+
+#endif // AFFINE_KERNELS_X86
+}
+
+void AffineTransform::apply(Point* points, size_t count) const {
+    double* xy = reinterpret_cast<double*>(points);
+    switch (TrapezoidKernels::activeIsa()) {
+#ifdef AFFINE_KERNELS_X86
+    case TrapezoidKernels::Isa::AVX2:
+        return applyAVX2(*this, xy, count);
+    case TrapezoidKernels::Isa::SSE2:
+        return applySSE2(*this, xy, count);
+#endif
+    default:
+        return applyScalar(*this, xy, count);
+    }
+}
+
+void AffineTransform::apply(std::vector<Point>& points) const {
+    apply(points.data(), points.size());
+}
+
+void AffineTransform::apply(Polygon& polygon) const {
+    apply(polygon.get_vertices());
+    for (Hole& hole : polygon.get_holes()) {
+        apply(hole.get_vertices());
+    }
+}
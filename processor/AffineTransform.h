@@ -0,0 +1,33 @@
+#ifndef AFFINETRANSFORM_H
+#define AFFINETRANSFORM_H
+
+#include "Entity.h"
+
+// Аффинное преобразование плоскости: x' = a*x + b*y + c, y' = d*x + e*y + f
+class AffineTransform {
+public:
+    double a, b, c;
+    double d, e, f;
+
+    AffineTransform(double a = 1, double b = 0, double c = 0, double d = 0, double e = 1, double f = 0);
+
+    static AffineTransform translation(double dx, double dy);
+    static AffineTransform rotation(double angle, const Point& center = Point());     // Угол в радианах, против часовой стрелки
+    static AffineTransform scaling(double sx, double sy, const Point& center = Point());
+    static AffineTransform mirrorX(double axis_y = 0);   // Отражение относительно горизонтальной прямой y = axis_y
+    static AffineTransform mirrorY(double axis_x = 0);   // Отражение относительно вертикальной прямой x = axis_x
+
+    // Композиция: сначала other, затем this
+    AffineTransform operator*(const AffineTransform& other) const;
+    Point apply(const Point& point) const;
+    double determinant() const;
+    bool flips_orientation() const;     // Отрицательный определитель: обход контуров меняется на противоположный
+    AffineTransform inverse() const;    // Для вырожденного преобразования бросает std::invalid_argument
+
+    // Пакетное применение к непрерывному массиву точек на месте (AVX2/SSE2 при поддержке процессором)
+    void apply(Point* points, size_t count) const;
+    void apply(std::vector<Point>& points) const;
+    void apply(Polygon& polygon) const;
+};
+
+#endif // AFFINETRANSFORM_H
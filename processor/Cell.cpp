@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "Cell.h"
+
+namespace {
+    Box transformBox(const AffineTransform& transform, const Box& box) {
+        Box result;
+        if (box.empty())
+            return result;
+        result.expand(transform.apply(Point(box.min_x, box.min_y)));
+        result.expand(transform.apply(Point(box.max_x, box.min_y)));
+        result.expand(transform.apply(Point(box.max_x, box.max_y)));
+        result.expand(transform.apply(Point(box.min_x, box.max_y)));
+        return result;
+    }
+
+    Box translateBox(const Box& box, const Point& offset) {
+        return Box(box.min_x + offset.x, box.min_y + offset.y, box.max_x + offset.x, box.max_y + offset.y);
+    }
+
+    // Ограничивающий прямоугольник всех копий массива: копии образуют решётку,
+    // поэтому достаточно крайних копий в её углах
+    Box instanceBox(const CellInstance& instance, const Box& cell_box) {
+        Box first = transformBox(instance.transform, cell_box);
+        Box result;
+        if (first.empty() || instance.copies() == 0)
+            return result;
+        Point last_column = instance.column_step * static_cast<double>(instance.columns - 1);
+        Point last_row = instance.row_step * static_cast<double>(instance.rows - 1);
+        result.expand(first);
+        result.expand(translateBox(first, last_column));
+        result.expand(translateBox(first, last_row));
+        result.expand(translateBox(first, last_column + last_row));
+        return result;
+    }
+
+    Box layerBox(const Layer& layer) {
+        Box box;
+        if (layer.is_compact()) {
+            const CompactPolygons& compact = layer.get_compact();
+            for (size_t i = 0; i < compact.size(); ++i)
+                box.expand(compact[i].get_bounding_box());
+        } else {
+            for (const Polygon& polygon : layer.get_polygons())
+                box.expand(polygon.get_bounding_box());
+        }
+        return box;
+    }
+
+    uint64_t mix(uint64_t hash, uint64_t value) {
+        return hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+    }
+
+    // Сужает диапазон копий [first, last) вдоль одной оси до тех, что могут пересечь [min, max].
+    // Диапазон берётся с запасом в одну копию с каждой стороны, точная проверка - по прямоугольнику копии
+    void narrowCopies(size_t& first, size_t& last, double low, double high, double step, double min, double max) {
+        if (step == 0) {
+            if (high < min || low > max)
+                last = first;
+            return;
+        }
+        double from = (min - high) / step;
+        double to = (max - low) / step;
+        if (step < 0)
+            std::swap(from, to);
+        from = std::max(static_cast<double>(first), std::ceil(from) - 1);
+        to = std::min(static_cast<double>(last) - 1, std::floor(to) + 1);
+        if (!(from <= to)) {
+            last = first;
+            return;
+        }
+        first = static_cast<size_t>(from);
+        last = static_cast<size_t>(to) + 1;
+    }
+}
+
+CellInstance::CellInstance(size_t cell, const AffineTransform& transform, size_t columns, size_t rows,
+                           const Point& column_step, const Point& row_step)
+    : cell(cell), transform(transform), columns(columns), rows(rows), column_step(column_step), row_step(row_step) {}
+
+size_t CellInstance::copies() const {
+    return columns * rows;
+}
+
+Cell::Cell(const std::string& name) : name(name), revision(0) {}
+
+const std::string& Cell::get_name() const {
+    return name;
+}
+
+LayerPack& Cell::get_layers() {
+    return layers;
+}
+
+const LayerPack& Cell::get_layers() const {
+    return layers;
+}
+
+const std::vector<CellInstance>& Cell::get_instances() const {
+    return instances;
+}
+
+void CellLibrary::check_index(size_t index) const {
+    if (index >= cells.size()) {
+        throw std::out_of_range("Индекс ячейки выходит за границы");
+    }
+}
+
+size_t CellLibrary::add_cell(const std::string& name) {
+    if (index_by_name.find(name) != index_by_name.end()) {
+        throw std::invalid_argument("Ячейка с именем \"" + name + "\" уже существует.");
+    }
+    index_by_name.emplace(name, cells.size());
+    cells.emplace_back(name);
+    boxes.emplace_back();
+    return cells.size() - 1;
+}
+
+size_t CellLibrary::find(const std::string& name) const {
+    auto it = index_by_name.find(name);
+    if (it == index_by_name.end()) {
+        throw std::out_of_range("Ячейка с таким именем не найдена");
+    }
+    return it->second;
+}
+
+bool CellLibrary::contains(const std::string& name) const {
+    return index_by_name.find(name) != index_by_name.end();
+}
+
+size_t CellLibrary::size() const {
+    return cells.size();
+}
+
+Cell& CellLibrary::operator[](size_t index) {
+    check_index(index);
+    return cells[index];
+}
+
+const Cell& CellLibrary::operator[](size_t index) const {
+    check_index(index);
+    return cells[index];
+}
+
+Cell& CellLibrary::operator[](const std::string& name) {
+    return cells[find(name)];
+}
+
+const Cell& CellLibrary::operator[](const std::string& name) const {
+    return cells[find(name)];
+}
+
+bool CellLibrary::reaches(size_t from, size_t to) const {
+    std::vector<char> visited(cells.size(), 0);
+    std::vector<size_t> stack = {from};
+    visited[from] = 1;
+    while (!stack.empty()) {
+        size_t index = stack.back();
+        stack.pop_back();
+        if (index == to)
+            return true;
+        for (const CellInstance& instance : cells[index].instances) {
+            if (!visited[instance.cell]) {
+                visited[instance.cell] = 1;
+                stack.push_back(instance.cell);
+            }
+        }
+    }
+    return false;
+}
+
+void CellLibrary::add_instance(size_t parent, const CellInstance& instance) {
+    check_index(parent);
+    check_index(instance.cell);
+    if (reaches(instance.cell, parent)) {
+        throw std::invalid_argument("Вхождение ячейки \"" + cells[instance.cell].name + "\" в \"" +
+                                    cells[parent].name + "\" создаёт цикл");
+    }
+    cells[parent].instances.push_back(instance);
+    ++cells[parent].revision;
+}
+
+void CellLibrary::remove_instance(size_t parent, size_t index) {
+    check_index(parent);
+    std::vector<CellInstance>& instances = cells[parent].instances;
+    if (index >= instances.size()) {
+        throw std::out_of_range("Индекс вхождения выходит за границы");
+    }
+    instances.erase(instances.begin() + index);
+    ++cells[parent].revision;
+}
+
+std::vector<size_t> CellLibrary::top_cells() const {
+    std::vector<char> used(cells.size(), 0);
+    for (const Cell& cell : cells) {
+        for (const CellInstance& instance : cell.instances)
+            used[instance.cell] = 1;
+    }
+    std::vector<size_t> result;
+    for (size_t i = 0; i < cells.size(); ++i) {
+        if (!used[i])
+            result.push_back(i);
+    }
+    return result;
+}
+
+// Проверяет кэш ячейки и её вхождений один раз за запрос (refreshed), пересчитывая устаревшие
+const CellLibrary::BoxCache& CellLibrary::refresh(size_t index, std::vector<char>& refreshed) const {
+    BoxCache& cache = boxes[index];
+    if (refreshed[index])
+        return cache;
+    refreshed[index] = 1;
+
+    const Cell& cell = cells[index];
+    const std::vector<Layer>& layers = cell.layers.get_layers();
+    uint64_t own_stamp = mix(0, layers.size());
+    for (const Layer& layer : layers)
+        own_stamp = mix(own_stamp, layer.get_version());
+    if (!cache.valid || cache.own_stamp != own_stamp) {
+        cache.own_box = Box();
+        for (const Layer& layer : layers)
+            cache.own_box.expand(layerBox(layer));
+        cache.own_stamp = own_stamp;
+        cache.valid = false;
+    }
+
+    uint64_t stamp = mix(own_stamp, cell.revision);
+    for (const CellInstance& instance : cell.instances)
+        stamp = mix(stamp, refresh(instance.cell, refreshed).stamp);
+    if (!cache.valid || cache.stamp != stamp) {
+        cache.box = cache.own_box;
+        for (const CellInstance& instance : cell.instances)
+            cache.box.expand(instanceBox(instance, boxes[instance.cell].box));
+        cache.stamp = stamp;
+        cache.valid = true;
+    }
+    return cache;
+}
+
+Box CellLibrary::get_bounding_box(size_t index) const {
+    check_index(index);
+    std::vector<char> refreshed(cells.size(), 0);
+    return refresh(index, refreshed).box;
+}
+
+void CellLibrary::flatten(size_t index, const std::string& layer, const AffineTransform& transform,
+                          const Box* region, Layer& target) const {
+    const Cell& cell = cells[index];
+    bool invertible = transform.determinant() != 0;
+
+    if (cell.layers.contains(layer)) {
+        const Layer& source = cell.layers[layer];
+        // Компактный слой ячейки читается через PolygonView: копия полигона нужна всё равно,
+        // а распаковка самого слоя держала бы в памяти обе формы
+        auto polygonAt = [&source](size_t i) {
+            return source.is_compact() ? source.get_compact()[i].to_polygon() : source[i];
+        };
+        if (!region) {
+            for (size_t i = 0; i < source.size(); ++i) {
+                Polygon placed = polygonAt(i);
+                transform.apply(placed);
+                target.append(std::move(placed));
+            }
+        } else {
+            std::vector<size_t> candidates;
+            if (invertible) {
+                candidates = source.query_window(transformBox(transform.inverse(), *region));
+            } else {
+                candidates.resize(source.size());
+                for (size_t i = 0; i < candidates.size(); ++i)
+                    candidates[i] = i;
+            }
+            for (size_t i : candidates) {
+                Polygon placed = polygonAt(i);
+                transform.apply(placed);
+                if (placed.get_bounding_box().intersects(*region))
+                    target.append(std::move(placed));
+            }
+        }
+    }
+
+    for (const CellInstance& instance : cell.instances) {
+        const Box& child_box = boxes[instance.cell].box;
+        if (child_box.empty())
+            continue;
+
+        size_t first_column = 0, last_column = instance.columns;
+        size_t first_row = 0, last_row = instance.rows;
+        // Для массивов по осям диапазон копий в окне вычисляется сразу, без перебора всех копий
+        if (region && invertible && instance.column_step.y == 0 && instance.row_step.x == 0) {
+            Box local_region = transformBox(transform.inverse(), *region);
+            Box first = transformBox(instance.transform, child_box);
+            narrowCopies(first_column, last_column, first.min_x, first.max_x, instance.column_step.x,
+                         local_region.min_x, local_region.max_x);
+            narrowCopies(first_row, last_row, first.min_y, first.max_y, instance.row_step.y,
+                         local_region.min_y, local_region.max_y);
+        }
+
+        for (size_t j = first_row; j < last_row; ++j) {
+            for (size_t i = first_column; i < last_column; ++i) {
+                Point offset = instance.column_step * static_cast<double>(i) + instance.row_step * static_cast<double>(j);
+                AffineTransform placement = transform * AffineTransform::translation(offset.x, offset.y) * instance.transform;
+                if (region && !transformBox(placement, child_box).intersects(*region))
+                    continue;
+                flatten(instance.cell, layer, placement, region, target);
+            }
+        }
+    }
+}
+
+void CellLibrary::flatten(size_t index, const std::string& layer, Layer& target) const {
+    check_index(index);
+    std::vector<char> refreshed(cells.size(), 0);
+    refresh(index, refreshed);
+    flatten(index, layer, AffineTransform(), nullptr, target);
+}
+
+void CellLibrary::flatten(size_t index, const std::string& layer, const Box& region, Layer& target) const {
+    check_index(index);
+    std::vector<char> refreshed(cells.size(), 0);
+    if (region.empty() || !refresh(index, refreshed).box.intersects(region))
+        return;
+    flatten(index, layer, AffineTransform(), &region, target);
+}
+
+size_t CellLibrary::placed_count(size_t index, const std::string& layer) const {
+    check_index(index);
+    const size_t unknown = std::numeric_limits<size_t>::max();
+    std::vector<size_t> counts(cells.size(), unknown);
+    // Обход в обратном порядке: ячейка считается после всех своих вхождений
+    std::vector<std::pair<size_t, bool>> stack = {{index, false}};
+    while (!stack.empty()) {
+        auto [current, expanded] = stack.back();
+        stack.pop_back();
+        if (counts[current] != unknown)
+            continue;
+        const Cell& cell = cells[current];
+        if (!expanded) {
+            stack.push_back({current, true});
+            for (const CellInstance& instance : cell.instances) {
+                if (counts[instance.cell] == unknown)
+                    stack.push_back({instance.cell, false});
+            }
+            continue;
+        }
+        size_t count = cell.layers.contains(layer) ? cell.layers[layer].size() : 0;
+        for (const CellInstance& instance : cell.instances)
+            count += instance.copies() * counts[instance.cell];
+        counts[current] = count;
+    }
+    return counts[index];
+}
@@ -0,0 +1,104 @@
+#ifndef CELL_H
+#define CELL_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Entity.h"
+#include "AffineTransform.h"
+
+// Вхождение ячейки в родительскую. Массив - columns x rows копий: копия (i, j) получается
+// преобразованием transform и затем сдвигом на i * column_step + j * row_step в координатах родителя
+struct CellInstance {
+    size_t cell;                    // Индекс ячейки в CellLibrary
+    AffineTransform transform;
+    size_t columns, rows;
+    Point column_step, row_step;
+
+    CellInstance(size_t cell, const AffineTransform& transform = AffineTransform(),
+                 size_t columns = 1, size_t rows = 1, const Point& column_step = Point(), const Point& row_step = Point());
+
+    size_t copies() const;
+};
+
+
+// Ячейка: собственные слои и вхождения других ячеек. Вхождения меняются только
+// через CellLibrary, которая следит за отсутствием циклов
+class Cell {
+private:
+    std::string name;
+    LayerPack layers;
+    std::vector<CellInstance> instances;
+    uint64_t revision;      // Меняется при изменении списка вхождений
+
+    friend class CellLibrary;
+
+public:
+    explicit Cell(const std::string& name = "Unnamed Cell");
+
+    const std::string& get_name() const;
+    LayerPack& get_layers();
+    const LayerPack& get_layers() const;
+    const std::vector<CellInstance>& get_instances() const;
+};
+
+
+// Иерархия ячеек. Повторяющаяся геометрия хранится один раз в своей ячейке, поэтому память
+// растёт с уникальной геометрией, а не с размещённой; плоский слой строится по запросу
+// и только для нужной области.
+// Ограничивающие прямоугольники ячеек кэшируются вместе с версиями слоёв (Layer::get_version)
+// и вхождений и пересчитываются только для изменённых ячеек и их предков. Кэш заполняется
+// при константных запросах, поэтому одновременные запросы из разных потоков небезопасны
+class CellLibrary {
+private:
+    struct BoxCache {
+        bool valid = false;
+        uint64_t own_stamp = 0;     // Версии собственных слоёв, при которых вычислен own_box
+        uint64_t stamp = 0;         // То же с учётом вхождений для box
+        Box own_box;
+        Box box;
+    };
+
+    std::vector<Cell> cells;
+    std::unordered_map<std::string, size_t> index_by_name;
+    mutable std::vector<BoxCache> boxes;
+
+    void check_index(size_t index) const;
+    bool reaches(size_t from, size_t to) const;     // Ячейка to входит в иерархию from
+    const BoxCache& refresh(size_t index, std::vector<char>& refreshed) const;
+    void flatten(size_t index, const std::string& layer, const AffineTransform& transform,
+                 const Box* region, Layer& target) const;
+
+public:
+    CellLibrary() = default;
+
+    size_t add_cell(const std::string& name);       // Индекс новой пустой ячейки
+    size_t find(const std::string& name) const;
+    bool contains(const std::string& name) const;
+    size_t size() const;
+
+    Cell& operator[](size_t index);
+    const Cell& operator[](size_t index) const;
+    Cell& operator[](const std::string& name);
+    const Cell& operator[](const std::string& name) const;
+
+    // Бросает std::invalid_argument, если вхождение создаёт цикл
+    void add_instance(size_t parent, const CellInstance& instance);
+    void remove_instance(size_t parent, size_t index);
+
+    std::vector<size_t> top_cells() const;          // Ячейки, не входящие в другие
+
+    // Ограничивающий прямоугольник всех слоёв ячейки вместе с вхождениями
+    Box get_bounding_box(size_t index) const;
+
+    // Полигоны слоя layer ячейки и всех её вхождений в координатах ячейки добавляются в target.
+    // С окном region добавляются только полигоны, ограничивающий прямоугольник которых его пересекает,
+    // а поддеревья и копии массивов вне окна не обходятся
+    void flatten(size_t index, const std::string& layer, Layer& target) const;
+    void flatten(size_t index, const std::string& layer, const Box& region, Layer& target) const;
+
+    // Число полигонов слоя после полного разворачивания, без построения геометрии
+    size_t placed_count(size_t index, const std::string& layer) const;
+};
+
+#endif // CELL_H
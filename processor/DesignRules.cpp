@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include "DesignRules.h"
+#include "GeometryOperations.h"
+#include "ThreadPool.h"
+
+namespace DesignRules {
+    namespace {
+        const double DRC_EPSILON = 1e-9;
+
+        // Ребро объединённой области; область всегда слева от ребра
+        struct RuleEdge {
+            Point from, to;
+            double min_x, max_x, min_y, max_y;
+            size_t contour;         // Сквозной номер контура
+            size_t index, count;    // Номер ребра в контуре и число рёбер контура
+            int operand;            // 0 - проверяемый слой, 1 - внешний слой правила Enclosure
+        };
+
+        struct LayerGeometry {
+            std::vector<Trapezoid> trapezoids;
+            std::vector<RuleEdge> edges;
+            size_t contours = 0;
+        };
+
+        void appendContour(const std::vector<Point>& contour, LayerGeometry& geometry) {
+            size_t count = contour.size();
+            for (size_t i = 0; i < count; ++i) {
+                const Point& from = contour[i];
+                const Point& to = contour[(i + 1) % count];
+                RuleEdge edge = {from, to,
+                                 std::min(from.x, to.x), std::max(from.x, to.x),
+                                 std::min(from.y, to.y), std::max(from.y, to.y),
+                                 geometry.contours, i, count, 0};
+                geometry.edges.push_back(edge);
+            }
+            ++geometry.contours;
+        }
+
+        // Сборка из трапецоидов даёт внешние контуры против часовой стрелки, дырки - по часовой.
+        // reconstructLayer не пропускает фигуры: незамкнувшийся контур - исключение, а не пустой слой без нарушений
+        LayerGeometry buildGeometry(const Layer& layer) {
+            LayerGeometry geometry;
+            geometry.trapezoids = LayerOperations::decomposeLayer(layer);
+            Layer merged;
+            LayerOperations::reconstructLayer(geometry.trapezoids, merged);
+            for (const Polygon& polygon : merged.get_polygons()) {
+                appendContour(polygon.get_vertices(), geometry);
+                for (const Hole& hole : polygon.get_holes()) {
+                    appendContour(hole.get_vertices(), geometry);
+                }
+            }
+            return geometry;
+        }
+
+        double dot(const Point& a, const Point& b) {
+            return a.x * b.x + a.y * b.y;
+        }
+
+        double cross(const Point& a, const Point& b) {
+            return a.x * b.y - a.y * b.x;
+        }
+
+        double length(const Point& a) {
+            return std::sqrt(dot(a, a));
+        }
+
+        // Параметр проекции точки на отрезок, ограниченный [0, 1]
+        double project(const Point& point, const Point& from, const Point& to) {
+            Point direction = to - from;
+            double squared = dot(direction, direction);
+            if (squared == 0)
+                return 0;
+            return std::min(1.0, std::max(0.0, dot(point - from, direction) / squared));
+        }
+
+        Point pointAt(const RuleEdge& edge, double t) {
+            return edge.from + (edge.to - edge.from) * t;
+        }
+
+        // Ближайшие точки двух отрезков; для пересекающихся - точка пересечения и расстояние 0
+        double closestPoints(const RuleEdge& a, const RuleEdge& b, Point& on_a, Point& on_b) {
+            Point da = a.to - a.from;
+            Point db = b.to - b.from;
+            double s1 = cross(da, b.from - a.from);
+            double s2 = cross(da, b.to - a.from);
+            double s3 = cross(db, a.from - b.from);
+            double s4 = cross(db, a.to - b.from);
+            if (((s1 > 0 && s2 < 0) || (s1 < 0 && s2 > 0)) && ((s3 > 0 && s4 < 0) || (s3 < 0 && s4 > 0))) {
+                on_a = pointAt(a, s3 / (s3 - s4));
+                on_b = on_a;
+                return 0;
+            }
+
+            double best = std::numeric_limits<double>::infinity();
+            auto consider = [&](const Point& p, const Point& q) {
+                double distance = length(q - p);
+                if (distance < best) {
+                    best = distance;
+                    on_a = p;
+                    on_b = q;
+                }
+            };
+            consider(a.from, pointAt(b, project(a.from, b.from, b.to)));
+            consider(a.to, pointAt(b, project(a.to, b.from, b.to)));
+            consider(pointAt(a, project(b.from, a.from, a.to)), b.from);
+            consider(pointAt(a, project(b.to, a.from, a.to)), b.to);
+            return best;
+        }
+
+        bool adjacent(const RuleEdge& a, const RuleEdge& b) {
+            if (a.contour != b.contour || a.operand != b.operand)
+                return false;
+            size_t next_a = (a.index + 1) % a.count;
+            size_t next_b = (b.index + 1) % b.count;
+            return next_a == b.index || next_b == a.index;
+        }
+
+        // Сторона, с которой от ребра лежит точка: > 0 - внутри области, < 0 - снаружи, 0 - на прямой ребра
+        int side(const RuleEdge& edge, const Point& offset) {
+            Point direction = edge.to - edge.from;
+            double scale = length(direction) * length(offset);
+            double value = cross(direction, offset);
+            if (std::abs(value) <= scale * DRC_EPSILON)
+                return 0;
+            return value > 0 ? 1 : -1;
+        }
+
+        // Прямоугольник, охватывающий части рёбер, лежащие напротив друг друга
+        Box facingRegion(const RuleEdge& a, const RuleEdge& b, const Point& on_a, const Point& on_b) {
+            Box region;
+            region.expand(on_a);
+            region.expand(on_b);
+            region.expand(pointAt(a, project(b.from, a.from, a.to)));
+            region.expand(pointAt(a, project(b.to, a.from, a.to)));
+            region.expand(pointAt(b, project(a.from, b.from, b.to)));
+            region.expand(pointAt(b, project(a.to, b.from, b.to)));
+            return region;
+        }
+
+        bool pointLess(const Point& a, const Point& b) {
+            return a.x < b.x || (a.x == b.x && a.y < b.y);
+        }
+
+        // Проверка пары рёбер; для Enclosure a - ребро проверяемого слоя, b - внешнего
+        bool checkPair(const Rule& rule, size_t rule_index, const RuleEdge& a, const RuleEdge& b,
+                       std::vector<Violation>& violations) {
+            if (rule.kind == RuleKind::Enclosure) {
+                if (a.operand == b.operand)
+                    return false;
+                if (a.operand == 1)
+                    return checkPair(rule, rule_index, b, a, violations);
+            } else if (adjacent(a, b)) {
+                return false;
+            }
+
+            Point on_a, on_b;
+            double distance = closestPoints(a, b, on_a, on_b);
+            double tolerance = DRC_EPSILON * std::max(1.0, rule.value);
+            if (distance >= rule.value - tolerance)
+                return false;
+
+            // Касание и пересечение рёбер нарушают любое правило; иначе рёбра должны смотреть
+            // друг на друга нужными сторонами
+            if (distance > tolerance) {
+                int side_a = side(a, on_b - on_a);
+                int side_b = side(b, on_a - on_b);
+                bool facing = false;
+                switch (rule.kind) {
+                case RuleKind::Width:
+                    facing = side_a > 0 && side_b > 0;
+                    break;
+                case RuleKind::Spacing:
+                    facing = side_a < 0 && side_b < 0;
+                    break;
+                case RuleKind::Enclosure:
+                    facing = side_a < 0 && side_b > 0;
+                    break;
+                }
+                if (!facing)
+                    return false;
+            }
+
+            // Для симметричных правил пара записывается в одном порядке, чтобы повторы совпадали
+            if (rule.kind != RuleKind::Enclosure && pointLess(on_b, on_a))
+                std::swap(on_a, on_b);
+            violations.push_back({rule_index, rule.kind, on_a, on_b, distance, facingRegion(a, b, on_a, on_b)});
+            return true;
+        }
+
+        // Сетка тайлов над ограничивающим прямоугольником рёбер
+        struct TileGrid {
+            double min_x, min_y, width, height;
+            size_t columns, rows;
+
+            size_t column(double x) const {
+                double cell = std::floor((x - min_x) / width);
+                return cell <= 0 ? 0 : std::min(columns - 1, static_cast<size_t>(cell));
+            }
+
+            size_t row(double y) const {
+                double cell = std::floor((y - min_y) / height);
+                return cell <= 0 ? 0 : std::min(rows - 1, static_cast<size_t>(cell));
+            }
+        };
+
+        // Проход по рёбрам тайла в порядке левого края: каждое ребро сравнивается с более ранними,
+        // правый край которых с учётом нормы ещё не пройден. Пара принадлежит тайлу, в котором лежит
+        // точка (левый край правого ребра, наибольший из нижних краёв пары)
+        void sweepTile(const Rule& rule, size_t rule_index, const std::vector<RuleEdge>& edges,
+                       const std::vector<size_t>& tile_edges, const TileGrid& grid, size_t column, size_t row,
+                       std::vector<Violation>& violations) {
+            std::vector<size_t> active;
+            for (size_t i : tile_edges) {
+                const RuleEdge& edge = edges[i];
+                bool owned_column = grid.column(edge.min_x) == column;
+                size_t kept = 0;
+                for (size_t j : active) {
+                    const RuleEdge& other = edges[j];
+                    if (other.max_x + rule.value < edge.min_x)
+                        continue;
+                    active[kept++] = j;
+                    if (!owned_column)
+                        continue;
+                    if (other.max_y + rule.value < edge.min_y || edge.max_y + rule.value < other.min_y)
+                        continue;
+                    if (grid.row(std::max(edge.min_y, other.min_y)) != row)
+                        continue;
+                    checkPair(rule, rule_index, other, edge, violations);
+                }
+                active.resize(kept);
+                active.push_back(i);
+            }
+        }
+
+        void checkEdges(const Rule& rule, size_t rule_index, std::vector<RuleEdge>& edges,
+                        ThreadPool* pool, std::vector<Violation>& violations) {
+            if (edges.empty())
+                return;
+            std::sort(edges.begin(), edges.end(), [](const RuleEdge& a, const RuleEdge& b) {
+                return a.min_x < b.min_x;
+            });
+
+            // Около EDGES_PER_TILE рёбер на тайл, при нескольких потоках - не меньше 4 тайлов на поток
+            const size_t EDGES_PER_TILE = 256;
+            Box bounds;
+            for (const RuleEdge& edge : edges) {
+                bounds.expand(edge.from);
+                bounds.expand(edge.to);
+            }
+            size_t side = static_cast<size_t>(std::ceil(std::sqrt(double(edges.size()) / EDGES_PER_TILE)));
+            if (pool)
+                side = std::max(side, static_cast<size_t>(std::ceil(std::sqrt(4.0 * pool->size()))));
+            TileGrid grid = {bounds.min_x, bounds.min_y,
+                             std::max(bounds.max_x - bounds.min_x, rule.value) / side,
+                             std::max(bounds.max_y - bounds.min_y, rule.value) / side,
+                             side, side};
+
+            // Ребро попадает во все тайлы, которые пересекает его прямоугольник, расширенный на норму
+            // вправо и вверх; номера рёбер в тайле остаются упорядоченными по левому краю
+            std::vector<std::vector<size_t>> tiles(grid.columns * grid.rows);
+            for (size_t i = 0; i < edges.size(); ++i) {
+                const RuleEdge& edge = edges[i];
+                size_t last_column = grid.column(edge.max_x + rule.value);
+                size_t last_row = grid.row(edge.max_y + rule.value);
+                for (size_t column = grid.column(edge.min_x); column <= last_column; ++column) {
+                    for (size_t row = grid.row(edge.min_y); row <= last_row; ++row) {
+                        tiles[row * grid.columns + column].push_back(i);
+                    }
+                }
+            }
+
+            std::vector<std::vector<Violation>> found(tiles.size());
+            auto body = [&](size_t tile) {
+                sweepTile(rule, rule_index, edges, tiles[tile], grid, tile % grid.columns, tile / grid.columns, found[tile]);
+            };
+            if (pool) {
+                pool->parallel_for(tiles.size(), body);
+            } else {
+                for (size_t tile = 0; tile < tiles.size(); ++tile) {
+                    body(tile);
+                }
+            }
+            for (std::vector<Violation>& part : found) {
+                violations.insert(violations.end(), part.begin(), part.end());
+            }
+        }
+
+        // Части проверяемого слоя вне внешнего слоя
+        void checkUncovered(size_t rule_index, const LayerGeometry& inner, const LayerGeometry& outer,
+                            std::vector<Violation>& violations) {
+            std::vector<Trapezoid> uncovered = TrapezoidOperations::subtract(inner.trapezoids, outer.trapezoids);
+            if (uncovered.empty())
+                return;
+            Layer parts;
+            LayerOperations::reconstructLayer(uncovered, parts);
+            for (const Polygon& polygon : parts.get_polygons()) {
+                Box box = polygon.get_bounding_box();
+                violations.push_back({rule_index, RuleKind::Enclosure, Point(box.min_x, box.min_y),
+                                      Point(box.max_x, box.max_y), 0, box});
+            }
+        }
+    }
+
+    Rule Rule::width(const std::string& layer, double value) {
+        return {RuleKind::Width, layer, std::string(), value};
+    }
+
+    Rule Rule::spacing(const std::string& layer, double value) {
+        return {RuleKind::Spacing, layer, std::string(), value};
+    }
+
+    Rule Rule::enclosure(const std::string& layer, const std::string& outer_layer, double value) {
+        return {RuleKind::Enclosure, layer, outer_layer, value};
+    }
+
+    std::vector<Violation> check(const LayerPack& layerpack, const std::vector<Rule>& rules, size_t threads) {
+        for (const Rule& rule : rules) {
+            if (!(rule.value > 0)) {
+                throw std::invalid_argument("Норма правила должна быть положительной");
+            }
+        }
+
+        // Объединённая геометрия строится один раз на слой, даже если он входит в несколько правил
+        std::map<std::string, LayerGeometry> geometries;
+        auto geometry = [&](const std::string& name) -> const LayerGeometry& {
+            auto it = geometries.find(name);
+            if (it == geometries.end())
+                it = geometries.emplace(name, buildGeometry(layerpack[name])).first;
+            return it->second;
+        };
+
+        std::unique_ptr<ThreadPool> pool;
+        if (threads > 1)
+            pool.reset(new ThreadPool(threads));
+
+        std::vector<Violation> violations;
+        for (size_t i = 0; i < rules.size(); ++i) {
+            const Rule& rule = rules[i];
+            const LayerGeometry& inner = geometry(rule.layer);
+            std::vector<RuleEdge> edges = inner.edges;
+            if (rule.kind == RuleKind::Enclosure) {
+                const LayerGeometry& outer = geometry(rule.outer_layer);
+                for (RuleEdge edge : outer.edges) {
+                    edge.operand = 1;
+                    edges.push_back(edge);
+                }
+                checkUncovered(i, inner, outer, violations);
+            }
+            checkEdges(rule, i, edges, pool.get(), violations);
+        }
+
+        // Угол вблизи чужого угла даёт одно и то же место для нескольких пар рёбер
+        auto less = [](const Violation& a, const Violation& b) {
+            if (a.rule != b.rule)
+                return a.rule < b.rule;
+            if (!(a.first == b.first))
+                return pointLess(a.first, b.first);
+            return pointLess(a.second, b.second);
+        };
+        std::stable_sort(violations.begin(), violations.end(), less);
+        violations.erase(std::unique(violations.begin(), violations.end(), [](const Violation& a, const Violation& b) {
+            return a.rule == b.rule && a.first == b.first && a.second == b.second;
+        }), violations.end());
+        return violations;
+    }
+
+    std::vector<Violation> check(const LayerPack& layerpack, const Rule& rule, size_t threads) {
+        return check(layerpack, std::vector<Rule>{rule}, threads);
+    }
+}
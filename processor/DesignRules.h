@@ -0,0 +1,49 @@
+#ifndef DESIGNRULES_H
+#define DESIGNRULES_H
+
+#include <string>
+#include <vector>
+#include "Entity.h"
+
+// Проверка топологических норм (DRC): ширина, зазор и перекрытие одного слоя другим.
+//
+// Полигоны слоя предварительно объединяются, поэтому перекрывающиеся и соприкасающиеся фигуры
+// проверяются как одна область. Ограничивающий прямоугольник рёбер делится на сетку тайлов,
+// в каждом тайле пары рёбер ближе нормы ищутся проходом по x (sweep-line): рёбра упорядочены
+// по левому краю, активными остаются те, чей правый край с учётом нормы ещё не пройден.
+// Каждая пара приписана одному тайлу, поэтому нарушение находится ровно один раз;
+// при threads > 1 тайлы проверяются в пуле потоков.
+namespace DesignRules {
+    enum class RuleKind {
+        Width,          // Расстояние между противолежащими рёбрами внутри фигуры
+        Spacing,        // Расстояние между рёбрами снаружи фигур (в том числе внутри одной фигуры - "вырезы")
+        Enclosure,      // Отступ границы внешнего слоя от границы внутреннего
+    };
+
+    struct Rule {
+        RuleKind kind;
+        std::string layer;
+        std::string outer_layer;    // Только для Enclosure: слой, который должен покрывать layer
+        double value;               // Минимально допустимое расстояние
+
+        static Rule width(const std::string& layer, double value);
+        static Rule spacing(const std::string& layer, double value);
+        static Rule enclosure(const std::string& layer, const std::string& outer_layer, double value);
+    };
+
+    // Место нарушения - ближайшие точки пары рёбер и прямоугольник, охватывающий их противолежащие части.
+    // Для части внутреннего слоя, не покрытой внешним, distance = 0, а first и second - углы этой части
+    struct Violation {
+        size_t rule;                // Номер правила в списке
+        RuleKind kind;
+        Point first, second;
+        double distance;
+        Box region;
+    };
+
+    // Нарушения упорядочены по номеру правила, затем по координатам места
+    std::vector<Violation> check(const LayerPack& layerpack, const std::vector<Rule>& rules, size_t threads = 1);
+    std::vector<Violation> check(const LayerPack& layerpack, const Rule& rule, size_t threads = 1);
+}
+
+#endif // DESIGNRULES_H
@@ -0,0 +1,286 @@
+#include "EditJournal.h"
+
+EditJournal::EditJournal(LayerPack& layerpack, size_t max_depth)
+    : layerpack(layerpack), max_depth(max_depth) {}
+
+size_t EditJournal::layer_index(const std::string& name) const {
+    const auto& index = layerpack.get_layers_index();
+    auto it = index.find(name);
+    if (it == index.end()) {
+        throw std::out_of_range("Слой с таким именем не найден");
+    }
+    return it->second;
+}
+
+// Вставка в позицию, равную размеру, означает добавление в конец: так отменяется удаление последнего элемента
+EditJournal::Edit EditJournal::apply(Edit& edit) {
+    Edit inverse;
+    inverse.layer = edit.layer;
+    inverse.polygon = edit.polygon;
+    inverse.index = edit.index;
+
+    switch (edit.kind) {
+    case Edit::Kind::InsertVertex: {
+        Polygon& polygon = layerpack[edit.layer][edit.polygon];
+        if (edit.index == polygon.get_vertices().size())
+            polygon.append(edit.point);
+        else
+            polygon.insert(edit.point, edit.index);
+        inverse.kind = Edit::Kind::RemoveVertex;
+        break;
+    }
+    case Edit::Kind::RemoveVertex: {
+        Polygon& polygon = layerpack[edit.layer][edit.polygon];
+        inverse.point = polygon[edit.index];
+        polygon.remove(edit.index);
+        inverse.kind = Edit::Kind::InsertVertex;
+        break;
+    }
+    case Edit::Kind::SetVertex: {
+        Point& vertex = layerpack[edit.layer][edit.polygon][edit.index];
+        inverse.point = vertex;
+        vertex = edit.point;
+        inverse.kind = Edit::Kind::SetVertex;
+        break;
+    }
+    case Edit::Kind::InsertPolygon: {
+        Layer& layer = layerpack[edit.layer];
+        if (edit.index == layer.size())
+            layer.append(std::move(edit.shape));
+        else
+            layer.insert(edit.shape, edit.index);
+        inverse.kind = Edit::Kind::RemovePolygon;
+        break;
+    }
+    case Edit::Kind::RemovePolygon: {
+        Layer& layer = layerpack[edit.layer];
+        inverse.shape = static_cast<const Layer&>(layer)[edit.index];
+        layer.remove(edit.index);
+        inverse.kind = Edit::Kind::InsertPolygon;
+        break;
+    }
+    case Edit::Kind::InsertLayer: {
+        if (edit.layer == layerpack.get_layers().size())
+            layerpack.append_layer(std::move(edit.content));
+        else
+            layerpack.insert_layer(edit.content, edit.layer);
+        inverse.kind = Edit::Kind::RemoveLayer;
+        break;
+    }
+    case Edit::Kind::RemoveLayer: {
+        inverse.content = layerpack[edit.layer];
+        layerpack.remove_layer(edit.layer);
+        inverse.kind = Edit::Kind::InsertLayer;
+        break;
+    }
+    case Edit::Kind::RenameLayer: {
+        inverse.name = layerpack[edit.layer].get_name();
+        layerpack.rename_layer(inverse.name, edit.name);
+        inverse.kind = Edit::Kind::RenameLayer;
+        break;
+    }
+    }
+    return inverse;
+}
+
+// Повторы сбрасываются только завершённой правкой: после отката транзакции они остаются действительными
+void EditJournal::record(Edit edit) {
+    if (!levels.empty()) {
+        current.push_back(std::move(edit));
+        return;
+    }
+    redo_stack.clear();
+    undo_stack.emplace_back();
+    undo_stack.back().push_back(std::move(edit));
+    trim();
+}
+
+void EditJournal::trim() {
+    while (undo_stack.size() > max_depth) {
+        undo_stack.pop_front();
+    }
+}
+
+void EditJournal::begin() {
+    levels.push_back(current.size());
+}
+
+void EditJournal::commit() {
+    if (levels.empty()) {
+        throw std::logic_error("Нет открытой транзакции");
+    }
+    levels.pop_back();
+    if (!levels.empty())
+        return;
+    if (!current.empty()) {
+        redo_stack.clear();
+        undo_stack.push_back(std::move(current));
+        trim();
+    }
+    current.clear();
+}
+
+void EditJournal::rollback() {
+    if (levels.empty()) {
+        throw std::logic_error("Нет открытой транзакции");
+    }
+    // Отменяются только правки самого внутреннего уровня, правки внешних остаются в транзакции
+    size_t start = levels.back();
+    for (size_t i = current.size(); i > start; --i) {
+        apply(current[i - 1]);
+    }
+    current.erase(current.begin() + start, current.end());
+    levels.pop_back();
+}
+
+bool EditJournal::in_transaction() const {
+    return !levels.empty();
+}
+
+void EditJournal::insert_vertex(const std::string& layer, size_t polygon, const Point& point, size_t index) {
+    Edit edit;
+    edit.kind = Edit::Kind::InsertVertex;
+    edit.layer = layer_index(layer);
+    edit.polygon = polygon;
+    edit.index = index;
+    edit.point = point;
+    record(apply(edit));
+}
+
+void EditJournal::append_vertex(const std::string& layer, size_t polygon, const Point& point) {
+    size_t index = layerpack[layer][polygon].get_vertices().size();
+    insert_vertex(layer, polygon, point, index);
+}
+
+void EditJournal::remove_vertex(const std::string& layer, size_t polygon, size_t index) {
+    Edit edit;
+    edit.kind = Edit::Kind::RemoveVertex;
+    edit.layer = layer_index(layer);
+    edit.polygon = polygon;
+    edit.index = index;
+    record(apply(edit));
+}
+
+void EditJournal::set_vertex(const std::string& layer, size_t polygon, size_t index, const Point& point) {
+    Edit edit;
+    edit.kind = Edit::Kind::SetVertex;
+    edit.layer = layer_index(layer);
+    edit.polygon = polygon;
+    edit.index = index;
+    edit.point = point;
+    record(apply(edit));
+}
+
+void EditJournal::append_polygon(const std::string& layer, const Polygon& polygon) {
+    insert_polygon(layer, polygon, layerpack[layer].size());
+}
+
+void EditJournal::insert_polygon(const std::string& layer, const Polygon& polygon, size_t index) {
+    Edit edit;
+    edit.kind = Edit::Kind::InsertPolygon;
+    edit.layer = layer_index(layer);
+    edit.index = index;
+    edit.shape = polygon;
+    record(apply(edit));
+}
+
+void EditJournal::remove_polygon(const std::string& layer, size_t index) {
+    Edit edit;
+    edit.kind = Edit::Kind::RemovePolygon;
+    edit.layer = layer_index(layer);
+    edit.index = index;
+    record(apply(edit));
+}
+
+void EditJournal::append_layer(const Layer& layer) {
+    insert_layer(layer, layerpack.get_layers().size());
+}
+
+void EditJournal::insert_layer(const Layer& layer, size_t index) {
+    Edit edit;
+    edit.kind = Edit::Kind::InsertLayer;
+    edit.layer = index;
+    edit.content = layer;
+    record(apply(edit));
+}
+
+void EditJournal::remove_layer(const std::string& name) {
+    Edit edit;
+    edit.kind = Edit::Kind::RemoveLayer;
+    edit.layer = layer_index(name);
+    record(apply(edit));
+}
+
+void EditJournal::rename_layer(const std::string& name, const std::string& new_name) {
+    Edit edit;
+    edit.kind = Edit::Kind::RenameLayer;
+    edit.layer = layer_index(name);
+    edit.name = new_name;
+    record(apply(edit));
+}
+
+bool EditJournal::can_undo() const {
+    return !undo_stack.empty() && levels.empty();
+}
+
+bool EditJournal::can_redo() const {
+    return !redo_stack.empty() && levels.empty();
+}
+
+// Обе стопки хранят обратные правки в порядке выполнения и применяются с конца
+bool EditJournal::undo() {
+    if (!levels.empty()) {
+        throw std::logic_error("Отмена невозможна при открытой транзакции");
+    }
+    if (undo_stack.empty())
+        return false;
+
+    Transaction transaction = std::move(undo_stack.back());
+    undo_stack.pop_back();
+    Transaction inverse;
+    inverse.reserve(transaction.size());
+    for (auto it = transaction.rbegin(); it != transaction.rend(); ++it) {
+        inverse.push_back(apply(*it));
+    }
+    redo_stack.push_back(std::move(inverse));
+    return true;
+}
+
+bool EditJournal::redo() {
+    if (!levels.empty()) {
+        throw std::logic_error("Повтор невозможен при открытой транзакции");
+    }
+    if (redo_stack.empty())
+        return false;
+
+    Transaction transaction = std::move(redo_stack.back());
+    redo_stack.pop_back();
+    Transaction inverse;
+    inverse.reserve(transaction.size());
+    for (auto it = transaction.rbegin(); it != transaction.rend(); ++it) {
+        inverse.push_back(apply(*it));
+    }
+    undo_stack.push_back(std::move(inverse));
+    trim();
+    return true;
+}
+
+size_t EditJournal::undo_depth() const {
+    return undo_stack.size();
+}
+
+size_t EditJournal::redo_depth() const {
+    return redo_stack.size();
+}
+
+void EditJournal::set_max_depth(size_t max_depth) {
+    this->max_depth = max_depth;
+    trim();
+}
+
+void EditJournal::clear() {
+    undo_stack.clear();
+    redo_stack.clear();
+    current.clear();
+    levels.clear();
+}
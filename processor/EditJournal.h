@@ -0,0 +1,92 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include "Entity.h"
+
+// Журнал правок LayerPack с отменой и повтором.
+//
+// Правки выполняются через журнал; для каждой сохраняется обратная правка размером с саму правку
+// (удалённая вершина, полигон или слой, прежнее имя), а не снимок проекта. Правки группируются
+// в транзакции, отмена и повтор работают по транзакции целиком за время, пропорциональное её размеру.
+// Слои в правках задаются именами, в журнале хранятся их номера: при отмене и повторе правки
+// воспроизводятся строго в обратном и прямом порядке, поэтому номера остаются согласованными.
+// Изменения LayerPack в обход журнала делают историю недействительной - её нужно очистить через clear().
+class EditJournal {
+public:
+    explicit EditJournal(LayerPack& layerpack, size_t max_depth = 100);
+
+    // Транзакции могут быть вложенными, правки вложенных попадают во внешнюю.
+    // Правка вне транзакции образует отдельную транзакцию
+    void begin();
+    void commit();
+    void rollback();                // Отменяет правки самой внутренней открытой транзакции и закрывает её
+    bool in_transaction() const;
+
+    // Правки вершин внешнего контура
+    void insert_vertex(const std::string& layer, size_t polygon, const Point& point, size_t index);
+    void append_vertex(const std::string& layer, size_t polygon, const Point& point);
+    void remove_vertex(const std::string& layer, size_t polygon, size_t index);
+    void set_vertex(const std::string& layer, size_t polygon, size_t index, const Point& point);
+
+    // Правки полигонов слоя
+    void append_polygon(const std::string& layer, const Polygon& polygon);
+    void insert_polygon(const std::string& layer, const Polygon& polygon, size_t index);
+    void remove_polygon(const std::string& layer, size_t index);
+
+    // Правки слоёв
+    void append_layer(const Layer& layer);
+    void insert_layer(const Layer& layer, size_t index);
+    void remove_layer(const std::string& name);
+    void rename_layer(const std::string& name, const std::string& new_name);
+
+    bool can_undo() const;
+    bool can_redo() const;
+    bool undo();                    // false, если отменять нечего
+    bool redo();
+    size_t undo_depth() const;
+    size_t redo_depth() const;
+    void set_max_depth(size_t max_depth);   // Старые транзакции сверх предела удаляются
+    void clear();
+
+private:
+    struct Edit {
+        enum class Kind {
+            InsertVertex,
+            RemoveVertex,
+            SetVertex,
+            InsertPolygon,
+            RemovePolygon,
+            InsertLayer,
+            RemoveLayer,
+            RenameLayer,
+        };
+
+        Kind kind;
+        size_t layer = 0;           // Номер слоя в LayerPack (для InsertLayer - позиция вставки)
+        size_t polygon = 0;
+        size_t index = 0;           // Номер вершины или полигона
+        Point point;
+        Polygon shape;              // Вставляемый полигон
+        Layer content;              // Вставляемый слой (полигоны разделяются, копия - O(1))
+        std::string name;           // Новое имя слоя
+    };
+
+    using Transaction = std::vector<Edit>;
+
+    LayerPack& layerpack;
+    size_t max_depth;
+    std::deque<Transaction> undo_stack;
+    std::vector<Transaction> redo_stack;
+    Transaction current;
+    std::vector<size_t> levels;     // Начало правок каждой открытой транзакции в current, по вложенности
+
+    size_t layer_index(const std::string& name) const;
+    Edit apply(Edit& edit);         // Выполняет правку и возвращает обратную
+    void record(Edit edit);
+    void trim();
+};
+
+#endif // EDITJOURNAL_H
@@ -1,147 +1,738 @@
 #include "Entity.h"
+#include "SpatialIndex.h"
+#include "Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iterator>
+#include <limits>
 #include <unordered_map>
 #include <stdexcept>
+#include <utility>
 
 
-// Реализация класса Point
-Point::Point(double x, double y) : x(x), y(y) {}
+// Реализация класса BasicPoint
+template <typename T>
+BasicPoint<T>::BasicPoint(T x, T y) : x(x), y(y) {}
 
-Point Point::operator+(const Point& other) const {
-    return Point(x + other.x, y + other.y);
+template <typename T>
+BasicPoint<T> BasicPoint<T>::operator+(const BasicPoint& other) const {
+    return BasicPoint(x + other.x, y + other.y);
 }
 
-Point Point::operator-(const Point& other) const {
-    return Point(x - other.x, y - other.y);
+template <typename T>
+BasicPoint<T> BasicPoint<T>::operator-(const BasicPoint& other) const {
+    return BasicPoint(x - other.x, y - other.y);
 }
-Point Point::operator*(const double& other) const {
-    return Point(x * other, y * other);
+
+template <typename T>
+BasicPoint<T> BasicPoint<T>::operator*(const T& other) const {
+    return BasicPoint(x * other, y * other);
 }
 
-bool Point::operator==(const Point& other) const {
+template <typename T>
+bool BasicPoint<T>::operator==(const BasicPoint& other) const {
     return x == other.x && y == other.y;
 }
 
 
-std::unordered_map<std::string, double> Point::ravel() const {
-    return {{"x", x}, {"y", y}};
+template <typename T>
+std::unordered_map<std::string, double> BasicPoint<T>::ravel() const {
+    return {{"x", static_cast<double>(x)}, {"y", static_cast<double>(y)}};
+}
+
+template class BasicPoint<double>;
+template class BasicPoint<int32_t>;
+template class BasicPoint<int64_t>;
+
+// Реализация класса Box
+Box::Box()
+    : min_x(std::numeric_limits<double>::infinity()), min_y(std::numeric_limits<double>::infinity()),
+      max_x(-std::numeric_limits<double>::infinity()), max_y(-std::numeric_limits<double>::infinity()) {}
+
+Box::Box(double min_x, double min_y, double max_x, double max_y)
+    : min_x(min_x), min_y(min_y), max_x(max_x), max_y(max_y) {}
+
+bool Box::empty() const {
+    return min_x > max_x || min_y > max_y;
+}
+
+bool Box::intersects(const Box& other) const {
+    return min_x <= other.max_x && other.min_x <= max_x && min_y <= other.max_y && other.min_y <= max_y;
+}
+
+bool Box::contains(const Point& point) const {
+    return point.x >= min_x && point.x <= max_x && point.y >= min_y && point.y <= max_y;
+}
+
+void Box::expand(const Point& point) {
+    min_x = std::min(min_x, point.x);
+    min_y = std::min(min_y, point.y);
+    max_x = std::max(max_x, point.x);
+    max_y = std::max(max_y, point.y);
+}
+
+void Box::expand(const Box& other) {
+    if (other.empty())
+        return;
+    min_x = std::min(min_x, other.min_x);
+    min_y = std::min(min_y, other.min_y);
+    max_x = std::max(max_x, other.max_x);
+    max_y = std::max(max_y, other.max_y);
+}
+
+double Box::area() const {
+    return empty() ? 0 : (max_x - min_x) * (max_y - min_y);
+}
+
+double Box::distance(const Point& point) const {
+    if (empty())
+        return std::numeric_limits<double>::infinity();
+    double dx = std::max({min_x - point.x, 0.0, point.x - max_x});
+    double dy = std::max({min_y - point.y, 0.0, point.y - max_y});
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+// Чётность пересечений луча вправо от точки с рёбрами контура.
+// Для целых координат сравнение выполняется через точные произведения без деления
+template <typename T>
+static bool contourContains(const BasicPoint<T>* p, size_t count, const BasicPoint<T>& point) {
+    using Wide = typename CoordinateTraits<T>::wide_type;
+    bool inside = false;
+    for (size_t i = 0, j = count - 1; i < count; j = i++) {
+        const BasicPoint<T>& a = p[i];
+        const BasicPoint<T>& b = p[j];
+        if ((a.y > point.y) == (b.y > point.y))
+            continue;
+        bool left;
+        if constexpr (CoordinateTraits<T>::exact) {
+            Wide lhs = (Wide(point.x) - a.x) * (Wide(b.y) - a.y);
+            Wide rhs = (Wide(b.x) - a.x) * (Wide(point.y) - a.y);
+            left = b.y > a.y ? lhs < rhs : lhs > rhs;
+        } else {
+            left = point.x < (b.x - a.x) * (point.y - a.y) / (b.y - a.y) + a.x;
+        }
+        if (left)
+            inside = !inside;
+    }
+    return inside;
 }
 
-// Реализация класса Hole
-Hole::Hole(const std::vector<Point>& vertices) {
+template <typename T>
+static double contourDistance(const BasicPoint<T>* p, size_t count, const BasicPoint<T>& point) {
+    double best = std::numeric_limits<double>::infinity();
+    for (size_t i = 0, j = count - 1; i < count; j = i++) {
+        double ax = static_cast<double>(p[j].x), ay = static_cast<double>(p[j].y);
+        double px = static_cast<double>(point.x), py = static_cast<double>(point.y);
+        double dx = static_cast<double>(p[i].x) - ax, dy = static_cast<double>(p[i].y) - ay;
+        double length = dx * dx + dy * dy;
+        double t = length > 0 ? ((px - ax) * dx + (py - ay) * dy) / length : 0;
+        t = std::max(0.0, std::min(1.0, t));
+        best = std::min(best, std::hypot(ax + t * dx - px, ay + t * dy - py));
+    }
+    return best;
+}
+
+// Реализация класса BasicHole
+template <typename T>
+BasicHole<T>::BasicHole(const std::vector<BasicPoint<T>>& vertices) {
     for (const auto& vertex : vertices) {
         append(vertex);
     }
 }
 
-void Hole::append(const Point& point) {
-    vertices.push_back(point);
+template <typename T>
+void BasicHole<T>::append(const BasicPoint<T>& point) {
+    this->vertices.push_back(point);
 }
 
-void Hole::insert(const Point& point, size_t index) {
-    if (index >= vertices.size()) {
+template <typename T>
+void BasicHole<T>::insert(const BasicPoint<T>& point, size_t index) {
+    if (index >= this->vertices.size()) {
         throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
     }
-    vertices.insert(vertices.begin() + index, point);
+    this->vertices.insert(this->vertices.begin() + index, point);
 }
 
-void Hole::remove(size_t index) {
-    if (index >= vertices.size()) {
-        throw std::out_of_range("Индекс " + std::to_string(index) + " выходит за пределы допустимого диапазона [0, " + std::to_string(vertices.size() - 1) + "]");
+template <typename T>
+void BasicHole<T>::remove(size_t index) {
+    if (index >= this->vertices.size()) {
+        throw std::out_of_range("Индекс " + std::to_string(index) + " выходит за пределы допустимого диапазона [0, " + std::to_string(this->vertices.size() - 1) + "]");
     }
-    vertices.erase(vertices.begin() + index);
+    this->vertices.erase(this->vertices.begin() + index);
 }
 
 
-const std::vector<Point>& Hole::get_vertices() const {
-    return vertices;
+template <typename T>
+const std::vector<BasicPoint<T>>& BasicHole<T>::get_vertices() const {
+    return this->vertices;
 }
 
-Point& Hole::operator[](size_t index) {
-    if (index >= vertices.size()) {
+template <typename T>
+std::vector<BasicPoint<T>>& BasicHole<T>::get_vertices() {
+    return this->vertices;
+}
+
+template <typename T>
+BasicPoint<T>& BasicHole<T>::operator[](size_t index) {
+    if (index >= this->vertices.size()) {
         throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
     }
-    return vertices[index];
+    return this->vertices[index];
 }
 
-const Point& Hole::operator[](size_t index) const {
-    if (index >= vertices.size()) {
+template <typename T>
+const BasicPoint<T>& BasicHole<T>::operator[](size_t index) const {
+    if (index >= this->vertices.size()) {
         throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
     }
-    return vertices[index];
+    return this->vertices[index];
 }
 
-Polygon::Polygon(const std::vector<Point>& vertices, const std::vector<Hole>& holes) {
+// Реализация класса BasicPolygon
+template <typename T>
+BasicPolygon<T>::BasicPolygon(const std::vector<BasicPoint<T>>& vertices, const std::vector<BasicHole<T>>& holes) {
     for (const auto& vertex : vertices) {
         append(vertex);
     }
     this->holes = holes;
 }
 
-void Polygon::append(const Point& point) {
-    vertices.push_back(point);
+template <typename T>
+void BasicPolygon<T>::append(const BasicPoint<T>& point) {
+    this->vertices.push_back(point);
 }
 
-void Polygon::insert(const Point& point, size_t index) {
-    if (index >= vertices.size()) {
+template <typename T>
+void BasicPolygon<T>::insert(const BasicPoint<T>& point, size_t index) {
+    if (index >= this->vertices.size()) {
         throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
     }
-    vertices.insert(vertices.begin() + index, point);
+    this->vertices.insert(this->vertices.begin() + index, point);
 }
 
-void Polygon::remove(size_t index) {
-    if (index >= vertices.size()) {
-        throw std::out_of_range("Индекс " + std::to_string(index) + " выходит за пределы допустимого диапазона [0, " + std::to_string(vertices.size() - 1) + "]");
+template <typename T>
+void BasicPolygon<T>::remove(size_t index) {
+    if (index >= this->vertices.size()) {
+        throw std::out_of_range("Индекс " + std::to_string(index) + " выходит за пределы допустимого диапазона [0, " + std::to_string(this->vertices.size() - 1) + "]");
     }
-    vertices.erase(vertices.begin() + index);
+    this->vertices.erase(this->vertices.begin() + index);
 }
 
 
-const std::vector<Point>& Polygon::get_vertices() const {
-    return vertices;
+template <typename T>
+const std::vector<BasicPoint<T>>& BasicPolygon<T>::get_vertices() const {
+    return this->vertices;
+}
+
+template <typename T>
+std::vector<BasicPoint<T>>& BasicPolygon<T>::get_vertices() {
+    return this->vertices;
 }
 
-Point& Polygon::operator[](size_t index) {
-    if (index >= vertices.size()) {
+template <typename T>
+BasicPoint<T>& BasicPolygon<T>::operator[](size_t index) {
+    if (index >= this->vertices.size()) {
         throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
     }
-    return vertices[index];
+    return this->vertices[index];
 }
 
-const Point& Polygon::operator[](size_t index) const {
-    if (index >= vertices.size()) {
+template <typename T>
+const BasicPoint<T>& BasicPolygon<T>::operator[](size_t index) const {
+    if (index >= this->vertices.size()) {
         throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
     }
-    return vertices[index];
+    return this->vertices[index];
 }
 
-void Polygon::add_hole(const Hole& hole) {
+template <typename T>
+void BasicPolygon<T>::add_hole(const BasicHole<T>& hole) {
     holes.push_back(hole);
 }
 
-void Polygon::remove_hole(size_t index) {
+template <typename T>
+void BasicPolygon<T>::add_hole(BasicHole<T>&& hole) {
+    holes.push_back(std::move(hole));
+}
+
+template <typename T>
+void BasicPolygon<T>::remove_hole(size_t index) {
     if (index >= holes.size()) {
         throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
     }
     holes.erase(holes.begin() + index);
 }
 
-const std::vector<Hole>& Polygon::get_holes() const {
+template <typename T>
+const std::vector<BasicHole<T>>& BasicPolygon<T>::get_holes() const {
     return holes;
 }
 
-std::vector<Hole> &Polygon::get_holes()
+template <typename T>
+std::vector<BasicHole<T>>& BasicPolygon<T>::get_holes()
 {
     return holes;
 }
 
+template <typename T>
+Box BasicPolygon<T>::get_bounding_box() const {
+    Box box;
+    for (const auto& vertex : this->vertices) {
+        box.expand(Point(vertex));
+    }
+    return box;
+}
+
+template <typename T>
+bool BasicPolygon<T>::contains(const BasicPoint<T>& point) const {
+    const auto& vertices = this->vertices;
+    if (vertices.size() < 3 || !contourContains(vertices.data(), vertices.size(), point))
+        return false;
+    for (const auto& hole : holes) {
+        const auto& contour = hole.get_vertices();
+        if (contour.size() >= 3 && contourContains(contour.data(), contour.size(), point))
+            return false;
+    }
+    return true;
+}
+
+template <typename T>
+double BasicPolygon<T>::distance(const BasicPoint<T>& point) const {
+    if (contains(point))
+        return 0;
+    const auto& vertices = this->vertices;
+    double best = vertices.empty() ? std::numeric_limits<double>::infinity() : contourDistance(vertices.data(), vertices.size(), point);
+    for (const auto& hole : holes) {
+        const auto& contour = hole.get_vertices();
+        if (!contour.empty())
+            best = std::min(best, contourDistance(contour.data(), contour.size(), point));
+    }
+    return best;
+}
+
+template class BasicHole<double>;
+template class BasicHole<int32_t>;
+template class BasicHole<int64_t>;
+template class BasicPolygon<double>;
+template class BasicPolygon<int32_t>;
+template class BasicPolygon<int64_t>;
+
+// Реализация класса ContourView
+ContourView::ContourView(const Point* points, size_t count) : points(points), count(count) {}
+
+ContourView::ContourView(const std::vector<Point>& points) : points(points.data()), count(points.size()) {}
+
+size_t ContourView::size() const {
+    return count;
+}
+
+bool ContourView::empty() const {
+    return count == 0;
+}
+
+const Point* ContourView::data() const {
+    return points;
+}
+
+const Point* ContourView::begin() const {
+    return points;
+}
+
+const Point* ContourView::end() const {
+    return points + count;
+}
+
+const Point& ContourView::operator[](size_t index) const {
+    if (index >= count) {
+        throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
+    }
+    return points[index];
+}
+
+// Реализация класса PolygonView
+PolygonView::PolygonView(const CompactPolygons* owner, size_t index) : owner(owner), index(index) {}
+
+ContourView PolygonView::get_vertices() const {
+    size_t contour = owner->polygon_data[index];
+    size_t begin = owner->contour_data[contour];
+    return ContourView(owner->vertex_data + begin, owner->contour_data[contour + 1] - begin);
+}
+
+size_t PolygonView::hole_count() const {
+    return owner->polygon_data[index + 1] - owner->polygon_data[index] - 1;
+}
+
+ContourView PolygonView::get_hole(size_t index) const {
+    if (index >= hole_count()) {
+        throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
+    }
+    size_t contour = owner->polygon_data[this->index] + 1 + index;
+    size_t begin = owner->contour_data[contour];
+    return ContourView(owner->vertex_data + begin, owner->contour_data[contour + 1] - begin);
+}
+
+Box PolygonView::get_bounding_box() const {
+    Box box;
+    for (const Point& vertex : get_vertices()) {
+        box.expand(vertex);
+    }
+    return box;
+}
+
+bool PolygonView::contains(const Point& point) const {
+    ContourView outer = get_vertices();
+    if (outer.size() < 3 || !contourContains(outer.data(), outer.size(), point))
+        return false;
+    for (size_t i = 0; i < hole_count(); ++i) {
+        ContourView hole = get_hole(i);
+        if (hole.size() >= 3 && contourContains(hole.data(), hole.size(), point))
+            return false;
+    }
+    return true;
+}
+
+double PolygonView::distance(const Point& point) const {
+    if (contains(point))
+        return 0;
+    ContourView outer = get_vertices();
+    double best = outer.empty() ? std::numeric_limits<double>::infinity() : contourDistance(outer.data(), outer.size(), point);
+    for (size_t i = 0; i < hole_count(); ++i) {
+        ContourView hole = get_hole(i);
+        if (!hole.empty())
+            best = std::min(best, contourDistance(hole.data(), hole.size(), point));
+    }
+    return best;
+}
+
+Polygon PolygonView::to_polygon() const {
+    ContourView outer = get_vertices();
+    Polygon polygon;
+    polygon.get_vertices().assign(outer.begin(), outer.end());
+    polygon.get_holes().reserve(hole_count());
+    for (size_t i = 0; i < hole_count(); ++i) {
+        ContourView hole = get_hole(i);
+        polygon.add_hole(Hole(std::vector<Point>(hole.begin(), hole.end())));
+    }
+    return polygon;
+}
+
+// Реализация класса CompactPolygons
+CompactPolygons::CompactPolygons() : contour_offsets(1, 0), polygon_offsets(1, 0) {
+    attach();
+}
+
+CompactPolygons::CompactPolygons(const std::vector<Polygon>& polygons) : CompactPolygons() {
+    size_t contours = 0, points = 0;
+    for (const Polygon& polygon : polygons) {
+        contours += 1 + polygon.get_holes().size();
+        points += polygon.get_vertices().size();
+        for (const Hole& hole : polygon.get_holes())
+            points += hole.get_vertices().size();
+    }
+    reserve(polygons.size(), contours, points);
+    for (const Polygon& polygon : polygons) {
+        append(polygon);
+    }
+}
+
+CompactPolygons::CompactPolygons(std::shared_ptr<const void> storage,
+                                 const Point* vertices, size_t vertex_count,
+                                 const size_t* contour_offsets, size_t contour_count,
+                                 const size_t* polygon_offsets, size_t polygon_count)
+    : storage(std::move(storage)), vertex_data(vertices), contour_data(contour_offsets), polygon_data(polygon_offsets),
+      vertex_size(vertex_count), contour_size(contour_count + 1), polygon_size(polygon_count + 1) {}
+
+CompactPolygons::CompactPolygons(const CompactPolygons& other)
+    : vertices(other.vertices), contour_offsets(other.contour_offsets), polygon_offsets(other.polygon_offsets),
+      storage(other.storage), vertex_data(other.vertex_data), contour_data(other.contour_data),
+      polygon_data(other.polygon_data), vertex_size(other.vertex_size), contour_size(other.contour_size),
+      polygon_size(other.polygon_size) {
+    if (!storage)
+        attach();
+}
+
+CompactPolygons::CompactPolygons(CompactPolygons&& other)
+    : vertices(std::move(other.vertices)), contour_offsets(std::move(other.contour_offsets)),
+      polygon_offsets(std::move(other.polygon_offsets)), storage(std::move(other.storage)),
+      vertex_data(other.vertex_data), contour_data(other.contour_data), polygon_data(other.polygon_data),
+      vertex_size(other.vertex_size), contour_size(other.contour_size), polygon_size(other.polygon_size) {
+    other.vertices.clear();
+    other.contour_offsets.assign(1, 0);
+    other.polygon_offsets.assign(1, 0);
+    other.attach();
+}
+
+CompactPolygons& CompactPolygons::operator=(const CompactPolygons& other) {
+    if (this != &other) {
+        *this = CompactPolygons(other);
+    }
+    return *this;
+}
+
+CompactPolygons& CompactPolygons::operator=(CompactPolygons&& other) {
+    if (this != &other) {
+        vertices = std::move(other.vertices);
+        contour_offsets = std::move(other.contour_offsets);
+        polygon_offsets = std::move(other.polygon_offsets);
+        storage = std::move(other.storage);
+        vertex_data = other.vertex_data;
+        contour_data = other.contour_data;
+        polygon_data = other.polygon_data;
+        vertex_size = other.vertex_size;
+        contour_size = other.contour_size;
+        polygon_size = other.polygon_size;
+        other.vertices.clear();
+        other.contour_offsets.assign(1, 0);
+        other.polygon_offsets.assign(1, 0);
+        other.attach();
+    }
+    return *this;
+}
+
+void CompactPolygons::attach() {
+    vertex_data = vertices.data();
+    contour_data = contour_offsets.data();
+    polygon_data = polygon_offsets.data();
+    vertex_size = vertices.size();
+    contour_size = contour_offsets.size();
+    polygon_size = polygon_offsets.size();
+}
+
+void CompactPolygons::detach() {
+    if (!storage)
+        return;
+    vertices.assign(vertex_data, vertex_data + vertex_size);
+    contour_offsets.assign(contour_data, contour_data + contour_size);
+    polygon_offsets.assign(polygon_data, polygon_data + polygon_size);
+    storage.reset();
+    attach();
+}
+
+void CompactPolygons::reserve(size_t polygons, size_t contours, size_t vertices) {
+    detach();
+    polygon_offsets.reserve(polygons + 1);
+    contour_offsets.reserve(contours + 1);
+    this->vertices.reserve(vertices);
+    attach();
+}
+
+void CompactPolygons::append(const Polygon& polygon) {
+    const std::vector<Point>& outer = polygon.get_vertices();
+    append_contour(outer.data(), outer.size(), false);
+    for (const Hole& hole : polygon.get_holes()) {
+        append_contour(hole.get_vertices().data(), hole.get_vertices().size(), true);
+    }
+}
+
+void CompactPolygons::append_contour(const Point* points, size_t count, bool is_hole) {
+    if (is_hole && empty()) {
+        throw std::invalid_argument("Дырка не может предшествовать внешнему контуру");
+    }
+    detach();
+    vertices.insert(vertices.end(), points, points + count);
+    contour_offsets.push_back(vertices.size());
+    if (is_hole)
+        polygon_offsets.back() = contour_offsets.size() - 1;
+    else
+        polygon_offsets.push_back(contour_offsets.size() - 1);
+    attach();
+}
+
+size_t CompactPolygons::size() const {
+    return polygon_size - 1;
+}
+
+bool CompactPolygons::empty() const {
+    return size() == 0;
+}
+
+size_t CompactPolygons::contour_count() const {
+    return contour_size - 1;
+}
+
+size_t CompactPolygons::vertex_count() const {
+    return vertex_size;
+}
+
+bool CompactPolygons::is_external() const {
+    return storage != nullptr;
+}
+
+PolygonView CompactPolygons::operator[](size_t index) const {
+    if (index >= size()) {
+        throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
+    }
+    return PolygonView(this, index);
+}
+
+ContourView CompactPolygons::get_vertices() const {
+    return ContourView(vertex_data, vertex_size);
+}
+
+std::vector<Point>& CompactPolygons::get_vertices() {
+    detach();
+    return vertices;
+}
+
+const size_t* CompactPolygons::get_contour_offsets() const {
+    return contour_data;
+}
+
+const size_t* CompactPolygons::get_polygon_offsets() const {
+    return polygon_data;
+}
+
+std::vector<Polygon> CompactPolygons::to_polygons() const {
+    std::vector<Polygon> polygons;
+    polygons.reserve(size());
+    for (size_t i = 0; i < size(); ++i) {
+        polygons.push_back(PolygonView(this, i).to_polygon());
+    }
+    return polygons;
+}
+
+// Общий пустой список полигонов: пустые и перемещённые слои не выделяют память
+static const std::shared_ptr<std::vector<Polygon>>& emptyPolygons() {
+    static const std::shared_ptr<std::vector<Polygon>> empty = std::make_shared<std::vector<Polygon>>();
+    return empty;
+}
+
+// Версии выдаются из общего счётчика: одинаковая версия у двух слоёв означает общее содержимое
+static uint64_t nextVersion() {
+    static std::atomic<uint64_t> counter(0);
+    return ++counter;
+}
+
+Layer::Layer() : name("Unnamed Layer"), polygons(emptyPolygons()), version(0), changes_base(0) {}
+
+Layer::Layer(const char* name) : name(name), polygons(emptyPolygons()), version(0), changes_base(0) {}
+
+Layer::Layer(const Layer& other)
+    : name(other.name), polygons(other.polygons), compact_polygons(other.compact_polygons), version(other.version),
+      changes(other.changes), changes_base(other.changes_base) {}
+
+// Имя слоя из пакета хранится и в индексе пакета, поэтому при перемещении из такого слоя оно копируется
+Layer::Layer(Layer&& other) noexcept
+    : name(other.owner ? other.name : std::move(other.name)), polygons(std::move(other.polygons)),
+      compact_polygons(std::move(other.compact_polygons)), index(std::move(other.index)), version(other.version),
+      changes(std::move(other.changes)), changes_base(other.changes_base) {
+    other.polygons = emptyPolygons();
+    other.version = 0;
+    other.changes_base = 0;
+}
+
+// Слой из пакета при присваивании сохраняет своё имя: имена в пакете меняет только LayerPack::rename_layer
+Layer& Layer::operator=(const Layer& other) {
+    if (this != &other) {
+        if (!owner)
+            name = other.name;
+        polygons = other.polygons;
+        compact_polygons = other.compact_polygons;
+        index.reset();
+        version = other.version;
+        changes = other.changes;
+        changes_base = other.changes_base;
+    }
+    return *this;
+}
+
+Layer& Layer::operator=(Layer&& other) noexcept {
+    if (this != &other) {
+        if (!owner)
+            name = other.owner ? other.name : std::move(other.name);
+        polygons = std::move(other.polygons);
+        compact_polygons = std::move(other.compact_polygons);
+        index = std::move(other.index);
+        version = other.version;
+        changes = std::move(other.changes);
+        changes_base = other.changes_base;
+        other.polygons = emptyPolygons();
+        other.version = 0;
+        other.changes_base = 0;
+    }
+    return *this;
+}
+
+Layer::~Layer() = default;
+
 Layer::Layer(const std::string& name, const std::vector<Polygon>& polygons)
-    : name(name), polygons(polygons) {
+    : name(name), polygons(std::make_shared<std::vector<Polygon>>(polygons)), version(nextVersion()), changes_base(version) {
     // Здесь можно добавить валидацию имени, если нужно
     if (name.empty()) {
         throw std::invalid_argument("Имя слоя не может быть пустым");
     }
 }
 
+Layer::Layer(const std::string& name, CompactPolygons&& polygons)
+    : name(name), polygons(emptyPolygons()), compact_polygons(std::make_shared<CompactPolygons>(std::move(polygons))),
+      version(nextVersion()), changes_base(version) {
+    if (name.empty()) {
+        throw std::invalid_argument("Имя слоя не может быть пустым");
+    }
+}
+
+// Номера полигонов при распаковке не меняются, поэтому индекс остаётся действительным
+void Layer::unpack() {
+    if (!compact_polygons)
+        return;
+    polygons = std::make_shared<std::vector<Polygon>>(compact_polygons->to_polygons());
+    compact_polygons.reset();
+}
+
+std::vector<Polygon>& Layer::mutable_polygons() {
+    unpack();
+    version = nextVersion();
+    if (polygons.use_count() > 1) {
+        polygons = std::make_shared<std::vector<Polygon>>(*polygons);
+    }
+    return *polygons;
+}
+
+Box Layer::polygon_box(size_t index) const {
+    return compact_polygons ? (*compact_polygons)[index].get_bounding_box() : (*polygons)[index].get_bounding_box();
+}
+
+std::vector<Layer::Change>& Layer::mutable_changes() {
+    if (!changes) {
+        changes = std::make_shared<std::vector<Change>>();
+    } else if (changes.use_count() > 1) {
+        changes = std::make_shared<std::vector<Change>>(*changes);
+    }
+    return *changes;
+}
+
+// Вызывается после смены версии, поэтому запись относится к новой версии
+void Layer::record(const Box& box, size_t polygon) {
+    if (changes && changes->size() >= MAX_CHANGES) {
+        reset_changes();
+        return;
+    }
+    mutable_changes().push_back({version, box, polygon});
+}
+
+// Выданные ссылки перестают действовать при сдвиге полигонов, поэтому их текущие прямоугольники
+// фиксируются до сдвига - с текущей версией, чтобы покрыть и правки через ссылку после последнего запроса
+void Layer::flush_touched() {
+    if (!changes || std::none_of(changes->begin(), changes->end(), [](const Change& change) {
+            return change.polygon != NO_POLYGON;
+        }))
+        return;
+    std::vector<Change>& log = mutable_changes();
+    for (size_t i = 0, count = log.size(); i < count; ++i) {
+        if (log[i].polygon == NO_POLYGON)
+            continue;
+        Box box = polygon_box(log[i].polygon);
+        log[i].polygon = NO_POLYGON;
+        log.push_back({version, box, NO_POLYGON});
+    }
+}
+
+void Layer::reset_changes() {
+    changes.reset();
+    changes_base = version;
+}
+
 const std::string& Layer::get_name() const {
     return name;
 }
@@ -150,156 +741,393 @@ void Layer::rename(const std::string& new_name) {
     if (new_name.empty()) {
         throw std::invalid_argument("Новое имя слоя не может быть пустым");
     }
+    if (owner) {
+        owner->rename_layer(name, new_name);
+        return;
+    }
     name = new_name;
 }
 
 void Layer::append(const Polygon& polygon) {
-    polygons.push_back(polygon);
+    std::vector<Polygon>& own = mutable_polygons();
+    flush_touched();
+    own.push_back(polygon);
+    record(polygon.get_bounding_box());
+    if (index)
+        index->insert(own.size() - 1, polygon.get_bounding_box());
+}
+
+void Layer::append(Polygon&& polygon) {
+    std::vector<Polygon>& own = mutable_polygons();
+    flush_touched();
+    own.push_back(std::move(polygon));
+    record(own.back().get_bounding_box());
+    if (index)
+        index->insert(own.size() - 1, own.back().get_bounding_box());
 }
 
 void Layer::insert(const Polygon& polygon, size_t index) {
-    if (index >= polygons.size()) {
+    if (index >= size()) {
         throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
     }
-    polygons.insert(polygons.begin() + index, polygon);
+    std::vector<Polygon>& own = mutable_polygons();
+    flush_touched();
+    own.insert(own.begin() + index, polygon);
+    record(polygon.get_bounding_box());
+    if (this->index)
+        this->index->insert(index, polygon.get_bounding_box());
 }
 
 void Layer::remove(size_t index) {
-    if (index >= polygons.size()) {
+    if (index >= size()) {
         throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
     }
-    polygons.erase(polygons.begin() + index);
+    std::vector<Polygon>& own = mutable_polygons();
+    flush_touched();
+    record(own[index].get_bounding_box());
+    own.erase(own.begin() + index);
+    if (this->index)
+        this->index->remove(index);
 }
 
+// Распаковка здесь удвоила бы память слоя и меняла бы его из константного метода, в том числе из разных потоков
 const std::vector<Polygon>& Layer::get_polygons() const {
-    return polygons;
+    if (compact_polygons) {
+        throw std::logic_error("Слой в компактном режиме: используйте get_compact(), to_polygons() или unpack()");
+    }
+    return *polygons;
+}
+
+std::vector<Polygon> Layer::to_polygons() const {
+    return compact_polygons ? compact_polygons->to_polygons() : *polygons;
 }
 
+bool Layer::is_shared() const {
+    return compact_polygons ? compact_polygons.use_count() > 1 : polygons.use_count() > 1;
+}
+
+size_t Layer::size() const {
+    return compact_polygons ? compact_polygons->size() : polygons->size();
+}
+
+void Layer::compact() {
+    if (compact_polygons)
+        return;
+    flush_touched();
+    compact_polygons = std::make_shared<CompactPolygons>(*polygons);
+    polygons = emptyPolygons();
+}
+
+bool Layer::is_compact() const {
+    return compact_polygons != nullptr;
+}
+
+const CompactPolygons& Layer::get_compact() const {
+    if (!compact_polygons) {
+        throw std::logic_error("Слой не находится в компактном режиме");
+    }
+    return *compact_polygons;
+}
+
+CompactPolygons& Layer::get_compact() {
+    if (!compact_polygons) {
+        throw std::logic_error("Слой не находится в компактном режиме");
+    }
+    if (compact_polygons.use_count() > 1) {
+        compact_polygons = std::make_shared<CompactPolygons>(*compact_polygons);
+    }
+    index.reset();
+    version = nextVersion();
+    reset_changes();
+    return *compact_polygons;
+}
+
+// Полигон может быть изменён через возвращаемую ссылку, поэтому индекс сбрасывается.
+// Ссылка остаётся в этом хранилище и после копирования слоя (см. Entity.h)
 Polygon& Layer::operator[](size_t index) {
-    if (index >= polygons.size()) {
+    if (index >= size()) {
         throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
     }
-    return polygons[index];
+    this->index.reset();
+    std::vector<Polygon>& own = mutable_polygons();
+    record(own[index].get_bounding_box(), index);
+    return own[index];
 }
 
 const Polygon& Layer::operator[](size_t index) const {
-    if (index >= polygons.size()) {
+    if (index >= size()) {
         throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
     }
-    return polygons[index];
+    return get_polygons()[index];
+}
+
+SpatialIndex& Layer::get_index() const {
+    if (!index) {
+        std::vector<Box> boxes;
+        boxes.reserve(size());
+        if (compact_polygons) {
+            for (size_t i = 0; i < compact_polygons->size(); ++i)
+                boxes.push_back((*compact_polygons)[i].get_bounding_box());
+        } else {
+            for (const auto& polygon : *polygons)
+                boxes.push_back(polygon.get_bounding_box());
+        }
+        index.reset(new SpatialIndex(boxes));
+    }
+    return *index;
+}
+
+std::vector<size_t> Layer::query_window(const Box& window) const {
+    std::vector<size_t> result;
+    get_index().query(window, [&result](size_t id) {
+        result.push_back(id);
+    });
+    return result;
+}
+
+std::vector<size_t> Layer::query_point(const Point& point) const {
+    std::vector<size_t> result;
+    get_index().query(point, [&](size_t id) {
+        if (compact_polygons ? (*compact_polygons)[id].contains(point) : (*polygons)[id].contains(point))
+            result.push_back(id);
+    });
+    return result;
+}
+
+std::vector<size_t> Layer::query_nearest(const Point& point, size_t count) const {
+    return get_index().nearest(point, count, [&](size_t id) {
+        return compact_polygons ? (*compact_polygons)[id].distance(point) : (*polygons)[id].distance(point);
+    });
+}
+
+bool Layer::changed_regions(uint64_t since, std::vector<Box>& regions) const {
+    if (since == version)
+        return true;
+    auto later = [](uint64_t value, const Change& change) {
+        return value < change.version;
+    };
+    if (!changes)
+        return since == changes_base;
+    auto first = std::upper_bound(changes->begin(), changes->end(), since, later);
+    if (since != changes_base && (first == changes->begin() || std::prev(first)->version != since))
+        return false;
+    for (auto it = first; it != changes->end(); ++it)
+        regions.push_back(it->box);
+    // Полигоны по выданным ссылкам могли измениться и после своей записи
+    for (const Change& change : *changes) {
+        if (change.polygon != NO_POLYGON)
+            regions.push_back(polygon_box(change.polygon));
+    }
+    return true;
+}
+
+Box Layer::get_bounding_box() const {
+    return get_index().bounds();
+}
+
+uint64_t Layer::get_version() const {
+    return version;
+}
+
+bool Layer::has_index() const {
+    return index != nullptr;
+}
+
+void Layer::drop_index() {
+    index.reset();
 }
 
 LayerPack::LayerPack(const std::vector<Layer>& layers) {
+    this->layers.reserve(layers.size());
     for (const auto& layer : layers) {
         append_layer(layer);
     }
 }
 
+size_t LayerPack::find_index(const std::string& name) const {
+    auto it = index_by_name.find(name);
+    if (it == index_by_name.end()) {
+        throw std::out_of_range("Слой с таким именем не найден");
+    }
+    return it->second;
+}
+
+LayerPack::LayerPack(const LayerPack& other) : layers(other.layers), index_by_name(other.index_by_name) {
+    reindex(0);
+}
+
+LayerPack::LayerPack(LayerPack&& other) noexcept
+    : layers(std::move(other.layers)), index_by_name(std::move(other.index_by_name)) {
+    reindex(0);
+    other.layers.clear();
+    other.index_by_name.clear();
+}
+
+// Поэлементное присваивание слоёв переименовывало бы их через этот же пакет
+LayerPack& LayerPack::operator=(const LayerPack& other) {
+    if (this != &other)
+        *this = LayerPack(other);
+    return *this;
+}
+
+LayerPack& LayerPack::operator=(LayerPack&& other) noexcept {
+    if (this != &other) {
+        layers = std::move(other.layers);
+        index_by_name = std::move(other.index_by_name);
+        reindex(0);
+        other.layers.clear();
+        other.index_by_name.clear();
+    }
+    return *this;
+}
+
+// Обновляет индексы имён для слоёв начиная с from после вставки или удаления
+void LayerPack::reindex(size_t from) {
+    for (size_t i = from; i < layers.size(); ++i) {
+        index_by_name[layers[i].get_name()] = i;
+        layers[i].owner = this;
+    }
+}
+
+void LayerPack::release(size_t from) {
+    for (size_t i = from; i < layers.size(); ++i) {
+        layers[i].owner = nullptr;
+    }
+}
+
 void LayerPack::append_layer(const Layer& layer) {
-    std::string layer_name = layer.get_name();
-    
+    append_layer(Layer(layer));
+}
+
+void LayerPack::append_layer(Layer&& layer) {
+    TRACE_SCOPE("layerpack_append");
+    const std::string& layer_name = layer.get_name();
+
     // Проверка на существование слоя с тем же именем
-    if (layers_by_name.find(layer_name) != layers_by_name.end()) {
+    if (index_by_name.find(layer_name) != index_by_name.end()) {
         throw std::invalid_argument("Слой с именем \"" + layer_name + "\" уже существует.");
     }
 
-    layers_by_name.emplace(layer_name, layer);  // Используем emplace
-    layers_by_index.push_back(layer);
+    index_by_name.emplace(layer_name, layers.size());
+    // При перевыделении памяти слои перемещаются в новые объекты: отвязанные слои отдают имена без копирования
+    bool grow = layers.size() == layers.capacity();
+    if (grow)
+        release(0);
+    try {
+        layers.push_back(std::move(layer));
+    } catch (...) {
+        index_by_name.erase(layer_name);
+        reindex(0);
+        throw;
+    }
+    if (grow)
+        reindex(0);
+    else
+        layers.back().owner = this;
 }
 
 void LayerPack::insert_layer(const Layer& layer, size_t index) {
-    if (index > layers_by_index.size()) {
+    TRACE_SCOPE("layerpack_insert");
+    TRACE_COUNT("reindexed", layers.size() - std::min(index, layers.size()));
+    if (index > layers.size()) {
         throw std::out_of_range("Индекс выходит за границы");
     }
 
-    std::string layer_name = layer.get_name();
+    const std::string& layer_name = layer.get_name();
 
     // Проверка на существование слоя с тем же именем
-    if (layers_by_name.find(layer_name) != layers_by_name.end()) {
+    if (index_by_name.find(layer_name) != index_by_name.end()) {
         throw std::invalid_argument("Слой с именем \"" + layer_name + "\" уже существует.");
     }
 
-    layers_by_index.insert(layers_by_index.begin() + index, layer);
-    layers_by_name[layer_name] = layer;  // Обновление словаря имен
+    // Сдвигаемые слои (и все слои при перевыделении памяти) отвязываются, чтобы перемещаться вместе с именами
+    bool grow = layers.size() == layers.capacity();
+    release(grow ? 0 : index);
+    try {
+        layers.insert(layers.begin() + index, layer);
+    } catch (...) {
+        reindex(0);
+        throw;
+    }
+    reindex(grow ? 0 : index);
 }
 
 void LayerPack::remove_layer(const std::string& name) {
-    auto it = layers_by_name.find(name);
-    if (it == layers_by_name.end()) {
-        throw std::out_of_range("Слой с таким именем не найден");
-    }
-
-    // Получите индекс слоя в layers_by_index
-    size_t index = layers_by_index.size(); // Инициализируем так, чтобы гарантированно выйти за пределы
-    for (size_t i = 0; i < layers_by_index.size(); ++i) {
-        if (layers_by_index[i].get_name() == name) {
-            index = i; // Найден индекс
-            break;
-        }
-    }
+    remove_layer(find_index(name));
+}
 
-    if (index == layers_by_index.size()) {
-        throw std::out_of_range("Слой с таким именем не найден в списке слоев");
+void LayerPack::remove_layer(size_t index) {
+    TRACE_SCOPE("layerpack_remove");
+    TRACE_COUNT("reindexed", layers.size() - std::min(index + 1, layers.size()));
+    if (index >= layers.size()) {
+        throw std::out_of_range("Индекс выходит за границы");
     }
 
-    // Удалите слой из обеих структур
-    layers_by_index.erase(layers_by_index.begin() + index);
-    layers_by_name.erase(it);
+    index_by_name.erase(layers[index].get_name());
+    release(index);
+    layers.erase(layers.begin() + index);
+    reindex(index);
 }
 
-void LayerPack::remove_layer(size_t index) {
-    if (index >= layers_by_index.size()) {
-        throw std::out_of_range("Индекс выходит за границы");
+void LayerPack::rename_layer(const std::string& name, const std::string& new_name) {
+    TRACE_SCOPE("layerpack_rename");
+    size_t index = find_index(name);
+    if (name == new_name)
+        return;
+    if (new_name.empty()) {
+        throw std::invalid_argument("Новое имя слоя не может быть пустым");
+    }
+    if (index_by_name.find(new_name) != index_by_name.end()) {
+        throw std::invalid_argument("Слой с именем \"" + new_name + "\" уже существует.");
     }
 
-    layers_by_name.erase(layers_by_index[index].get_name());
-    layers_by_index.erase(layers_by_index.begin() + index);
+    // name может ссылаться на имя самого слоя (вызов из Layer::rename), поэтому индекс обновляется первым
+    index_by_name.erase(name);
+    index_by_name.emplace(new_name, index);
+    layers[index].name = new_name;
 }
 
 // Методы доступа
 const std::vector<Layer>& LayerPack::get_layers() const {
-    return layers_by_index;
+    return layers;
 }
 
 std::vector<std::string> LayerPack::get_layers_names() const {
     std::vector<std::string> names;
-    for (const auto& pair : layers_by_name) {
-        names.push_back(pair.first);
+    names.reserve(layers.size());
+    for (const auto& layer : layers) {
+        names.push_back(layer.get_name());
     }
     return names;
 }
 
-const std::unordered_map<std::string, Layer>& LayerPack::get_layers_map() const {
-    return layers_by_name;
+const std::unordered_map<std::string, size_t>& LayerPack::get_layers_index() const {
+    return index_by_name;
+}
+
+bool LayerPack::contains(const std::string& name) const {
+    return index_by_name.find(name) != index_by_name.end();
 }
 
 // Перегрузка операторов
 Layer& LayerPack::operator[](size_t index) {
-    if (index >= layers_by_index.size()) {
+    if (index >= layers.size()) {
         throw std::out_of_range("Индекс выходит за границы");
     }
-    return layers_by_index[index];
+    return layers[index];
 }
 
 const Layer& LayerPack::operator[](size_t index) const {
-    if (index >= layers_by_index.size()) {
+    if (index >= layers.size()) {
         throw std::out_of_range("Индекс выходит за границы");
     }
-    return layers_by_index[index];
+    return layers[index];
 }
 
 Layer& LayerPack::operator[](const std::string& name) {
-    auto it = layers_by_name.find(name);
-    if (it == layers_by_name.end()) {
-        throw std::out_of_range("Слой с таким именем не найден");
-    }
-    return it->second;
+    return layers[find_index(name)];
 }
 
 const Layer& LayerPack::operator[](const std::string& name) const {
-    auto it = layers_by_name.find(name);
-    if (it == layers_by_name.end()) {
-        throw std::out_of_range("Слой с таким именем не найден");
-    }
-    return it->second;
+    return layers[find_index(name)];
 }
@@ -1,126 +1,411 @@
 #ifndef ENTITY_H
 #define ENTITY_H
 
+#include <cstdint>
 #include <unordered_map>
 #include <vector>
 #include <string>
 #include <stdexcept>
+#include <memory>
+
+// Тип точных произведений разностей координат (ориентация, площадь). Для double совпадает с double,
+// для целых координат в единицах базы данных вычисления точны: int32 - при любых значениях,
+// int64 - при |координата| < 2^62
+template <typename T>
+struct CoordinateTraits {
+    using wide_type = T;
+    static constexpr bool exact = false;
+};
+
+#ifdef __SIZEOF_INT128__
+template <>
+struct CoordinateTraits<int32_t> {
+    using wide_type = __int128;
+    static constexpr bool exact = true;
+};
+
+template <>
+struct CoordinateTraits<int64_t> {
+    using wide_type = __int128;
+    static constexpr bool exact = true;
+};
+#else
+// Без 128-битных целых int32 точен при |координата| < 2^30, int64 не поддерживается
+template <>
+struct CoordinateTraits<int32_t> {
+    using wide_type = int64_t;
+    static constexpr bool exact = true;
+};
+#endif
 
-class Point {
+
+// Точка с координатами типа T: double - пользовательские единицы,
+// int32_t/int64_t - целые единицы базы данных с точными сравнениями.
+// На T параметризованы только точка, дырка и полигон с их предикатами (contains, signedArea, orientation).
+// Layer, LayerPack, CompactPolygons и булевы операции работают с double; целые полигоны переводятся
+// на границе через LayerOperations::toDatabaseUnits/fromDatabaseUnits
+template <typename T>
+class BasicPoint {
 public:
-    double x; // Координата точки по оси X
-    double y; // Координата точки по оси Y
+    using coordinate_type = T;
+
+    T x; // Координата точки по оси X
+    T y; // Координата точки по оси Y
 
-    Point(double x = 0.0, double y = 0.0);
+    BasicPoint(T x = T(), T y = T());
+    // Приведение типа координат без округления (для округления - LayerOperations::toDatabaseUnits)
+    template <typename U>
+    explicit BasicPoint(const BasicPoint<U>& other) : x(static_cast<T>(other.x)), y(static_cast<T>(other.y)) {}
 
-    Point operator+(const Point& other) const;
-    Point operator-(const Point& other) const;
-    Point operator*(const double& other) const;
-    bool operator==(const Point& other) const;
+    BasicPoint operator+(const BasicPoint& other) const;
+    BasicPoint operator-(const BasicPoint& other) const;
+    BasicPoint operator*(const T& other) const;
+    bool operator==(const BasicPoint& other) const;
 
     std::unordered_map<std::string, double> ravel() const;
 };
 
-class AbstractPolygon {
+using Point = BasicPoint<double>;
+using Point32 = BasicPoint<int32_t>;
+using Point64 = BasicPoint<int64_t>;
+
+extern template class BasicPoint<double>;
+extern template class BasicPoint<int32_t>;
+extern template class BasicPoint<int64_t>;
+
+// Ограничивающий прямоугольник; по умолчанию пустой
+class Box {
+public:
+    double min_x, min_y, max_x, max_y;
+
+    Box();
+    Box(double min_x, double min_y, double max_x, double max_y);
+
+    bool empty() const;
+    bool intersects(const Box& other) const;
+    bool contains(const Point& point) const;
+    void expand(const Point& point);
+    void expand(const Box& other);
+    double area() const;
+    double distance(const Point& point) const;  // Расстояние от точки до прямоугольника (0 внутри)
+};
+
+class SpatialIndex;
+
+template <typename T>
+class BasicAbstractPolygon {
 protected:
-    std::vector<Point> vertices;
+    std::vector<BasicPoint<T>> vertices;
 
 public:
-    AbstractPolygon() = default;
+    BasicAbstractPolygon() = default;
 
-    virtual ~AbstractPolygon() = default;
-    virtual void append(const Point& point) = 0;
-    virtual void insert(const Point& point, size_t index) = 0;
+    virtual ~BasicAbstractPolygon() = default;
+    virtual void append(const BasicPoint<T>& point) = 0;
+    virtual void insert(const BasicPoint<T>& point, size_t index) = 0;
     virtual void remove(size_t index) = 0;
-    virtual const std::vector<Point>& get_vertices() const = 0;
+    virtual const std::vector<BasicPoint<T>>& get_vertices() const = 0;
 
-    virtual Point& operator[](size_t index) = 0;
-    virtual const Point& operator[](size_t index) const = 0;
+    virtual BasicPoint<T>& operator[](size_t index) = 0;
+    virtual const BasicPoint<T>& operator[](size_t index) const = 0;
 };
 
 
-class Hole : public AbstractPolygon {
+template <typename T>
+class BasicHole : public BasicAbstractPolygon<T> {
 public:
-    Hole(const std::vector<Point>& vertices = {});
+    BasicHole(const std::vector<BasicPoint<T>>& vertices = {});
 
-    void append(const Point& point) override;
-    void insert(const Point& point, size_t index) override;
+    void append(const BasicPoint<T>& point) override;
+    void insert(const BasicPoint<T>& point, size_t index) override;
     void remove(size_t index) override;
-    const std::vector<Point>& get_vertices() const override;
+    const std::vector<BasicPoint<T>>& get_vertices() const override;
+    std::vector<BasicPoint<T>>& get_vertices();
 
-    Point& operator[](size_t index) override;
-    const Point& operator[](size_t index) const override;
+    BasicPoint<T>& operator[](size_t index) override;
+    const BasicPoint<T>& operator[](size_t index) const override;
 };
 
 
-class Polygon : public AbstractPolygon {
+template <typename T>
+class BasicPolygon : public BasicAbstractPolygon<T> {
 private:
-    std::vector<Hole> holes;
+    std::vector<BasicHole<T>> holes;
 
 public:
-    Polygon(const std::vector<Point>& vertices = {}, const std::vector<Hole>& holes = {}); // Default arguments
+    BasicPolygon(const std::vector<BasicPoint<T>>& vertices = {}, const std::vector<BasicHole<T>>& holes = {}); // Default arguments
 
-    void append(const Point& point) override;
-    void insert(const Point& point, size_t index) override;
+    void append(const BasicPoint<T>& point) override;
+    void insert(const BasicPoint<T>& point, size_t index) override;
     void remove(size_t index) override;
-    const std::vector<Point>& get_vertices() const override;
+    const std::vector<BasicPoint<T>>& get_vertices() const override;
+    std::vector<BasicPoint<T>>& get_vertices();
 
-    Point& operator[](size_t index) override;
-    const Point& operator[](size_t index) const override;
+    BasicPoint<T>& operator[](size_t index) override;
+    const BasicPoint<T>& operator[](size_t index) const override;
 
-    void add_hole(const Hole& hole);
+    void add_hole(const BasicHole<T>& hole);
+    void add_hole(BasicHole<T>&& hole);
     void remove_hole(size_t index);
-    const std::vector<Hole>& get_holes() const;
-    std::vector<Hole>& get_holes();
+    const std::vector<BasicHole<T>>& get_holes() const;
+    std::vector<BasicHole<T>>& get_holes();
+
+    Box get_bounding_box() const;
+    bool contains(const BasicPoint<T>& point) const;    // Точка внутри внешнего контура и вне дырок (для целых - точно)
+    double distance(const BasicPoint<T>& point) const;  // Расстояние до границы, 0 для точки внутри
 };
 
+using AbstractPolygon = BasicAbstractPolygon<double>;
+using Hole = BasicHole<double>;
+using Polygon = BasicPolygon<double>;
+// Полигоны в целых единицах базы данных; int32 - вдвое меньше памяти на вершину
+using Hole32 = BasicHole<int32_t>;
+using Polygon32 = BasicPolygon<int32_t>;
+using Hole64 = BasicHole<int64_t>;
+using Polygon64 = BasicPolygon<int64_t>;
+
+extern template class BasicHole<double>;
+extern template class BasicHole<int32_t>;
+extern template class BasicHole<int64_t>;
+extern template class BasicPolygon<double>;
+extern template class BasicPolygon<int32_t>;
+extern template class BasicPolygon<int64_t>;
+
+
+// Представление контура внутри непрерывного массива вершин (память не принадлежит представлению)
+class ContourView {
+private:
+    const Point* points;
+    size_t count;
+
+public:
+    ContourView(const Point* points = nullptr, size_t count = 0);
+    ContourView(const std::vector<Point>& points);
+
+    size_t size() const;
+    bool empty() const;
+    const Point* data() const;
+    const Point* begin() const;
+    const Point* end() const;
+    const Point& operator[](size_t index) const;
+};
+
+
+class CompactPolygons;
+
+// Представление полигона с дырками, хранящегося в CompactPolygons
+class PolygonView {
+private:
+    const CompactPolygons* owner;
+    size_t index;
+
+public:
+    PolygonView(const CompactPolygons* owner, size_t index);
+
+    ContourView get_vertices() const;   // Внешний контур
+    size_t hole_count() const;
+    ContourView get_hole(size_t index) const;
+
+    Box get_bounding_box() const;
+    bool contains(const Point& point) const;
+    double distance(const Point& point) const;
+    Polygon to_polygon() const;
+};
+
+
+// Компактное хранение полигонов: все вершины лежат в одном массиве, контуры и полигоны задаются
+// таблицами смещений. Контур c занимает vertices[contour_offsets[c], contour_offsets[c + 1]),
+// полигон p - контуры [polygon_offsets[p], polygon_offsets[p + 1]), первый из них внешний, остальные - дырки.
+// Загрузка, обход и освобождение стоят несколько выделений памяти вместо одного на каждый контур.
+// Массивы могут принадлежать объекту или лежать во внешней памяти (например, в отображённом файле),
+// во втором случае они копируются только при первом изменении
+class CompactPolygons {
+private:
+    std::vector<Point> vertices;
+    std::vector<size_t> contour_offsets;
+    std::vector<size_t> polygon_offsets;
+
+    // Внешняя память, которую нужно удерживать, пока на неё ссылаются указатели ниже
+    std::shared_ptr<const void> storage;
+    const Point* vertex_data;
+    const size_t* contour_data;
+    const size_t* polygon_data;
+    size_t vertex_size, contour_size, polygon_size;
+
+    void attach();                  // Направляет указатели на собственные массивы
+    void detach();                  // Копирует внешние массивы в собственные
+
+    friend class PolygonView;
+
+public:
+    CompactPolygons();
+    explicit CompactPolygons(const std::vector<Polygon>& polygons);
+    // Представление внешних массивов без копирования; размеры таблиц смещений на единицу больше
+    // числа контуров и полигонов. storage удерживает память, пока она используется
+    CompactPolygons(std::shared_ptr<const void> storage,
+                    const Point* vertices, size_t vertex_count,
+                    const size_t* contour_offsets, size_t contour_count,
+                    const size_t* polygon_offsets, size_t polygon_count);
+    CompactPolygons(const CompactPolygons& other);
+    CompactPolygons(CompactPolygons&& other);       // Перемещённый объект остаётся пустым
+    CompactPolygons& operator=(const CompactPolygons& other);
+    CompactPolygons& operator=(CompactPolygons&& other);
+
+    void reserve(size_t polygons, size_t contours, size_t vertices);
+    void append(const Polygon& polygon);
+    // Потоковое добавление: внешний контур начинает новый полигон, дырка добавляется к последнему
+    void append_contour(const Point* points, size_t count, bool is_hole);
+
+    size_t size() const;            // Количество полигонов
+    bool empty() const;
+    size_t contour_count() const;
+    size_t vertex_count() const;
+    bool is_external() const;       // Массивы лежат во внешней памяти
+
+    PolygonView operator[](size_t index) const;
+    // Весь массив вершин и таблицы смещений - для пакетной обработки и сохранения
+    ContourView get_vertices() const;
+    std::vector<Point>& get_vertices();  // Копирует внешние массивы
+    const size_t* get_contour_offsets() const;
+    const size_t* get_polygon_offsets() const;
+
+    std::vector<Polygon> to_polygons() const;
+};
+
+
+class LayerPack;
 
 class Layer {
 private:
     std::string name;
-    std::vector<Polygon> polygons;
+    // Пакет, в котором хранится слой: переименование идёт через него, чтобы индекс имён оставался верным.
+    // Копии и перемещённые слои ни к какому пакету не относятся, пока пакет их не примет
+    LayerPack* owner = nullptr;
+    // Полигоны разделяются между копиями слоя (copy-on-write): копирование и переименование - O(1),
+    // реальное копирование происходит при первом изменяющем вызове
+    std::shared_ptr<std::vector<Polygon>> polygons;
+    // Компактное хранение (после compact()); пока оно задано, polygons пуст. Обратно в объекты Polygon
+    // слой переводит только явный unpack(), константные методы хранение не меняют
+    std::shared_ptr<CompactPolygons> compact_polygons;
+    mutable std::unique_ptr<SpatialIndex> index;    // R-дерево, строится лениво при первом запросе
+    uint64_t version;                               // Меняется при каждом изменении геометрии
+
+    // Журнал областей правок: прямоугольники полигонов до и после изменения с версией слоя после него.
+    // Полигон, выданный изменяемым operator[], записывается номером: его новый прямоугольник читается
+    // при запросе, а при append/insert/remove/compact переносится в журнал. Журнал полон начиная
+    // с версии changes_base и, как полигоны, разделяется между копиями слоя
+    struct Change {
+        uint64_t version;
+        Box box;
+        size_t polygon;                             // NO_POLYGON или номер полигона, выданного по ссылке
+    };
+    static const size_t NO_POLYGON = static_cast<size_t>(-1);
+    static const size_t MAX_CHANGES = 1024;         // При переполнении журнал начинается заново
+    std::shared_ptr<std::vector<Change>> changes;
+    uint64_t changes_base;
+
+    SpatialIndex& get_index() const;
+    Box polygon_box(size_t index) const;
+    std::vector<Change>& mutable_changes();         // Отделяет собственную копию журнала
+    void record(const Box& box, size_t polygon = NO_POLYGON);
+    void flush_touched();                           // Переносит прямоугольники выданных полигонов в журнал
+    void reset_changes();                           // Правка без известной области
+    std::vector<Polygon>& mutable_polygons();       // Отделяет собственную копию полигонов, если они разделены
+
+    friend class LayerPack;
 
 public:
-    Layer() : name("Unnamed Layer"), polygons() {}  // Конструктор по умолчанию
-    Layer(const char* name) : name(name), polygons() {} // Конструктор с const char*
+    Layer();                                        // Конструктор по умолчанию
+    Layer(const char* name);                        // Конструктор с const char*
     Layer(const std::string& name, const std::vector<Polygon>& polygons);
-    Layer(const Layer& other) = default;          // Конструктор копирования
-    Layer(Layer&& other) noexcept = default;       // Перемещающий конструктор
-    Layer& operator=(const Layer& other) = default; // Оператор копирования
-    Layer& operator=(Layer&& other) noexcept = default; // Оператор перемещения
+    Layer(const std::string& name, CompactPolygons&& polygons);   // Слой сразу в компактном режиме
+    Layer(const Layer& other);                      // Конструктор копирования (индекс не копируется)
+    Layer(Layer&& other) noexcept;                  // Перемещающий конструктор
+    Layer& operator=(const Layer& other);           // Оператор копирования
+    Layer& operator=(Layer&& other) noexcept;       // Оператор перемещения
+    ~Layer();
 
     const std::string& get_name() const;
+    // У слоя из LayerPack выполняется через LayerPack::rename_layer (std::invalid_argument при повторе имени).
+    // Присваивание слою из пакета заменяет только содержимое, имя остаётся прежним;
+    // перемещение из слоя пакета оставляет ему имя (например, std::swap двух слоёв пакета меняет их содержимое)
     void rename(const std::string& new_name);
     void append(const Polygon& polygon);
+    void append(Polygon&& polygon);
     void insert(const Polygon& polygon, size_t index);
     void remove(size_t index);
+    // Только для обычного режима, у компактного слоя std::logic_error: его читают через get_compact()
+    // или копируют в to_polygons()
     const std::vector<Polygon>& get_polygons() const;
-
+    std::vector<Polygon> to_polygons() const;       // Копия полигонов в любом режиме хранения
+    bool is_shared() const;                         // Полигоны разделены с другой копией слоя
+    // Версия геометрии: новая после любого изменяющего вызова, у копий совпадает с оригиналом.
+    // Пустые слои без изменений имеют версию 0
+    uint64_t get_version() const;
+    // Добавляет в regions прямоугольники, покрывающие все изменения после версии since (старое и новое
+    // положение каждого изменённого полигона). false, если журнал этого не знает: since не из истории слоя,
+    // журнал переполнился или была правка без известной области (get_compact()) - тогда изменён весь слой
+    bool changed_regions(uint64_t since, std::vector<Box>& regions) const;
+    Box get_bounding_box() const;                   // По R-дереву слоя, строит его при первом вызове
+    size_t size() const;                            // Количество полигонов в любом режиме хранения
+
+    // Компактный режим: вершины всех полигонов в одном массиве (см. CompactPolygons)
+    void compact();
+    void unpack();                                  // Переводит слой из компактного хранения в обычное
+    bool is_compact() const;
+    const CompactPolygons& get_compact() const;
+    CompactPolygons& get_compact();                 // Отделяет собственную копию и сбрасывает индекс
+
+    // Изменяемая ссылка указывает в текущее хранилище слоя и, как у std::vector, действительна только
+    // до копирования или присваивания слоя и до append/insert/remove/compact: копия разделяет то же хранилище,
+    // поэтому запись через старую ссылку видна и в копии. После копирования ссылку нужно получить заново -
+    // тогда слой отделит собственные полигоны
+    // Изменяемый доступ распаковывает компактный слой, константный в компактном режиме - std::logic_error
     Polygon& operator[](size_t index);
     const Polygon& operator[](size_t index) const;
+
+    // Пространственные запросы, возвращают индексы полигонов
+    std::vector<size_t> query_window(const Box& window) const;          // Пересечение ограничивающих прямоугольников с окном
+    std::vector<size_t> query_point(const Point& point) const;          // Полигоны, содержащие точку
+    std::vector<size_t> query_nearest(const Point& point, size_t count) const; // count ближайших полигонов по возрастанию расстояния
+    bool has_index() const;
+    void drop_index();
 };
 
 
 
 class LayerPack {
 private:
-    std::unordered_map<std::string, Layer> layers_by_name;   // Хранит слои по имени
-    std::vector<Layer> layers_by_index;                      // Хранит слои по индексу
+    std::vector<Layer> layers;                               // Хранит слои по индексу
+    std::unordered_map<std::string, size_t> index_by_name;   // Индекс слоя по имени
+
+    size_t find_index(const std::string& name) const;
+    void reindex(size_t from);                  // Обновляет индекс имён и владельца слоёв с номерами >= from
+    void release(size_t from);                  // Отвязывает слои перед сдвигом элементов вектора
 
 public:
     // Конструктор
     LayerPack(const std::vector<Layer>& layers = {});
+    LayerPack(const LayerPack& other);
+    LayerPack(LayerPack&& other) noexcept;
+    LayerPack& operator=(const LayerPack& other);
+    LayerPack& operator=(LayerPack&& other) noexcept;
 
     // Методы управления слоями
     void append_layer(const Layer& layer);
+    void append_layer(Layer&& layer);
     void insert_layer(const Layer& layer, size_t index);
     void remove_layer(const std::string& name);
     void remove_layer(size_t index);
+    // Переименование сохраняет согласованность индекса имён; Layer::rename у слоя,
+    // полученного через operator[], вызывает этот же метод
+    void rename_layer(const std::string& name, const std::string& new_name);
 
     // Методы доступа к слоям
     const std::vector<Layer>& get_layers() const;
     std::vector<std::string> get_layers_names() const;
-    const std::unordered_map<std::string, Layer>& get_layers_map() const;
+    const std::unordered_map<std::string, size_t>& get_layers_index() const;
+    bool contains(const std::string& name) const;
 
     // Перегрузка операторов
     Layer& operator[](size_t index);
@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <iterator>
+#include "ExpressionGraph.h"
+#include "ThreadPool.h"
+
+ExpressionGraph::ExpressionGraph(size_t threads)
+    : pool(threads > 1 ? new ThreadPool(threads) : nullptr), hits(0), misses(0) {}
+
+ExpressionGraph::~ExpressionGraph() = default;
+
+ExpressionGraph::Id ExpressionGraph::layer(const std::string& name) {
+    auto it = layer_nodes.find(name);
+    if (it != layer_nodes.end())
+        return it->second;
+
+    Id id = nodes.size();
+    nodes.emplace_back();
+    nodes.back().kind = Kind::Layer;
+    nodes.back().name = name;
+    nodes.back().leaves.push_back(id);
+    layer_nodes.emplace(name, id);
+    return id;
+}
+
+ExpressionGraph::Id ExpressionGraph::operation(Kind kind, Id a, Id b) {
+    if (a >= nodes.size() || b >= nodes.size()) {
+        throw std::out_of_range("Узел выражения не найден");
+    }
+    // Объединение и пересечение коммутативны и идемпотентны
+    if (kind != Kind::Difference) {
+        if (a == b)
+            return a;
+        if (b < a)
+            std::swap(a, b);
+    }
+
+    auto key = std::make_tuple(kind, a, b);
+    auto it = operation_nodes.find(key);
+    if (it != operation_nodes.end())
+        return it->second;
+
+    Node node;
+    node.kind = kind;
+    node.left = a;
+    node.right = b;
+    std::set_union(nodes[a].leaves.begin(), nodes[a].leaves.end(), nodes[b].leaves.begin(), nodes[b].leaves.end(),
+                   std::back_inserter(node.leaves));
+    nodes.push_back(std::move(node));
+    operation_nodes.emplace(key, nodes.size() - 1);
+    return nodes.size() - 1;
+}
+
+ExpressionGraph::Id ExpressionGraph::unite(Id a, Id b) {
+    return operation(Kind::Union, a, b);
+}
+
+ExpressionGraph::Id ExpressionGraph::intersect(Id a, Id b) {
+    return operation(Kind::Intersection, a, b);
+}
+
+ExpressionGraph::Id ExpressionGraph::subtract(Id a, Id b) {
+    return operation(Kind::Difference, a, b);
+}
+
+size_t ExpressionGraph::size() const {
+    return nodes.size();
+}
+
+const std::vector<Trapezoid>& ExpressionGraph::compute(Id id, const LayerPack& layerpack) {
+    Node& node = nodes[id];
+    std::vector<uint64_t> versions;
+    versions.reserve(node.leaves.size());
+    for (Id leaf : node.leaves) {
+        versions.push_back(layerpack[nodes[leaf].name].get_version());
+    }
+    if (node.cached && node.versions == versions) {
+        ++hits;
+        return node.result;
+    }
+    ++misses;
+
+    // Если левый операнд пересечения или разности пуст, правый не вычисляется
+    std::vector<Trapezoid> result;
+    switch (node.kind) {
+    case Kind::Layer:
+        result = LayerOperations::decomposeLayer(layerpack[node.name]);
+        break;
+    case Kind::Union: {
+        const std::vector<Trapezoid>& a = compute(node.left, layerpack);
+        const std::vector<Trapezoid>& b = compute(node.right, layerpack);
+        result = pool ? TrapezoidOperations::unite(a, b, *pool) : TrapezoidOperations::unite(a, b);
+        break;
+    }
+    case Kind::Intersection: {
+        const std::vector<Trapezoid>& a = compute(node.left, layerpack);
+        if (a.empty())
+            break;
+        const std::vector<Trapezoid>& b = compute(node.right, layerpack);
+        if (!b.empty())
+            result = pool ? TrapezoidOperations::intersect(a, b, *pool) : TrapezoidOperations::intersect(a, b);
+        break;
+    }
+    case Kind::Difference: {
+        const std::vector<Trapezoid>& a = compute(node.left, layerpack);
+        if (a.empty())
+            break;
+        const std::vector<Trapezoid>& b = compute(node.right, layerpack);
+        if (b.empty())
+            result = a;
+        else
+            result = pool ? TrapezoidOperations::subtract(a, b, *pool) : TrapezoidOperations::subtract(a, b);
+        break;
+    }
+    }
+
+    node.result = std::move(result);
+    node.versions = std::move(versions);
+    node.cached = true;
+    return node.result;
+}
+
+const std::vector<Trapezoid>& ExpressionGraph::evaluate(Id id, const LayerPack& layerpack) {
+    if (id >= nodes.size()) {
+        throw std::out_of_range("Узел выражения не найден");
+    }
+    return compute(id, layerpack);
+}
+
+void ExpressionGraph::evaluate(Id id, const LayerPack& layerpack, Layer& target) {
+    LayerOperations::reconstructLayer(evaluate(id, layerpack), target);
+}
+
+size_t ExpressionGraph::cache_hits() const {
+    return hits;
+}
+
+size_t ExpressionGraph::cache_misses() const {
+    return misses;
+}
+
+void ExpressionGraph::clear_cache() {
+    for (Node& node : nodes) {
+        node.cached = false;
+        node.versions.clear();
+        std::vector<Trapezoid>().swap(node.result);
+    }
+}
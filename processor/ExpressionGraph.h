@@ -0,0 +1,65 @@
+#ifndef EXPRESSIONGRAPH_H
+#define EXPRESSIONGRAPH_H
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "GeometryOperations.h"
+
+// Граф булевых выражений над слоями LayerPack, например (A ∪ B) − (C ∩ D).
+//
+// Одинаковые подвыражения строятся один раз: повторный вызов с теми же аргументами возвращает
+// существующий узел (для объединения и пересечения порядок аргументов не важен).
+// Вычисляется только запрошенный узел и его зависимости; результат каждого узла кэшируется
+// вместе с версиями входных слоёв (Layer::get_version), поэтому после правки одного слоя
+// пересчитываются только узлы, зависящие от него.
+class ExpressionGraph {
+public:
+    using Id = size_t;
+
+    explicit ExpressionGraph(size_t threads = 1);   // threads > 1 - многопоточные булевы операции на общем пуле
+    ~ExpressionGraph();
+
+    Id layer(const std::string& name);
+    Id unite(Id a, Id b);
+    Id intersect(Id a, Id b);
+    Id subtract(Id a, Id b);
+    size_t size() const;                            // Количество узлов
+
+    // Ссылка действительна до следующего вычисления или очистки кэша
+    const std::vector<Trapezoid>& evaluate(Id id, const LayerPack& layerpack);
+    // Результат в виде полигонов с дырками, добавляется в target
+    void evaluate(Id id, const LayerPack& layerpack, Layer& target);
+
+    size_t cache_hits() const;
+    size_t cache_misses() const;
+    void clear_cache();
+
+private:
+    enum class Kind { Layer, Union, Intersection, Difference };
+
+    struct Node {
+        Kind kind;
+        std::string name;               // Имя слоя для листа
+        Id left = 0, right = 0;
+        std::vector<Id> leaves;         // Листья, от которых зависит узел, по возрастанию
+        std::vector<uint64_t> versions; // Версии листьев, при которых вычислен result
+        bool cached = false;
+        std::vector<Trapezoid> result;
+    };
+
+    std::deque<Node> nodes;
+    std::unordered_map<std::string, Id> layer_nodes;
+    std::map<std::tuple<Kind, Id, Id>, Id> operation_nodes;
+    std::unique_ptr<ThreadPool> pool;   // Создаётся один раз при threads > 1 и используется всеми узлами
+    size_t hits, misses;
+
+    Id operation(Kind kind, Id a, Id b);
+    const std::vector<Trapezoid>& compute(Id id, const LayerPack& layerpack);
+};
+
+#endif // EXPRESSIONGRAPH_H
@@ -0,0 +1,555 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <unordered_map>
+#include "GdsFile.h"
+#include "GeometryOperations.h"
+
+namespace GdsFile {
+
+    namespace {
+
+        // Типы записей (старший байт - запись, младший - тип данных)
+        enum Record : uint16_t {
+            HEADER = 0x0002,
+            BGNLIB = 0x0102,
+            LIBNAME = 0x0206,
+            UNITS = 0x0305,
+            ENDLIB = 0x0400,
+            BGNSTR = 0x0502,
+            STRNAME = 0x0606,
+            ENDSTR = 0x0700,
+            BOUNDARY = 0x0800,
+            PATH = 0x0900,
+            SREF = 0x0A00,
+            AREF = 0x0B00,
+            TEXT = 0x0C00,
+            LAYER = 0x0D02,
+            DATATYPE = 0x0E02,
+            XY = 0x1003,
+            ENDEL = 0x1100,
+            SNAME = 0x1206,
+            COLROW = 0x1302,
+            NODE = 0x1500,
+            STRANS = 0x1A01,
+            MAG = 0x1B05,
+            ANGLE = 0x1C05,
+            BOX = 0x2D00,
+            BOXTYPE = 0x2E02,
+        };
+
+        const size_t MAX_RECORD = 0xFFFF;
+        const size_t MAX_POINTS = (MAX_RECORD - 4) / 8;     // Включая замыкающую точку
+        const size_t BUFFER_SIZE = 1 << 20;
+
+        uint16_t readUint16(const unsigned char* p) {
+            return static_cast<uint16_t>(p[0] << 8 | p[1]);
+        }
+
+        int32_t readInt32(const unsigned char* p) {
+            return static_cast<int32_t>(uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | uint32_t(p[3]));
+        }
+
+        void writeUint16(unsigned char* p, uint16_t value) {
+            p[0] = static_cast<unsigned char>(value >> 8);
+            p[1] = static_cast<unsigned char>(value);
+        }
+
+        void writeInt32(unsigned char* p, int32_t value) {
+            uint32_t bits = static_cast<uint32_t>(value);
+            p[0] = static_cast<unsigned char>(bits >> 24);
+            p[1] = static_cast<unsigned char>(bits >> 16);
+            p[2] = static_cast<unsigned char>(bits >> 8);
+            p[3] = static_cast<unsigned char>(bits);
+        }
+
+        // Вещественные числа GDSII: знак, 7 бит порядка по основанию 16 со смещением 64, 56 бит мантиссы
+        double readReal8(const unsigned char* p) {
+            uint64_t bits = 0;
+            for (int i = 0; i < 8; ++i)
+                bits = bits << 8 | p[i];
+            double mantissa = static_cast<double>(bits & ((uint64_t(1) << 56) - 1)) / std::ldexp(1.0, 56);
+            int exponent = static_cast<int>((bits >> 56) & 0x7F) - 64;
+            double value = mantissa * std::pow(16.0, exponent);
+            return (bits >> 63) ? -value : value;
+        }
+
+        void writeReal8(unsigned char* p, double value) {
+            uint64_t bits = 0;
+            if (value != 0) {
+                uint64_t sign = value < 0 ? 1 : 0;
+                value = std::abs(value);
+                int exponent = 64;
+                while (value >= 1) {
+                    value /= 16;
+                    ++exponent;
+                }
+                while (value < 1.0 / 16) {
+                    value *= 16;
+                    --exponent;
+                }
+                uint64_t mantissa = static_cast<uint64_t>(value * std::ldexp(1.0, 56) + 0.5);
+                if (mantissa >= uint64_t(1) << 56) {
+                    mantissa >>= 4;
+                    ++exponent;
+                }
+                bits = sign << 63 | uint64_t(exponent) << 56 | mantissa;
+            }
+            for (int i = 7; i >= 0; --i) {
+                p[i] = static_cast<unsigned char>(bits);
+                bits >>= 8;
+            }
+        }
+
+        // Чтение записей через буфер фиксированного размера; данные записи действительны до следующего вызова
+        class RecordReader {
+        public:
+            explicit RecordReader(const std::string& path) : in(path, std::ios::binary), buffer(BUFFER_SIZE), begin(0), end(0) {
+                if (!in) {
+                    throw std::runtime_error("Не удалось открыть файл \"" + path + "\"");
+                }
+            }
+
+            bool next(uint16_t& type, const unsigned char*& data, size_t& size) {
+                if (!fill(4))
+                    return false;
+                size_t length = readUint16(&buffer[begin]);
+                if (length < 4) {
+                    throw std::runtime_error("Повреждённый файл GDSII: неверная длина записи");
+                }
+                if (!fill(length)) {
+                    throw std::runtime_error("Повреждённый файл GDSII: файл обрывается внутри записи");
+                }
+                type = readUint16(&buffer[begin + 2]);
+                data = &buffer[begin + 4];
+                size = length - 4;
+                begin += length;
+                return true;
+            }
+
+        private:
+            std::ifstream in;
+            std::vector<unsigned char> buffer;
+            size_t begin, end;
+
+            // Гарантирует count непрочитанных байт подряд в буфере; false - если файл закончился раньше
+            bool fill(size_t count) {
+                if (end - begin >= count)
+                    return true;
+                std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+                end -= begin;
+                begin = 0;
+                while (end < count && in) {
+                    in.read(reinterpret_cast<char*>(buffer.data() + end), static_cast<std::streamsize>(buffer.size() - end));
+                    end += static_cast<size_t>(in.gcount());
+                }
+                return end >= count;
+            }
+        };
+
+        // Запись через собственный буфер; записи собираются в нём без промежуточных объектов
+        class RecordWriter {
+        public:
+            explicit RecordWriter(const std::string& path) : out(path, std::ios::binary | std::ios::trunc), buffer(BUFFER_SIZE), used(0) {
+                if (!out) {
+                    throw std::runtime_error("Не удалось создать файл \"" + path + "\"");
+                }
+            }
+
+            // Резервирует в буфере запись с size байтами данных и возвращает указатель на данные
+            unsigned char* begin(uint16_t type, size_t size) {
+                if (used + size + 4 > buffer.size())
+                    flush();
+                unsigned char* p = &buffer[used];
+                writeUint16(p, static_cast<uint16_t>(size + 4));
+                writeUint16(p + 2, type);
+                used += size + 4;
+                return p + 4;
+            }
+
+            void empty(uint16_t type) {
+                begin(type, 0);
+            }
+
+            void int16(uint16_t type, int value) {
+                writeUint16(begin(type, 2), static_cast<uint16_t>(value));
+            }
+
+            void ascii(uint16_t type, const std::string& text) {
+                size_t size = text.size() + text.size() % 2;    // Строки дополняются до чётной длины
+                unsigned char* p = begin(type, size);
+                std::memset(p, 0, size);
+                std::memcpy(p, text.data(), text.size());
+            }
+
+            void flush() {
+                out.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(used));
+                used = 0;
+            }
+
+            void close(const std::string& path) {
+                flush();
+                out.flush();
+                if (!out) {
+                    throw std::runtime_error("Ошибка записи в файл \"" + path + "\"");
+                }
+            }
+
+        private:
+            std::ofstream out;
+            std::vector<unsigned char> buffer;
+            size_t used;
+        };
+
+        // Ссылка SREF/AREF; ячейка разрешается по имени после чтения всех структур,
+        // потому что структура может быть определена позже ссылки на неё
+        struct Reference {
+            size_t parent;
+            std::string name;
+            AffineTransform transform;
+            size_t columns, rows;
+            Point column_step, row_step;
+        };
+
+        const uint16_t STRANS_REFLECTION = 0x8000;
+        const size_t NO_STRUCTURE = static_cast<size_t>(-1);
+
+        // Строки GDSII дополняются нулём до чётной длины
+        std::string readString(const unsigned char* data, size_t size) {
+            std::string text(reinterpret_cast<const char*>(data), size);
+            text.erase(std::find(text.begin(), text.end(), '\0'), text.end());
+            return text;
+        }
+
+        // Структуры файла в виде ячеек; layer_order - имена слоёв в порядке первого появления
+        CellLibrary readCells(const std::string& path, const LayerMap& layer_names, std::vector<std::string>& layer_order) {
+            RecordReader reader(path);
+
+            CellLibrary library;
+            std::vector<Reference> references;
+            std::unordered_map<uint32_t, size_t> layer_index;   // (layer << 16 | datatype) -> номер в layer_order
+            std::unordered_map<std::string, size_t> name_index;
+            std::map<size_t, CompactPolygons> structure_layers;  // Полигоны текущей структуры по номеру слоя
+            std::vector<Point> points;
+            double scale = 1;               // Размер единицы базы данных в пользовательских единицах
+            size_t structure = NO_STRUCTURE;
+
+            uint16_t element = 0;           // Текущий элемент (0 - вне элемента)
+            int layer = 0, datatype = 0;
+            std::string sname;
+            uint16_t strans = 0;
+            double magnification = 1, angle = 0;
+            size_t columns = 1, rows = 1;
+            bool finished = false;
+
+            uint16_t type;
+            const unsigned char* data;
+            size_t size;
+            while (!finished && reader.next(type, data, size)) {
+                switch (type) {
+                case UNITS:
+                    if (size < 16) {
+                        throw std::runtime_error("Повреждённый файл GDSII: неверная запись UNITS");
+                    }
+                    scale = readReal8(data);
+                    break;
+                case STRNAME: {
+                    std::string name = readString(data, size);
+                    if (library.contains(name)) {
+                        throw std::runtime_error("Повреждённый файл GDSII: структура \"" + name + "\" определена дважды");
+                    }
+                    structure = library.add_cell(name);
+                    structure_layers.clear();
+                    break;
+                }
+                case ENDSTR:
+                    if (structure != NO_STRUCTURE) {
+                        LayerPack& cell_layers = library[structure].get_layers();
+                        for (auto& entry : structure_layers)
+                            cell_layers.append_layer(Layer(layer_order[entry.first], std::move(entry.second)));
+                    }
+                    structure_layers.clear();
+                    structure = NO_STRUCTURE;
+                    break;
+                case BOUNDARY:
+                case BOX:
+                case PATH:
+                case SREF:
+                case AREF:
+                case TEXT:
+                case NODE:
+                    element = type;
+                    layer = datatype = 0;
+                    strans = 0;
+                    magnification = 1;
+                    angle = 0;
+                    columns = rows = 1;
+                    points.clear();
+                    break;
+                case LAYER:
+                    if (size >= 2)
+                        layer = static_cast<int16_t>(readUint16(data));
+                    break;
+                case DATATYPE:
+                case BOXTYPE:
+                    if (size >= 2)
+                        datatype = static_cast<int16_t>(readUint16(data));
+                    break;
+                case SNAME:
+                    sname = readString(data, size);
+                    break;
+                case STRANS:
+                    if (size >= 2)
+                        strans = readUint16(data);
+                    break;
+                case MAG:
+                    if (size >= 8)
+                        magnification = readReal8(data);
+                    break;
+                case ANGLE:
+                    if (size >= 8)
+                        angle = readReal8(data);
+                    break;
+                case COLROW:
+                    if (size >= 4) {
+                        columns = readUint16(data);
+                        rows = readUint16(data + 2);
+                    }
+                    break;
+                case XY:
+                    if (element == BOUNDARY || element == BOX || element == SREF || element == AREF) {
+                        // Число точек известно из длины записи - память выделяется один раз
+                        size_t count = size / 8;
+                        points.resize(count);
+                        for (size_t i = 0; i < count; ++i)
+                            points[i] = Point(readInt32(data + 8 * i) * scale, readInt32(data + 8 * i + 4) * scale);
+                    }
+                    break;
+                case ENDEL:
+                    if (element != 0 && element != TEXT && element != NODE && element != PATH && structure == NO_STRUCTURE) {
+                        throw std::runtime_error("Повреждённый файл GDSII: элемент вне структуры");
+                    }
+                    if ((element == BOUNDARY || element == BOX) && points.size() >= 3) {
+                        size_t count = points.size();
+                        if (points.front() == points.back())
+                            --count;
+                        uint32_t key = uint32_t(uint16_t(layer)) << 16 | uint16_t(datatype);
+                        auto it = layer_index.find(key);
+                        if (it == layer_index.end()) {
+                            // Несколько пар могут быть отображены в один слой
+                            auto mapped = layer_names.find(std::make_pair(layer, datatype));
+                            std::string name = mapped != layer_names.end() ? mapped->second : defaultLayerName(layer, datatype);
+                            auto named = name_index.find(name);
+                            if (named == name_index.end()) {
+                                layer_order.push_back(name);
+                                named = name_index.emplace(name, layer_order.size() - 1).first;
+                            }
+                            it = layer_index.emplace(key, named->second).first;
+                        }
+                        structure_layers[it->second].append_contour(points.data(), count, false);
+                    } else if (element == SREF || element == AREF) {
+                        size_t expected = element == SREF ? 1 : 3;
+                        if (points.size() != expected) {
+                            throw std::runtime_error("Повреждённый файл GDSII: неверная запись XY ссылки на \"" + sname + "\"");
+                        }
+                        // Порядок GDSII: отражение относительно оси x, увеличение, поворот, сдвиг в точку ссылки
+                        AffineTransform transform = AffineTransform::translation(points[0].x, points[0].y) *
+                                                    AffineTransform::rotation(angle * std::acos(-1.0) / 180) *
+                                                    AffineTransform::scaling(magnification, magnification);
+                        if (strans & STRANS_REFLECTION)
+                            transform = transform * AffineTransform::mirrorX();
+                        Reference reference = {structure, sname, transform, 1, 1, Point(), Point()};
+                        if (element == AREF) {
+                            if (columns == 0 || rows == 0) {
+                                throw std::runtime_error("Повреждённый файл GDSII: пустой массив ссылок на \"" + sname + "\"");
+                            }
+                            reference.columns = columns;
+                            reference.rows = rows;
+                            reference.column_step = (points[1] - points[0]) * (1.0 / columns);
+                            reference.row_step = (points[2] - points[0]) * (1.0 / rows);
+                        }
+                        references.push_back(std::move(reference));
+                    }
+                    element = 0;
+                    break;
+                case ENDLIB:
+                    finished = true;
+                    break;
+                default:
+                    break;
+                }
+            }
+            if (!finished) {
+                throw std::runtime_error("Повреждённый файл GDSII: нет записи ENDLIB");
+            }
+
+            for (const Reference& reference : references) {
+                if (!library.contains(reference.name)) {
+                    throw std::runtime_error("Повреждённый файл GDSII: ссылка на неизвестную структуру \"" + reference.name + "\"");
+                }
+                CellInstance instance(library.find(reference.name), reference.transform, reference.columns, reference.rows,
+                                      reference.column_step, reference.row_step);
+                try {
+                    library.add_instance(reference.parent, instance);
+                } catch (const std::invalid_argument& error) {
+                    throw std::runtime_error(std::string("Повреждённый файл GDSII: ") + error.what());
+                }
+            }
+            return library;
+        }
+
+        void writeDate(unsigned char* p) {
+            std::memset(p, 0, 24);
+        }
+
+        int32_t toDatabase(double value, double scale) {
+            double scaled = std::round(value * scale);
+            if (!(std::abs(scaled) <= std::numeric_limits<int32_t>::max())) {
+                throw std::out_of_range("Координата не помещается в 32-битную единицу базы данных GDSII");
+            }
+            return static_cast<int32_t>(scaled);
+        }
+
+        // Записывает замкнутый контур как BOUNDARY; соседние совпавшие после округления точки удаляются
+        void writeBoundary(RecordWriter& writer, int layer, int datatype, const Point* points, size_t count, double scale,
+                           std::vector<int32_t>& coords) {
+            coords.clear();
+            for (size_t i = 0; i < count; ++i) {
+                int32_t x = toDatabase(points[i].x, scale), y = toDatabase(points[i].y, scale);
+                if (!coords.empty() && coords[coords.size() - 2] == x && coords.back() == y)
+                    continue;
+                coords.push_back(x);
+                coords.push_back(y);
+            }
+            while (coords.size() > 2 && coords[0] == coords[coords.size() - 2] && coords[1] == coords.back()) {
+                coords.resize(coords.size() - 2);
+            }
+            if (coords.size() < 6)
+                return;
+            coords.push_back(coords[0]);
+            coords.push_back(coords[1]);
+
+            writer.empty(BOUNDARY);
+            writer.int16(LAYER, layer);
+            writer.int16(DATATYPE, datatype);
+            unsigned char* p = writer.begin(XY, coords.size() * 4);
+            for (size_t i = 0; i < coords.size(); ++i)
+                writeInt32(p + 4 * i, coords[i]);
+            writer.empty(ENDEL);
+        }
+
+        void writeTrapezoids(RecordWriter& writer, int layer, int datatype, const Polygon& polygon, double scale,
+                             std::vector<int32_t>& coords) {
+            PolygonOperations::decompose(polygon, [&](const Trapezoid& t) {
+                Point points[4] = {Point(t.x1_bottom, t.y_bottom), Point(t.x2_bottom, t.y_bottom),
+                                   Point(t.x2_top, t.y_top), Point(t.x1_top, t.y_top)};
+                writeBoundary(writer, layer, datatype, points, 4, scale, coords);
+            });
+        }
+    }
+
+    std::string defaultLayerName(int layer, int datatype) {
+        return std::to_string(layer) + "/" + std::to_string(datatype);
+    }
+
+    CellLibrary readLibrary(const std::string& path, const LayerMap& layer_names) {
+        std::vector<std::string> layer_order;
+        return readCells(path, layer_names, layer_order);
+    }
+
+    LayerPack read(const std::string& path, const LayerMap& layer_names) {
+        std::vector<std::string> layer_order;
+        CellLibrary library = readCells(path, layer_names, layer_order);
+
+        LayerPack layerpack;
+        // Единственная структура без ссылок (плоский файл) - слои переносятся без копирования
+        if (library.size() == 1) {
+            LayerPack& cell_layers = library[0].get_layers();
+            for (const std::string& name : layer_order)
+                layerpack.append_layer(std::move(cell_layers[name]));
+            return layerpack;
+        }
+
+        std::vector<size_t> tops = library.top_cells();
+        for (const std::string& name : layer_order) {
+            Layer layer(name, std::vector<Polygon>());
+            for (size_t top : tops)
+                library.flatten(top, name, layer);
+            if (layer.size() == 0)
+                continue;
+            layer.compact();
+            layerpack.append_layer(std::move(layer));
+        }
+        return layerpack;
+    }
+
+    void write(const LayerPack& layerpack, const std::string& path, const LayerMap& layer_names, double database_unit) {
+        if (!(database_unit > 0)) {
+            throw std::invalid_argument("Единица базы данных должна быть положительной");
+        }
+
+        // Номера GDSII для всех слоёв определяются до начала записи
+        std::unordered_map<std::string, std::pair<int, int>> numbers;
+        for (const auto& entry : layer_names) {
+            numbers.emplace(entry.second, entry.first);
+        }
+        std::vector<std::pair<int, int>> layer_numbers;
+        for (const Layer& layer : layerpack.get_layers()) {
+            auto it = numbers.find(layer.get_name());
+            if (it != numbers.end()) {
+                layer_numbers.push_back(it->second);
+                continue;
+            }
+            int number = 0, datatype = 0;
+            char rest = 0;
+            if (std::sscanf(layer.get_name().c_str(), "%d/%d%c", &number, &datatype, &rest) != 2 ||
+                layer.get_name() != defaultLayerName(number, datatype)) {
+                throw std::invalid_argument("Для слоя \"" + layer.get_name() + "\" не задан номер GDSII");
+            }
+            layer_numbers.emplace_back(number, datatype);
+        }
+
+        RecordWriter writer(path);
+        writer.int16(HEADER, 600);
+        writeDate(writer.begin(BGNLIB, 24));
+        writer.ascii(LIBNAME, "LIB");
+        unsigned char* units = writer.begin(UNITS, 16);
+        writeReal8(units, database_unit);
+        writeReal8(units + 8, database_unit * 1e-6);    // Пользовательская единица - микрон
+        writeDate(writer.begin(BGNSTR, 24));
+        writer.ascii(STRNAME, "TOP");
+
+        double scale = 1 / database_unit;
+        std::vector<int32_t> coords;
+        for (size_t i = 0; i < layerpack.get_layers().size(); ++i) {
+            const Layer& layer = layerpack.get_layers()[i];
+            int number = layer_numbers[i].first, datatype = layer_numbers[i].second;
+            if (layer.is_compact()) {
+                const CompactPolygons& compact = layer.get_compact();
+                for (size_t j = 0; j < compact.size(); ++j) {
+                    PolygonView polygon = compact[j];
+                    ContourView outer = polygon.get_vertices();
+                    if (polygon.hole_count() == 0 && outer.size() < MAX_POINTS)
+                        writeBoundary(writer, number, datatype, outer.data(), outer.size(), scale, coords);
+                    else
+                        writeTrapezoids(writer, number, datatype, polygon.to_polygon(), scale, coords);
+                }
+            } else {
+                for (const Polygon& polygon : layer.get_polygons()) {
+                    const std::vector<Point>& outer = polygon.get_vertices();
+                    if (polygon.get_holes().empty() && outer.size() < MAX_POINTS)
+                        writeBoundary(writer, number, datatype, outer.data(), outer.size(), scale, coords);
+                    else
+                        writeTrapezoids(writer, number, datatype, polygon, scale, coords);
+                }
+            }
+        }
+
+        writer.empty(ENDSTR);
+        writer.empty(ENDLIB);
+        writer.close(path);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef GDSFILE_H
+#define GDSFILE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include "Entity.h"
+#include "Cell.h"
+
+// Потоковое чтение и запись GDSII.
+//
+// Читаются элементы BOUNDARY и BOX и ссылки SREF/AREF (с отражением, увеличением и поворотом);
+// PATH, TEXT и NODE пропускаются. Файл читается блоками фиксированного размера, полигоны каждого слоя
+// складываются сразу в компактное хранение (CompactPolygons), поэтому память растёт только вместе с геометрией.
+// Координаты в Layer хранятся в пользовательских единицах (обычно микронах).
+namespace GdsFile {
+    // Имена слоёв по паре (номер слоя, тип данных)
+    using LayerMap = std::map<std::pair<int, int>, std::string>;
+
+    // Имя слоя по умолчанию - "layer/datatype", например "10/0"
+    std::string defaultLayerName(int layer, int datatype);
+
+    // Структуры файла как ячейки с вхождениями. Пары, отсутствующие в layer_names, получают имена по умолчанию.
+    // Ссылка на неизвестную структуру или цикл ссылок - std::runtime_error
+    CellLibrary readLibrary(const std::string& path, const LayerMap& layer_names = {});
+
+    // Плоская геометрия: все структуры верхнего уровня (не входящие в другие) с развёрнутыми ссылками
+    LayerPack read(const std::string& path, const LayerMap& layer_names = {});
+
+    // Полигоны с дырками и полигоны, не помещающиеся в одну запись XY (более 8190 вершин),
+    // записываются как набор трапецоидов. Слой, которого нет в layer_names, должен называться
+    // по умолчанию. database_unit - размер единицы базы данных в пользовательских единицах
+    void write(const LayerPack& layerpack, const std::string& path, const LayerMap& layer_names = {},
+               double database_unit = 1e-3);
+}
+
+#endif // GDSFILE_H
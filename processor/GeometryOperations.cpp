@@ -1,367 +1,1820 @@
 #include <algorithm>
 #include <utility>
 #include <tuple>
+#include <queue>
+#include <deque>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <stdexcept>
 #include "GeometryOperations.h"
+#include "TrapezoidBuffer.h"
+#include "AffineTransform.h"
+#include "ThreadPool.h"
+#include "Predicates.h"
+#include "Trace.h"
 
 Trapezoid :: Trapezoid(double x1_top, double x2_top, double x1_bottom, double x2_bottom, double y_top, double y_bottom)
         : x1_top(x1_top), x2_top(x2_top), x1_bottom(x1_bottom), x2_bottom(x2_bottom), y_top(y_top), y_bottom(y_bottom) {}
 
-    // Копирующий конструктор
-Trapezoid :: Trapezoid(const Trapezoid& other)
-        : x1_top(other.x1_top), x2_top(other.x2_top), x1_bottom(other.x1_bottom), x2_bottom(other.x2_bottom),
-          y_top(other.y_top), y_bottom(other.y_bottom) {}
-
-    // Конструктор перемещения
-Trapezoid :: Trapezoid(Trapezoid&& other)
-        : x1_top(std::move(other.x1_top)), x2_top(std::move(other.x2_top)),
-          x1_bottom(std::move(other.x1_bottom)), x2_bottom(std::move(other.x2_bottom)),
-          y_top(std::move(other.y_top)), y_bottom(std::move(other.y_bottom)) {}
-
-
-Trapezoid& Trapezoid :: operator=(const Trapezoid& other) {
-        if (this != &other) { // проверка самоприсваивания
-            x1_top = other.x1_top;
-            x2_top = other.x2_top;
-            x1_bottom = other.x1_bottom;
-            x2_bottom = other.x2_bottom;
-            y_top = other.y_top;
-            y_bottom = other.y_bottom;
-        }
-        return *this;
-    }
 
+SweepEdge :: SweepEdge(double x_bottom, double x_top, double y_bottom, double y_top, int winding, int operand)
+        : x_bottom(x_bottom), x_top(x_top), y_bottom(y_bottom), y_top(y_top), winding(winding), operand(operand) {}
 
 
 namespace TrapezoidOperations {
 
-    // Функция для вычисления пересечения двух трапецоидов по оси y
-    std::pair<double, double> overlapY(const Trapezoid& a, const Trapezoid& b) {
-        double y_top = std::min(a.y_top, b.y_top);
-        double y_bottom = std::max(a.y_bottom, b.y_bottom);
-        if(a.x2_bottom >= b.x1_bottom || a.x2_top >= b.x1_top || b.x1_bottom <= a.x2_bottom || b.x1_top <= a.x2_top)
-            return std::make_pair(y_top, y_bottom);
-        else
-            return std::make_pair(-1, 0);
-    }
-
-    // Линейная интерполяция для вычисления координаты x на высоте y
+    // Линейная интерполяция для вычисления координаты x на высоте y.
+    // На концах ребра возвращается сохранённый x без округления: углы трапецоидов совпадают с вершинами входа
     double interpolateX(double y, double y1, double y2, double x1, double x2) {
+        if (y == y1)
+            return x1;
+        if (y == y2)
+            return x2;
         return x1 + (x2 - x1) * (y - y1) / (y2 - y1);
     }
 
-    Point findIntersection(Point A, Point B, Point C, Point D) {
-        double a1 = B.y - A.y;
-        double b1 = A.x - B.x;
-        double c1 = a1 * A.x + b1 * A.y;
 
-        double a2 = D.y - C.y;
-        double b2 = C.x - D.x;
-        double c2 = a2 * C.x + b2 * C.y;
 
-        double det = a1 * b2 - a2 * b1;
+    // Открытый (ещё растущий вверх) трапецоид результата
+    struct OpenSpan {
+        Trapezoid trapezoid;
+        double slope_left, slope_right;
+    };
 
-        if (det == 0) {
-            throw std::runtime_error("Lines are parallel or coincident");
+    bool isInside(BooleanOperation operation, const int winding[2]) {
+        switch (operation) {
+        case BooleanOperation::Union:
+            return winding[0] != 0 || winding[1] != 0;
+        case BooleanOperation::Intersection:
+            return winding[0] != 0 && winding[1] != 0;
+        case BooleanOperation::Difference:
+            return winding[0] != 0 && winding[1] == 0;
         }
+        return false;
+    }
 
-        double x = (b2 * c1 - b1 * c2) / det;
-        double y = (a1 * c2 - a2 * c1) / det;
-
-        return {x, y};
+    // Граница интервала результата: на левой операция начинает выполняться, на правой - перестаёт
+    enum class Boundary { None, Left, Right };
+
+    struct ActiveNode;
+
+    // Ребро на заметающей прямой и состояние результата справа от него
+    struct ActiveEdge {
+        SweepEdge edge = SweepEdge(0, 0, 0, 0, 0);  // Копия ребра: спуск по дереву не читает массив рёбер
+        size_t index = 0;                   // Номер ребра во входе sweepEvents
+        double slope = 0;                   // dx/dy
+        ActiveNode* node = nullptr;         // Узел в ActiveList, nullptr вне списка
+        int after[2] = {0, 0};              // Число обхода операндов справа от ребра
+        bool inside = false;                // isInside для after
+        bool dirty = false;                 // after нужно пересчитать начиная с этого ребра
+        Boundary boundary = Boundary::None;
+        ActiveEdge* partner = nullptr;      // Другая граница того же интервала
+        bool interval = false;              // Левая граница: интервал до partner действителен
+        bool open = false;                  // Левая граница: у интервала есть растущий трапецоид span
+        OpenSpan span = {Trapezoid(0, 0, 0, 0, 0, 0), 0, 0};
+        uint64_t seen = 0;                  // Номер события, в котором ребро уже попало в список проверки
+    };
+
+    double xAt(const ActiveEdge* a, double y) {
+        return interpolateX(y, a->edge.y_bottom, a->edge.y_top, a->edge.x_bottom, a->edge.x_top);
     }
 
-    bool isBetween(Point A, Point B, Point P) {
-        if (A.x != B.x) { // Если прямая не вертикальная
-            return (P.x - A.x) * (P.x - B.x) <= 0 && std::abs(P.x - A.x) + std::abs(P.x - B.x) >= std::abs(B.x - A.x);
-        } else { // Если прямая вертикальная
-            return (P.y - A.y) * (P.y - B.y) <= 0 && std::abs(P.y - A.y) + std::abs(P.y - B.y) >= std::abs(B.y - A.y);
-        }
+    // Точный знак (a) x (b) по концам рёбер: < 0, если выше общей точки a идёт левее b
+    double turn(const ActiveEdge* a, const ActiveEdge* b) {
+        return Predicates::cross(Point(a->edge.x_bottom, a->edge.y_bottom), Point(a->edge.x_top, a->edge.y_top),
+                                 Point(b->edge.x_bottom, b->edge.y_bottom), Point(b->edge.x_top, b->edge.y_top));
     }
 
-    std::vector<Point> getIntersectionPoints(const Trapezoid& t1, const Trapezoid& t2) {
-        std::vector<Point> intersections;
+    // Порядок на высоте y (x_a - положение a на y): по x, при равенстве - по направлению
+    // (порядок сразу выше y), затем левые границы раньше правых
+    bool leftOf(const ActiveEdge* a, double x_a, const ActiveEdge* b, double y) {
+        double x_b = xAt(b, y);
+        if (x_a != x_b)
+            return x_a < x_b;
+        if (double t = turn(a, b))
+            return t < 0;
+        return a->edge.winding > b->edge.winding;
+    }
 
-        // Define points for edges in both trapezoids
-        Point A1 = {t1.x1_top, t1.y_top}, B1 = {t1.x2_top, t1.y_top};
-        Point C1 = {t1.x1_bottom, t1.y_bottom}, D1 = {t1.x2_bottom, t1.y_bottom};
-        Point A2 = {t2.x1_top, t2.y_top}, B2 = {t2.x2_top, t2.y_top};
-        Point C2 = {t2.x1_bottom, t2.y_bottom}, D2 = {t2.x2_bottom, t2.y_bottom};
+    struct ActiveNode {
+        ActiveEdge* item;
+        ActiveNode* parent;
+        ActiveNode* child[2];
+        uint32_t priority;
+        size_t boundaries;                  // Границ интервалов в поддереве
+    };
+
+    // Активные рёбра слева направо: декартово дерево с родительскими ссылками. Порядок задаётся только
+    // при вставке, дальше его меняют обмены соседей в точках пересечений, поэтому сравнение по x нужно
+    // лишь на пути вставки. Счётчики границ в поддеревьях дают ближайшую границу интервала слева
+    // или справа за O(log n), без обхода внутренних рёбер интервала
+    class ActiveList {
+    private:
+        std::deque<ActiveNode> nodes;       // deque не перемещает узлы при росте
+        std::vector<ActiveNode*> spare;     // Узлы удалённых рёбер для повторного использования
+        ActiveNode* root = nullptr;
+        size_t count = 0;
+        uint32_t seed = 0x9e3779b9u;
+        std::vector<ActiveNode*> path;      // Правый край дерева при сборке в assign
+
+        static size_t boundariesOf(const ActiveNode* n) { return n ? n->boundaries : 0; }
+
+        static void pull(ActiveNode* n) {
+            n->boundaries = (n->item->boundary != Boundary::None) + boundariesOf(n->child[0]) + boundariesOf(n->child[1]);
+        }
 
-        // Check each edge pair for intersections
-        try { intersections.push_back(findIntersection(A1, B1, A2, B2)); } catch (...) {}
-        try { intersections.push_back(findIntersection(C1, D1, C2, D2)); } catch (...) {}
-        try { intersections.push_back(findIntersection(A1, C1, A2, C2)); } catch (...) {}
-        try { intersections.push_back(findIntersection(B1, D1, B2, D2)); } catch (...) {}
+        static void pullUp(ActiveNode* n) {
+            for (; n; n = n->parent)
+                pull(n);
+        }
 
-        // Filter points within the trapezoid bounds to avoid out-of-bounds intersections
-        intersections.erase(std::remove_if(intersections.begin(), intersections.end(), [&](Point p) {
-            return !(p.y <= std::max(t1.y_top, t2.y_top) && p.y >= std::min(t1.y_bottom, t2.y_bottom));
-        }), intersections.end());
+        // Поднимает x на место его родителя
+        void rotateUp(ActiveNode* x) {
+            ActiveNode* p = x->parent;
+            ActiveNode* g = p->parent;
+            int side = p->child[1] == x;
+            ActiveNode* moved = x->child[!side];
+            p->child[side] = moved;
+            if (moved)
+                moved->parent = p;
+            x->child[!side] = p;
+            p->parent = x;
+            x->parent = g;
+            if (g)
+                g->child[g->child[1] == p] = x;
+            else
+                root = x;
+            pull(p);
+            pull(x);
+        }
 
-        return intersections;
-    }
+        static ActiveNode* extreme(ActiveNode* n, int side) {
+            while (n->child[side])
+                n = n->child[side];
+            return n;
+        }
 
+        static ActiveNode* step(ActiveNode* n, int side) {
+            if (n->child[side])
+                return extreme(n->child[side], !side);
+            while (n->parent && n->parent->child[side] == n)
+                n = n->parent;
+            return n->parent;
+        }
 
-    // Создает трапецоид для области пересечения,
-    // вычисляя актуальные координаты трапецоида для рассматриваемой координаты y
-    Trapezoid create_trapezoid(double y_top, double y_bottom, const Trapezoid& a, const Trapezoid& b, bool is_union) {
-        double x1_top_a = interpolateX(y_top, a.y_top, a.y_bottom, a.x1_top, a.x1_bottom);
-        double x1_top_b = interpolateX(y_top, b.y_top, b.y_bottom, b.x1_top, b.x1_bottom);
+        // Крайняя граница поддерева со стороны side
+        static ActiveNode* extremeBoundary(ActiveNode* n, int side) {
+            for (;;) {
+                if (boundariesOf(n->child[side]))
+                    n = n->child[side];
+                else if (n->item->boundary != Boundary::None)
+                    return n;
+                else
+                    n = n->child[!side];
+            }
+        }
 
-        double x2_top_a = interpolateX(y_top, a.y_top, a.y_bottom, a.x2_top, a.x2_bottom);
-        double x2_top_b = interpolateX(y_top, b.y_top, b.y_bottom, b.x2_top, b.x2_bottom);
+        // Ближайшая граница в направлении side, не считая самого n
+        static ActiveNode* stepBoundary(ActiveNode* n, int side) {
+            if (boundariesOf(n->child[side]))
+                return extremeBoundary(n->child[side], !side);
+            for (; n->parent; n = n->parent) {
+                ActiveNode* p = n->parent;
+                if (p->child[!side] != n)
+                    continue;
+                if (p->item->boundary != Boundary::None)
+                    return p;
+                if (boundariesOf(p->child[side]))
+                    return extremeBoundary(p->child[side], !side);
+            }
+            return nullptr;
+        }
 
-        double x1_bottom_a = interpolateX(y_bottom, a.y_top, a.y_bottom, a.x1_top, a.x1_bottom);
-        double x1_bottom_b = interpolateX(y_bottom, b.y_top, b.y_bottom, b.x1_top, b.x1_bottom);
+        static ActiveEdge* itemOf(const ActiveNode* n) {
+            return n ? n->item : nullptr;
+        }
 
-        double x2_bottom_a = interpolateX(y_bottom, a.y_top, a.y_bottom, a.x2_top, a.x2_bottom);
-        double x2_bottom_b = interpolateX(y_bottom, b.y_top, b.y_bottom, b.x2_top, b.x2_bottom);
+        uint32_t nextPriority() {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            return seed;
+        }
 
-        double x1_top = is_union ? std::min(x1_top_a, x1_top_b)
-                                 : std::max(x1_top_a, x1_top_b);
+    public:
+        size_t size() const { return count; }
 
-        double x2_top = is_union ? std::max(x2_top_a, x2_top_b)
-                                 : std::min(x2_top_a, x2_top_b);
+        ActiveEdge* first() const {
+            return root ? extreme(root, 0)->item : nullptr;
+        }
 
-        double x1_bottom = is_union ? std::min(x1_bottom_a, x1_bottom_b)
-                                    : std::max(x1_bottom_a, x1_bottom_b);
+        ActiveEdge* prev(const ActiveEdge* a) const { return itemOf(step(a->node, 0)); }
+        ActiveEdge* next(const ActiveEdge* a) const { return itemOf(step(a->node, 1)); }
+        ActiveEdge* prevBoundary(const ActiveEdge* a) const { return itemOf(stepBoundary(a->node, 0)); }
+        ActiveEdge* nextBoundary(const ActiveEdge* a) const { return itemOf(stepBoundary(a->node, 1)); }
+
+        // leftOf(b) - вставляемое ребро левее b; вызывается только для рёбер на пути от корня
+        template <typename LeftOf>
+        void insert(ActiveEdge* item, const LeftOf& leftOf) {
+            ++count;
+            ActiveNode* n;
+            if (spare.empty()) {
+                n = &nodes.emplace_back();
+            } else {
+                n = spare.back();
+                spare.pop_back();
+            }
+            *n = {item, nullptr, {nullptr, nullptr}, nextPriority(), 0};
+            item->node = n;
+            pull(n);
+            if (!root) {
+                root = n;
+                return;
+            }
+            ActiveNode* current = root;
+            for (;;) {
+                int side = !leftOf(current->item);
+                if (!current->child[side]) {
+                    current->child[side] = n;
+                    n->parent = current;
+                    break;
+                }
+                current = current->child[side];
+            }
+            pullUp(n->parent);
+            while (n->parent && n->parent->priority < n->priority)
+                rotateUp(n);
+        }
 
+        void erase(ActiveEdge* item) {
+            --count;
+            ActiveNode* n = item->node;
+            while (n->child[0] && n->child[1])
+                rotateUp(n->child[n->child[0]->priority < n->child[1]->priority]);
+            ActiveNode* child = n->child[0] ? n->child[0] : n->child[1];
+            ActiveNode* parent = n->parent;
+            if (child)
+                child->parent = parent;
+            if (parent)
+                parent->child[parent->child[1] == n] = child;
+            else
+                root = child;
+            pullUp(parent);
+            item->node = nullptr;
+            spare.push_back(n);
+        }
 
-        double x2_bottom = is_union ? std::max(x2_bottom_a, x2_bottom_b)
-                                    : std::min(x2_bottom_a, x2_bottom_b);
+        // Заменяет список рёбрами items, уже упорядоченными слева направо, за O(n): узлы
+        // добавляются по одному на правый край дерева, как при построении декартова дерева по порядку
+        void assign(const std::vector<ActiveEdge*>& items) {
+            while (nodes.size() < items.size())
+                nodes.emplace_back();
+            count = items.size();
+            path.clear();
+            for (size_t i = 0; i < items.size(); ++i) {
+                ActiveNode* n = &nodes[i];
+                *n = {items[i], nullptr, {nullptr, nullptr}, nextPriority(), 0};
+                items[i]->node = n;
+                // Снятые с края поддеревья закончены и становятся левым поддеревом нового узла
+                ActiveNode* last = nullptr;
+                while (!path.empty() && path.back()->priority < n->priority) {
+                    last = path.back();
+                    path.pop_back();
+                    pull(last);
+                }
+                n->child[0] = last;
+                if (last)
+                    last->parent = n;
+                if (!path.empty()) {
+                    path.back()->child[1] = n;
+                    n->parent = path.back();
+                }
+                path.push_back(n);
+            }
+            for (size_t i = path.size(); i-- > 0;)
+                pull(path[i]);
+            root = path.empty() ? nullptr : path.front();
+            spare.clear();
+            for (size_t i = items.size(); i < nodes.size(); ++i)
+                spare.push_back(&nodes[i]);
+        }
 
-        return Trapezoid(x1_top, x2_top, x1_bottom, x2_bottom, y_top, y_bottom);
+        // Обмен соседних рёбер a и b (b сразу за a) в точке их пересечения
+        void swap(ActiveEdge* a, ActiveEdge* b) {
+            ActiveNode* na = a->node;
+            ActiveNode* nb = b->node;
+            na->item = b;
+            nb->item = a;
+            a->node = nb;
+            b->node = na;
+            pullUp(na);
+            pullUp(nb);
+        }
 
-    }
+        // Пересчитывает счётчики после смены Boundary у ребра
+        void refresh(ActiveEdge* item) {
+            pullUp(item->node);
+        }
 
-    std::vector<Trapezoid> create_trapezoids_substructed(double y_top, double y_bottom, const Trapezoid& a, const Trapezoid& b, bool is_substruct=false){
-        std::vector<Trapezoid> result;
-        double x1_top_a = interpolateX(y_top, a.y_top, a.y_bottom, a.x1_top, a.x1_bottom);
-        double x1_top_b = interpolateX(y_top, b.y_top, b.y_bottom, b.x1_top, b.x1_bottom);
-
-        double x2_top_a = interpolateX(y_top, a.y_top, a.y_bottom, a.x2_top, a.x2_bottom);
-        double x2_top_b = interpolateX(y_top, b.y_top, b.y_bottom, b.x2_top, b.x2_bottom);
-
-        double x1_bottom_a = interpolateX(y_bottom, a.y_top, a.y_bottom, a.x1_top, a.x1_bottom);
-        double x1_bottom_b = interpolateX(y_bottom, b.y_top, b.y_bottom, b.x1_top, b.x1_bottom);
-
-        double x2_bottom_a = interpolateX(y_bottom, a.y_top, a.y_bottom, a.x2_top, a.x2_bottom);
-        double x2_bottom_b = interpolateX(y_bottom, b.y_top, b.y_bottom, b.x2_top, b.x2_bottom);
-
-        if(a.x1_bottom <= b.x1_bottom){
-            double x1_top = x1_top_a;
-            double x2_top =  std::min(x2_top_a, x1_top_b);
-            double x1_bottom = x1_bottom_a;
-            double x2_bottom = std::min(x2_bottom_a, x1_bottom_b);
-            if(x1_top <= x2_top && x1_bottom < x2_bottom || x1_top < x2_top && x1_bottom <= x2_bottom)
-                result.emplace_back(x1_top, x2_top, x1_bottom, x2_bottom, y_top, y_bottom);
-        }
-        else if(a.x2_bottom >= b.x2_bottom){
-            double x1_top = std::max(x1_top_a, x2_top_b);
-            double x2_top =  x2_top_a;
-            double x1_bottom = std::max(x1_bottom_a, x2_bottom_b);
-            double x2_bottom = x2_bottom_a;
-            if(x1_top <= x2_top && x1_bottom < x2_bottom || x1_top < x2_top && x1_bottom <= x2_bottom)
-                result.emplace_back(x1_top, x2_top, x1_bottom, x2_bottom, y_top, y_bottom);
+        // Пересчитывает счётчики всего дерева за O(n) обратным обходом по родительским ссылкам,
+        // когда Boundary сменилась у многих рёбер сразу
+        void refreshAll() {
+            ActiveNode* from = nullptr;
+            for (ActiveNode* n = root; n;) {
+                ActiveNode* to;
+                if (from == n->parent && (n->child[0] || n->child[1])) {
+                    to = n->child[0] ? n->child[0] : n->child[1];
+                } else if (from == n->child[0] && n->child[1] && from) {
+                    to = n->child[1];
+                } else {
+                    pull(n);
+                    to = n->parent;
+                }
+                from = n;
+                n = to;
+            }
         }
-        return result;
-    }
+    };
+
+    // Относительный допуск, в пределах которого высота пересечения совпадает с соседним событием:
+    // иначе округление оставляет между ними полосу нулевой высоты
+    const double CROSSING_SNAP = 1e-12;
+
+    // Событие, меняющее больше 1/BULK_EVENT_SHARE активного списка, пересобирает его целиком
+    const size_t BULK_EVENT_SHARE = 8;
+
+    // Пересечение соседних рёбер a (левее) и b. ActiveEdge переиспользуются после удаления,
+    // поэтому запоминаются и номера рёбер: устаревшее пересечение отбрасывается по их несовпадению
+    struct Crossing {
+        double y;
+        ActiveEdge* a;
+        ActiveEdge* b;
+        size_t index_a;
+        size_t index_b;
+
+        bool operator>(const Crossing& other) const {
+            return y > other.y;
+        }
+    };
 
+    using SpanSink = std::function<void(const OpenSpan&)>;
 
-    std::vector<Trapezoid> unite(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2) {
-        std::vector<Trapezoid> result;
+    void appendEdges(const std::vector<Trapezoid>& trapezoids, int operand, std::vector<SweepEdge>& edges) {
+        for (const auto& t : trapezoids) {
+            if (t.y_top <= t.y_bottom)
+                continue;
+            edges.emplace_back(t.x1_bottom, t.x1_top, t.y_bottom, t.y_top, +1, operand);
+            edges.emplace_back(t.x2_bottom, t.x2_top, t.y_bottom, t.y_top, -1, operand);
+        }
+    }
 
-        for (const auto& a : trapezoids1) {
-            bool intersected = false;
+    void appendEdges(const TrapezoidBuffer& trapezoids, int operand, std::vector<SweepEdge>& edges) {
+        for (size_t i = 0; i < trapezoids.size(); ++i) {
+            if (trapezoids.y_top[i] <= trapezoids.y_bottom[i])
+                continue;
+            edges.emplace_back(trapezoids.x1_bottom[i], trapezoids.x1_top[i], trapezoids.y_bottom[i], trapezoids.y_top[i], +1, operand);
+            edges.emplace_back(trapezoids.x2_bottom[i], trapezoids.x2_top[i], trapezoids.y_bottom[i], trapezoids.y_top[i], -1, operand);
+        }
+    }
 
-            for (const auto& b : trapezoids2) {
-                std::pair<double, double> y_overlap_result = overlapY(a, b);
-                double y_top = y_overlap_result.first;
-                double y_bottom = y_overlap_result.second;
+    // Отбрасывает горизонтальные рёбра, сортирует рёбра по нижнему концу и строит список событий по y
+    void prepareEdges(std::vector<SweepEdge>& edges, std::vector<double>& events) {
+        edges.erase(std::remove_if(edges.begin(), edges.end(), [](const SweepEdge& e) {
+            return !(e.y_top > e.y_bottom);
+        }), edges.end());
+
+        // События по y сортируются один раз
+        std::sort(edges.begin(), edges.end(), [](const SweepEdge& a, const SweepEdge& b) {
+            return a.y_bottom < b.y_bottom;
+        });
+
+        events.clear();
+        events.reserve(edges.size() * 2);
+        for (const auto& e : edges) {
+            events.push_back(e.y_bottom);
+            events.push_back(e.y_top);
+        }
+        std::sort(events.begin(), events.end());
+        events.erase(std::unique(events.begin(), events.end()), events.end());
+    }
 
-                if (y_top > y_bottom) { // Есть пересечение по y
-                    // 1. Добавляем верхнюю часть трапецоида до области пересечения
-                    if (a.y_bottom < y_bottom) {
-                        result.push_back(create_trapezoid(y_bottom, a.y_bottom, a, a, true));
-                    } else if (b.y_bottom < y_bottom) {
-                        result.push_back(create_trapezoid(y_bottom, b.y_bottom, b, b, true));
+    // Проход заметающей прямой по [y_begin, y_end], edges отсортированы по y_bottom.
+    // Событиями служат концы рёбер и пересечения соседних рёбер. В событии меняются только затронутые
+    // рёбра: удаления, вставки и обмены в ActiveList, затем пересчёт чисел обхода от изменённых рёбер
+    // вправо, пока они расходятся с прежними. Интервалы результата, чьи границы при этом не изменились,
+    // продолжают свои трапецоиды без просмотра; изменившиеся закрываются, а новые продолжают закрытый
+    // трапецоид с теми же x и наклонами границ, как при сшивке полос. Итого O((n + k) log n), где k -
+    // пересечения рёбер, включая рёбра, пересекающие отброшенные горизонтальные рёбра (через них
+    // меняется число обхода). Событие, меняющее заметную долю списка, обходит его целиком: это не дороже
+    // самих изменений. Трапецоиды, открытые на y_end, остаются в open по возрастанию x1_top
+    void sweepEvents(const std::vector<const SweepEdge*>& edges, double y_begin, double y_end, BooleanOperation operation,
+                     std::vector<OpenSpan>& open, const SpanSink& sink) {
+        TRACE_SCOPE("sweep_events");
+        TRACE_COUNT("edges", edges.size());
+        // Состояния рёбер берутся из пула и возвращаются в него после удаления: рабочий набор
+        // пропорционален активному списку, а не всем рёбрам
+        std::deque<ActiveEdge> pool;
+        std::vector<ActiveEdge*> spare;
+        std::vector<ActiveEdge*> slots(edges.size(), nullptr);
+        ActiveList active;
+
+        // Концы рёбер, доходящих выше y_begin, в порядке y_top
+        std::vector<size_t> ends;
+        ends.reserve(edges.size());
+        for (size_t i = 0; i < edges.size(); ++i) {
+            if (edges[i]->y_top > y_begin)
+                ends.push_back(i);
+        }
+        std::sort(ends.begin(), ends.end(), [&edges](size_t a, size_t b) {
+            return edges[a]->y_top < edges[b]->y_top;
+        });
+
+        std::priority_queue<Crossing, std::vector<Crossing>, std::greater<Crossing>> crossings;
+        std::vector<ActiveEdge*> dirty, probes, removed, checked, sequence, survivors;
+        std::vector<std::pair<double, ActiveEdge*>> ordered, arrivals;
+        std::vector<std::pair<ActiveEdge*, Boundary>> changes;
+        std::vector<OpenSpan> candidates;
+        std::vector<bool> continued;
+        size_t next_start = 0, next_end = 0;
+        uint64_t stamp = 0;
+        double y = y_begin;
+
+        // Высота at достигла y_event с точностью до округления
+        auto reached = [](double at, double y_event) {
+            return y_event - at <= CROSSING_SNAP * std::max(std::abs(at), 1.0);
+        };
+
+        // Пара соседей, сходящихся выше y, получает событие пересечения; уже сошедшиеся меняются местами в этом же событии
+        auto checkPair = [&](ActiveEdge* a, ActiveEdge* b) {
+            if (!a || !b || !(turn(a, b) > 0))
+                return;
+            double y0 = std::max(a->edge.y_bottom, b->edge.y_bottom);
+            double y_cross = y0 + (xAt(b, y0) - xAt(a, y0)) / (a->slope - b->slope);
+            if (y_cross < std::min(a->edge.y_top, b->edge.y_top))
+                crossings.push({y_cross, a, b, a->index, b->index});
+        };
+        auto markDirty = [&](ActiveEdge* a) {
+            a->dirty = true;
+            dirty.push_back(a);
+        };
+        auto check = [&](ActiveEdge* a) {
+            if (a->seen != stamp) {
+                a->seen = stamp;
+                checked.push_back(a);
+            }
+        };
+
+        // Закрывает интервал с левой границей left на высоте y и делает его трапецоид кандидатом на продолжение
+        auto close = [&](ActiveEdge* left) {
+            if (!left->interval)
+                return;
+            left->interval = false;
+            if (left->open) {
+                OpenSpan span = left->span;
+                span.trapezoid.x1_top = xAt(left, y);
+                span.trapezoid.x2_top = xAt(left->partner, y);
+                span.trapezoid.y_top = y;
+                // Границы, разошедшиеся вверх, могли так и не разойтись до следующего события
+                if (span.trapezoid.x1_top < span.trapezoid.x2_top || span.trapezoid.x1_bottom < span.trapezoid.x2_bottom)
+                    candidates.push_back(span);
+                left->open = false;
+            }
+        };
+
+        // Открывает интервал, которого ещё нет, продолжая подходящий закрытый трапецоид.
+        // Интервал нулевой ширины, чьи границы не расходятся вверх, трапецоида не получает
+        auto reopen = [&](ActiveEdge* left) {
+            ActiveEdge* right = active.nextBoundary(left);
+            if (!right)
+                return;
+            left->interval = true;
+            left->partner = right;
+            right->partner = left;
+            double x1 = xAt(left, y), x2 = xAt(right, y);
+            if (!(x1 < x2 || turn(left, right) < 0))
+                return;
+            left->open = true;
+            auto it = std::lower_bound(candidates.begin(), candidates.end(), x1, [](const OpenSpan& c, double x) {
+                return c.trapezoid.x1_top < x;
+            });
+            for (; it != candidates.end() && it->trapezoid.x1_top == x1; ++it) {
+                size_t index = it - candidates.begin();
+                if (!continued[index] && it->trapezoid.x2_top == x2 &&
+                    it->slope_left == left->slope && it->slope_right == right->slope) {
+                    // Продолжаем трапецоид вверх
+                    continued[index] = true;
+                    left->span = *it;
+                    return;
+                }
+            }
+            left->span = {Trapezoid(x1, x2, x1, x2, y, y), left->slope, right->slope};
+        };
+
+        // Состояние для ребра index, начинающегося на y; nullptr, если ребро целиком ниже y
+        auto acquire = [&](size_t index) -> ActiveEdge* {
+            const SweepEdge& edge = *edges[index];
+            if (edge.y_top <= y)
+                return nullptr;
+            ActiveEdge* e;
+            if (spare.empty()) {
+                e = &pool.emplace_back();
+            } else {
+                e = spare.back();
+                spare.pop_back();
+                *e = ActiveEdge();
+            }
+            slots[index] = e;
+            e->edge = edge;
+            e->index = index;
+            e->slope = (edge.x_top - edge.x_bottom) / (edge.y_top - edge.y_bottom);
+            return e;
+        };
+
+        for (bool first = true;; first = false) {
+            if (!first) {
+                double next_y = y_end;
+                if (next_start < edges.size())
+                    next_y = std::min(next_y, edges[next_start]->y_bottom);
+                if (next_end < ends.size())
+                    next_y = std::min(next_y, edges[ends[next_end]]->y_top);
+                // Пересечение чуть ниже вершины обрабатывается вместе с ней
+                if (!crossings.empty() && !reached(crossings.top().y, next_y))
+                    next_y = crossings.top().y;
+                if (!(next_y < y_end))
+                    break;
+                y = next_y;
+            }
+            ++stamp;
+
+            // Удаления, затем вставки. Событие, меняющее заметную долю списка (ряд одинаковых фигур),
+            // пересобирает его слиянием за O(n + k log k) вместо k операций по O(log n)
+            size_t end_last = next_end, start_last = next_start;
+            while (end_last < ends.size() && edges[ends[end_last]]->y_top <= y)
+                ++end_last;
+            while (start_last < edges.size() && edges[start_last]->y_bottom <= y)
+                ++start_last;
+            bool bulk = (end_last - next_end + start_last - next_start) * BULK_EVENT_SHARE >= active.size();
+            if (bulk) {
+                bool gap = false;
+                sequence.clear();
+                for (ActiveEdge* e = active.first(); e; e = active.next(e)) {
+                    if (e->edge.y_top <= y) {
+                        removed.push_back(e);
+                        gap = true;
+                        continue;
                     }
+                    if (gap) {
+                        if (!sequence.empty())
+                            probes.push_back(sequence.back());
+                        markDirty(e);
+                        gap = false;
+                    }
+                    sequence.push_back(e);
+                }
+                if (gap && !sequence.empty())
+                    probes.push_back(sequence.back());
+                for (ActiveEdge* e : removed)
+                    e->node = nullptr;
+                next_end = end_last;
+
+                arrivals.clear();
+                for (; next_start < start_last; ++next_start) {
+                    if (ActiveEdge* e = acquire(next_start)) {
+                        arrivals.emplace_back(xAt(e, y), e);
+                        markDirty(e);
+                    }
+                }
+                std::sort(arrivals.begin(), arrivals.end(), [y](const auto& a, const auto& b) {
+                    return leftOf(a.second, a.first, b.second, y);
+                });
+                // Равные рёбрам списка новые рёбра встают правее них, как при вставке по одному
+                survivors.swap(sequence);
+                sequence.clear();
+                size_t i = 0;
+                for (const auto& [x, e] : arrivals) {
+                    while (i < survivors.size() && !leftOf(e, x, survivors[i], y))
+                        sequence.push_back(survivors[i++]);
+                    sequence.push_back(e);
+                }
+                sequence.insert(sequence.end(), survivors.begin() + i, survivors.end());
+                active.assign(sequence);
+            } else {
+                for (; next_end < end_last; ++next_end) {
+                    ActiveEdge* e = slots[ends[next_end]];
+                    if (!e || !e->node)
+                        continue;
+                    if (ActiveEdge* p = active.prev(e))
+                        probes.push_back(p);
+                    if (ActiveEdge* q = active.next(e))
+                        markDirty(q);
+                    active.erase(e);
+                    removed.push_back(e);
+                }
+                for (; next_start < start_last; ++next_start) {
+                    if (ActiveEdge* e = acquire(next_start)) {
+                        double x = xAt(e, y);
+                        active.insert(e, [e, x, y](const ActiveEdge* other) {
+                            return leftOf(e, x, other, y);
+                        });
+                        markDirty(e);
+                    }
+                }
+            }
 
-                    // 2. Добавляем общую часть пересечения (объединение трапецоидов)
-                    result.push_back(create_trapezoid(y_top, y_bottom, a, b, true));
-
-                    // 3. Добавляем нижнюю часть трапецоида после области пересечения
-                    if (a.y_top > y_top) {
-                        result.push_back(create_trapezoid(a.y_top, y_top, a, a, true));
-                    } else if (b.y_top > y_top) {
-                        result.push_back(create_trapezoid(b.y_top, y_top, b, b, true));
+            // Новые соседи и пересечения, наступившие к y
+            if (bulk) {
+                for (size_t i = 1; i < sequence.size(); ++i)
+                    checkPair(sequence[i - 1], sequence[i]);
+            } else {
+                for (ActiveEdge* a : dirty) {
+                    if (a->node) {
+                        checkPair(active.prev(a), a);
+                        checkPair(a, active.next(a));
+                    }
+                }
+            }
+            while (!crossings.empty() && reached(y, crossings.top().y)) {
+                Crossing crossing = crossings.top();
+                crossings.pop();
+                if (crossing.a->index != crossing.index_a || crossing.b->index != crossing.index_b ||
+                    !crossing.a->node || !crossing.b->node || active.next(crossing.a) != crossing.b)
+                    continue;
+                TRACE_COUNT("intersections", 1);
+                active.swap(crossing.a, crossing.b);
+                markDirty(crossing.a);
+                markDirty(crossing.b);
+                checkPair(active.prev(crossing.b), crossing.b);
+                checkPair(crossing.a, active.next(crossing.a));
+            }
+            if (dirty.empty() && removed.empty()) {
+                probes.clear();
+                continue;
+            }
+            TRACE_COUNT("events", 1);
+
+            auto boundaryOf = [](bool inside, bool inside_before) {
+                return inside ? (inside_before ? Boundary::None : Boundary::Left)
+                              : (inside_before ? Boundary::Right : Boundary::None);
+            };
+            if (bulk) {
+                // Большое событие пересчитывает всё одним проходом слева направо; интервал, внутри
+                // которого появилась граница, закрывается по последней прежней левой границе
+                int winding[2] = {0, 0};
+                bool inside_before = false;
+                ActiveEdge* enclosing = nullptr;
+                for (ActiveEdge* c = active.first(); c; c = active.next(c)) {
+                    winding[c->edge.operand] += c->edge.winding;
+                    c->after[0] = winding[0];
+                    c->after[1] = winding[1];
+                    c->inside = isInside(operation, winding);
+                    c->dirty = false;
+                    Boundary boundary = boundaryOf(c->inside, inside_before);
+                    inside_before = c->inside;
+                    if (boundary != c->boundary) {
+                        changes.push_back({c, boundary});
+                        if (c->boundary == Boundary::None && enclosing)
+                            close(enclosing);
                     }
+                    if (c->boundary != Boundary::None)
+                        enclosing = c->boundary == Boundary::Left ? c : nullptr;
+                    checked.push_back(c);
+                }
+            } else {
+                // Числа обхода пересчитываются вправо от изменённых рёбер, пока не совпадут с прежними.
+                // Обход, дошедший до ребра, пересчитанного по устаревшему соседу, сравнит значения и
+                // продолжит, если они разошлись; порядок по x и начало с самого левого из подряд идущих
+                // изменённых рёбер (у обменявшихся x равны) избавляют от таких повторных проходов
+                ordered.clear();
+                for (ActiveEdge* a : dirty) {
+                    if (a->node)
+                        ordered.emplace_back(xAt(a, y), a);
+                }
+                std::sort(ordered.begin(), ordered.end());
+                for (auto [x, start] : ordered) {
+                    if (!start->dirty)
+                        continue;
+                    ActiveEdge* p = active.prev(start);
+                    for (; p && p->dirty; p = active.prev(p))
+                        start = p;
+                    int winding[2] = {p ? p->after[0] : 0, p ? p->after[1] : 0};
+                    ActiveEdge* current = start;
+                    for (; current; current = active.next(current)) {
+                        winding[current->edge.operand] += current->edge.winding;
+                        if (current != start && !current->dirty &&
+                            winding[0] == current->after[0] && winding[1] == current->after[1])
+                            break;
+                        current->after[0] = winding[0];
+                        current->after[1] = winding[1];
+                        current->inside = isInside(operation, winding);
+                        current->dirty = false;
+                        check(current);
+                    }
+                    if (current)
+                        check(current);
+                }
+                for (ActiveEdge* p : probes) {
+                    if (p->node)
+                        check(p);
+                }
 
-                    intersected = true;
-                    break;
+                // Новые границы проверенных рёбер
+                for (ActiveEdge* c : checked) {
+                    ActiveEdge* p = active.prev(c);
+                    Boundary boundary = boundaryOf(c->inside, p && p->inside);
+                    if (boundary != c->boundary)
+                        changes.push_back({c, boundary});
                 }
             }
 
-            // Если не было пересечения, добавляем весь трапецоид
-            if (!intersected) {
-                result.push_back(a);
+            // Закрываются интервалы, у которых сменилась граница или внутри которых появилась новая
+            for (ActiveEdge* e : removed) {
+                if (e->boundary == Boundary::Left)
+                    close(e);
+                else if (e->boundary == Boundary::Right)
+                    close(e->partner);
+            }
+            for (const auto& [c, boundary] : changes) {
+                if (c->boundary == Boundary::Left) {
+                    close(c);
+                } else if (c->boundary == Boundary::Right) {
+                    close(c->partner);
+                } else if (ActiveEdge* p = bulk ? nullptr : active.prevBoundary(c)) {
+                    if (p->boundary == Boundary::Left)
+                        close(p);
+                }
+            }
+            bool many = changes.size() * BULK_EVENT_SHARE >= active.size();
+            for (const auto& [c, boundary] : changes) {
+                c->boundary = boundary;
+                c->interval = false;
+                if (!many)
+                    active.refresh(c);
+            }
+            if (many)
+                active.refreshAll();
+
+            std::sort(candidates.begin(), candidates.end(), [](const OpenSpan& a, const OpenSpan& b) {
+                return a.trapezoid.x1_top < b.trapezoid.x1_top;
+            });
+            continued.assign(candidates.size(), false);
+            for (ActiveEdge* c : checked) {
+                ActiveEdge* left = c->boundary == Boundary::Left ? c : bulk ? nullptr : active.prevBoundary(c);
+                if (left && left->boundary == Boundary::Left && !left->interval)
+                    reopen(left);
+            }
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                if (!continued[i])
+                    sink(candidates[i]);
+            }
+
+            for (ActiveEdge* e : removed)
+                spare.push_back(e);
+            dirty.clear();
+            probes.clear();
+            removed.clear();
+            checked.clear();
+            changes.clear();
+            candidates.clear();
+        }
+
+        open.clear();
+        for (ActiveEdge* e = active.first(); e; e = active.next(e)) {
+            if (e->boundary == Boundary::Left && e->open) {
+                OpenSpan span = e->span;
+                span.trapezoid.x1_top = xAt(e, y_end);
+                span.trapezoid.x2_top = xAt(e->partner, y_end);
+                span.trapezoid.y_top = y_end;
+                if (span.trapezoid.x1_top < span.trapezoid.x2_top || span.trapezoid.x1_bottom < span.trapezoid.x2_bottom)
+                    open.push_back(span);
             }
         }
+        std::sort(open.begin(), open.end(), [](const OpenSpan& a, const OpenSpan& b) {
+            return a.trapezoid.x1_top < b.trapezoid.x1_top;
+        });
+    }
 
-        // Добавляем трапецоиды из второго множества, которые не пересеклись с первым
-        for (const auto& b : trapezoids2) {
-            bool intersected = false;
+    void sweep(std::vector<SweepEdge> edges, BooleanOperation operation, const TrapezoidSink& sink) {
+        std::vector<double> events;
+        prepareEdges(edges, events);
+        if (events.size() < 2)
+            return;
+
+        std::vector<const SweepEdge*> sorted;
+        sorted.reserve(edges.size());
+        for (const auto& e : edges)
+            sorted.push_back(&e);
+
+        std::vector<OpenSpan> open;
+        sweepEvents(sorted, events.front(), events.back(), operation, open, [&sink](const OpenSpan& span) {
+            sink(span.trapezoid);
+        });
+        for (const auto& span : open)
+            sink(span.trapezoid);
+    }
 
-            for (const auto& a : trapezoids1) {
-                std::pair<double, double> y_overlap_result = overlapY(b, a);
-                if (y_overlap_result.first > y_overlap_result.second) {
-                    intersected = true;
-                    break;
+    // Результат обработки одной полосы параллельного прохода
+    struct BandResult {
+        std::vector<OpenSpan> closed;   // Трапецоиды, закрытые внутри полосы
+        std::vector<OpenSpan> open;     // Трапецоиды, открытые на верхней границе полосы
+    };
+
+    void sweep(std::vector<SweepEdge> edges, BooleanOperation operation, const TrapezoidSink& sink, ThreadPool& pool, size_t bands) {
+        std::vector<double> events;
+        prepareEdges(edges, events);
+        if (events.size() < 2)
+            return;
+        if (bands == 0)
+            bands = 4 * pool.size();
+
+        // Границы полос выбираются среди событий так, чтобы на полосу приходилось примерно равное число рёбер.
+        // Граница совпадает с событием последовательного прохода, поэтому вычисления в полосах те же самые
+        std::vector<size_t> cuts = {0};
+        for (size_t k = 1; k < bands; ++k) {
+            double y = edges[k * edges.size() / bands].y_bottom;
+            size_t index = std::lower_bound(events.begin(), events.end(), y) - events.begin();
+            if (index > cuts.back() && index + 1 < events.size())
+                cuts.push_back(index);
+        }
+        cuts.push_back(events.size() - 1);
+        size_t band_count = cuts.size() - 1;
+
+        // Ребро попадает во все полосы, которые пересекает
+        std::vector<std::vector<const SweepEdge*>> band_edges(band_count);
+        size_t first = 0;
+        for (const auto& e : edges) {
+            while (first + 1 < band_count && events[cuts[first + 1]] <= e.y_bottom)
+                ++first;
+            for (size_t b = first; b < band_count && events[cuts[b]] < e.y_top; ++b)
+                band_edges[b].push_back(&e);
+        }
+
+        std::vector<BandResult> results(band_count);
+        pool.parallel_for(band_count, [&](size_t b) {
+            BandResult& result = results[b];
+            sweepEvents(band_edges[b], events[cuts[b]], events[cuts[b + 1]], operation, result.open, [&result](const OpenSpan& span) {
+                result.closed.push_back(span);
+            });
+        });
+
+        // Сшивка по границам в порядке полос: трапецоид, начинающийся на границе, продолжает открытый
+        // трапецоид предыдущей полосы при тех же условиях, что и в последовательном проходе
+        TRACE_SCOPE("sweep_stitch");
+        TRACE_COUNT("bands", band_count);
+        std::vector<OpenSpan> carry;
+        std::vector<bool> continued;
+        for (size_t b = 0; b < band_count; ++b) {
+            double boundary = events[cuts[b]];
+            continued.assign(carry.size(), false);
+
+            auto stitch = [&](OpenSpan& span) {
+                if (span.trapezoid.y_bottom != boundary)
+                    return;
+                auto it = std::lower_bound(carry.begin(), carry.end(), span.trapezoid.x1_bottom, [](const OpenSpan& c, double x) {
+                    return c.trapezoid.x1_top < x;
+                });
+                for (; it != carry.end() && it->trapezoid.x1_top == span.trapezoid.x1_bottom; ++it) {
+                    size_t index = it - carry.begin();
+                    if (!continued[index] && it->trapezoid.y_top == boundary && it->trapezoid.x2_top == span.trapezoid.x2_bottom &&
+                        it->slope_left == span.slope_left && it->slope_right == span.slope_right) {
+                        continued[index] = true;
+                        span.trapezoid.x1_bottom = it->trapezoid.x1_bottom;
+                        span.trapezoid.x2_bottom = it->trapezoid.x2_bottom;
+                        span.trapezoid.y_bottom = it->trapezoid.y_bottom;
+                        return;
+                    }
                 }
+            };
+
+            for (auto& span : results[b].closed)
+                stitch(span);
+            for (auto& span : results[b].open)
+                stitch(span);
+            for (size_t i = 0; i < carry.size(); ++i) {
+                if (!continued[i])
+                    sink(carry[i].trapezoid);
             }
+            for (const auto& span : results[b].closed)
+                sink(span.trapezoid);
+            carry.swap(results[b].open);
+        }
+        for (const auto& span : carry)
+            sink(span.trapezoid);
+    }
 
-            if (!intersected) {
-                result.push_back(b);
-            }
+    const char* operationName(BooleanOperation operation) {
+        switch (operation) {
+        case BooleanOperation::Union:
+            return "unite";
+        case BooleanOperation::Intersection:
+            return "intersect";
+        case BooleanOperation::Difference:
+            return "subtract";
         }
+        return "boolean";
+    }
+
+    std::vector<Trapezoid> apply(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, BooleanOperation operation) {
+        TRACE_SCOPE(operationName(operation));
+        TRACE_COUNT("trapezoids_in", trapezoids1.size() + trapezoids2.size());
+        std::vector<SweepEdge> edges;
+        edges.reserve(2 * (trapezoids1.size() + trapezoids2.size()));
+        appendEdges(trapezoids1, 0, edges);
+        appendEdges(trapezoids2, 1, edges);
 
+        std::vector<Trapezoid> result;
+        sweep(std::move(edges), operation, [&result](const Trapezoid& trapezoid) {
+            result.push_back(trapezoid);
+        });
+        TRACE_COUNT("trapezoids_out", result.size());
         return result;
     }
 
-    std::vector<Trapezoid> intersect(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2) {
-        std::vector<Trapezoid> result;
+    // Диапазон y трапецоидов буфера
+    void rangeY(const TrapezoidBuffer& trapezoids, double& y_bottom, double& y_top) {
+        double unused;
+        TrapezoidKernels::bounds(trapezoids.y_bottom.data(), trapezoids.size(), y_bottom, unused);
+        TrapezoidKernels::bounds(trapezoids.y_top.data(), trapezoids.size(), unused, y_top);
+    }
 
-        for (const auto& a : trapezoids1) {
-            for (const auto& b : trapezoids2) {
-                // Проверяем пересечение по y
-                std::pair<double, double> y_overlap_result = overlapY(a, b);
-                double y_top = y_overlap_result.first;
-                double y_bottom = y_overlap_result.second;
+    // Обрезка буфера полосой [y_bottom, y_top]; если буфер уже внутри полосы, он возвращается без копирования
+    const TrapezoidBuffer& clipToBand(const TrapezoidBuffer& trapezoids, double y_bottom, double y_top, TrapezoidBuffer& storage) {
+        double bottom, top;
+        rangeY(trapezoids, bottom, top);
+        if (bottom >= y_bottom && top <= y_top)
+            return trapezoids;
+        TrapezoidKernels::clipBand(trapezoids, y_bottom, y_top, storage);
+        return storage;
+    }
 
-                if (y_top > y_bottom) { // Есть пересечение по y
-                    // Добавляем только общую часть, используя `create_trapezoid`
-                    result.push_back(create_trapezoid(y_top, y_bottom, a, b, false));  // false для пересечения
-                }
+    TrapezoidBuffer apply(const TrapezoidBuffer& trapezoids1, const TrapezoidBuffer& trapezoids2, BooleanOperation operation) {
+        TRACE_SCOPE(operationName(operation));
+        TRACE_COUNT("trapezoids_in", trapezoids1.size() + trapezoids2.size());
+
+        // Пересечение лежит в общей полосе по y операндов, разность - в полосе первого операнда.
+        // Трапецоиды вне полосы отбрасываются векторными ядрами до построения рёбер
+        const TrapezoidBuffer* first = &trapezoids1;
+        const TrapezoidBuffer* second = &trapezoids2;
+        TrapezoidBuffer clipped1, clipped2;
+        if (operation != BooleanOperation::Union) {
+            if (trapezoids1.empty() || (operation == BooleanOperation::Intersection && trapezoids2.empty()))
+                return TrapezoidBuffer();
+            double y_bottom, y_top;
+            rangeY(trapezoids1, y_bottom, y_top);
+            if (operation == BooleanOperation::Intersection) {
+                double bottom2, top2;
+                rangeY(trapezoids2, bottom2, top2);
+                y_bottom = std::max(y_bottom, bottom2);
+                y_top = std::min(y_top, top2);
+                if (!(y_bottom < y_top))
+                    return TrapezoidBuffer();
+                first = &clipToBand(trapezoids1, y_bottom, y_top, clipped1);
             }
+            if (!trapezoids2.empty())
+                second = &clipToBand(trapezoids2, y_bottom, y_top, clipped2);
+            TRACE_COUNT("trapezoids_clipped", trapezoids1.size() + trapezoids2.size() - first->size() - second->size());
         }
 
+        std::vector<SweepEdge> edges;
+        edges.reserve(2 * (first->size() + second->size()));
+        appendEdges(*first, 0, edges);
+        appendEdges(*second, 1, edges);
+
+        TrapezoidBuffer result;
+        sweep(std::move(edges), operation, [&result](const Trapezoid& trapezoid) {
+            result.push_back(trapezoid);
+        });
+        TRACE_COUNT("trapezoids_out", result.size());
         return result;
     }
 
+    std::vector<Trapezoid> unite(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2) {
+        return apply(trapezoids1, trapezoids2, BooleanOperation::Union);
+    }
+
+    std::vector<Trapezoid> intersect(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2) {
+        return apply(trapezoids1, trapezoids2, BooleanOperation::Intersection);
+    }
 
     // Функция для вычитания двух векторов трапезоидов
     std::vector<Trapezoid> subtract(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2) {
+        return apply(trapezoids1, trapezoids2, BooleanOperation::Difference);
+    }
+
+    std::vector<Trapezoid> apply(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2,
+                                 BooleanOperation operation, ThreadPool& pool) {
+        TRACE_SCOPE(operationName(operation));
+        TRACE_COUNT("trapezoids_in", trapezoids1.size() + trapezoids2.size());
+        TRACE_COUNT("threads", pool.size());
+        std::vector<SweepEdge> edges;
+        edges.reserve(2 * (trapezoids1.size() + trapezoids2.size()));
+        appendEdges(trapezoids1, 0, edges);
+        appendEdges(trapezoids2, 1, edges);
+
         std::vector<Trapezoid> result;
+        sweep(std::move(edges), operation, [&result](const Trapezoid& trapezoid) {
+            result.push_back(trapezoid);
+        }, pool);
+        TRACE_COUNT("trapezoids_out", result.size());
+        return result;
+    }
 
-        for (const auto& a : trapezoids1) {
-            bool intersected = false;
+    std::vector<Trapezoid> apply(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2,
+                                 BooleanOperation operation, size_t threads) {
+        if (threads <= 1) {
+            return apply(trapezoids1, trapezoids2, operation);
+        }
+        ThreadPool pool(threads);
+        return apply(trapezoids1, trapezoids2, operation, pool);
+    }
 
-            for (const auto& b : trapezoids2) {
-                // Проверяем пересечение по y
-                std::pair<double, double> y_overlap_result = overlapY(a, b);
-                double y_top = y_overlap_result.first;
-                double y_bottom = y_overlap_result.second;
+    std::vector<Trapezoid> unite(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, size_t threads) {
+        return apply(trapezoids1, trapezoids2, BooleanOperation::Union, threads);
+    }
 
-                if (y_top > y_bottom) { // Есть пересечение по y
-                    intersected = true;
+    std::vector<Trapezoid> intersect(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, size_t threads) {
+        return apply(trapezoids1, trapezoids2, BooleanOperation::Intersection, threads);
+    }
 
-                    // 1. Добавляем часть до пересечения
-                    if (a.y_bottom < y_bottom) {
-                        result.push_back(create_trapezoid(y_bottom, a.y_bottom, a, a, true));
-                    }
+    std::vector<Trapezoid> subtract(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, size_t threads) {
+        return apply(trapezoids1, trapezoids2, BooleanOperation::Difference, threads);
+    }
+
+    std::vector<Trapezoid> unite(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, ThreadPool& pool) {
+        return apply(trapezoids1, trapezoids2, BooleanOperation::Union, pool);
+    }
+
+    std::vector<Trapezoid> intersect(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, ThreadPool& pool) {
+        return apply(trapezoids1, trapezoids2, BooleanOperation::Intersection, pool);
+    }
+
+    std::vector<Trapezoid> subtract(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, ThreadPool& pool) {
+        return apply(trapezoids1, trapezoids2, BooleanOperation::Difference, pool);
+    }
+
+    TrapezoidBuffer unite(const TrapezoidBuffer& trapezoids1, const TrapezoidBuffer& trapezoids2) {
+        return apply(trapezoids1, trapezoids2, BooleanOperation::Union);
+    }
+
+    TrapezoidBuffer intersect(const TrapezoidBuffer& trapezoids1, const TrapezoidBuffer& trapezoids2) {
+        return apply(trapezoids1, trapezoids2, BooleanOperation::Intersection);
+    }
+
+    TrapezoidBuffer subtract(const TrapezoidBuffer& trapezoids1, const TrapezoidBuffer& trapezoids2) {
+        return apply(trapezoids1, trapezoids2, BooleanOperation::Difference);
+    }
+} // namespace TrapezoidOperations
 
-                    // 2. Переcечение
-                    auto trapezoids = create_trapezoids_substructed(y_top, y_bottom, a, b, true);
-                    for(const auto& trap : trapezoids)
-                        result.push_back(trap);
 
-                    // 3. Добавляем часть после пересечения
-                    if (a.y_top > y_top) {
-                        result.push_back(create_trapezoid(a.y_top, y_top, a, a, true));
+
+namespace PolygonOperations {
+
+    std::vector<Polygon> modifyPolygon(const std::vector<Polygon>& polygons, double size, JoinType join, double miter_limit) {
+        TRACE_SCOPE("modify_polygon");
+        Layer source("Polygons", polygons);
+        Layer target;
+        LayerOperations::sizeLayer(source, size, target, join, miter_limit);
+        return target.get_polygons();
+    }
+
+    // Удвоенная ориентированная площадь контура: > 0 для обхода против часовой стрелки
+    double signedArea(const ContourView& contour) {
+        const Point* p = contour.data();
+        double area = 0;
+        for (size_t i = 0, j = contour.size() - 1; i < contour.size(); j = i++) {
+            area += (p[j].x - p[i].x) * (p[j].y + p[i].y);
+        }
+        return area;
+    }
+
+    double signedArea(const std::vector<Point>& contour) {
+        return signedArea(ContourView(contour));
+    }
+
+    template <typename T>
+    typename CoordinateTraits<T>::wide_type signedArea(const std::vector<BasicPoint<T>>& contour) {
+        using Wide = typename CoordinateTraits<T>::wide_type;
+        Wide area = 0;
+        for (size_t i = 0, j = contour.size() - 1; i < contour.size(); j = i++) {
+            area += (Wide(contour[j].x) - contour[i].x) * (Wide(contour[j].y) + contour[i].y);
+        }
+        return area;
+    }
+
+    template <typename T>
+    int orientation(const BasicPoint<T>& a, const BasicPoint<T>& b, const BasicPoint<T>& c) {
+        using Wide = typename CoordinateTraits<T>::wide_type;
+        Wide cross = (Wide(b.x) - a.x) * (Wide(c.y) - a.y) - (Wide(b.y) - a.y) * (Wide(c.x) - a.x);
+        return (cross > 0) - (cross < 0);
+    }
+
+    template CoordinateTraits<int32_t>::wide_type signedArea(const std::vector<Point32>& contour);
+    template CoordinateTraits<int64_t>::wide_type signedArea(const std::vector<Point64>& contour);
+    // Для double знак берётся из адаптивного предиката, а не из произведений с округлением
+    template <>
+    int orientation(const Point& a, const Point& b, const Point& c) {
+        double value = Predicates::orient2d(a, b, c);
+        return (value > 0) - (value < 0);
+    }
+
+    template int orientation(const Point32& a, const Point32& b, const Point32& c);
+    template int orientation(const Point64& a, const Point64& b, const Point64& c);
+
+    void appendContourEdges(const ContourView& contour, bool is_hole, int operand, std::vector<SweepEdge>& edges) {
+        if (contour.size() < 3)
+            return;
+        const Point* points = contour.data();
+
+        // При обходе против часовой стрелки левая граница области идёт вниз
+        int direction = signedArea(contour) > 0 ? 1 : -1;
+        if (is_hole)
+            direction = -direction;
+
+        for (size_t i = 0, j = contour.size() - 1; i < contour.size(); j = i++) {
+            const Point& p = points[j];
+            const Point& q = points[i];
+            if (p.y == q.y)
+                continue;
+            if (q.y < p.y)
+                edges.emplace_back(q.x, p.x, q.y, p.y, direction, operand);
+            else
+                edges.emplace_back(p.x, q.x, p.y, q.y, -direction, operand);
+        }
+    }
+
+    void appendEdges(const Polygon& polygon, int operand, std::vector<SweepEdge>& edges) {
+        appendContourEdges(polygon.get_vertices(), false, operand, edges);
+        for (const Hole& hole : polygon.get_holes()) {
+            appendContourEdges(hole.get_vertices(), true, operand, edges);
+        }
+    }
+
+    void appendEdges(const PolygonView& polygon, int operand, std::vector<SweepEdge>& edges) {
+        appendContourEdges(polygon.get_vertices(), false, operand, edges);
+        for (size_t i = 0; i < polygon.hole_count(); ++i) {
+            appendContourEdges(polygon.get_hole(i), true, operand, edges);
+        }
+    }
+
+    void decompose(const Polygon& polygon, const TrapezoidOperations::TrapezoidSink& sink) {
+        size_t count = polygon.get_vertices().size();
+        for (const Hole& hole : polygon.get_holes())
+            count += hole.get_vertices().size();
+
+        std::vector<SweepEdge> edges;
+        edges.reserve(count);
+        appendEdges(polygon, 0, edges);
+        TrapezoidOperations::sweep(std::move(edges), BooleanOperation::Union, sink);
+    }
+
+    std::vector<Trapezoid> decompose(const Polygon& polygon) {
+        std::vector<Trapezoid> result;
+        decompose(polygon, [&result](const Trapezoid& trapezoid) {
+            result.push_back(trapezoid);
+        });
+        return result;
+    }
+}   // namespace PolygonOperations
+
+namespace LayerOperations {
+
+    struct PointHash {
+        size_t operator()(const Point& p) const {
+            size_t h = std::hash<double>()(p.x);
+            return h ^ (std::hash<double>()(p.y) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+        }
+    };
+
+    // Направленное ребро границы; область лежит слева от него
+    struct BoundaryEdge {
+        Point from, to;
+        size_t next_from_same;  // Следующее ребро с тем же началом (односвязный список в хэш-таблице)
+        bool used;
+    };
+
+    // Горизонтальный отрезок трапецоида на высоте y: sign = +1 для верхнего основания, -1 для нижнего
+    struct HorizontalSegment {
+        double x1, x2;
+        int sign;
+    };
+
+    const size_t NO_EDGE = static_cast<size_t>(-1);
+
+    class EdgeMap {
+    public:
+        std::vector<BoundaryEdge> edges;
+        std::unordered_map<Point, size_t, PointHash> first_from;
+
+        explicit EdgeMap(size_t expected) {
+            edges.reserve(expected);
+            first_from.reserve(expected);
+        }
+
+        // Добавляет ребро; если уже есть противоположно направленное, оба взаимно уничтожаются
+        void add(const Point& from, const Point& to, bool cancel_opposite) {
+            if (from == to)
+                return;
+            if (cancel_opposite) {
+                auto it = first_from.find(to);
+                for (size_t e = it == first_from.end() ? NO_EDGE : it->second; e != NO_EDGE; e = edges[e].next_from_same) {
+                    if (!edges[e].used && edges[e].to == from) {
+                        edges[e].used = true;
+                        return;
                     }
-                    break;
                 }
             }
+            auto inserted = first_from.emplace(from, edges.size());
+            size_t next = NO_EDGE;
+            if (!inserted.second) {
+                next = inserted.first->second;
+                inserted.first->second = edges.size();
+            }
+            edges.push_back({from, to, next, false});
+        }
 
-            // Если не было пересечения, добавляем весь трапецоид из первого множества
-            if (!intersected) {
-                result.push_back(a);
+        // Выбирает продолжение контура в вершине: при нескольких вариантах - самый левый поворот,
+        // тогда касающиеся в вершине контуры не склеиваются в один.
+        // Повороты сравниваются точными предикатами: сначала по направлению (вправо, прямо, влево, назад),
+        // при одинаковом - по знаку векторного произведения кандидатов
+        size_t next(size_t current, size_t start) const {
+            const BoundaryEdge& edge = edges[current];
+            auto it = first_from.find(edge.to);
+            if (it == first_from.end())
+                return NO_EDGE;
+
+            auto direction = [&edge](const BoundaryEdge& candidate) {
+                double turn = Predicates::cross(edge.from, edge.to, candidate.from, candidate.to);
+                if (turn != 0)
+                    return turn > 0 ? 2 : 0;
+                double dot = (edge.to.x - edge.from.x) * (candidate.to.x - candidate.from.x) +
+                             (edge.to.y - edge.from.y) * (candidate.to.y - candidate.from.y);
+                return dot > 0 ? 1 : 3;
+            };
+            size_t best = NO_EDGE;
+            int best_direction = 0;
+            for (size_t e = it->second; e != NO_EDGE; e = edges[e].next_from_same) {
+                if (edges[e].used && e != start)
+                    continue;
+                int e_direction = direction(edges[e]);
+                if (best == NO_EDGE || e_direction > best_direction ||
+                    (e_direction == best_direction &&
+                     Predicates::cross(edges[best].from, edges[best].to, edges[e].from, edges[e].to) > 0)) {
+                    best = e;
+                    best_direction = e_direction;
+                }
             }
+            return best;
         }
+    };
+
+    // Удаляет вершины, лежащие на прямой между соседними (остатки разбиения на полосы)
+    void removeCollinear(std::vector<Point>& contour) {
+        bool changed = true;
+        while (changed && contour.size() >= 3) {
+            changed = false;
+            size_t out = 0;
+            for (size_t i = 0; i < contour.size(); ++i) {
+                const Point& prev = out > 0 ? contour[out - 1] : contour.back();
+                const Point& cur = contour[i];
+                const Point& next = contour[(i + 1) % contour.size()];
+                double ax = cur.x - prev.x, ay = cur.y - prev.y;
+                double bx = next.x - cur.x, by = next.y - cur.y;
+                double cross = Predicates::orient2d(prev, cur, next);
+                double scale = (std::abs(ax) + std::abs(ay)) * (std::abs(bx) + std::abs(by));
+                if (std::abs(cross) <= 1e-12 * scale && ax * bx + ay * by >= 0) {
+                    changed = true;
+                    continue;
+                }
+                contour[out++] = cur;
+            }
+            contour.resize(out);
+        }
+    }
 
-        return result;
+    bool containsPoint(const std::vector<Point>& contour, const Point& p) {
+        bool inside = false;
+        for (size_t i = 0, j = contour.size() - 1; i < contour.size(); j = i++) {
+            const Point& a = contour[i];
+            const Point& b = contour[j];
+            // Точка левее пересечения луча с ребром - слева от ребра, направленного вверх
+            if ((a.y > p.y) != (b.y > p.y) &&
+                (a.y < b.y ? Predicates::orient2d(a, b, p) : Predicates::orient2d(b, a, p)) > 0)
+                inside = !inside;
+        }
+        return inside;
     }
-} // namespace TrapezoidOperations
 
+    // Координаты углов, отличающиеся меньше чем на SNAP_EPSILON от размера слоя, считаются совпадающими
+    const double SNAP_EPSILON = 1e-10;
 
+    // Сводит близкие значения к наименьшему в группе: values сортируются без повторов, snapped[i] - замена values[i]
+    void snapValues(std::vector<double>& values, std::vector<double>& snapped, double tolerance) {
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+        snapped.resize(values.size());
+        for (size_t i = 0; i < values.size(); ++i)
+            snapped[i] = i > 0 && values[i] - values[i - 1] <= tolerance ? snapped[i - 1] : values[i];
+    }
 
-namespace PolygonOperations {
+    // Согласование углов трапецоидов. В точках пересечения рёбер sweep вычисляет x каждого ребра отдельно,
+    // а одна и та же вершина, построенная разными путями (например, при смещении границ), получает y,
+    // отличающиеся на ulp. Сначала сводятся близкие высоты (полосы нулевой высоты пропадают), затем близкие x
+    // на каждой высоте, иначе контуры не замыкаются или появляются полигоны-щели
+    class CornerSnap {
+    public:
+        explicit CornerSnap(const std::vector<Trapezoid>& trapezoids) {
+            double scale = 0;
+            for (const auto& t : trapezoids) {
+                if (t.y_top <= t.y_bottom)
+                    continue;
+                heights.push_back(t.y_top);
+                heights.push_back(t.y_bottom);
+                scale = std::max({scale, std::abs(t.y_top), std::abs(t.y_bottom), std::abs(t.x1_top), std::abs(t.x2_top),
+                                  std::abs(t.x1_bottom), std::abs(t.x2_bottom)});
+            }
+            double tolerance = scale * SNAP_EPSILON;
+            snapValues(heights, snapped_heights, tolerance);
+
+            for (const auto& t : trapezoids) {
+                if (t.y_top <= t.y_bottom)
+                    continue;
+                double y_top = y(t.y_top), y_bottom = y(t.y_bottom);
+                if (y_top == y_bottom)
+                    continue;
+                levels[y_top].insert(levels[y_top].end(), {t.x1_top, t.x2_top});
+                levels[y_bottom].insert(levels[y_bottom].end(), {t.x1_bottom, t.x2_bottom});
+            }
+            for (auto& level : levels)
+                snapValues(level.second, targets[level.first], tolerance);
+        }
 
-     std::vector<Polygon> modifyPolygon(const std::vector<Polygon>& polygons, float size) {
-        std::vector<Polygon> modifiedPolygons;
+        double y(double value) const {
+            return snapped_heights[std::lower_bound(heights.begin(), heights.end(), value) - heights.begin()];
+        }
 
-        size = size > 0 ? size : 1 / std::abs(size); // Если size - отрицаетльный, то делим на модуль size
+        // y - уже согласованная высота
+        double x(double value, double y) const {
+            const std::vector<double>& xs = levels.at(y);
+            return targets.at(y)[std::lower_bound(xs.begin(), xs.end(), value) - xs.begin()];
+        }
 
-        for (const Polygon& polygon : polygons) {
-            std::vector<Point> newVertices;
+    private:
+        std::vector<double> heights, snapped_heights;
+        std::unordered_map<double, std::vector<double>> levels;     // Различные x углов на каждой высоте по возрастанию
+        std::unordered_map<double, std::vector<double>> targets;    // x, на который заменяется соответствующий угол
+    };
+
+    void reconstructLayer(const std::vector<Trapezoid>& trapezoids, Layer& target) {
+        TRACE_SCOPE("reconstruct_layer");
+        TRACE_COUNT("trapezoids_in", trapezoids.size());
+        EdgeMap map(trapezoids.size() * 4);
+        std::unordered_map<double, std::vector<HorizontalSegment>> horizontals;
+        CornerSnap snap(trapezoids);
+
+        // 1. Боковые рёбра: совпадающие рёбра соседних трапецоидов уничтожаются через хэш-таблицу
+        for (const auto& t : trapezoids) {
+            if (t.y_top <= t.y_bottom)
+                continue;
+            double y_top = snap.y(t.y_top), y_bottom = snap.y(t.y_bottom);
+            if (y_top == y_bottom)
+                continue;
+            double x1_top = snap.x(t.x1_top, y_top), x2_top = snap.x(t.x2_top, y_top);
+            double x1_bottom = snap.x(t.x1_bottom, y_bottom), x2_bottom = snap.x(t.x2_bottom, y_bottom);
+            map.add(Point(x1_top, y_top), Point(x1_bottom, y_bottom), true);
+            map.add(Point(x2_bottom, y_bottom), Point(x2_top, y_top), true);
+            if (x1_top < x2_top)
+                horizontals[y_top].push_back({x1_top, x2_top, +1});
+            if (x1_bottom < x2_bottom)
+                horizontals[y_bottom].push_back({x1_bottom, x2_bottom, -1});
+        }
 
-            // Изменяем каждую вершину, масштабируя её относительно центра полигона
-            Point center = Point(0, 0);
-            for (const Point& vertex : polygon.get_points()) {
-                center = center + vertex;
+        // 2. Горизонтальные рёбра: на каждой высоте остаются участки, покрытые только снизу или только сверху
+        std::vector<std::pair<double, int>> events;
+        for (const auto& level : horizontals) {
+            double y = level.first;
+            events.clear();
+            for (const auto& segment : level.second) {
+                events.emplace_back(segment.x1, segment.sign);
+                events.emplace_back(segment.x2, -segment.sign);
             }
-            center.x /= polygon.get_points().size();
-            center.y /= polygon.get_points().size();
-
-            for (const Point& vertex : polygon.get_points()) {
-                Point scaledVertex = center + (vertex - center) * size;
-                newVertices.push_back(scaledVertex);
+            std::sort(events.begin(), events.end());
+
+            int net = 0;
+            double run_start = 0;
+            for (size_t i = 0; i < events.size(); ) {
+                double x = events[i].first;
+                int previous = net;
+                for (; i < events.size() && events[i].first == x; ++i)
+                    net += events[i].second;
+                if (previous == net)
+                    continue;
+                if (previous > 0) // Область снизу: ребро идёт справа налево
+                    map.add(Point(x, y), Point(run_start, y), false);
+                else if (previous < 0)
+                    map.add(Point(run_start, y), Point(x, y), false);
+                run_start = x;
             }
-            // Масштабируем каждую вершину для каждой дырки относительно центра полигона
-            std::vector<Hole> newHoles;
-            for (const Hole& hole : polygon.get_holes()) {
-                std::vector<Point> newHoleVertices;
-                for (const Point& vertex : hole.get_points()) {
-                    double newX = center.x + (vertex.x - center.x) * size;
-                    double newY = center.y + (vertex.y - center.y) * size;
-                    newHoleVertices.emplace_back(newX, newY);
+        }
+
+        // 3. Обход контуров
+        struct OuterInfo {
+            size_t index;
+            double area;
+            double min_x, min_y, max_x, max_y;
+        };
+        std::vector<OuterInfo> outers;
+        std::vector<Hole> holes;
+        std::vector<Point> contour;
+
+        for (size_t start = 0; start < map.edges.size(); ++start) {
+            if (map.edges[start].used)
+                continue;
+
+            contour.clear();
+            size_t current = start;
+            bool closed = false;
+            while (current != NO_EDGE) {
+                map.edges[current].used = true;
+                contour.push_back(map.edges[current].from);
+                current = map.next(current, start);
+                if (current == start) {
+                    closed = true;
+                    break;
                 }
-                newHoles.emplace_back(newHoleVertices);
             }
 
-            // Создаём новый полигон с модифицированными вершинами и дырками
-            Polygon modifiedPolygon(newVertices, newHoles);
-            modifiedPolygons.push_back(modifiedPolygon);
+            // После согласования углов у каждой вершины входящих рёбер столько же, сколько исходящих,
+            // поэтому незамкнутый контур означает пересекающиеся трапецоиды на входе
+            if (!closed)
+                throw std::runtime_error("Контур не замыкается: трапецоиды на входе перекрываются");
+            removeCollinear(contour);
+            if (contour.size() < 3)
+                continue;
+
+            double area = PolygonOperations::signedArea(contour);
+            if (area > 0) {
+                OuterInfo info = {target.get_polygons().size(), area, contour[0].x, contour[0].y, contour[0].x, contour[0].y};
+                for (const Point& p : contour) {
+                    info.min_x = std::min(info.min_x, p.x);
+                    info.min_y = std::min(info.min_y, p.y);
+                    info.max_x = std::max(info.max_x, p.x);
+                    info.max_y = std::max(info.max_y, p.y);
+                }
+                outers.push_back(info);
+                target.append(Polygon(contour));
+            } else if (area < 0) {
+                holes.emplace_back(contour);
+            }
         }
 
-        return modifiedPolygons;
+        // 4. Каждая дырка относится к наименьшему внешнему контуру, содержащему точку рядом с её ребром
+        std::sort(outers.begin(), outers.end(), [](const OuterInfo& a, const OuterInfo& b) {
+            return a.area < b.area;
+        });
+        for (Hole& hole : holes) {
+            const std::vector<Point>& vertices = hole.get_vertices();
+            double dx = vertices[1].x - vertices[0].x;
+            double dy = vertices[1].y - vertices[0].y;
+            // Слева от ребра дырки - заполненная область
+            Point probe((vertices[0].x + vertices[1].x) / 2 - dy * 1e-6,
+                        (vertices[0].y + vertices[1].y) / 2 + dx * 1e-6);
+            for (const OuterInfo& outer : outers) {
+                if (probe.x < outer.min_x || probe.x > outer.max_x || probe.y < outer.min_y || probe.y > outer.max_y)
+                    continue;
+                Polygon& polygon = target[outer.index];
+                if (containsPoint(polygon.get_vertices(), probe)) {
+                    polygon.add_hole(std::move(hole));
+                    break;
+                }
+            }
+        }
     }
-}   // namespace PolygonOperations
-
-namespace LayerOperations {
 
     // Копирование слоя внутри одного LayerPack
     void copyLayerFromLayerPack(LayerPack& layerpack, const std::string& sourceLayerName, const std::string& targetLayerName) {
 
-        const Layer& sourceLayer = layerpack[sourceLayerName];
-        Layer copiedLayer = sourceLayer;
+        Layer copiedLayer = layerpack[sourceLayerName];
         copiedLayer.rename(targetLayerName);
 
-        layerpack.append_layer(copiedLayer);
+        layerpack.append_layer(std::move(copiedLayer));
     }
 
     // Копирование слоя из одного LayerPack в другой
     void copyLayerFromLayerPack(const LayerPack& layerpack1, LayerPack& layerpack2, const std::string& sourceLayerName, const std::string& targetLayerName) {
-        const Layer& sourceLayer = layerpack1[sourceLayerName];
-        Layer copiedLayer = sourceLayer;
+        Layer copiedLayer = layerpack1[sourceLayerName];
         copiedLayer.rename(targetLayerName);
 
-        layerpack2.append_layer(copiedLayer);
+        layerpack2.append_layer(std::move(copiedLayer));
     }
 
     // Проверка наличия фигур в слое
     bool layerIsEmpty(const Layer& layer) {
-        return layer.get_polygons().empty();
+        return layer.size() == 0;
     }
-}  // namespace LayerOperations
 
+    void transformLayer(Layer& layer, const AffineTransform& transform, size_t threads) {
+        if (threads > 1) {
+            ThreadPool pool(threads);
+            transformLayer(layer, transform, pool);
+            return;
+        }
+        // В компактном режиме все вершины слоя лежат подряд и преобразуются одним вызовом ядра
+        if (layer.is_compact()) {
+            std::vector<Point>& vertices = layer.get_compact().get_vertices();
+            transform.apply(vertices.data(), vertices.size());
+            return;
+        }
+        for (size_t i = 0; i < layer.size(); ++i)
+            transform.apply(layer[i]);
+    }
+
+    void transformLayer(Layer& layer, const AffineTransform& transform, ThreadPool& pool) {
+        if (layer.is_compact()) {
+            std::vector<Point>& vertices = layer.get_compact().get_vertices();
+            size_t count = vertices.size();
+            size_t chunks = std::max<size_t>(1, std::min(pool.size(), count));
+            size_t chunk = (count + chunks - 1) / chunks;
+            pool.parallel_for(chunks, [&](size_t c) {
+                size_t begin = c * chunk;
+                if (begin < count)
+                    transform.apply(vertices.data() + begin, std::min(chunk, count - begin));
+            });
+            return;
+        }
+
+        size_t count = layer.size();
+        std::vector<Polygon*> polygons;
+        polygons.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            polygons.push_back(&layer[i]);
+        }
+
+        // Полигоны разного размера: по несколько непрерывных диапазонов на поток для выравнивания нагрузки
+        size_t chunks = std::max<size_t>(1, std::min(4 * pool.size(), count));
+        size_t chunk = (count + chunks - 1) / chunks;
+        pool.parallel_for(chunks, [&](size_t c) {
+            size_t end = std::min(count, (c + 1) * chunk);
+            for (size_t i = c * chunk; i < end; ++i)
+                transform.apply(*polygons[i]);
+        });
+    }
+
+    void transformLayerPack(LayerPack& layerpack, const AffineTransform& transform, size_t threads) {
+        if (threads > 1) {
+            ThreadPool pool(threads);
+            transformLayerPack(layerpack, transform, pool);
+            return;
+        }
+        for (size_t i = 0; i < layerpack.get_layers().size(); ++i) {
+            transformLayer(layerpack[i], transform);
+        }
+    }
+
+    void transformLayerPack(LayerPack& layerpack, const AffineTransform& transform, ThreadPool& pool) {
+        for (size_t i = 0; i < layerpack.get_layers().size(); ++i) {
+            transformLayer(layerpack[i], transform, pool);
+        }
+    }
+
+    void decomposeLayer(const Layer& layer, const TrapezoidOperations::TrapezoidSink& sink) {
+        TRACE_SCOPE("decompose_layer");
+        TRACE_COUNT("polygons_in", layer.size());
+        if (layer.is_compact()) {
+            const CompactPolygons& compact = layer.get_compact();
+            std::vector<SweepEdge> edges;
+            edges.reserve(compact.vertex_count());
+            for (size_t i = 0; i < compact.size(); ++i) {
+                PolygonOperations::appendEdges(compact[i], 0, edges);
+            }
+            TrapezoidOperations::sweep(std::move(edges), BooleanOperation::Union, sink);
+            return;
+        }
+
+        size_t count = 0;
+        for (const Polygon& polygon : layer.get_polygons()) {
+            count += polygon.get_vertices().size();
+            for (const Hole& hole : polygon.get_holes())
+                count += hole.get_vertices().size();
+        }
+
+        std::vector<SweepEdge> edges;
+        edges.reserve(count);
+        for (const Polygon& polygon : layer.get_polygons()) {
+            PolygonOperations::appendEdges(polygon, 0, edges);
+        }
+        TrapezoidOperations::sweep(std::move(edges), BooleanOperation::Union, sink);
+    }
+
+    std::vector<Trapezoid> decomposeLayer(const Layer& layer) {
+        std::vector<Trapezoid> result;
+        decomposeLayer(layer, [&result](const Trapezoid& trapezoid) {
+            result.push_back(trapezoid);
+        });
+        return result;
+    }
+
+    // Наибольшее отклонение хорды дуги Round от окружности в долях радиуса
+    const double ARC_TOLERANCE = 0.01;
+
+    // Нормаль длины width вправо от ребра - наружу области, лежащей слева
+    Point outwardNormal(const Point& from, const Point& to, double width) {
+        double dx = to.x - from.x;
+        double dy = to.y - from.y;
+        double length = std::sqrt(dx * dx + dy * dy);
+        return Point(dy / length * width, -dx / length * width);
+    }
+
+    // Полосы шириной width вдоль рёбер контура с правой (внешней) стороны и соединения
+    // у вершин, где контур поворачивает влево; добавляются в edges как операнд 1
+    void appendOffsetPieces(const std::vector<Point>& contour, double width, JoinType join, double miter_limit,
+                            std::vector<SweepEdge>& edges) {
+        size_t n = contour.size();
+        std::vector<Point> piece;
+        auto emit = [&]() {
+            PolygonOperations::appendContourEdges(ContourView(piece), false, 1, edges);
+        };
+
+        for (size_t i = 0; i < n; ++i) {
+            const Point& p = contour[i];
+            const Point& q = contour[(i + 1) % n];
+            if (p == q)
+                continue;
+            Point normal = outwardNormal(p, q, width);
+            piece = {p, q, q + normal, p + normal};
+            emit();
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            const Point& prev = contour[(i + n - 1) % n];
+            const Point& vertex = contour[i];
+            const Point& next = contour[(i + 1) % n];
+            if (prev == vertex || vertex == next)
+                continue;
+            Point n1 = outwardNormal(prev, vertex, width);
+            Point n2 = outwardNormal(vertex, next, width);
+            // Направления рёбер единичной длины: e = (-n.y, n.x) / width
+            Point e1(-n1.y / width, n1.x / width);
+            Point e2(-n2.y / width, n2.x / width);
+            if (Predicates::orient2d(prev, vertex, next) <= 0)
+                continue;
+
+            piece = {vertex, vertex + n1};
+            if (join == JoinType::Round) {
+                // Поворот влево уже установлен точным предикатом, здесь нужна только величина угла в [0, pi]
+                double dot = e1.x * e2.x + e1.y * e2.y;
+                double angle = std::acos(std::max(-1.0, std::min(1.0, dot)));
+                double step = 2 * std::acos(1 - ARC_TOLERANCE);
+                size_t steps = static_cast<size_t>(std::ceil(angle / step));
+                for (size_t k = 1; k < steps; ++k) {
+                    double a = angle * k / steps;
+                    piece.emplace_back(vertex.x + n1.x * std::cos(a) - n1.y * std::sin(a),
+                                       vertex.y + n1.x * std::sin(a) + n1.y * std::cos(a));
+                }
+            } else {
+                // Срез перпендикулярен биссектрисе b на расстоянии cut от вершины
+                double bx = n1.x + n2.x;
+                double by = n1.y + n2.y;
+                double length = std::sqrt(bx * bx + by * by);
+                bx /= length;
+                by /= length;
+                double cos_half = (n1.x * bx + n1.y * by) / width;
+                double miter = width / cos_half;
+                double cut = join == JoinType::Square ? width : std::min(miter, miter_limit * width);
+                if (cut < miter) {
+                    double shift = (cut - width * cos_half) / (e1.x * bx + e1.y * by);
+                    piece.push_back(vertex + n1 + e1 * shift);
+                    piece.push_back(vertex + n2 - e2 * shift);
+                } else {
+                    piece.push_back(vertex + Point(bx, by) * miter);
+                }
+            }
+            piece.push_back(vertex + n2);
+            emit();
+        }
+    }
+
+    // Расширение - объединение области с полосами вдоль её границы и соединениями у выпуклых вершин.
+    // Сужение - то же для дополнения (контуры обходятся в обратную сторону), вычитаемое из области
+    void sizeLayer(const Layer& layer, double distance, Layer& target, JoinType join, double miter_limit) {
+        TRACE_SCOPE("size_layer");
+        TRACE_COUNT("polygons_in", layer.size());
+        if (!std::isfinite(distance)) {
+            throw std::invalid_argument("Величина смещения должна быть конечной");
+        }
+        if (join == JoinType::Miter && !(miter_limit >= 1)) {
+            throw std::invalid_argument("Предел угла Miter должен быть не меньше 1");
+        }
+
+        std::vector<Trapezoid> region = decomposeLayer(layer);
+        if (distance == 0 || region.empty()) {
+            reconstructLayer(region, target);
+            return;
+        }
+
+        // Граница объединения: внешние контуры против часовой стрелки, дырки по часовой, область слева
+        Layer merged;
+        reconstructLayer(region, merged);
+
+        // Область берётся рёбрами контуров, а не трапецоидов: стороны трапецоидов разрезаны по полосам и
+        // расходятся с полосами смещения на ulp, что оставляет щели нулевой ширины вдоль исходных рёбер
+        std::vector<SweepEdge> edges;
+        for (const Polygon& polygon : merged.get_polygons())
+            PolygonOperations::appendEdges(polygon, 0, edges);
+        double width = std::abs(distance);
+        std::vector<Point> contour;
+        auto offsetContour = [&](const std::vector<Point>& vertices) {
+            contour = vertices;
+            if (distance < 0)
+                std::reverse(contour.begin(), contour.end());
+            appendOffsetPieces(contour, width, join, miter_limit, edges);
+        };
+        for (const Polygon& polygon : merged.get_polygons()) {
+            offsetContour(polygon.get_vertices());
+            for (const Hole& hole : polygon.get_holes()) {
+                offsetContour(hole.get_vertices());
+            }
+        }
+
+        TRACE_COUNT("sweep_edges", edges.size());
+        std::vector<Trapezoid> result;
+        BooleanOperation operation = distance > 0 ? BooleanOperation::Union : BooleanOperation::Difference;
+        TrapezoidOperations::sweep(std::move(edges), operation, [&result](const Trapezoid& trapezoid) {
+            result.push_back(trapezoid);
+        });
+        reconstructLayer(result, target);
+    }
+
+    template <typename T>
+    std::vector<BasicPoint<T>> toDatabaseUnits(const ContourView& contour, double unit) {
+        std::vector<BasicPoint<T>> result;
+        result.reserve(contour.size());
+        auto convert = [unit](double value) {
+            double scaled = std::round(value / unit);
+            // -min = 2^(N-1) представимо точно, в отличие от max для int64
+            double limit = -static_cast<double>(std::numeric_limits<T>::min());
+            if (!(scaled >= -limit && scaled < limit)) {
+                throw std::out_of_range("Координата " + std::to_string(value) + " не помещается в единицы базы данных");
+            }
+            return static_cast<T>(scaled);
+        };
+        for (const Point& point : contour) {
+            result.emplace_back(convert(point.x), convert(point.y));
+        }
+        return result;
+    }
+
+    template <typename T>
+    std::vector<BasicPolygon<T>> toDatabaseUnits(const Layer& layer, double unit) {
+        if (!(unit > 0)) {
+            throw std::invalid_argument("Единица базы данных должна быть положительной");
+        }
+        std::vector<BasicPolygon<T>> result;
+        result.reserve(layer.size());
+        if (layer.is_compact()) {
+            const CompactPolygons& compact = layer.get_compact();
+            for (size_t i = 0; i < compact.size(); ++i) {
+                PolygonView polygon = compact[i];
+                BasicPolygon<T> converted(toDatabaseUnits<T>(polygon.get_vertices(), unit));
+                for (size_t j = 0; j < polygon.hole_count(); ++j) {
+                    converted.add_hole(BasicHole<T>(toDatabaseUnits<T>(polygon.get_hole(j), unit)));
+                }
+                result.push_back(std::move(converted));
+            }
+            return result;
+        }
+        for (const Polygon& polygon : layer.get_polygons()) {
+            BasicPolygon<T> converted(toDatabaseUnits<T>(polygon.get_vertices(), unit));
+            for (const Hole& hole : polygon.get_holes()) {
+                converted.add_hole(BasicHole<T>(toDatabaseUnits<T>(hole.get_vertices(), unit)));
+            }
+            result.push_back(std::move(converted));
+        }
+        return result;
+    }
+
+    template <typename T>
+    std::vector<Point> fromDatabaseUnits(const std::vector<BasicPoint<T>>& contour, double unit) {
+        std::vector<Point> result;
+        result.reserve(contour.size());
+        for (const BasicPoint<T>& point : contour) {
+            result.emplace_back(static_cast<double>(point.x) * unit, static_cast<double>(point.y) * unit);
+        }
+        return result;
+    }
+
+    template <typename T>
+    void fromDatabaseUnits(const std::vector<BasicPolygon<T>>& polygons, double unit, Layer& target) {
+        for (const BasicPolygon<T>& polygon : polygons) {
+            Polygon converted(fromDatabaseUnits(polygon.get_vertices(), unit));
+            for (const BasicHole<T>& hole : polygon.get_holes()) {
+                converted.add_hole(Hole(fromDatabaseUnits(hole.get_vertices(), unit)));
+            }
+            target.append(std::move(converted));
+        }
+    }
+
+    template std::vector<Polygon32> toDatabaseUnits(const Layer& layer, double unit);
+    template std::vector<Polygon64> toDatabaseUnits(const Layer& layer, double unit);
+    template void fromDatabaseUnits(const std::vector<Polygon32>& polygons, double unit, Layer& target);
+    template void fromDatabaseUnits(const std::vector<Polygon64>& polygons, double unit, Layer& target);
+}  // namespace LayerOperations
@@ -1,8 +1,12 @@
 #ifndef GEOMETRYOPERATIONS_H
 #define GEOMETRYOPERATIONS_H
 
+#include <functional>
 #include "Entity.h"
 // Forward declarations
+class TrapezoidBuffer;
+class AffineTransform;
+class ThreadPool;
 
 class Trapezoid {
 public:
@@ -11,31 +15,131 @@ public:
 
     Trapezoid(double x1_top, double x2_top, double x1_bottom, double x2_bottom, double y_top, double y_bottom);
 
-    // Копирующий конструктор
-    Trapezoid(const Trapezoid& other);
-
-    // Конструктор перемещения
-    Trapezoid(Trapezoid&& other);
+    // Тривиально копируемый: векторы трапецоидов копируются через memcpy
+    Trapezoid(const Trapezoid& other) = default;
+    Trapezoid(Trapezoid&& other) = default;
+    Trapezoid& operator=(const Trapezoid& other) = default;
+    Trapezoid& operator=(Trapezoid&& other) = default;
+};
 
-    // Копирующее присваивание
-    Trapezoid& operator=(const Trapezoid& other);
+// Невертикальное ребро для построчного (sweep-line) алгоритма, y_bottom < y_top
+struct SweepEdge {
+    double x_bottom, x_top;
+    double y_bottom, y_top;
+    int winding;    // Вклад в число обхода: +1 для левой границы, -1 для правой
+    int operand;    // Номер операнда: 0 - первое множество, 1 - второе
 
+    SweepEdge(double x_bottom, double x_top, double y_bottom, double y_top, int winding, int operand = 0);
 };
 
+enum class BooleanOperation { Union, Intersection, Difference };
+
+// Соединение смещённых рёбер у выпуклых вершин: продолжение рёбер до пересечения, срез
+// на расстоянии смещения от вершины или дуга окружности
+enum class JoinType { Miter, Square, Round };
+
 namespace TrapezoidOperations {
+    using TrapezoidSink = std::function<void(const Trapezoid&)>;
+
+    // Добавляет левую и правую границы трапецоидов в список рёбер для sweep
+    void appendEdges(const std::vector<Trapezoid>& trapezoids, int operand, std::vector<SweepEdge>& edges);
+    void appendEdges(const TrapezoidBuffer& trapezoids, int operand, std::vector<SweepEdge>& edges);
+
+    // Построчный проход по рёбрам: выдаёт в sink трапецоиды области, где выполняется операция.
+    // Сортирует события по y один раз и ведёт упорядоченный по x список активных рёбер; событие
+    // пересчитывает только рёбра рядом с изменившимися, а трапецоиды с прежними границами растут дальше
+    // без просмотра: O((n + k) log n), где n - рёбра, k - пересечения
+    void sweep(std::vector<SweepEdge> edges, BooleanOperation operation, const TrapezoidSink& sink);
+
+    // Параллельный вариант: диапазон по y делится на bands полос (по умолчанию 4 на поток) с равным числом рёбер,
+    // полосы обрабатываются в пуле потоков и сшиваются по границам в порядке полос.
+    // Результат совпадает с последовательным проходом с точностью до порядка трапецоидов
+    void sweep(std::vector<SweepEdge> edges, BooleanOperation operation, const TrapezoidSink& sink, ThreadPool& pool, size_t bands = 0);
+
     std::vector<Trapezoid> unite(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2);
     std::vector<Trapezoid> intersect(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2);
     std::vector<Trapezoid> subtract(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2);
+
+    // Многопоточные варианты, threads <= 1 - последовательный проход
+    std::vector<Trapezoid> unite(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, size_t threads);
+    std::vector<Trapezoid> intersect(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, size_t threads);
+    std::vector<Trapezoid> subtract(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, size_t threads);
+
+    // Варианты на готовом пуле: потоки не создаются на каждый вызов, пул можно передавать в серию операций
+    std::vector<Trapezoid> unite(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, ThreadPool& pool);
+    std::vector<Trapezoid> intersect(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, ThreadPool& pool);
+    std::vector<Trapezoid> subtract(const std::vector<Trapezoid>& trapezoids1, const std::vector<Trapezoid>& trapezoids2, ThreadPool& pool);
+
+    // Те же операции над буфером в формате структуры массивов
+    TrapezoidBuffer unite(const TrapezoidBuffer& trapezoids1, const TrapezoidBuffer& trapezoids2);
+    TrapezoidBuffer intersect(const TrapezoidBuffer& trapezoids1, const TrapezoidBuffer& trapezoids2);
+    TrapezoidBuffer subtract(const TrapezoidBuffer& trapezoids1, const TrapezoidBuffer& trapezoids2);
 }
 
 namespace PolygonOperations {
-    std::vector<Polygon> modifyPolygon(const std::vector<Polygon>& polygons, float size);
+    // Смещение границ на size: > 0 - расширение, < 0 - сужение. Полигоны предварительно объединяются,
+    // перекрытия результата сливаются, поэтому число полигонов может измениться.
+    // miter_limit - наибольшее удаление угла Miter от вершины в единицах |size|, дальше угол срезается
+    std::vector<Polygon> modifyPolygon(const std::vector<Polygon>& polygons, double size,
+                                       JoinType join = JoinType::Miter, double miter_limit = 2.0);
+
+    // Удвоенная ориентированная площадь контура: > 0 для обхода против часовой стрелки
+    double signedArea(const std::vector<Point>& contour);
+    double signedArea(const ContourView& contour);
+    // Для контуров в целых единицах базы данных площадь вычисляется точно (см. CoordinateTraits)
+    template <typename T>
+    typename CoordinateTraits<T>::wide_type signedArea(const std::vector<BasicPoint<T>>& contour);
+
+    // Знак поворота a -> b -> c: 1 - влево, -1 - вправо, 0 - точки на одной прямой. Для целых координат точен
+    template <typename T>
+    int orientation(const BasicPoint<T>& a, const BasicPoint<T>& b, const BasicPoint<T>& c);
+
+    // Добавляет рёбра внешнего контура и дырок в список для sweep.
+    // Ориентация контуров нормализуется: внешний контур даёт +1 к числу обхода, дырка -1
+    void appendEdges(const Polygon& polygon, int operand, std::vector<SweepEdge>& edges);
+    void appendEdges(const PolygonView& polygon, int operand, std::vector<SweepEdge>& edges);
+
+    // Разбиение полигона с дырками на горизонтальные трапецоиды, результат выдаётся в sink по мере готовности
+    void decompose(const Polygon& polygon, const TrapezoidOperations::TrapezoidSink& sink);
+    std::vector<Trapezoid> decompose(const Polygon& polygon);
 }
 
 namespace LayerOperations {
     void copyLayerFromLayerPack(LayerPack& layerpack, const std::string& sourceLayerName, const std::string& targetLayerName);
     void copyLayerFromLayerPack(const LayerPack& layerpack1, LayerPack& layerpack2, const std::string& sourceLayerName, const std::string& targetLayerName);
     bool layerIsEmpty(const Layer& layer);
+
+    // Преобразование всех вершин слоя на месте; при threads > 1 полигоны (в компактном режиме - вершины) делятся между потоками
+    void transformLayer(Layer& layer, const AffineTransform& transform, size_t threads = 1);
+    void transformLayerPack(LayerPack& layerpack, const AffineTransform& transform, size_t threads = 1);
+    // Варианты на готовом пуле; transformLayerPack с threads > 1 создаёт один пул на все слои
+    void transformLayer(Layer& layer, const AffineTransform& transform, ThreadPool& pool);
+    void transformLayerPack(LayerPack& layerpack, const AffineTransform& transform, ThreadPool& pool);
+
+    // Разбиение всего слоя (объединения его полигонов) на горизонтальные трапецоиды
+    void decomposeLayer(const Layer& layer, const TrapezoidOperations::TrapezoidSink& sink);
+    std::vector<Trapezoid> decomposeLayer(const Layer& layer);
+
+    // Сборка непересекающихся трапецоидов в полигоны с дырками: совпадающие рёбра соседних
+    // трапецоидов взаимно уничтожаются, оставшиеся сшиваются в замкнутые контуры и добавляются в target.
+    // Углы на одной высоте, отличающиеся на ошибку округления, сводятся к одной вершине.
+    // Бросает std::runtime_error, если контур не замыкается (трапецоиды перекрываются)
+    void reconstructLayer(const std::vector<Trapezoid>& trapezoids, Layer& target);
+
+    // Смещение границ объединения полигонов слоя (см. PolygonOperations::modifyPolygon), результат добавляется в target.
+    // Область и полосы вдоль её рёбер объединяются (при сужении - вычитаются) одним проходом sweep
+    // (оценку см. TrapezoidOperations::sweep)
+    void sizeLayer(const Layer& layer, double distance, Layer& target,
+                   JoinType join = JoinType::Miter, double miter_limit = 2.0);
+
+    // Перевод полигонов слоя в целые единицы базы данных размером unit с округлением к ближайшему.
+    // Результат - отдельные полигоны для точных предикатов: слоёв и булевых операций над целыми координатами нет.
+    // Бросает std::out_of_range, если координата не помещается в T
+    template <typename T>
+    std::vector<BasicPolygon<T>> toDatabaseUnits(const Layer& layer, double unit);
+    // Обратный перевод, полигоны добавляются в target
+    template <typename T>
+    void fromDatabaseUnits(const std::vector<BasicPolygon<T>>& polygons, double unit, Layer& target);
 }
 
 
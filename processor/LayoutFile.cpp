@@ -0,0 +1,265 @@
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include "LayoutFile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LAYOUT_FILE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Таблицы смещений отображаются напрямую в size_t, а вершины - в Point
+static_assert(sizeof(size_t) == sizeof(uint64_t), "Формат требует 64-битного size_t");
+static_assert(sizeof(Point) == 2 * sizeof(double), "Point должен состоять ровно из двух double");
+
+namespace LayoutFile {
+
+    namespace {
+
+        uint64_t align8(uint64_t offset) {
+            return (offset + 7) & ~uint64_t(7);
+        }
+
+        void writeBytes(std::ofstream& out, const void* data, uint64_t size) {
+            out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        }
+
+        void writePadding(std::ofstream& out, uint64_t size) {
+            static const char zeros[8] = {};
+            writeBytes(out, zeros, align8(size) - size);
+        }
+
+        // Количества для слоя в обычном режиме
+        void countLayer(const Layer& layer, LayerEntry& entry) {
+            entry.polygon_count = layer.size();
+            entry.contour_count = 0;
+            entry.vertex_count = 0;
+            for (const Polygon& polygon : layer.get_polygons()) {
+                entry.contour_count += 1 + polygon.get_holes().size();
+                entry.vertex_count += polygon.get_vertices().size();
+                for (const Hole& hole : polygon.get_holes())
+                    entry.vertex_count += hole.get_vertices().size();
+            }
+        }
+
+        // Таблицы слоя в обычном режиме строятся при записи, без промежуточной упаковки
+        void writeLayer(std::ofstream& out, const Layer& layer) {
+            uint64_t value = 0;
+            writeBytes(out, &value, sizeof(value));
+            for (const Polygon& polygon : layer.get_polygons()) {
+                value += 1 + polygon.get_holes().size();
+                writeBytes(out, &value, sizeof(value));
+            }
+
+            value = 0;
+            writeBytes(out, &value, sizeof(value));
+            for (const Polygon& polygon : layer.get_polygons()) {
+                value += polygon.get_vertices().size();
+                writeBytes(out, &value, sizeof(value));
+                for (const Hole& hole : polygon.get_holes()) {
+                    value += hole.get_vertices().size();
+                    writeBytes(out, &value, sizeof(value));
+                }
+            }
+
+            for (const Polygon& polygon : layer.get_polygons()) {
+                writeBytes(out, polygon.get_vertices().data(), polygon.get_vertices().size() * sizeof(Point));
+                for (const Hole& hole : polygon.get_holes())
+                    writeBytes(out, hole.get_vertices().data(), hole.get_vertices().size() * sizeof(Point));
+            }
+        }
+
+        void writeCompactLayer(std::ofstream& out, const CompactPolygons& compact) {
+            writeBytes(out, compact.get_polygon_offsets(), (compact.size() + 1) * sizeof(uint64_t));
+            writeBytes(out, compact.get_contour_offsets(), (compact.contour_count() + 1) * sizeof(uint64_t));
+            writeBytes(out, compact.get_vertices().data(), compact.vertex_count() * sizeof(Point));
+        }
+
+        // Отображённый файл; освобождается, когда на него не ссылается ни один слой
+        class Mapping {
+        public:
+            const char* data = nullptr;
+            uint64_t size = 0;
+
+            explicit Mapping(const std::string& path) {
+#ifdef LAYOUT_FILE_MMAP
+                int fd = ::open(path.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    throw std::runtime_error("Не удалось открыть файл \"" + path + "\"");
+                }
+                struct stat info;
+                if (fstat(fd, &info) != 0) {
+                    ::close(fd);
+                    throw std::runtime_error("Не удалось определить размер файла \"" + path + "\"");
+                }
+                size = static_cast<uint64_t>(info.st_size);
+                if (size > 0) {
+                    void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (address == MAP_FAILED) {
+                        ::close(fd);
+                        throw std::runtime_error("Не удалось отобразить файл \"" + path + "\" в память");
+                    }
+                    data = static_cast<const char*>(address);
+                }
+                ::close(fd);
+#else
+                // Без mmap файл читается целиком; формат и поведение слоёв те же
+                std::ifstream in(path, std::ios::binary | std::ios::ate);
+                if (!in) {
+                    throw std::runtime_error("Не удалось открыть файл \"" + path + "\"");
+                }
+                size = static_cast<uint64_t>(in.tellg());
+                buffer.resize(size / sizeof(uint64_t) + 1);
+                in.seekg(0);
+                in.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(size));
+                data = reinterpret_cast<const char*>(buffer.data());
+#endif
+            }
+
+            ~Mapping() {
+#ifdef LAYOUT_FILE_MMAP
+                if (data)
+                    munmap(const_cast<char*>(data), size);
+#endif
+            }
+
+            Mapping(const Mapping&) = delete;
+            Mapping& operator=(const Mapping&) = delete;
+
+        private:
+#ifndef LAYOUT_FILE_MMAP
+            std::vector<uint64_t> buffer;
+#endif
+        };
+
+        // Проверка, что count элементов размера element_size по смещению offset лежат внутри файла
+        void checkRange(uint64_t offset, uint64_t count, uint64_t element_size, uint64_t file_size) {
+            if (offset > file_size || count > (file_size - offset) / element_size) {
+                throw std::runtime_error("Повреждённый файл: данные выходят за пределы файла");
+            }
+        }
+
+        // Таблица смещений из count + 1 значений должна начинаться с нуля, заканчиваться на total
+        // и не убывать; при strict каждый элемент непуст (у полигона есть хотя бы внешний контур)
+        void checkOffsets(const size_t* offsets, uint64_t count, uint64_t total, bool strict) {
+            if (offsets[0] != 0 || offsets[count] != total) {
+                throw std::runtime_error("Повреждённый файл: таблицы смещений не согласованы");
+            }
+            for (uint64_t i = 0; i < count; ++i) {
+                if (offsets[i + 1] < offsets[i] || (strict && offsets[i + 1] == offsets[i])) {
+                    throw std::runtime_error("Повреждённый файл: таблица смещений не возрастает");
+                }
+            }
+        }
+    }
+
+    void save(const LayerPack& layerpack, const std::string& path) {
+        const std::vector<Layer>& layers = layerpack.get_layers();
+
+        // Размещение всех массивов вычисляется заранее, затем файл пишется одним проходом
+        std::vector<LayerEntry> entries(layers.size());
+        uint64_t offset = sizeof(Header) + layers.size() * sizeof(LayerEntry);
+        for (size_t i = 0; i < layers.size(); ++i) {
+            const Layer& layer = layers[i];
+            LayerEntry& entry = entries[i];
+            if (layer.is_compact()) {
+                const CompactPolygons& compact = layer.get_compact();
+                entry.polygon_count = compact.size();
+                entry.contour_count = compact.contour_count();
+                entry.vertex_count = compact.vertex_count();
+            } else {
+                countLayer(layer, entry);
+            }
+            entry.name_offset = offset;
+            entry.name_length = layer.get_name().size();
+            entry.polygon_offsets_offset = align8(entry.name_offset + entry.name_length);
+            entry.contour_offsets_offset = entry.polygon_offsets_offset + (entry.polygon_count + 1) * sizeof(uint64_t);
+            entry.vertices_offset = entry.contour_offsets_offset + (entry.contour_count + 1) * sizeof(uint64_t);
+            offset = entry.vertices_offset + entry.vertex_count * sizeof(Point);
+        }
+
+        Header header;
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.byte_order = BYTE_ORDER_MARK;
+        header.layer_count = layers.size();
+        header.directory_offset = sizeof(Header);
+        header.file_size = offset;
+
+        std::vector<char> buffer(1 << 20);
+        std::ofstream out;
+        out.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Не удалось создать файл \"" + path + "\"");
+        }
+
+        writeBytes(out, &header, sizeof(header));
+        writeBytes(out, entries.data(), entries.size() * sizeof(LayerEntry));
+        for (size_t i = 0; i < layers.size(); ++i) {
+            writeBytes(out, layers[i].get_name().data(), entries[i].name_length);
+            writePadding(out, entries[i].name_length);
+            if (layers[i].is_compact())
+                writeCompactLayer(out, layers[i].get_compact());
+            else
+                writeLayer(out, layers[i]);
+        }
+
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("Ошибка записи в файл \"" + path + "\"");
+        }
+    }
+
+    LayerPack open(const std::string& path) {
+        std::shared_ptr<Mapping> mapping = std::make_shared<Mapping>(path);
+        const char* data = mapping->data;
+        uint64_t size = mapping->size;
+
+        Header header;
+        checkRange(0, 1, sizeof(Header), size);
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+            throw std::runtime_error("Файл \"" + path + "\" не является файлом LayerPack");
+        }
+        if (header.byte_order != BYTE_ORDER_MARK) {
+            throw std::runtime_error("Файл \"" + path + "\" записан с другим порядком байт");
+        }
+        if (header.version != VERSION) {
+            throw std::runtime_error("Неподдерживаемая версия файла \"" + path + "\": " + std::to_string(header.version));
+        }
+        if (header.file_size != size) {
+            throw std::runtime_error("Файл \"" + path + "\" обрезан или повреждён");
+        }
+        checkRange(header.directory_offset, header.layer_count, sizeof(LayerEntry), size);
+
+        // Проверяются каталог и таблицы смещений (один линейный проход); массив вершин не читается до обращения к нему
+        LayerPack layerpack;
+        const LayerEntry* directory = reinterpret_cast<const LayerEntry*>(data + header.directory_offset);
+        for (uint64_t i = 0; i < header.layer_count; ++i) {
+            LayerEntry entry = directory[i];
+            checkRange(entry.name_offset, entry.name_length, 1, size);
+            checkRange(entry.polygon_offsets_offset, entry.polygon_count + 1, sizeof(uint64_t), size);
+            checkRange(entry.contour_offsets_offset, entry.contour_count + 1, sizeof(uint64_t), size);
+            checkRange(entry.vertices_offset, entry.vertex_count, sizeof(Point), size);
+            if ((entry.polygon_offsets_offset | entry.contour_offsets_offset | entry.vertices_offset) % 8 != 0) {
+                throw std::runtime_error("Повреждённый файл: массивы слоя не выровнены");
+            }
+
+            const size_t* polygon_offsets = reinterpret_cast<const size_t*>(data + entry.polygon_offsets_offset);
+            const size_t* contour_offsets = reinterpret_cast<const size_t*>(data + entry.contour_offsets_offset);
+            checkOffsets(polygon_offsets, entry.polygon_count, entry.contour_count, true);
+            checkOffsets(contour_offsets, entry.contour_count, entry.vertex_count, false);
+
+            CompactPolygons polygons(std::shared_ptr<const void>(mapping, data),
+                                     reinterpret_cast<const Point*>(data + entry.vertices_offset), entry.vertex_count,
+                                     contour_offsets, entry.contour_count,
+                                     polygon_offsets, entry.polygon_count);
+            layerpack.append_layer(Layer(std::string(data + entry.name_offset, entry.name_length), std::move(polygons)));
+        }
+        return layerpack;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef LAYOUTFILE_H
+#define LAYOUTFILE_H
+
+#include <cstdint>
+#include <string>
+#include "Entity.h"
+
+// Двоичный формат LayerPack для отображения в память.
+//
+// Все числа little-endian, все массивы выровнены на 8 байт:
+//   заголовок   - Header;
+//   каталог     - header.layer_count записей LayerEntry;
+//   данные      - для каждого слоя имя, таблица смещений полигонов (polygon_count + 1 значений uint64),
+//                 таблица смещений контуров (contour_count + 1 значений uint64) и координаты вершин
+//                 (vertex_count пар double).
+// Таблицы имеют тот же смысл, что и в CompactPolygons, поэтому открытые слои ссылаются
+// прямо на отображённый файл и копируются только при изменении.
+namespace LayoutFile {
+    const char MAGIC[8] = {'L', 'A', 'Y', 'O', 'U', 'T', 'P', 'K'};
+    const uint32_t VERSION = 1;
+    const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;        // BYTE_ORDER_MARK в порядке байт записавшей машины
+        uint64_t layer_count;
+        uint64_t directory_offset;
+        uint64_t file_size;
+    };
+
+    struct LayerEntry {
+        uint64_t name_offset;
+        uint64_t name_length;
+        uint64_t polygon_count;
+        uint64_t contour_count;
+        uint64_t vertex_count;
+        uint64_t polygon_offsets_offset;
+        uint64_t contour_offsets_offset;
+        uint64_t vertices_offset;
+    };
+
+    // Запись всех слоёв; слои в компактном режиме пишутся без распаковки
+    void save(const LayerPack& layerpack, const std::string& path);
+
+    // Открытие через mmap: читаются заголовок, каталог и таблицы смещений (проверяется, что они не убывают
+    // и не выходят за свои массивы), слои возвращаются в компактном режиме и ссылаются на отображённую
+    // память, которая освобождается вместе с последним слоем.
+    // Ошибки формата и ввода-вывода сообщаются исключением std::runtime_error
+    LayerPack open(const std::string& path);
+}
+
+#endif // LAYOUTFILE_H
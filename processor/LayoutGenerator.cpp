@@ -0,0 +1,99 @@
+#include <cmath>
+#include <random>
+#include "LayoutGenerator.h"
+
+namespace LayoutGenerator {
+    namespace {
+        Polygon rectangle(double x1, double y1, double x2, double y2) {
+            return Polygon({{x1, y1}, {x2, y1}, {x2, y2}, {x1, y2}});
+        }
+    }
+
+    Layer manhattanGrid(size_t rows, size_t cols, double pitch, double fill, double overlap, uint32_t seed) {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        std::vector<Polygon> polygons;
+        polygons.reserve(static_cast<size_t>(rows * cols * fill) + 1);
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t j = 0; j < cols; ++j) {
+                if (unit(random) >= fill)
+                    continue;
+                double x = j * pitch;
+                double y = i * pitch;
+                double width = pitch * (0.2 + 0.6 * unit(random));
+                double height = pitch * (0.2 + 0.6 * unit(random));
+                // Вытянутые прямоугольники заходят на соседний узел и перекрываются с ним
+                if (unit(random) < overlap) {
+                    if (unit(random) < 0.5)
+                        width += pitch;
+                    else
+                        height += pitch;
+                }
+                polygons.push_back(rectangle(x, y, x + width, y + height));
+            }
+        }
+        return Layer("ManhattanGrid", polygons);
+    }
+
+    Layer viaArray(size_t rows, size_t cols, double size, double pitch) {
+        std::vector<Polygon> polygons;
+        polygons.reserve(rows * cols);
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t j = 0; j < cols; ++j) {
+                double x = j * pitch;
+                double y = i * pitch;
+                polygons.push_back(rectangle(x, y, x + size, y + size));
+            }
+        }
+        return Layer("ViaArray", polygons);
+    }
+
+    Layer diagonalWires(size_t count, size_t segments, double segment_length, double width, double pitch) {
+        // Сдвиг по x, при котором горизонтальное сечение провода под 45 градусов имеет ширину width
+        double half = width / std::sqrt(2.0);
+        double step = segment_length / std::sqrt(2.0);
+        std::vector<Polygon> polygons;
+        polygons.reserve(count);
+        for (size_t k = 0; k < count; ++k) {
+            // Осевая линия идёт вверх, чередуя наклоны +45 и -45 градусов
+            std::vector<Point> axis;
+            axis.reserve(segments + 1);
+            double x = k * pitch;
+            for (size_t s = 0; s <= segments; ++s) {
+                axis.emplace_back(x, s * step);
+                x += s % 2 == 0 ? step : -step;
+            }
+            std::vector<Point> vertices;
+            vertices.reserve(2 * axis.size());
+            for (const Point& p : axis)
+                vertices.emplace_back(p.x + half, p.y);
+            for (size_t s = axis.size(); s-- > 0;)
+                vertices.emplace_back(axis[s].x - half, axis[s].y);
+            polygons.emplace_back(vertices);
+        }
+        return Layer("DiagonalWires", polygons);
+    }
+
+    Layer perforatedPlates(size_t count, size_t holes, double side, uint32_t seed) {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        double cell = side / (holes + 1);
+        std::vector<Polygon> polygons;
+        polygons.reserve(count);
+        for (size_t k = 0; k < count; ++k) {
+            double origin = k * side * 1.5;
+            Polygon plate = rectangle(origin, 0, origin + side, side);
+            for (size_t i = 0; i < holes; ++i) {
+                for (size_t j = 0; j < holes; ++j) {
+                    // Дырки по часовой стрелке, размер и положение в пределах своей ячейки случайны
+                    double size = cell * (0.2 + 0.3 * unit(random));
+                    double x = origin + cell * (j + 0.75) + (cell / 2 - size) * unit(random);
+                    double y = cell * (i + 0.75) + (cell / 2 - size) * unit(random);
+                    plate.add_hole(Hole({{x, y}, {x, y + size}, {x + size, y + size}, {x + size, y}}));
+                }
+            }
+            polygons.push_back(std::move(plate));
+        }
+        return Layer("PerforatedPlates", polygons);
+    }
+}
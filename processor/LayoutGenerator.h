@@ -0,0 +1,25 @@
+#ifndef LAYOUTGENERATOR_H
+#define LAYOUTGENERATOR_H
+
+#include <cstdint>
+#include "Entity.h"
+
+// Синтетические слои для бенчмарков и тестов. Результат зависит только от параметров и seed
+namespace LayoutGenerator {
+    // Прямоугольники со случайными размерами в узлах сетки rows x cols с шагом pitch.
+    // fill - доля занятых узлов, overlap - доля прямоугольников, вытянутых до соседнего узла
+    Layer manhattanGrid(size_t rows, size_t cols, double pitch, double fill = 0.7, double overlap = 0.2,
+                        uint32_t seed = 1);
+
+    // Плотный массив квадратных переходных отверстий со стороной size
+    Layer viaArray(size_t rows, size_t cols, double size, double pitch);
+
+    // Длинные провода шириной width под 45 градусов с изломами через каждые segment_length:
+    // каждый провод - один полигон из 2 * (segments + 1) вершин
+    Layer diagonalWires(size_t count, size_t segments, double segment_length, double width, double pitch);
+
+    // Квадратные пластины со стороной side, в каждой holes x holes квадратных дырок
+    Layer perforatedPlates(size_t count, size_t holes, double side, uint32_t seed = 1);
+}
+
+#endif // LAYOUTGENERATOR_H
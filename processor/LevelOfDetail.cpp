@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include "LevelOfDetail.h"
+#include "Predicates.h"
+#include "Trace.h"
+
+namespace {
+    uint64_t mix(uint64_t hash, uint64_t value) {
+        return hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+    }
+
+    uint64_t hashContour(uint64_t hash, const std::vector<Point>& contour) {
+        hash = mix(hash, contour.size());
+        for (const Point& point : contour) {
+            uint64_t x, y;
+            std::memcpy(&x, &point.x, sizeof(x));
+            std::memcpy(&y, &point.y, sizeof(y));
+            hash = mix(mix(hash, x), y);
+        }
+        return hash;
+    }
+
+    uint64_t hashPolygon(const Polygon& polygon) {
+        uint64_t hash = hashContour(0, polygon.get_vertices());
+        for (const Hole& hole : polygon.get_holes())
+            hash = hashContour(hash, hole.get_vertices());
+        return hash;
+    }
+
+    // Хэш не различает все полигоны, поэтому найденный по нему полигон сверяется с исходным по вершинам
+    bool samePolygon(const Polygon& a, const Polygon& b) {
+        if (a.get_vertices() != b.get_vertices() || a.get_holes().size() != b.get_holes().size())
+            return false;
+        for (size_t i = 0; i < a.get_holes().size(); ++i) {
+            if (a.get_holes()[i].get_vertices() != b.get_holes()[i].get_vertices())
+                return false;
+        }
+        return true;
+    }
+
+    Box contourBox(const std::vector<Point>& contour) {
+        Box box;
+        for (const Point& point : contour)
+            box.expand(point);
+        return box;
+    }
+
+    double segmentDistance(const Point& p, const Point& a, const Point& b) {
+        double dx = b.x - a.x, dy = b.y - a.y;
+        double length = dx * dx + dy * dy;
+        double t = length > 0 ? std::clamp(((p.x - a.x) * dx + (p.y - a.y) * dy) / length, 0.0, 1.0) : 0.0;
+        return std::hypot(p.x - a.x - t * dx, p.y - a.y - t * dy);
+    }
+
+    // Дуглас-Пекер для замкнутого контура: начальные опорные вершины - нулевая и самая далёкая от неё.
+    // Пустой результат - контур выродился
+    std::vector<Point> simplifyContour(const std::vector<Point>& contour, double tolerance) {
+        size_t n = contour.size();
+        if (n <= 3)
+            return contour;
+        size_t far = 1;
+        for (size_t i = 2; i < n; ++i) {
+            if (std::hypot(contour[i].x - contour[0].x, contour[i].y - contour[0].y) >
+                std::hypot(contour[far].x - contour[0].x, contour[far].y - contour[0].y))
+                far = i;
+        }
+        std::vector<char> keep(n, 0);
+        keep[0] = keep[far] = 1;
+        std::vector<std::pair<size_t, size_t>> stack = {{0, far}, {far, n}};    // Индекс n - снова вершина 0
+        while (!stack.empty()) {
+            auto [from, to] = stack.back();
+            stack.pop_back();
+            const Point& a = contour[from];
+            const Point& b = contour[to % n];
+            size_t farthest = from;
+            double distance = tolerance;
+            for (size_t i = from + 1; i < to; ++i) {
+                double d = segmentDistance(contour[i], a, b);
+                if (d > distance) {
+                    distance = d;
+                    farthest = i;
+                }
+            }
+            if (farthest != from) {
+                keep[farthest] = 1;
+                stack.push_back({from, farthest});
+                stack.push_back({farthest, to});
+            }
+        }
+        std::vector<Point> result;
+        for (size_t i = 0; i < n; ++i) {
+            if (keep[i])
+                result.push_back(contour[i]);
+        }
+        if (result.size() < 3)
+            result.clear();
+        return result;
+    }
+
+    // Контуры не пересекают себя и друг друга, дырки лежат внутри внешнего контура и не друг в друге
+    bool validTopology(const std::vector<std::vector<Point>>& contours) {
+        struct Segment {
+            size_t contour, index;
+            Box box;
+        };
+        std::vector<Segment> segments;
+        for (size_t c = 0; c < contours.size(); ++c) {
+            const std::vector<Point>& contour = contours[c];
+            for (size_t i = 0; i < contour.size(); ++i) {
+                Box box;
+                box.expand(contour[i]);
+                box.expand(contour[(i + 1) % contour.size()]);
+                segments.push_back({c, i, box});
+            }
+        }
+        std::sort(segments.begin(), segments.end(), [](const Segment& a, const Segment& b) {
+            return a.box.min_x < b.box.min_x;
+        });
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const Segment& s = segments[i];
+            for (size_t j = i + 1; j < segments.size() && segments[j].box.min_x <= s.box.max_x; ++j) {
+                const Segment& t = segments[j];
+                if (!s.box.intersects(t.box))
+                    continue;
+                const std::vector<Point>& sc = contours[s.contour];
+                const std::vector<Point>& tc = contours[t.contour];
+                Predicates::IntersectionStatus status = Predicates::intersectSegments(
+                    sc[s.index], sc[(s.index + 1) % sc.size()], tc[t.index], tc[(t.index + 1) % tc.size()]).status;
+                size_t n = sc.size();
+                bool adjacent = s.contour == t.contour &&
+                    ((s.index + 1) % n == t.index || (t.index + 1) % n == s.index);
+                // Соседние отрезки касаются в общей вершине, но не должны накладываться
+                if (adjacent ? status == Predicates::IntersectionStatus::Overlap : status != Predicates::IntersectionStatus::None)
+                    return false;
+            }
+        }
+        Polygon outer(contours[0]);
+        for (size_t h = 1; h < contours.size(); ++h) {
+            if (!outer.contains(contours[h][0]))
+                return false;
+            for (size_t other = 1; other < contours.size(); ++other) {
+                if (other != h && Polygon(contours[other]).contains(contours[h][0]))
+                    return false;
+            }
+        }
+        return true;
+    }
+}
+
+LodPyramid::LodPyramid(const Layer& layer, double tolerance, size_t levels, double factor)
+    : layer(layer), tolerance(tolerance), factor(factor), slots(levels) {
+    if (!(tolerance > 0) || !(factor > 1)) {
+        throw std::invalid_argument("Допуск должен быть положительным, а множитель уровней - больше 1");
+    }
+}
+
+LodPyramid::~LodPyramid() {
+    for (Slot& slot : slots) {
+        if (slot.pending.valid())
+            slot.pending.wait();
+    }
+}
+
+size_t LodPyramid::level_count() const {
+    return slots.size() + 1;
+}
+
+double LodPyramid::get_tolerance(size_t level) const {
+    if (level >= level_count()) {
+        throw std::out_of_range("Уровень детализации выходит за границы");
+    }
+    return level == 0 ? 0 : tolerance * std::pow(factor, static_cast<double>(level - 1));
+}
+
+size_t LodPyramid::choose_level(double scale) const {
+    double pixel = 1 / scale;
+    for (size_t level = slots.size(); level > 0; --level) {
+        if (get_tolerance(level) <= pixel)
+            return level;
+    }
+    return 0;
+}
+
+LodPyramid::Slot& LodPyramid::check_level(size_t level) {
+    if (level == 0 || level >= level_count()) {
+        throw std::out_of_range("Уровень детализации выходит за границы");
+    }
+    return slots[level - 1];
+}
+
+// Забирает результат фонового построения, если он готов (или ждёт его при wait)
+void LodPyramid::collect(Slot& slot, bool wait) {
+    if (!slot.pending.valid())
+        return;
+    if (wait || slot.pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        slot.ready = slot.pending.get();
+}
+
+void LodPyramid::request(size_t level) {
+    if (level == 0)
+        return;
+    Slot& slot = check_level(level);
+    collect(slot, false);
+    uint64_t version = layer.get_version();
+    // Устаревшее построение не прерывается: новое начнётся при следующем запросе после его завершения
+    if (slot.pending.valid() || (slot.ready && slot.ready->version == version))
+        return;
+    slot.pending = std::async(std::launch::async, &LodPyramid::build, Layer(layer), slot.ready, get_tolerance(level));
+}
+
+const Layer* LodPyramid::try_level(size_t level) {
+    if (level == 0)
+        return &layer;
+    Slot& slot = check_level(level);
+    request(level);
+    return slot.ready ? &slot.ready->layer : nullptr;
+}
+
+const Layer& LodPyramid::get_level(size_t level) {
+    if (level == 0)
+        return layer;
+    Slot& slot = check_level(level);
+    collect(slot, true);
+    request(level);
+    collect(slot, true);
+    return slot.ready->layer;
+}
+
+bool LodPyramid::is_current(size_t level) const {
+    if (level == 0)
+        return true;
+    if (level >= level_count()) {
+        throw std::out_of_range("Уровень детализации выходит за границы");
+    }
+    const Slot& slot = slots[level - 1];
+    return slot.ready && slot.ready->version == layer.get_version();
+}
+
+size_t LodPyramid::reused_polygons(size_t level) const {
+    if (level == 0 || level >= level_count()) {
+        throw std::out_of_range("Уровень детализации выходит за границы");
+    }
+    const Slot& slot = slots[level - 1];
+    return slot.ready ? slot.ready->reused : 0;
+}
+
+std::shared_ptr<const LodPyramid::Level> LodPyramid::build(Layer snapshot, std::shared_ptr<const Level> previous, double tolerance) {
+    TRACE_SCOPE("lod_build");
+    auto level = std::make_shared<Level>();
+    level->version = snapshot.get_version();
+    snapshot.unpack();              // Распаковывается только снимок уровня, слой вызывающего остаётся компактным
+    level->source = std::move(snapshot);
+    const std::vector<Polygon>& polygons = level->source.get_polygons();
+
+    auto simplify = [tolerance](const Polygon& polygon) {
+        Simplified result;
+        result.box = polygon.get_bounding_box();
+        result.small = result.box.max_x - result.box.min_x < tolerance && result.box.max_y - result.box.min_y < tolerance;
+        if (result.small)
+            return result;
+        // Если упрощение ломает топологию, допуск уменьшается; в крайнем случае полигон остаётся как есть
+        for (double t = tolerance; t > tolerance / 16; t /= 2) {
+            std::vector<std::vector<Point>> contours = {simplifyContour(polygon.get_vertices(), t)};
+            if (contours[0].empty())
+                continue;
+            for (const Hole& hole : polygon.get_holes()) {
+                Box box = contourBox(hole.get_vertices());
+                if (box.max_x - box.min_x < t && box.max_y - box.min_y < t)
+                    continue;       // Дырка меньше допуска исчезает
+                std::vector<Point> simplified = simplifyContour(hole.get_vertices(), t);
+                if (!simplified.empty())
+                    contours.push_back(std::move(simplified));
+            }
+            if (validTopology(contours)) {
+                std::vector<Hole> holes(contours.begin() + 1, contours.end());
+                result.polygon = Polygon(contours[0], holes);
+                return result;
+            }
+        }
+        result.polygon = polygon;
+        return result;
+    };
+
+    std::vector<Polygon> result;
+    std::map<std::pair<int64_t, int64_t>, Box> cells;     // Объединённые мелкие полигоны
+    double cell = tolerance * MERGE_CELLS;
+    Simplified collided;            // Полигон с занятым другим полигоном хэшем упрощается без запоминания
+    for (size_t i = 0; i < polygons.size(); ++i) {
+        const Polygon& polygon = polygons[i];
+        uint64_t hash = hashPolygon(polygon);
+        auto it = level->polygons.find(hash);
+        if (it == level->polygons.end()) {
+            const Simplified* old = nullptr;
+            if (previous) {
+                auto found = previous->polygons.find(hash);
+                if (found != previous->polygons.end()
+                    && samePolygon(previous->source.get_polygons()[found->second.source], polygon))
+                    old = &found->second;
+            }
+            if (old) {
+                it = level->polygons.emplace(hash, *old).first;
+                ++level->reused;
+            } else {
+                it = level->polygons.emplace(hash, simplify(polygon)).first;
+            }
+            it->second.source = i;
+        }
+        const Simplified* found = &it->second;
+        if (found->source != i && !samePolygon(polygons[found->source], polygon)) {
+            collided = simplify(polygon);
+            found = &collided;
+        }
+        const Simplified& simplified = *found;
+        if (simplified.small) {
+            std::pair<int64_t, int64_t> key(static_cast<int64_t>(std::floor((simplified.box.min_x + simplified.box.max_x) / 2 / cell)),
+                                            static_cast<int64_t>(std::floor((simplified.box.min_y + simplified.box.max_y) / 2 / cell)));
+            cells[key].expand(simplified.box);
+        } else {
+            result.push_back(simplified.polygon);
+        }
+    }
+    for (const auto& [key, box] : cells)
+        result.push_back(Polygon({{box.min_x, box.min_y}, {box.max_x, box.min_y}, {box.max_x, box.max_y}, {box.min_x, box.max_y}}));
+    TRACE_COUNT("polygons_in", polygons.size());
+    TRACE_COUNT("polygons_out", result.size());
+    TRACE_COUNT("reused", level->reused);
+
+    level->layer = Layer(level->source.get_name(), result);
+    return level;
+}
@@ -0,0 +1,82 @@
+#ifndef LEVELOFDETAIL_H
+#define LEVELOFDETAIL_H
+
+#include <future>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "Entity.h"
+
+// Пирамида упрощённых копий слоя для мелких масштабов.
+//
+// Уровень 0 - сам слой, уровень k >= 1 строится с допуском tolerance * factor^(k - 1):
+// контуры упрощаются алгоритмом Дугласа-Пекера, и если упрощение создаёт самопересечение,
+// пересечение контуров или выносит дырку из полигона, допуск для этого полигона уменьшается.
+// Топология между разными полигонами не проверяется. Полигоны меньше допуска по обеим осям
+// объединяются в прямоугольники по сетке с шагом MERGE_CELLS допусков.
+//
+// Уровни строятся по запросу в фоновом потоке по копии слоя (копирование слоя - O(1), см. Layer),
+// поэтому слой можно править во время построения. Упрощённые полигоны запоминаются по хэшу вершин,
+// и после правки заново упрощаются только изменённые полигоны. Совпадение хэша проверяется сравнением
+// вершин с исходным полигоном: уровень держит свой снимок слоя, пока не будет построен заново.
+// Слой должен жить дольше пирамиды; методы пирамиды вызываются из одного потока
+class LodPyramid {
+public:
+    static const size_t MERGE_CELLS = 4;
+
+    // Бросает std::invalid_argument, если tolerance <= 0 или factor <= 1
+    LodPyramid(const Layer& layer, double tolerance, size_t levels = 4, double factor = 4);
+    ~LodPyramid();                                  // Дожидается фоновых построений
+
+    LodPyramid(const LodPyramid&) = delete;
+    LodPyramid& operator=(const LodPyramid&) = delete;
+
+    size_t level_count() const;                     // Вместе с уровнем 0
+    double get_tolerance(size_t level) const;
+    // Самый грубый уровень, допуск которого не больше пикселя при scale пикселей на единицу
+    size_t choose_level(double scale) const;
+
+    // Запускает фоновое построение уровня, если он устарел и ещё не строится
+    void request(size_t level);
+    // Последний построенный уровень, возможно устаревший, без ожидания; nullptr, если уровень ещё не построен.
+    // Устаревший уровень заодно запрашивается. Указатель действителен до следующего вызова try_level или get_level
+    const Layer* try_level(size_t level);
+    // Актуальный уровень; при необходимости строит его и ждёт
+    const Layer& get_level(size_t level);
+    bool is_current(size_t level) const;
+
+    // Сколько полигонов последнее построение уровня взяло из прошлого построения без упрощения
+    size_t reused_polygons(size_t level) const;
+
+private:
+    struct Simplified {
+        bool small;         // Заменяется прямоугольником при объединении
+        Box box;
+        Polygon polygon;
+        size_t source = 0;  // Номер исходного полигона в Level::source
+    };
+
+    struct Level {
+        uint64_t version;
+        Layer source;       // Снимок, по которому построен уровень (полигоны разделяются со слоем, пока он не изменён)
+        Layer layer;
+        std::unordered_map<uint64_t, Simplified> polygons;  // По хэшу вершин исходного полигона
+        size_t reused = 0;
+    };
+
+    struct Slot {
+        std::shared_ptr<const Level> ready;
+        std::future<std::shared_ptr<const Level>> pending;
+    };
+
+    const Layer& layer;
+    double tolerance;
+    double factor;
+    std::vector<Slot> slots;        // slots[k - 1] - уровень k
+
+    Slot& check_level(size_t level);
+    void collect(Slot& slot, bool wait);
+    static std::shared_ptr<const Level> build(Layer snapshot, std::shared_ptr<const Level> previous, double tolerance);
+};
+
+#endif // LEVELOFDETAIL_H
@@ -0,0 +1,1061 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <zlib.h>
+#include "OasisFile.h"
+#include "GeometryOperations.h"
+
+namespace OasisFile {
+
+    namespace {
+
+        const char MAGIC[] = "%SEMI-OASIS\r\n";
+        const size_t MAGIC_SIZE = sizeof(MAGIC) - 1;
+
+        enum Record : uint64_t {
+            PAD = 0,
+            START = 1,
+            END = 2,
+            CELLNAME_IMPLICIT = 3,
+            CELLNAME = 4,
+            TEXTSTRING_IMPLICIT = 5,
+            TEXTSTRING = 6,
+            PROPNAME_IMPLICIT = 7,
+            PROPNAME = 8,
+            PROPSTRING_IMPLICIT = 9,
+            PROPSTRING = 10,
+            LAYERNAME = 11,
+            LAYERNAME_TEXT = 12,
+            CELL_REFERENCE = 13,
+            CELL = 14,
+            XYABSOLUTE = 15,
+            XYRELATIVE = 16,
+            RECTANGLE = 20,
+            POLYGON = 21,
+            CBLOCK = 34,
+        };
+
+        // Биты info-byte записей RECTANGLE и POLYGON
+        const unsigned char INFO_SQUARE = 0x80;
+        const unsigned char INFO_WIDTH = 0x40;
+        const unsigned char INFO_HEIGHT = 0x20;
+        const unsigned char INFO_POINTS = 0x20;
+        const unsigned char INFO_X = 0x10;
+        const unsigned char INFO_Y = 0x08;
+        const unsigned char INFO_REPETITION = 0x04;
+        const unsigned char INFO_DATATYPE = 0x02;
+        const unsigned char INFO_LAYER = 0x01;
+
+        const size_t BLOCK_SIZE = 1 << 18;      // Объём записей в одном блоке CBLOCK
+        const size_t BUFFER_SIZE = 1 << 20;
+        const size_t END_RECORD_SIZE = 256;
+        const int64_t MAX_COORDINATE = int64_t(1) << 53;
+
+        using Bytes = std::vector<unsigned char>;
+        using Position = std::pair<int64_t, int64_t>;
+
+        // Направления 3-дельт и октангулярных g-дельт: E, N, W, S, NE, NW, SW, SE
+        const int DIRECTION_X[8] = {1, 0, -1, 0, 1, -1, -1, 1};
+        const int DIRECTION_Y[8] = {0, 1, 0, -1, 1, 1, -1, -1};
+
+        // Кодирование целых: 7 бит на байт, младшие первыми; у знаковых знак в младшем бите
+        void putUint(Bytes& out, uint64_t value) {
+            while (value >= 0x80) {
+                out.push_back(static_cast<unsigned char>(value | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<unsigned char>(value));
+        }
+
+        void putSint(Bytes& out, int64_t value) {
+            uint64_t magnitude = value < 0 ? uint64_t(-(value + 1)) + 1 : uint64_t(value);
+            putUint(out, magnitude << 1 | (value < 0 ? 1 : 0));
+        }
+
+        void putString(Bytes& out, const std::string& text) {
+            putUint(out, text.size());
+            out.insert(out.end(), text.begin(), text.end());
+        }
+
+        // Целые значения пишутся как тип 0, остальные - как IEEE double (тип 7)
+        void putReal(Bytes& out, double value) {
+            if (value >= 0 && value == std::floor(value) && value < 9007199254740992.0) {
+                putUint(out, 0);
+                putUint(out, static_cast<uint64_t>(value));
+                return;
+            }
+            putUint(out, 7);
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            for (int i = 0; i < 8; ++i) {
+                out.push_back(static_cast<unsigned char>(bits >> (8 * i)));
+            }
+        }
+
+        // g-дельта в общей форме: |dx| со знаком и флагом формы, затем dy
+        void putGDelta(Bytes& out, int64_t dx, int64_t dy) {
+            uint64_t magnitude = dx < 0 ? uint64_t(-dx) : uint64_t(dx);
+            putUint(out, magnitude << 2 | (dx < 0 ? 2 : 0) | 1);
+            putSint(out, dy);
+        }
+
+        bool isNameString(const std::string& text) {
+            return !text.empty() && std::all_of(text.begin(), text.end(), [](char c) {
+                return c > 0x20 && c < 0x7F;
+            });
+        }
+
+        // Вершины в единицах сетки без повторов и без вершин на продолжении соседних рёбер;
+        // начальной становится наименьшая вершина, чтобы одинаковые фигуры давали одинаковый код
+        bool gridContour(const Point* points, size_t count, double scale, std::vector<Position>& out) {
+            out.clear();
+            for (size_t i = 0; i < count; ++i) {
+                double x = std::round(points[i].x * scale), y = std::round(points[i].y * scale);
+                if (!(std::abs(x) < MAX_COORDINATE && std::abs(y) < MAX_COORDINATE)) {
+                    throw std::out_of_range("Координата не помещается в сетку OASIS");
+                }
+                Position p(static_cast<int64_t>(x), static_cast<int64_t>(y));
+                if (out.empty() || out.back() != p)
+                    out.push_back(p);
+            }
+            while (out.size() > 1 && out.front() == out.back())
+                out.pop_back();
+
+            // Коллинеарность проверяется по нормированным направлениям рёбер, без переполнения
+            auto direction = [](const Position& a, const Position& b) {
+                int64_t dx = b.first - a.first, dy = b.second - a.second;
+                int64_t g = std::gcd(dx < 0 ? -dx : dx, dy < 0 ? -dy : dy);
+                return Position(dx / g, dy / g);
+            };
+            auto collinear = [&](const Position& a, const Position& b, const Position& c) {
+                if (a == b || b == c)
+                    return true;    // Совпадение после удаления соседней вершины
+                Position d1 = direction(a, b), d2 = direction(b, c);
+                return d1 == d2 || (d1.first == -d2.first && d1.second == -d2.second);
+            };
+            bool changed = true;
+            while (changed && out.size() >= 3) {
+                changed = false;
+                for (size_t i = 0; i < out.size() && out.size() >= 3; ++i) {
+                    const Position& prev = out[(i + out.size() - 1) % out.size()];
+                    const Position& next = out[(i + 1) % out.size()];
+                    if (collinear(prev, out[i], next)) {
+                        out.erase(out.begin() + i);
+                        changed = true;
+                        --i;
+                    }
+                }
+            }
+            if (out.size() < 3)
+                return false;
+            std::rotate(out.begin(), std::min_element(out.begin(), out.end()), out.end());
+            return true;
+        }
+
+        // Ключ фигуры - тип записи и её описание без положения; положение - первая вершина
+        void encodeShape(const std::vector<Position>& contour, Bytes& key, Position& position) {
+            key.clear();
+            size_t n = contour.size();
+            position = contour[0];
+
+            bool manhattan = true, octangular = true;
+            for (size_t i = 0; i < n; ++i) {
+                int64_t dx = contour[(i + 1) % n].first - contour[i].first;
+                int64_t dy = contour[(i + 1) % n].second - contour[i].second;
+                if (dx != 0 && dy != 0) {
+                    manhattan = false;
+                    if (dx != dy && dx != -dy)
+                        octangular = false;
+                }
+            }
+
+            if (manhattan && n == 4) {
+                int64_t min_x = contour[0].first, min_y = contour[0].second, max_x = min_x, max_y = min_y;
+                for (const Position& p : contour) {
+                    min_x = std::min(min_x, p.first);
+                    max_x = std::max(max_x, p.first);
+                    min_y = std::min(min_y, p.second);
+                    max_y = std::max(max_y, p.second);
+                }
+                key.push_back(RECTANGLE);
+                putUint(key, static_cast<uint64_t>(max_x - min_x));
+                putUint(key, static_cast<uint64_t>(max_y - min_y));
+                position = Position(min_x, min_y);
+                return;
+            }
+
+            key.push_back(POLYGON);
+            if (manhattan) {
+                // Рёбра чередуются, последняя вершина восстанавливается по первой
+                bool horizontal_first = contour[1].second == contour[0].second;
+                putUint(key, horizontal_first ? 0 : 1);
+                putUint(key, n - 2);
+                for (size_t i = 0; i + 2 < n; ++i) {
+                    int64_t dx = contour[i + 1].first - contour[i].first;
+                    int64_t dy = contour[i + 1].second - contour[i].second;
+                    putSint(key, dx != 0 ? dx : dy);
+                }
+            } else if (octangular) {
+                putUint(key, 3);
+                putUint(key, n - 1);
+                for (size_t i = 0; i + 1 < n; ++i) {
+                    int64_t dx = contour[i + 1].first - contour[i].first;
+                    int64_t dy = contour[i + 1].second - contour[i].second;
+                    int dir = 0;
+                    while (!(DIRECTION_X[dir] == (dx > 0) - (dx < 0) && DIRECTION_Y[dir] == (dy > 0) - (dy < 0)))
+                        ++dir;
+                    uint64_t magnitude = dx != 0 ? uint64_t(dx < 0 ? -dx : dx) : uint64_t(dy < 0 ? -dy : dy);
+                    putUint(key, magnitude << 3 | uint64_t(dir));
+                }
+            } else {
+                putUint(key, 4);
+                putUint(key, n - 1);
+                for (size_t i = 0; i + 1 < n; ++i) {
+                    putGDelta(key, contour[i + 1].first - contour[i].first, contour[i + 1].second - contour[i].second);
+                }
+            }
+        }
+
+        // Повторение для отсортированных положений: строка, столбец, решётка или произвольный список
+        void encodeRepetition(const std::vector<Position>& positions, Bytes& out) {
+            std::vector<int64_t> xs, ys;
+            for (const Position& p : positions) {
+                xs.push_back(p.first);
+                ys.push_back(p.second);
+            }
+            std::sort(xs.begin(), xs.end());
+            xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+            std::sort(ys.begin(), ys.end());
+            ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+            auto uniform = [](const std::vector<int64_t>& values) {
+                for (size_t i = 2; i < values.size(); ++i) {
+                    if (values[i] - values[i - 1] != values[1] - values[0])
+                        return false;
+                }
+                return true;
+            };
+            bool distinct = std::adjacent_find(positions.begin(), positions.end()) == positions.end();
+            if (distinct && positions.size() == xs.size() * ys.size() && uniform(xs) && uniform(ys)) {
+                if (ys.size() == 1) {
+                    putUint(out, 2);
+                    putUint(out, xs.size() - 2);
+                    putUint(out, static_cast<uint64_t>(xs[1] - xs[0]));
+                } else if (xs.size() == 1) {
+                    putUint(out, 3);
+                    putUint(out, ys.size() - 2);
+                    putUint(out, static_cast<uint64_t>(ys[1] - ys[0]));
+                } else {
+                    putUint(out, 1);
+                    putUint(out, xs.size() - 2);
+                    putUint(out, ys.size() - 2);
+                    putUint(out, static_cast<uint64_t>(xs[1] - xs[0]));
+                    putUint(out, static_cast<uint64_t>(ys[1] - ys[0]));
+                }
+                return;
+            }
+
+            putUint(out, 10);
+            putUint(out, positions.size() - 2);
+            for (size_t i = 1; i < positions.size(); ++i) {
+                putGDelta(out, positions[i].first - positions[i - 1].first, positions[i].second - positions[i - 1].second);
+            }
+        }
+
+        // Файл OASIS на запись: записи копятся в буфере и уходят в файл блоками (сжатыми при compress)
+        class Output {
+        public:
+            Bytes records;
+
+            Output(const std::string& path, bool compress) : out(path, std::ios::binary | std::ios::trunc), compress(compress), path(path) {
+                if (!out) {
+                    throw std::runtime_error("Не удалось создать файл \"" + path + "\"");
+                }
+            }
+
+            void maybe_flush() {
+                if (records.size() >= (compress ? BLOCK_SIZE : BUFFER_SIZE))
+                    flush();
+            }
+
+            void flush() {
+                if (records.empty())
+                    return;
+                if (!compress) {
+                    write(records);
+                    records.clear();
+                    return;
+                }
+
+                z_stream stream = {};
+                if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                    throw std::runtime_error("Не удалось инициализировать сжатие");
+                }
+                Bytes compressed(deflateBound(&stream, static_cast<uLong>(records.size())));
+                stream.next_in = records.data();
+                stream.avail_in = static_cast<uInt>(records.size());
+                stream.next_out = compressed.data();
+                stream.avail_out = static_cast<uInt>(compressed.size());
+                int status = deflate(&stream, Z_FINISH);
+                compressed.resize(stream.total_out);
+                deflateEnd(&stream);
+                if (status != Z_STREAM_END) {
+                    throw std::runtime_error("Ошибка сжатия блока");
+                }
+
+                Bytes header;
+                putUint(header, CBLOCK);
+                putUint(header, 0);         // deflate
+                putUint(header, records.size());
+                putUint(header, compressed.size());
+                write(header);
+                write(compressed);
+                records.clear();
+            }
+
+            // Запись вне блоков (START и END не могут находиться внутри CBLOCK)
+            void write_raw(const Bytes& bytes) {
+                flush();
+                write(bytes);
+            }
+
+            void close() {
+                flush();
+                out.flush();
+                if (!out) {
+                    throw std::runtime_error("Ошибка записи в файл \"" + path + "\"");
+                }
+            }
+
+        private:
+            std::ofstream out;
+            bool compress;
+            std::string path;
+
+            void write(const Bytes& bytes) {
+                out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+            }
+        };
+
+        // Одинаковые фигуры слоя: ключ и все положения
+        struct ShapeGroup {
+            Bytes key;
+            std::vector<Position> positions;
+        };
+
+        // Одна запись фигуры с count положениями (count не больше MAX_REPETITION)
+        void writeRecord(Output& output, const ShapeGroup& group, const Position* positions, size_t count,
+                         uint64_t layer, uint64_t datatype) {
+            bool repeated = count > 1;
+
+            Bytes& out = output.records;
+            out.push_back(group.key[0]);
+            if (group.key[0] == RECTANGLE) {
+                // Ключ прямоугольника: ширина и высота; квадрат пишется одним размером
+                Bytes body(group.key.begin() + 1, group.key.end());
+                size_t width_size = 0;
+                while (body[width_size] & 0x80)
+                    ++width_size;
+                ++width_size;
+                bool square = std::equal(body.begin(), body.begin() + width_size, body.begin() + width_size, body.end());
+                out.push_back(static_cast<unsigned char>((square ? INFO_SQUARE | INFO_WIDTH : INFO_WIDTH | INFO_HEIGHT) |
+                                                         INFO_X | INFO_Y | INFO_DATATYPE | INFO_LAYER | (repeated ? INFO_REPETITION : 0)));
+                putUint(out, layer);
+                putUint(out, datatype);
+                out.insert(out.end(), body.begin(), square ? body.begin() + width_size : body.end());
+            } else {
+                out.push_back(static_cast<unsigned char>(INFO_POINTS | INFO_X | INFO_Y | INFO_DATATYPE | INFO_LAYER |
+                                                         (repeated ? INFO_REPETITION : 0)));
+                putUint(out, layer);
+                putUint(out, datatype);
+                out.insert(out.end(), group.key.begin() + 1, group.key.end());
+            }
+            putSint(out, positions[0].first);
+            putSint(out, positions[0].second);
+            if (repeated) {
+                std::vector<Position> offsets;
+                offsets.reserve(count);
+                for (size_t i = 0; i < count; ++i)
+                    offsets.emplace_back(positions[i].first - positions[0].first, positions[i].second - positions[0].second);
+                encodeRepetition(offsets, out);
+            }
+            output.maybe_flush();
+        }
+
+        // Группа больше max_repetition делится на несколько записей. Части составляются из целых рядов
+        // положений (по y), если ряд помещается в часть, чтобы полная решётка оставалась решёткой в каждой части
+        void writeGroup(Output& output, const ShapeGroup& group, uint64_t layer, uint64_t datatype, uint64_t max_repetition) {
+            std::vector<Position> positions = group.positions;
+            std::sort(positions.begin(), positions.end(), [](const Position& a, const Position& b) {
+                return a.second != b.second ? a.second < b.second : a.first < b.first;
+            });
+            size_t row = 0;
+            while (row < positions.size() && positions[row].second == positions[0].second)
+                ++row;
+            size_t chunk = static_cast<size_t>(max_repetition);
+            if (row <= chunk)
+                chunk -= chunk % row;
+            for (size_t begin = 0; begin < positions.size(); begin += chunk) {
+                writeRecord(output, group, positions.data() + begin, std::min(chunk, positions.size() - begin), layer, datatype);
+            }
+        }
+
+        void writeLayer(Output& output, const Layer& layer, uint64_t number, uint64_t datatype, double scale,
+                        uint64_t max_repetition) {
+            std::vector<ShapeGroup> groups;
+            std::unordered_map<std::string, size_t> group_index;
+            std::vector<Position> contour;
+            Bytes key;
+            Position position;
+
+            auto add = [&](const Point* points, size_t count) {
+                if (!gridContour(points, count, scale, contour))
+                    return;
+                encodeShape(contour, key, position);
+                std::string hash_key(key.begin(), key.end());
+                auto it = group_index.find(hash_key);
+                if (it == group_index.end()) {
+                    groups.push_back({key, {}});
+                    it = group_index.emplace(std::move(hash_key), groups.size() - 1).first;
+                }
+                groups[it->second].positions.push_back(position);
+            };
+            auto addPolygon = [&](const Polygon& polygon) {
+                if (polygon.get_holes().empty()) {
+                    add(polygon.get_vertices().data(), polygon.get_vertices().size());
+                    return;
+                }
+                PolygonOperations::decompose(polygon, [&](const Trapezoid& t) {
+                    Point points[4] = {Point(t.x1_bottom, t.y_bottom), Point(t.x2_bottom, t.y_bottom),
+                                       Point(t.x2_top, t.y_top), Point(t.x1_top, t.y_top)};
+                    add(points, 4);
+                });
+            };
+
+            if (layer.is_compact()) {
+                const CompactPolygons& compact = layer.get_compact();
+                for (size_t i = 0; i < compact.size(); ++i) {
+                    PolygonView polygon = compact[i];
+                    if (polygon.hole_count() == 0)
+                        add(polygon.get_vertices().data(), polygon.get_vertices().size());
+                    else
+                        addPolygon(polygon.to_polygon());
+                }
+            } else {
+                for (const Polygon& polygon : layer.get_polygons())
+                    addPolygon(polygon);
+            }
+
+            for (const ShapeGroup& group : groups)
+                writeGroup(output, group, number, datatype, max_repetition);
+        }
+
+        // Файл OASIS на чтение; содержимое CBLOCK распаковывается целиком и читается вместо файла
+        class Input {
+        public:
+            explicit Input(const std::string& path)
+                : in(path, std::ios::binary | std::ios::ate), buffer(BUFFER_SIZE), file_size(0), file_offset(0), pos(0), end(0),
+                  block_pos(0), in_block(false) {
+                if (!in) {
+                    throw std::runtime_error("Не удалось открыть файл \"" + path + "\"");
+                }
+                file_size = static_cast<uint64_t>(in.tellg());
+                in.seekg(0);
+            }
+
+            // Непрочитанные байты текущего блока или файла
+            uint64_t remaining() const {
+                return in_block ? block.size() - block_pos : file_size - file_offset - pos;
+            }
+
+            // Каждый из count объявленных элементов занимает хотя бы байт: большее число означает повреждение,
+            // и память под него не выделяется
+            void expect(uint64_t count) const {
+                if (count > remaining()) {
+                    throw std::runtime_error("Повреждённый файл OASIS: объявленный размер больше оставшихся данных");
+                }
+            }
+
+            // Конец текущего блока - возврат к чтению файла; false в конце файла
+            bool next_record() {
+                if (in_block && block_pos == block.size())
+                    in_block = false;
+                return in_block || fill();
+            }
+
+            unsigned char byte() {
+                if (in_block) {
+                    if (block_pos == block.size()) {
+                        throw std::runtime_error("Повреждённый файл OASIS: запись выходит за пределы блока");
+                    }
+                    return block[block_pos++];
+                }
+                if (!fill()) {
+                    throw std::runtime_error("Повреждённый файл OASIS: неожиданный конец файла");
+                }
+                return buffer[pos++];
+            }
+
+            uint64_t uint() {
+                uint64_t value = 0;
+                for (int shift = 0;; shift += 7) {
+                    unsigned char b = byte();
+                    if (shift < 64)
+                        value |= uint64_t(b & 0x7F) << shift;
+                    if (!(b & 0x80))
+                        return value;
+                }
+            }
+
+            int64_t sint() {
+                uint64_t value = uint();
+                int64_t magnitude = static_cast<int64_t>(value >> 1);
+                return (value & 1) ? -magnitude : magnitude;
+            }
+
+            double real() {
+                uint64_t type = uint();
+                switch (type) {
+                case 0: return static_cast<double>(uint());
+                case 1: return -static_cast<double>(uint());
+                case 2: return 1.0 / static_cast<double>(uint());
+                case 3: return -1.0 / static_cast<double>(uint());
+                case 4: { double a = static_cast<double>(uint()); return a / static_cast<double>(uint()); }
+                case 5: { double a = static_cast<double>(uint()); return -a / static_cast<double>(uint()); }
+                case 6: {
+                    uint32_t bits = 0;
+                    for (int i = 0; i < 4; ++i)
+                        bits |= uint32_t(byte()) << (8 * i);
+                    float value;
+                    std::memcpy(&value, &bits, sizeof(value));
+                    return value;
+                }
+                case 7: {
+                    uint64_t bits = 0;
+                    for (int i = 0; i < 8; ++i)
+                        bits |= uint64_t(byte()) << (8 * i);
+                    double value;
+                    std::memcpy(&value, &bits, sizeof(value));
+                    return value;
+                }
+                default:
+                    throw std::runtime_error("Повреждённый файл OASIS: неизвестный тип вещественного числа");
+                }
+            }
+
+            std::string string() {
+                uint64_t length = uint();
+                expect(length);
+                std::string text(length, '\0');
+                for (char& c : text)
+                    c = static_cast<char>(byte());
+                return text;
+            }
+
+            // g-дельта в любой из двух форм
+            Position gdelta() {
+                uint64_t value = uint();
+                if (!(value & 1)) {
+                    int dir = static_cast<int>((value >> 1) & 7);
+                    int64_t magnitude = static_cast<int64_t>(value >> 4);
+                    return Position(DIRECTION_X[dir] * magnitude, DIRECTION_Y[dir] * magnitude);
+                }
+                int64_t dx = static_cast<int64_t>(value >> 2);
+                if (value & 2)
+                    dx = -dx;
+                return Position(dx, sint());
+            }
+
+            // Блок распаковывается в буфер, растущий по мере распаковки: объявленный размер
+            // не выделяется заранее и сверяется с фактическим
+            void start_block() {
+                if (uint() != 0) {
+                    throw std::runtime_error("Неподдерживаемый метод сжатия блока OASIS");
+                }
+                uint64_t uncompressed = uint(), compressed = uint();
+                expect(compressed);
+                Bytes source(compressed);
+                for (unsigned char& b : source)
+                    b = byte();
+
+                z_stream stream = {};
+                if (inflateInit2(&stream, -15) != Z_OK) {
+                    throw std::runtime_error("Не удалось инициализировать распаковку");
+                }
+                stream.next_in = source.data();
+                stream.avail_in = static_cast<uInt>(source.size());
+                // Лишний байт сверх объявленного размера позволяет заметить более длинный поток
+                uint64_t limit = uncompressed + 1;
+                block.resize(static_cast<size_t>(std::min<uint64_t>(limit, BLOCK_SIZE)));
+                int status = Z_OK;
+                while (status == Z_OK) {
+                    if (stream.total_out == block.size()) {
+                        if (block.size() == limit)
+                            break;
+                        block.resize(static_cast<size_t>(std::min<uint64_t>(limit, 2 * block.size())));
+                    }
+                    stream.next_out = block.data() + stream.total_out;
+                    stream.avail_out = static_cast<uInt>(std::min<uint64_t>(block.size() - stream.total_out,
+                                                                            std::numeric_limits<uInt>::max()));
+                    status = inflate(&stream, Z_NO_FLUSH);
+                }
+                bool complete = status == Z_STREAM_END && stream.total_out == uncompressed;
+                inflateEnd(&stream);
+                if (!complete) {
+                    throw std::runtime_error("Повреждённый файл OASIS: ошибка распаковки блока");
+                }
+                block.resize(static_cast<size_t>(uncompressed));
+                block_pos = 0;
+                in_block = true;
+            }
+
+        private:
+            std::ifstream in;
+            Bytes buffer;
+            uint64_t file_size;
+            uint64_t file_offset;   // Положение buffer[0] в файле
+            size_t pos, end;
+            Bytes block;
+            size_t block_pos;
+            bool in_block;
+
+            bool fill() {
+                if (pos < end)
+                    return true;
+                file_offset += end;
+                in.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+                pos = 0;
+                end = static_cast<size_t>(in.gcount());
+                return end > 0;
+            }
+        };
+
+        // Число элементов повторения (в файле хранится на 2 меньше)
+        uint64_t repetitionCount(Input& input) {
+            uint64_t count = input.uint();
+            if (count > MAX_REPETITION - 2) {
+                throw std::runtime_error("Повреждённый файл OASIS: слишком большое повторение");
+            }
+            return count + 2;
+        }
+
+        void checkGrid(uint64_t columns, uint64_t rows) {
+            if (columns * rows > MAX_REPETITION) {
+                throw std::runtime_error("Повреждённый файл OASIS: слишком большое повторение");
+            }
+        }
+
+        // Смещения повторения относительно положения записи
+        void readRepetition(Input& input, std::vector<Position>& repetition) {
+            uint64_t type = input.uint();
+            if (type == 0) {
+                if (repetition.empty()) {
+                    throw std::runtime_error("Повреждённый файл OASIS: повторение не задано");
+                }
+                return;
+            }
+
+            repetition.clear();
+            switch (type) {
+            case 1: {
+                uint64_t nx = repetitionCount(input), ny = repetitionCount(input);
+                checkGrid(nx, ny);
+                int64_t sx = static_cast<int64_t>(input.uint()), sy = static_cast<int64_t>(input.uint());
+                for (uint64_t j = 0; j < ny; ++j)
+                    for (uint64_t i = 0; i < nx; ++i)
+                        repetition.emplace_back(int64_t(i) * sx, int64_t(j) * sy);
+                break;
+            }
+            case 2:
+            case 3: {
+                uint64_t n = repetitionCount(input);
+                int64_t s = static_cast<int64_t>(input.uint());
+                for (uint64_t i = 0; i < n; ++i)
+                    repetition.push_back(type == 2 ? Position(int64_t(i) * s, 0) : Position(0, int64_t(i) * s));
+                break;
+            }
+            case 4:
+            case 5:
+            case 6:
+            case 7: {
+                uint64_t n = repetitionCount(input);
+                int64_t grid = (type == 5 || type == 7) ? static_cast<int64_t>(input.uint()) : 1;
+                input.expect(n - 1);
+                int64_t offset = 0;
+                repetition.emplace_back(0, 0);
+                for (uint64_t i = 1; i < n; ++i) {
+                    offset += static_cast<int64_t>(input.uint()) * grid;
+                    repetition.push_back(type <= 5 ? Position(offset, 0) : Position(0, offset));
+                }
+                break;
+            }
+            case 8: {
+                uint64_t n = repetitionCount(input), m = repetitionCount(input);
+                checkGrid(n, m);
+                Position a = input.gdelta(), b = input.gdelta();
+                for (uint64_t j = 0; j < m; ++j)
+                    for (uint64_t i = 0; i < n; ++i)
+                        repetition.emplace_back(int64_t(i) * a.first + int64_t(j) * b.first, int64_t(i) * a.second + int64_t(j) * b.second);
+                break;
+            }
+            case 9: {
+                uint64_t n = repetitionCount(input);
+                Position a = input.gdelta();
+                for (uint64_t i = 0; i < n; ++i)
+                    repetition.emplace_back(int64_t(i) * a.first, int64_t(i) * a.second);
+                break;
+            }
+            case 10:
+            case 11: {
+                uint64_t n = repetitionCount(input);
+                int64_t grid = type == 11 ? static_cast<int64_t>(input.uint()) : 1;
+                input.expect(n - 1);
+                Position offset(0, 0);
+                repetition.push_back(offset);
+                for (uint64_t i = 1; i < n; ++i) {
+                    Position d = input.gdelta();
+                    offset.first += d.first * grid;
+                    offset.second += d.second * grid;
+                    repetition.push_back(offset);
+                }
+                break;
+            }
+            default:
+                throw std::runtime_error("Повреждённый файл OASIS: неизвестный тип повторения");
+            }
+        }
+
+        // Вершины полигона относительно первой
+        void readPointList(Input& input, std::vector<Position>& points) {
+            uint64_t type = input.uint();
+            uint64_t count = input.uint();
+            input.expect(count);
+            points.assign(1, Position(0, 0));
+            Position current(0, 0);
+            for (uint64_t i = 0; i < count; ++i) {
+                switch (type) {
+                case 0:
+                case 1: {
+                    int64_t delta = input.sint();
+                    bool horizontal = (i % 2 == 0) == (type == 0);
+                    (horizontal ? current.first : current.second) += delta;
+                    break;
+                }
+                case 2: {
+                    uint64_t value = input.uint();
+                    int dir = static_cast<int>(value & 3);
+                    int64_t magnitude = static_cast<int64_t>(value >> 2);
+                    current.first += DIRECTION_X[dir] * magnitude;
+                    current.second += DIRECTION_Y[dir] * magnitude;
+                    break;
+                }
+                case 3: {
+                    uint64_t value = input.uint();
+                    int dir = static_cast<int>(value & 7);
+                    int64_t magnitude = static_cast<int64_t>(value >> 3);
+                    current.first += DIRECTION_X[dir] * magnitude;
+                    current.second += DIRECTION_Y[dir] * magnitude;
+                    break;
+                }
+                case 4: {
+                    Position d = input.gdelta();
+                    current.first += d.first;
+                    current.second += d.second;
+                    break;
+                }
+                default:
+                    throw std::runtime_error("Неподдерживаемый тип списка точек OASIS");
+                }
+                points.push_back(current);
+            }
+            // У манхэттенских списков последняя вершина неявная
+            if (type == 0)
+                points.emplace_back(0, current.second);
+            else if (type == 1)
+                points.emplace_back(current.first, 0);
+        }
+
+        void skipInterval(Input& input, uint64_t& bound, bool& exact) {
+            uint64_t type = input.uint();
+            exact = type == 3;
+            if (type == 1 || type == 2 || type == 3)
+                bound = input.uint();
+            else if (type == 4) {
+                bound = input.uint();
+                input.uint();
+            } else if (type != 0) {
+                throw std::runtime_error("Повреждённый файл OASIS: неверный интервал");
+            }
+        }
+
+        struct LayerData {
+            std::pair<int, int> number;
+            CompactPolygons polygons;
+        };
+    }
+
+    void write(const LayerPack& layerpack, const std::string& path, const LayerMap& layer_names, double database_unit,
+               bool compress, uint64_t max_repetition) {
+        if (!(database_unit > 0)) {
+            throw std::invalid_argument("Единица базы данных должна быть положительной");
+        }
+        if (max_repetition == 0 || max_repetition > MAX_REPETITION) {
+            throw std::invalid_argument("Размер повторения должен быть от 1 до " + std::to_string(MAX_REPETITION));
+        }
+
+        // Номера слоёв: из layer_names, из имени вида "layer/datatype", иначе первый свободный
+        std::unordered_map<std::string, std::pair<int, int>> numbers;
+        for (const auto& entry : layer_names) {
+            numbers.emplace(entry.second, entry.first);
+        }
+        std::vector<std::pair<int, int>> layer_numbers;
+        std::vector<bool> assigned;
+        int next_free = 0;
+        for (const Layer& layer : layerpack.get_layers()) {
+            auto it = numbers.find(layer.get_name());
+            int number = 0, datatype = 0;
+            bool known = it != numbers.end();
+            if (known) {
+                number = it->second.first;
+                datatype = it->second.second;
+            } else if (std::sscanf(layer.get_name().c_str(), "%d/%d", &number, &datatype) == 2 &&
+                       layer.get_name() == GdsFile::defaultLayerName(number, datatype)) {
+                known = true;
+            }
+            if (known && (number < 0 || datatype < 0)) {
+                throw std::invalid_argument("Номера слоя OASIS не могут быть отрицательными: \"" + layer.get_name() + "\"");
+            }
+            layer_numbers.emplace_back(number, datatype);
+            assigned.push_back(known);
+            if (known)
+                next_free = std::max(next_free, number + 1);
+        }
+        for (size_t i = 0; i < layer_numbers.size(); ++i) {
+            if (!assigned[i])
+                layer_numbers[i] = std::make_pair(next_free++, 0);
+        }
+
+        Output output(path, compress);
+        Bytes start(MAGIC, MAGIC + MAGIC_SIZE);
+        putUint(start, START);
+        putString(start, "1.0");
+        double unit = 1 / database_unit;    // Шагов сетки на микрон
+        if (std::abs(unit - std::round(unit)) < 1e-9 * unit)
+            unit = std::round(unit);
+        putReal(start, unit);
+        putUint(start, 1);                  // Таблицы смещений находятся в записи END
+        output.write_raw(start);
+
+        const std::vector<Layer>& layers = layerpack.get_layers();
+        for (size_t i = 0; i < layers.size(); ++i) {
+            if (!isNameString(layers[i].get_name()))
+                continue;
+            Bytes& out = output.records;
+            putUint(out, LAYERNAME);
+            putString(out, layers[i].get_name());
+            putUint(out, 3);
+            putUint(out, static_cast<uint64_t>(layer_numbers[i].first));
+            putUint(out, 3);
+            putUint(out, static_cast<uint64_t>(layer_numbers[i].second));
+        }
+
+        putUint(output.records, CELL);
+        putString(output.records, "TOP");
+        double scale = 1 / database_unit;
+        for (size_t i = 0; i < layers.size(); ++i) {
+            writeLayer(output, layers[i], static_cast<uint64_t>(layer_numbers[i].first),
+                       static_cast<uint64_t>(layer_numbers[i].second), scale, max_repetition);
+        }
+
+        // Запись END дополняется до 256 байт
+        Bytes end;
+        putUint(end, END);
+        for (int i = 0; i < 12; ++i)
+            putUint(end, 0);
+        size_t padding = END_RECORD_SIZE - end.size() - 1 - 2;
+        putUint(end, padding);
+        end.insert(end.end(), padding, 0);
+        putUint(end, 0);                    // Без проверки целостности
+        output.write_raw(end);
+        output.close();
+    }
+
+    LayerPack read(const std::string& path, const LayerMap& layer_names) {
+        Input input(path);
+        for (size_t i = 0; i < MAGIC_SIZE; ++i) {
+            if (input.byte() != static_cast<unsigned char>(MAGIC[i])) {
+                throw std::runtime_error("Файл \"" + path + "\" не является файлом OASIS");
+            }
+        }
+
+        std::vector<LayerData> layers;
+        std::map<std::pair<int, int>, size_t> layer_index;
+        LayerMap file_names;
+        double scale = 1;
+
+        // Модальные переменные OASIS
+        uint64_t layer = 0, datatype = 0;
+        int64_t x = 0, y = 0;
+        uint64_t width = 0, height = 0;
+        bool relative = false;
+        std::vector<Position> point_list, repetition;
+        std::vector<Point> points;
+        bool finished = false;
+
+        auto emit = [&](const std::vector<Position>& shape, int64_t base_x, int64_t base_y, bool repeated) {
+            std::pair<int, int> key(static_cast<int>(layer), static_cast<int>(datatype));
+            auto it = layer_index.find(key);
+            if (it == layer_index.end()) {
+                layers.push_back({key, CompactPolygons()});
+                it = layer_index.emplace(key, layers.size() - 1).first;
+            }
+            CompactPolygons& target = layers[it->second].polygons;
+            static const std::vector<Position> single(1, Position(0, 0));
+            for (const Position& offset : repeated ? repetition : single) {
+                points.clear();
+                for (const Position& p : shape) {
+                    points.emplace_back((base_x + offset.first + p.first) * scale, (base_y + offset.second + p.second) * scale);
+                }
+                target.append_contour(points.data(), points.size(), false);
+            }
+        };
+
+        while (!finished && input.next_record()) {
+            uint64_t type = input.uint();
+            switch (type) {
+            case PAD:
+                break;
+            case START: {
+                input.string();
+                scale = 1 / input.real();
+                if (input.uint() == 0) {
+                    for (int i = 0; i < 12; ++i)
+                        input.uint();
+                }
+                break;
+            }
+            case END:
+                finished = true;
+                break;
+            case CELLNAME_IMPLICIT:
+            case TEXTSTRING_IMPLICIT:
+            case PROPNAME_IMPLICIT:
+            case PROPSTRING_IMPLICIT:
+                input.string();
+                break;
+            case CELLNAME:
+            case TEXTSTRING:
+            case PROPNAME:
+            case PROPSTRING:
+                input.string();
+                input.uint();
+                break;
+            case LAYERNAME:
+            case LAYERNAME_TEXT: {
+                std::string name = input.string();
+                uint64_t number = 0, type_number = 0;
+                bool exact_layer, exact_type;
+                skipInterval(input, number, exact_layer);
+                skipInterval(input, type_number, exact_type);
+                if (type == LAYERNAME && exact_layer && exact_type)
+                    file_names[std::make_pair(static_cast<int>(number), static_cast<int>(type_number))] = name;
+                break;
+            }
+            case CELL_REFERENCE:
+            case CELL:
+                if (type == CELL)
+                    input.string();
+                else
+                    input.uint();
+                x = y = 0;
+                relative = false;
+                break;
+            case XYABSOLUTE:
+                relative = false;
+                break;
+            case XYRELATIVE:
+                relative = true;
+                break;
+            case RECTANGLE: {
+                unsigned char info = input.byte();
+                if (info & INFO_LAYER)
+                    layer = input.uint();
+                if (info & INFO_DATATYPE)
+                    datatype = input.uint();
+                if (info & INFO_WIDTH)
+                    width = input.uint();
+                if (info & INFO_HEIGHT)
+                    height = input.uint();
+                if (info & INFO_SQUARE)
+                    height = width;
+                if (info & INFO_X)
+                    x = relative ? x + input.sint() : input.sint();
+                if (info & INFO_Y)
+                    y = relative ? y + input.sint() : input.sint();
+                if (info & INFO_REPETITION)
+                    readRepetition(input, repetition);
+                int64_t w = static_cast<int64_t>(width), h = static_cast<int64_t>(height);
+                emit({Position(0, 0), Position(w, 0), Position(w, h), Position(0, h)}, x, y, (info & INFO_REPETITION) != 0);
+                break;
+            }
+            case POLYGON: {
+                unsigned char info = input.byte();
+                if (info & INFO_LAYER)
+                    layer = input.uint();
+                if (info & INFO_DATATYPE)
+                    datatype = input.uint();
+                if (info & INFO_POINTS)
+                    readPointList(input, point_list);
+                if (info & INFO_X)
+                    x = relative ? x + input.sint() : input.sint();
+                if (info & INFO_Y)
+                    y = relative ? y + input.sint() : input.sint();
+                if (info & INFO_REPETITION)
+                    readRepetition(input, repetition);
+                emit(point_list, x, y, (info & INFO_REPETITION) != 0);
+                break;
+            }
+            case CBLOCK:
+                input.start_block();
+                break;
+            default:
+                throw std::runtime_error("Неподдерживаемая запись OASIS: " + std::to_string(type));
+            }
+        }
+        if (!finished) {
+            throw std::runtime_error("Повреждённый файл OASIS: нет записи END");
+        }
+
+        // Имена разрешаются в конце: записи LAYERNAME могут идти после геометрии
+        LayerPack layerpack;
+        std::unordered_map<std::string, size_t> merged;
+        std::vector<std::pair<std::string, CompactPolygons>> named;
+        for (LayerData& data : layers) {
+            auto mapped = layer_names.find(data.number);
+            auto from_file = file_names.find(data.number);
+            std::string name = mapped != layer_names.end() ? mapped->second
+                             : from_file != file_names.end() ? from_file->second
+                             : GdsFile::defaultLayerName(data.number.first, data.number.second);
+            auto it = merged.find(name);
+            if (it == merged.end()) {
+                merged.emplace(name, named.size());
+                named.emplace_back(name, std::move(data.polygons));
+                continue;
+            }
+            CompactPolygons& target = named[it->second].second;
+            for (size_t i = 0; i < data.polygons.size(); ++i) {
+                ContourView outer = data.polygons[i].get_vertices();
+                target.append_contour(outer.data(), outer.size(), false);
+            }
+        }
+        for (auto& entry : named) {
+            layerpack.append_layer(Layer(entry.first, std::move(entry.second)));
+        }
+        return layerpack;
+    }
+}
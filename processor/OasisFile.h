@@ -0,0 +1,38 @@
+#ifndef OASISFILE_H
+#define OASISFILE_H
+
+#include <string>
+#include "Entity.h"
+#include "GdsFile.h"
+
+// Экспорт и импорт в подмножестве формата OASIS.
+//
+// Запись сжимает геометрию несколькими способами:
+//   - прямоугольники пишутся записями RECTANGLE (ширина и высота вместо вершин);
+//   - вершины полигонов кодируются приращениями: манхэттенские контуры - одним числом на ребро
+//     с неявной последней вершиной, октангулярные - числом с направлением, остальные - парами;
+//   - одинаковые фигуры слоя пишутся одной записью с повторением (строка, столбец, решётка
+//     или произвольный список смещений), не больше max_repetition положений на запись;
+//   - при compress записи упаковываются в блоки CBLOCK (deflate).
+// Имена слоёв сохраняются записями LAYERNAME. Чтение понимает то, что производит запись
+// (а также XYRELATIVE, CELLNAME и прочие записи имён), блоки CBLOCK распаковываются по мере чтения.
+// Полигоны с дырками записываются трапецоидами, как и в GDSII.
+namespace OasisFile {
+    using LayerMap = GdsFile::LayerMap;
+
+    // Наибольшее число положений в одной записи с повторением. Регулярное повторение задаётся
+    // несколькими байтами при любом числе элементов, а при чтении все элементы разворачиваются
+    // в полигоны, поэтому чтение отвергает большие повторения, а запись делит группы на части
+    const uint64_t MAX_REPETITION = uint64_t(1) << 24;
+
+    // Слои без номера в layer_names и без имени вида "layer/datatype" получают свободные номера.
+    // database_unit - шаг сетки в пользовательских единицах (микронах).
+    // Бросает std::invalid_argument, если max_repetition вне [1, MAX_REPETITION]
+    void write(const LayerPack& layerpack, const std::string& path, const LayerMap& layer_names = {},
+               double database_unit = 1e-3, bool compress = true, uint64_t max_repetition = MAX_REPETITION);
+
+    // Имя слоя выбирается по layer_names, затем по записям LAYERNAME, затем по умолчанию
+    LayerPack read(const std::string& path, const LayerMap& layer_names = {});
+}
+
+#endif // OASISFILE_H
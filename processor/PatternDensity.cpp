@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include "GeometryOperations.h"
+#include "PatternDensity.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+namespace {
+    // Площадь части полосы трапецоида между y0 и y1 внутри столбца [xa, xb]. Левая граница идёт
+    // от l0 до l1, правая - от r0 до r1. Ширина min(r, xb) - max(l, xa), обрезанная снизу нулём,
+    // линейна между точками, где граница пересекает xa или xb, поэтому формула трапеции точна
+    double clippedArea(double y0, double y1, double l0, double l1, double r0, double r1, double xa, double xb) {
+        double breaks[6] = {0, 1};     // Упорядочены; 0 < t < 1, поэтому 0 ограничивает вставку
+        size_t count = 2;
+        auto add = [&](double a0, double a1, double x) {
+            if ((a0 - x) * (a1 - x) >= 0)
+                return;
+            double t = (x - a0) / (a1 - a0);
+            size_t k = count++;
+            for (; breaks[k - 1] > t; --k)
+                breaks[k] = breaks[k - 1];
+            breaks[k] = t;
+        };
+        add(l0, l1, xa);
+        add(l0, l1, xb);
+        add(r0, r1, xa);
+        add(r0, r1, xb);
+
+        auto width = [&](double t) {
+            double left = std::max(l0 + (l1 - l0) * t, xa);
+            double right = std::min(r0 + (r1 - r0) * t, xb);
+            return std::max(0.0, right - left);
+        };
+        double area = 0;
+        for (size_t k = 0; k + 1 < count; ++k)
+            area += (width(breaks[k]) + width(breaks[k + 1])) / 2 * (breaks[k + 1] - breaks[k]);
+        return area * (y1 - y0);
+    }
+
+    // Строки сетки, которые пересекает интервал [y_bottom, y_top), обрезанные по сетке
+    std::pair<int64_t, int64_t> rowRange(const PatternDensity::Grid& grid, double y_bottom, double y_top) {
+        int64_t first = static_cast<int64_t>(std::floor((y_bottom - grid.origin.y) / grid.step_y));
+        int64_t last = static_cast<int64_t>(std::ceil((y_top - grid.origin.y) / grid.step_y)) - 1;
+        return {std::max<int64_t>(first, 0), std::min<int64_t>(last, static_cast<int64_t>(grid.rows) - 1)};
+    }
+
+    // Частичная сетка потока: строки [first_row, first_row + values.size() / columns)
+    struct Partial {
+        int64_t first_row = 0;
+        std::vector<double> values;
+    };
+
+    void accumulate(const Trapezoid& trapezoid, const PatternDensity::Grid& grid, Partial& partial) {
+        double height = trapezoid.y_top - trapezoid.y_bottom;
+        if (!(height > 0))
+            return;
+        auto [first_row, last_row] = rowRange(grid, trapezoid.y_bottom, trapezoid.y_top);
+        for (int64_t row = first_row; row <= last_row; ++row) {
+            double ya = std::max(trapezoid.y_bottom, grid.origin.y + row * grid.step_y);
+            double yb = std::min(trapezoid.y_top, grid.origin.y + (row + 1) * grid.step_y);
+            if (!(yb > ya))
+                continue;
+            double ta = (ya - trapezoid.y_bottom) / height, tb = (yb - trapezoid.y_bottom) / height;
+            double l0 = trapezoid.x1_bottom + (trapezoid.x1_top - trapezoid.x1_bottom) * ta;
+            double l1 = trapezoid.x1_bottom + (trapezoid.x1_top - trapezoid.x1_bottom) * tb;
+            double r0 = trapezoid.x2_bottom + (trapezoid.x2_top - trapezoid.x2_bottom) * ta;
+            double r1 = trapezoid.x2_bottom + (trapezoid.x2_top - trapezoid.x2_bottom) * tb;
+
+            int64_t first_column = std::max<int64_t>(0, static_cast<int64_t>(std::floor((std::min(l0, l1) - grid.origin.x) / grid.step_x)));
+            int64_t last_column = std::min<int64_t>(static_cast<int64_t>(grid.columns) - 1,
+                static_cast<int64_t>(std::ceil((std::max(r0, r1) - grid.origin.x) / grid.step_x)) - 1);
+            // Столбцы целиком внутри полосы трапецоида не требуют обрезки
+            double inner_left = std::max(l0, l1), inner_right = std::min(r0, r1);
+            double* values = partial.values.data() + (row - partial.first_row) * grid.columns;
+            for (int64_t column = first_column; column <= last_column; ++column) {
+                double xa = grid.origin.x + column * grid.step_x;
+                double xb = grid.origin.x + (column + 1) * grid.step_x;
+                if (xa >= inner_left && xb <= inner_right)
+                    values[column] += (xb - xa) * (yb - ya);
+                else
+                    values[column] += clippedArea(ya, yb, l0, l1, r0, r1, xa, xb);
+            }
+        }
+    }
+
+    // Трапецоиды объединения полигонов слоя; при наличии пула - параллельным sweep
+    std::vector<Trapezoid> decompose(const Layer& layer, ThreadPool* pool) {
+        if (!pool)
+            return LayerOperations::decomposeLayer(layer);
+        std::vector<Trapezoid> trapezoids;
+        std::vector<SweepEdge> edges;
+        if (layer.is_compact()) {
+            const CompactPolygons& compact = layer.get_compact();
+            edges.reserve(compact.vertex_count());
+            for (size_t i = 0; i < compact.size(); ++i)
+                PolygonOperations::appendEdges(compact[i], 0, edges);
+        } else {
+            for (const Polygon& polygon : layer.get_polygons())
+                PolygonOperations::appendEdges(polygon, 0, edges);
+        }
+        TrapezoidOperations::sweep(std::move(edges), BooleanOperation::Union, [&trapezoids](const Trapezoid& trapezoid) {
+            trapezoids.push_back(trapezoid);
+        }, *pool);
+        return trapezoids;
+    }
+
+    void writeCsv(const PatternDensity::Grid& grid, std::ostream& out) {
+        out << std::setprecision(17) << "# " << grid.origin.x << ' ' << grid.origin.y << ' ' << grid.step_x << ' ' << grid.step_y
+            << ' ' << grid.window_x << ' ' << grid.window_y << ' ' << grid.columns << ' ' << grid.rows << '\n';
+        for (size_t row = grid.rows; row-- > 0;) {
+            for (size_t column = 0; column < grid.columns; ++column)
+                out << (column ? "," : "") << grid.values[row * grid.columns + column];
+            out << '\n';
+        }
+    }
+
+    void writeBinary(const PatternDensity::Grid& grid, std::ostream& out) {
+        out.write("DENSITY1", 8);
+        uint64_t sizes[2] = {grid.columns, grid.rows};
+        double geometry[6] = {grid.origin.x, grid.origin.y, grid.step_x, grid.step_y, grid.window_x, grid.window_y};
+        out.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+        out.write(reinterpret_cast<const char*>(geometry), sizeof(geometry));
+        out.write(reinterpret_cast<const char*>(grid.values.data()), static_cast<std::streamsize>(grid.values.size() * sizeof(double)));
+    }
+}
+
+namespace PatternDensity {
+    double& Grid::at(size_t column, size_t row) {
+        if (column >= columns || row >= rows) {
+            throw std::out_of_range("Ячейка выходит за границы сетки");
+        }
+        return values[row * columns + column];
+    }
+
+    double Grid::at(size_t column, size_t row) const {
+        if (column >= columns || row >= rows) {
+            throw std::out_of_range("Ячейка выходит за границы сетки");
+        }
+        return values[row * columns + column];
+    }
+
+    Box Grid::window(size_t column, size_t row) const {
+        double x = origin.x + column * step_x, y = origin.y + row * step_y;
+        return Box(x, y, x + window_x, y + window_y);
+    }
+
+    Grid coveredArea(const Layer& layer, const Box& extent, double step_x, double step_y, size_t threads) {
+        if (!(step_x > 0) || !(step_y > 0) || extent.empty()) {
+            throw std::invalid_argument("Шаг сетки должен быть положительным, а область - непустой");
+        }
+        TRACE_SCOPE("pattern_density");
+        Grid grid;
+        grid.origin = Point(extent.min_x, extent.min_y);
+        grid.step_x = grid.window_x = step_x;
+        grid.step_y = grid.window_y = step_y;
+        grid.columns = std::max<size_t>(1, static_cast<size_t>(std::ceil((extent.max_x - extent.min_x) / step_x)));
+        grid.rows = std::max<size_t>(1, static_cast<size_t>(std::ceil((extent.max_y - extent.min_y) / step_y)));
+        grid.values.assign(grid.columns * grid.rows, 0.0);
+
+        std::unique_ptr<ThreadPool> pool;
+        if (threads > 1)
+            pool.reset(new ThreadPool(threads));
+        std::vector<Trapezoid> trapezoids = decompose(layer, pool.get());
+        TRACE_COUNT("trapezoids", trapezoids.size());
+        TRACE_COUNT("cells", grid.values.size());
+
+        if (!pool) {
+            Partial whole;
+            whole.values.swap(grid.values);
+            for (const Trapezoid& trapezoid : trapezoids)
+                accumulate(trapezoid, grid, whole);
+            grid.values.swap(whole.values);
+            return grid;
+        }
+
+        // Трапецоиды выходят из sweep примерно по возрастанию y, поэтому у непрерывного куска
+        // узкий диапазон строк и частичная сетка занимает мало памяти
+        size_t chunks = std::min(trapezoids.size(), pool->size());
+        std::vector<Partial> partials(chunks);
+        pool->parallel_for(chunks, [&](size_t k) {
+            size_t from = k * trapezoids.size() / chunks, to = (k + 1) * trapezoids.size() / chunks;
+            int64_t first_row = std::numeric_limits<int64_t>::max(), last_row = -1;
+            for (size_t i = from; i < to; ++i) {
+                auto [first, last] = rowRange(grid, trapezoids[i].y_bottom, trapezoids[i].y_top);
+                if (first <= last) {
+                    first_row = std::min(first_row, first);
+                    last_row = std::max(last_row, last);
+                }
+            }
+            if (last_row < 0)
+                return;
+            Partial& partial = partials[k];
+            partial.first_row = first_row;
+            partial.values.assign(static_cast<size_t>(last_row - first_row + 1) * grid.columns, 0.0);
+            for (size_t i = from; i < to; ++i)
+                accumulate(trapezoids[i], grid, partial);
+        });
+
+        // Слияние по строкам: каждая строка результата складывается из частичных сеток одним потоком
+        pool->parallel_for(grid.rows, [&](size_t row) {
+            double* target = grid.values.data() + row * grid.columns;
+            for (const Partial& partial : partials) {
+                int64_t local = static_cast<int64_t>(row) - partial.first_row;
+                if (local < 0 || static_cast<size_t>(local) * grid.columns >= partial.values.size())
+                    continue;
+                const double* source = partial.values.data() + local * grid.columns;
+                for (size_t column = 0; column < grid.columns; ++column)
+                    target[column] += source[column];
+            }
+        });
+        return grid;
+    }
+
+    Grid density(const Layer& layer, const Box& extent, double step_x, double step_y, size_t threads) {
+        Grid grid = coveredArea(layer, extent, step_x, step_y, threads);
+        double cell = step_x * step_y;
+        for (double& value : grid.values)
+            value /= cell;
+        return grid;
+    }
+
+    Grid slidingDensity(const Grid& area, size_t window_columns, size_t window_rows) {
+        if (window_columns == 0 || window_rows == 0 || window_columns > area.columns || window_rows > area.rows) {
+            throw std::invalid_argument("Окно должно содержать от одной ячейки и помещаться в сетку");
+        }
+        // sums[(row) * (columns + 1) + column] - сумма ячеек левее column и ниже row
+        size_t width = area.columns + 1;
+        std::vector<double> sums(width * (area.rows + 1), 0.0);
+        for (size_t row = 0; row < area.rows; ++row) {
+            double line = 0;
+            for (size_t column = 0; column < area.columns; ++column) {
+                line += area.values[row * area.columns + column];
+                sums[(row + 1) * width + column + 1] = sums[row * width + column + 1] + line;
+            }
+        }
+
+        Grid result;
+        result.origin = area.origin;
+        result.step_x = area.step_x;
+        result.step_y = area.step_y;
+        result.window_x = area.step_x * window_columns;
+        result.window_y = area.step_y * window_rows;
+        result.columns = area.columns - window_columns + 1;
+        result.rows = area.rows - window_rows + 1;
+        result.values.resize(result.columns * result.rows);
+        double window = result.window_x * result.window_y;
+        for (size_t row = 0; row < result.rows; ++row) {
+            for (size_t column = 0; column < result.columns; ++column) {
+                size_t top = (row + window_rows) * width, bottom = row * width;
+                double sum = sums[top + column + window_columns] - sums[top + column]
+                           - sums[bottom + column + window_columns] + sums[bottom + column];
+                result.values[row * result.columns + column] = std::max(0.0, sum) / window;
+            }
+        }
+        return result;
+    }
+
+    void write(const Grid& grid, const std::string& path, GridFormat format) {
+        std::ofstream out(path, format == GridFormat::Binary ? std::ios::binary : std::ios::out);
+        if (!out) {
+            throw std::runtime_error("Не удалось открыть файл \"" + path + "\"");
+        }
+        if (format == GridFormat::Csv)
+            writeCsv(grid, out);
+        else
+            writeBinary(grid, out);
+        if (!out) {
+            throw std::runtime_error("Ошибка записи в файл \"" + path + "\"");
+        }
+    }
+}
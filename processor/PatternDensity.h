@@ -0,0 +1,51 @@
+#ifndef PATTERNDENSITY_H
+#define PATTERNDENSITY_H
+
+#include <string>
+#include <vector>
+#include "Entity.h"
+
+// Плотность заполнения слоя по сетке окон (проверка равномерности металла перед сдачей в производство).
+//
+// Полигоны слоя объединяются и разбиваются на трапецоиды, каждый трапецоид точно обрезается
+// по ячейкам сетки: ширина трапецоида внутри столбца кусочно-линейна по y, поэтому площадь
+// между изломами считается формулой трапеции без погрешности дискретизации.
+// При threads > 1 разбиение идёт параллельным sweep, а трапецоиды делятся между потоками;
+// каждый поток накапливает свою частичную сетку (только в строках, которых касаются его трапецоиды),
+// затем частичные сетки складываются.
+// Скользящие окна из нескольких ячеек с шагом в одну ячейку считаются по таблице частичных сумм
+// за O(1) на окно.
+namespace PatternDensity {
+    // Ячейка (column, row) - окно [origin.x + column * step_x, +window_x] x [origin.y + row * step_y, +window_y].
+    // Значения хранятся по строкам снизу вверх: values[row * columns + column]
+    struct Grid {
+        Point origin;
+        double step_x = 0, step_y = 0;
+        double window_x = 0, window_y = 0;      // Для сетки без скольжения совпадают с шагом
+        size_t columns = 0, rows = 0;
+        std::vector<double> values;
+
+        double& at(size_t column, size_t row);
+        double at(size_t column, size_t row) const;
+        Box window(size_t column, size_t row) const;
+    };
+
+    enum class GridFormat {
+        Csv,        // Строка "# origin_x origin_y step_x step_y window_x window_y columns rows", затем строки сверху вниз
+        Binary,     // "DENSITY1", columns и rows (uint64), origin, step и window (double), значения (double) снизу вверх
+    };
+
+    // Площадь слоя в каждой ячейке сетки с шагом step, начинающейся в левом нижнем углу extent.
+    // Ячеек столько, чтобы покрыть extent; последние ячейки могут выходить за него и считаются целиком.
+    // Бросает std::invalid_argument при неположительном шаге или пустом extent
+    Grid coveredArea(const Layer& layer, const Box& extent, double step_x, double step_y, size_t threads = 1);
+    // То же, делённое на площадь ячейки
+    Grid density(const Layer& layer, const Box& extent, double step_x, double step_y, size_t threads = 1);
+    // Плотность в окнах из window_columns x window_rows ячеек сетки площадей area с шагом в одну ячейку
+    Grid slidingDensity(const Grid& area, size_t window_columns, size_t window_rows);
+
+    // Бросает std::runtime_error, если файл не удалось записать
+    void write(const Grid& grid, const std::string& path, GridFormat format = GridFormat::Binary);
+}
+
+#endif // PATTERNDENSITY_H
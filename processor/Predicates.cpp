@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Predicates.h"
+
+namespace Predicates {
+    namespace {
+        // Половина расстояния между 1 и следующим double: относительная погрешность одного округления
+        const double EPSILON = std::ldexp(1.0, -53);
+        // Оценки погрешности вычисления в double (Shewchuk, "Adaptive Precision Floating-Point Arithmetic")
+        const double ORIENT_ERROR_BOUND = (3.0 + 16.0 * EPSILON) * EPSILON;
+        const double INCIRCLE_ERROR_BOUND = (10.0 + 96.0 * EPSILON) * EPSILON;
+
+        // Разложение: точное значение - сумма компонент; компоненты не пересекаются по разрядам,
+        // идут по возрастанию модуля и не содержат нулей. Знак определяется последней компонентой
+        using Expansion = std::vector<double>;
+
+        void twoSum(double a, double b, double& sum, double& error) {
+            sum = a + b;
+            double b_virtual = sum - a;
+            double a_virtual = sum - b_virtual;
+            error = (a - a_virtual) + (b - b_virtual);
+        }
+
+        void twoProduct(double a, double b, double& product, double& error) {
+            product = a * b;
+            error = std::fma(a, b, -product);
+        }
+
+        // Добавление числа к разложению без потери точности
+        void grow(Expansion& e, double b) {
+            Expansion result;
+            result.reserve(e.size() + 1);
+            double q = b;
+            for (double component : e) {
+                double sum, error;
+                twoSum(q, component, sum, error);
+                if (error != 0)
+                    result.push_back(error);
+                q = sum;
+            }
+            if (q != 0)
+                result.push_back(q);
+            e.swap(result);
+        }
+
+        Expansion difference(double a, double b) {
+            Expansion e;
+            grow(e, a);
+            grow(e, -b);
+            return e;
+        }
+
+        Expansion sum(Expansion e, const Expansion& f) {
+            for (double component : f)
+                grow(e, component);
+            return e;
+        }
+
+        Expansion negate(Expansion e) {
+            for (double& component : e)
+                component = -component;
+            return e;
+        }
+
+        Expansion product(const Expansion& e, const Expansion& f) {
+            Expansion result;
+            for (double a : e) {
+                for (double b : f) {
+                    double p, error;
+                    twoProduct(a, b, p, error);
+                    grow(result, error);
+                    grow(result, p);
+                }
+            }
+            return result;
+        }
+
+        // Приближение значения с тем же знаком, что и точное
+        double estimate(const Expansion& e) {
+            double value = 0;
+            for (double component : e)
+                value += component;
+            return value;
+        }
+
+        // Разложение длины до 2 без выделения памяти: разность двух double
+        struct ShortDifference {
+            double component[2];
+        };
+
+        ShortDifference shortDifference(double a, double b) {
+            ShortDifference result;
+            twoSum(a, -b, result.component[1], result.component[0]);
+            return result;
+        }
+
+        // grow для разложения в массиве длины size; места хватает на одну компоненту больше
+        void growInPlace(double* e, size_t& size, double b) {
+            size_t out = 0;
+            double q = b;
+            for (size_t i = 0; i < size; ++i) {
+                double sum, error;
+                twoSum(q, e[i], sum, error);
+                if (error != 0)
+                    e[out++] = error;
+                q = sum;
+            }
+            if (q != 0)
+                e[out++] = q;
+            size = out;
+        }
+
+        // Вызывается для почти параллельных векторов на каждом шаге заметания, поэтому без std::vector:
+        // 2 x 2 произведения по 2 компоненты на каждую сторону дают не больше 16 компонент
+        double crossExact(const Point& a, const Point& b, const Point& c, const Point& d) {
+            ShortDifference abx = shortDifference(b.x, a.x), aby = shortDifference(b.y, a.y);
+            ShortDifference cdx = shortDifference(d.x, c.x), cdy = shortDifference(d.y, c.y);
+            double e[16];
+            size_t size = 0;
+            for (double u : abx.component) {
+                for (double v : cdy.component) {
+                    double p, error;
+                    twoProduct(u, v, p, error);
+                    growInPlace(e, size, error);
+                    growInPlace(e, size, p);
+                }
+            }
+            for (double u : aby.component) {
+                for (double v : cdx.component) {
+                    double p, error;
+                    twoProduct(u, v, p, error);
+                    growInPlace(e, size, -error);
+                    growInPlace(e, size, -p);
+                }
+            }
+            double value = 0;
+            for (size_t i = 0; i < size; ++i)
+                value += e[i];
+            return value;
+        }
+
+        double incircleExact(const Point& a, const Point& b, const Point& c, const Point& d) {
+            Expansion adx = difference(a.x, d.x), ady = difference(a.y, d.y);
+            Expansion bdx = difference(b.x, d.x), bdy = difference(b.y, d.y);
+            Expansion cdx = difference(c.x, d.x), cdy = difference(c.y, d.y);
+
+            Expansion alift = sum(product(adx, adx), product(ady, ady));
+            Expansion blift = sum(product(bdx, bdx), product(bdy, bdy));
+            Expansion clift = sum(product(cdx, cdx), product(cdy, cdy));
+
+            Expansion bc = sum(product(bdx, cdy), negate(product(cdx, bdy)));
+            Expansion ca = sum(product(cdx, ady), negate(product(adx, cdy)));
+            Expansion ab = sum(product(adx, bdy), negate(product(bdx, ady)));
+
+            return estimate(sum(sum(product(alift, bc), product(blift, ca)), product(clift, ab)));
+        }
+
+        int sign(double value) {
+            return (value > 0) - (value < 0);
+        }
+
+        // Положение точки p на отрезке a-b, заведомо лежащей с ним на одной прямой, вдоль его главной оси
+        double along(const Point& a, const Point& b, const Point& p) {
+            return std::abs(b.x - a.x) >= std::abs(b.y - a.y) ? p.x : p.y;
+        }
+    }
+
+    double cross(const Point& a, const Point& b, const Point& c, const Point& d) {
+        double abx = b.x - a.x, aby = b.y - a.y;
+        double cdx = d.x - c.x, cdy = d.y - c.y;
+        double left = abx * cdy;
+        double right = aby * cdx;
+        double det = left - right;
+        // Слагаемые разных знаков: знак разности вычислен верно
+        if ((left > 0 && right <= 0) || (left < 0 && right >= 0))
+            return det;
+        // Разность double равна нулю только для равных аргументов, тогда слагаемое - точный ноль,
+        // а знак второго (если оно не ушло в ноль при антипереполнении) вычислен верно.
+        // Так без разложений решаются вертикальные и горизонтальные рёбра и совпадающие векторы
+        bool left_zero = abx == 0 || cdy == 0;
+        bool right_zero = aby == 0 || cdx == 0;
+        if (left_zero && right_zero)
+            return 0;
+        if (left_zero && right != 0)
+            return -right;
+        if (right_zero && left != 0)
+            return left;
+        if (a.x == c.x && a.y == c.y && b.x == d.x && b.y == d.y)
+            return 0;
+        double bound = ORIENT_ERROR_BOUND * (std::abs(left) + std::abs(right));
+        if (det > bound || -det > bound)
+            return det;
+        return crossExact(a, b, c, d);
+    }
+
+    double orient2d(const Point& a, const Point& b, const Point& c) {
+        return cross(a, b, a, c);
+    }
+
+    double incircle(const Point& a, const Point& b, const Point& c, const Point& d) {
+        double adx = a.x - d.x, ady = a.y - d.y;
+        double bdx = b.x - d.x, bdy = b.y - d.y;
+        double cdx = c.x - d.x, cdy = c.y - d.y;
+
+        double bdxcdy = bdx * cdy, cdxbdy = cdx * bdy;
+        double cdxady = cdx * ady, adxcdy = adx * cdy;
+        double adxbdy = adx * bdy, bdxady = bdx * ady;
+        double alift = adx * adx + ady * ady;
+        double blift = bdx * bdx + bdy * bdy;
+        double clift = cdx * cdx + cdy * cdy;
+
+        double det = alift * (bdxcdy - cdxbdy) + blift * (cdxady - adxcdy) + clift * (adxbdy - bdxady);
+        double permanent = (std::abs(bdxcdy) + std::abs(cdxbdy)) * alift
+                         + (std::abs(cdxady) + std::abs(adxcdy)) * blift
+                         + (std::abs(adxbdy) + std::abs(bdxady)) * clift;
+        double bound = INCIRCLE_ERROR_BOUND * permanent;
+        if (det > bound || -det > bound)
+            return det;
+        return incircleExact(a, b, c, d);
+    }
+
+    SegmentIntersection intersectSegments(const Point& p1, const Point& p2, const Point& q1, const Point& q2) {
+        double o1 = orient2d(p1, p2, q1);
+        double o2 = orient2d(p1, p2, q2);
+        double o3 = orient2d(q1, q2, p1);
+        double o4 = orient2d(q1, q2, p2);
+
+        if (o1 == 0 && o2 == 0 && o3 == 0 && o4 == 0) {
+            if (p1 == p2 && q1 == q2)
+                return {p1 == q1 ? IntersectionStatus::Crossing : IntersectionStatus::None, p1};
+            // Все четыре точки на одной прямой: пересечение проекций на главную ось невырожденного отрезка
+            const Point& axis_to = p1 == p2 ? q2 : p2;
+            const Point& axis_from = p1 == p2 ? q1 : p1;
+            auto key = [&](const Point& p) { return along(axis_from, axis_to, p); };
+            auto ordered = [&](const Point& a, const Point& b) { return key(a) <= key(b) ? std::make_pair(a, b) : std::make_pair(b, a); };
+            std::pair<Point, Point> p = ordered(p1, p2);
+            std::pair<Point, Point> q = ordered(q1, q2);
+            const Point& start = key(p.first) >= key(q.first) ? p.first : q.first;
+            const Point& end = key(p.second) <= key(q.second) ? p.second : q.second;
+            if (key(start) > key(end))
+                return {IntersectionStatus::None, Point()};
+            return {start == end ? IntersectionStatus::Crossing : IntersectionStatus::Overlap, start};
+        }
+
+        if (sign(o1) * sign(o2) > 0 || sign(o3) * sign(o4) > 0)
+            return {IntersectionStatus::None, Point()};
+
+        // Касание концом отрезка возвращается без округления
+        if (o1 == 0)
+            return {IntersectionStatus::Crossing, q1};
+        if (o2 == 0)
+            return {IntersectionStatus::Crossing, q2};
+        if (o3 == 0)
+            return {IntersectionStatus::Crossing, p1};
+        if (o4 == 0)
+            return {IntersectionStatus::Crossing, p2};
+
+        double t = o3 / (o3 - o4);
+        return {IntersectionStatus::Crossing, p1 + (p2 - p1) * t};
+    }
+
+    std::optional<Point> intersectLines(const Point& a, const Point& b, const Point& c, const Point& d) {
+        double det = cross(a, b, c, d);
+        if (det == 0)
+            return std::nullopt;
+        double t = cross(a, c, c, d) / det;
+        return a + (b - a) * t;
+    }
+}
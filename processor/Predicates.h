@@ -0,0 +1,40 @@
+#ifndef PREDICATES_H
+#define PREDICATES_H
+
+#include <optional>
+#include "Entity.h"
+
+// Геометрические предикаты с адаптивной точностью: значение сначала вычисляется в double
+// с оценкой погрешности, и только если знак не гарантирован, пересчитывается точно
+// в арифметике разложений (сумм непересекающихся double). Исключений не бросают
+namespace Predicates {
+    // > 0, если c слева от направленной прямой a -> b, < 0 - справа, 0 - точки на одной прямой.
+    // Знак точен, модуль приближённо равен удвоенной площади треугольника abc
+    double orient2d(const Point& a, const Point& b, const Point& c);
+
+    // Векторное произведение (b - a) x (d - c) с точным знаком
+    double cross(const Point& a, const Point& b, const Point& c, const Point& d);
+
+    // > 0, если d внутри окружности через a, b, c (обход против часовой стрелки),
+    // < 0 - снаружи, 0 - на окружности. Знак точен
+    double incircle(const Point& a, const Point& b, const Point& c, const Point& d);
+
+    enum class IntersectionStatus {
+        None,       // Отрезки не пересекаются
+        Crossing,   // Единственная общая точка (в том числе касание концом)
+        Overlap     // Отрезки лежат на одной прямой и перекрываются по отрезку
+    };
+
+    struct SegmentIntersection {
+        IntersectionStatus status;
+        Point point;    // Точка пересечения; для Overlap - начало общего участка
+    };
+
+    // Классификация выполняется точными предикатами, координаты точки пересечения - в double
+    SegmentIntersection intersectSegments(const Point& p1, const Point& p2, const Point& q1, const Point& q2);
+
+    // Пересечение прямых ab и cd; пусто для параллельных и совпадающих прямых
+    std::optional<Point> intersectLines(const Point& a, const Point& b, const Point& c, const Point& d);
+}
+
+#endif // PREDICATES_H
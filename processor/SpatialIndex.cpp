@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <numeric>
+#include <queue>
+#include <tuple>
+#include "SpatialIndex.h"
+
+namespace {
+    const size_t NO_NODE = static_cast<size_t>(-1);
+
+    double centerX(const Box& box) {
+        return box.empty() ? 0 : (box.min_x + box.max_x) / 2;
+    }
+
+    double centerY(const Box& box) {
+        return box.empty() ? 0 : (box.min_y + box.max_y) / 2;
+    }
+}
+
+SpatialIndex::SpatialIndex(const std::vector<Box>& boxes)
+    : root(NO_NODE), boxes(boxes), slots(boxes.size()), removed_nodes(0) {
+    std::iota(slots.begin(), slots.end(), 0);
+    rebuild();
+}
+
+size_t SpatialIndex::size() const {
+    return slots.size();
+}
+
+Box SpatialIndex::bounds() const {
+    return nodes[root].box;
+}
+
+size_t SpatialIndex::newNode(bool leaf) {
+    nodes.push_back({Box(), NO_NODE, leaf, {}});
+    return nodes.size() - 1;
+}
+
+void SpatialIndex::recomputeBox(size_t node) {
+    Node& n = nodes[node];
+    n.box = Box();
+    for (size_t e : n.entries) {
+        n.box.expand(n.leaf ? boxes[e] : nodes[e].box);
+    }
+}
+
+void SpatialIndex::adjustUpwards(size_t node) {
+    for (; node != NO_NODE; node = nodes[node].parent) {
+        recomputeBox(node);
+    }
+}
+
+void SpatialIndex::rebuild() {
+    // Постоянные номера уплотняются и совпадают с индексами
+    if (!free_slots.empty() || !std::is_sorted(slots.begin(), slots.end())) {
+        std::vector<Box> live;
+        live.reserve(slots.size());
+        for (size_t slot : slots)
+            live.push_back(boxes[slot]);
+        boxes.swap(live);
+        std::iota(slots.begin(), slots.end(), 0);
+        free_slots.clear();
+    }
+    positions = slots;
+
+    nodes.clear();
+    removed_nodes = 0;
+    leaves.assign(boxes.size(), NO_NODE);
+
+    std::vector<size_t> level(boxes.size());
+    for (size_t i = 0; i < level.size(); ++i)
+        level[i] = i;
+
+    // Уровни упаковываются снизу вверх: сортировка по x, разбиение на вертикальные полосы,
+    // сортировка полос по y и нарезка на узлы по MAX_ENTRIES элементов
+    bool leaf = true;
+    while (leaf || level.size() > 1) {
+        auto boxOf = [this, leaf](size_t e) -> const Box& {
+            return leaf ? boxes[e] : nodes[e].box;
+        };
+
+        size_t node_count = (level.size() + MAX_ENTRIES - 1) / MAX_ENTRIES;
+        size_t slice_count = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(node_count))));
+        size_t slice_size = std::max<size_t>(1, slice_count) * MAX_ENTRIES;
+
+        std::sort(level.begin(), level.end(), [&](size_t a, size_t b) {
+            return centerX(boxOf(a)) < centerX(boxOf(b));
+        });
+
+        std::vector<size_t> upper;
+        upper.reserve(node_count);
+        for (size_t slice = 0; slice < level.size(); slice += slice_size) {
+            auto begin = level.begin() + slice;
+            auto end = level.begin() + std::min(slice + slice_size, level.size());
+            std::sort(begin, end, [&](size_t a, size_t b) {
+                return centerY(boxOf(a)) < centerY(boxOf(b));
+            });
+
+            for (auto it = begin; it < end; it += std::min<ptrdiff_t>(MAX_ENTRIES, end - it)) {
+                size_t node = newNode(leaf);
+                auto last = it + std::min<ptrdiff_t>(MAX_ENTRIES, end - it);
+                nodes[node].entries.assign(it, last);
+                for (size_t e : nodes[node].entries) {
+                    if (leaf)
+                        leaves[e] = node;
+                    else
+                        nodes[e].parent = node;
+                }
+                recomputeBox(node);
+                upper.push_back(node);
+            }
+        }
+
+        if (upper.empty())
+            upper.push_back(newNode(true));
+        level.swap(upper);
+        leaf = false;
+    }
+
+    root = level.front();
+    nodes[root].parent = NO_NODE;
+}
+
+size_t SpatialIndex::chooseLeaf(const Box& box) const {
+    size_t node = root;
+    while (!nodes[node].leaf) {
+        size_t best = NO_NODE;
+        double best_growth = 0, best_area = 0;
+        for (size_t child : nodes[node].entries) {
+            Box grown = nodes[child].box;
+            grown.expand(box);
+            double area = nodes[child].box.empty() ? 0 : nodes[child].box.area();
+            double growth = grown.area() - area;
+            if (best == NO_NODE || growth < best_growth || (growth == best_growth && area < best_area)) {
+                best = child;
+                best_growth = growth;
+                best_area = area;
+            }
+        }
+        if (best == NO_NODE)
+            break;
+        node = best;
+    }
+    return node;
+}
+
+// Делит переполненный узел пополам вдоль оси с наибольшим разбросом центров
+void SpatialIndex::split(size_t node) {
+    bool leaf = nodes[node].leaf;
+    auto boxOf = [this, leaf](size_t e) -> const Box& {
+        return leaf ? boxes[e] : nodes[e].box;
+    };
+
+    std::vector<size_t> entries = std::move(nodes[node].entries);
+    Box centers;
+    for (size_t e : entries)
+        centers.expand(Point(centerX(boxOf(e)), centerY(boxOf(e))));
+    bool by_x = centers.max_x - centers.min_x >= centers.max_y - centers.min_y;
+    std::sort(entries.begin(), entries.end(), [&](size_t a, size_t b) {
+        return by_x ? centerX(boxOf(a)) < centerX(boxOf(b)) : centerY(boxOf(a)) < centerY(boxOf(b));
+    });
+
+    size_t sibling = newNode(leaf);
+    size_t half = entries.size() / 2;
+    nodes[node].entries.assign(entries.begin(), entries.begin() + half);
+    nodes[sibling].entries.assign(entries.begin() + half, entries.end());
+    for (size_t e : nodes[sibling].entries) {
+        if (leaf)
+            leaves[e] = sibling;
+        else
+            nodes[e].parent = sibling;
+    }
+    recomputeBox(node);
+    recomputeBox(sibling);
+
+    size_t parent = nodes[node].parent;
+    if (parent == NO_NODE) {
+        root = newNode(false);
+        nodes[root].entries = {node, sibling};
+        nodes[node].parent = root;
+        nodes[sibling].parent = root;
+        recomputeBox(root);
+        return;
+    }
+
+    nodes[sibling].parent = parent;
+    nodes[parent].entries.push_back(sibling);
+    if (nodes[parent].entries.size() > MAX_ENTRIES)
+        split(parent);
+    else
+        adjustUpwards(parent);
+}
+
+void SpatialIndex::attach(size_t slot) {
+    // Корень, у которого удалены все потомки, снова становится листом
+    if (!nodes[root].leaf && nodes[root].entries.empty())
+        nodes[root].leaf = true;
+
+    size_t leaf = chooseLeaf(boxes[slot]);
+    nodes[leaf].entries.push_back(slot);
+    leaves[slot] = leaf;
+    if (nodes[leaf].entries.size() > MAX_ENTRIES)
+        split(leaf);
+    else
+        adjustUpwards(leaf);
+}
+
+// Убирает элемент из листа; опустевшие узлы отцепляются от родителя
+void SpatialIndex::detach(size_t slot) {
+    size_t node = leaves[slot];
+    auto& entries = nodes[node].entries;
+    entries.erase(std::find(entries.begin(), entries.end(), slot));
+    leaves[slot] = NO_NODE;
+
+    while (nodes[node].entries.empty() && nodes[node].parent != NO_NODE) {
+        size_t parent = nodes[node].parent;
+        auto& siblings = nodes[parent].entries;
+        siblings.erase(std::find(siblings.begin(), siblings.end(), node));
+        nodes[node].parent = NO_NODE;
+        ++removed_nodes;
+        node = parent;
+    }
+    adjustUpwards(node);
+}
+
+void SpatialIndex::renumber(size_t from) {
+    for (size_t i = from; i < slots.size(); ++i)
+        positions[slots[i]] = i;
+}
+
+void SpatialIndex::insert(size_t id, const Box& box) {
+    if (id > slots.size()) {
+        throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
+    }
+    size_t slot;
+    if (free_slots.empty()) {
+        slot = boxes.size();
+        boxes.push_back(box);
+        leaves.push_back(NO_NODE);
+        positions.push_back(id);
+    } else {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        boxes[slot] = box;
+    }
+    slots.insert(slots.begin() + id, slot);
+    renumber(id);
+    attach(slot);
+}
+
+void SpatialIndex::remove(size_t id) {
+    if (id >= slots.size()) {
+        throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
+    }
+    size_t slot = slots[id];
+    detach(slot);
+    slots.erase(slots.begin() + id);
+    renumber(id);
+    positions[slot] = NO_NODE;
+    free_slots.push_back(slot);
+
+    // После множества удалений дерево перестраивается заново
+    if (removed_nodes > nodes.size() / 2)
+        rebuild();
+}
+
+void SpatialIndex::update(size_t id, const Box& box) {
+    if (id >= slots.size()) {
+        throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
+    }
+    size_t slot = slots[id];
+    detach(slot);
+    boxes[slot] = box;
+    attach(slot);
+}
+
+void SpatialIndex::query(const Box& window, const Visitor& visitor) const {
+    std::vector<size_t> stack = {root};
+    while (!stack.empty()) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+        if (!node.box.intersects(window))
+            continue;
+        for (size_t e : node.entries) {
+            if (!node.leaf)
+                stack.push_back(e);
+            else if (boxes[e].intersects(window))
+                visitor(positions[e]);
+        }
+    }
+}
+
+void SpatialIndex::query(const Point& point, const Visitor& visitor) const {
+    query(Box(point.x, point.y, point.x, point.y), visitor);
+}
+
+std::vector<size_t> SpatialIndex::nearest(const Point& point, size_t count, const DistanceFunction& distance) const {
+    // Поиск в порядке возрастания расстояния: в очереди и узлы, и элементы
+    using Candidate = std::tuple<double, bool, size_t>;    // расстояние, элемент ли, индекс
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> queue;
+    std::vector<size_t> result;
+
+    if (count == 0 || slots.empty())
+        return result;
+    queue.emplace(nodes[root].box.distance(point), false, root);
+
+    while (!queue.empty() && result.size() < count) {
+        Candidate candidate = queue.top();
+        queue.pop();
+        size_t index = std::get<2>(candidate);
+
+        if (std::get<1>(candidate)) {
+            result.push_back(index);
+            continue;
+        }
+
+        const Node& node = nodes[index];
+        for (size_t e : node.entries) {
+            if (node.leaf)
+                queue.emplace(distance ? distance(positions[e]) : boxes[e].distance(point), true, positions[e]);
+            else
+                queue.emplace(nodes[e].box.distance(point), false, e);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,62 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <functional>
+#include <vector>
+#include "Entity.h"
+
+// R-дерево по ограничивающим прямоугольникам элементов.
+// Элементы идентифицируются индексом (позицией полигона в слое), при вставке и удалении
+// в середину индексы последующих элементов сдвигаются так же, как в std::vector.
+// В дереве элементы хранятся под постоянными номерами, поэтому сдвиг меняет только таблицу
+// номеров: вставка и удаление стоят O(log n) плюс сдвиг хвоста этой таблицы, как у std::vector
+class SpatialIndex {
+public:
+    using Visitor = std::function<void(size_t)>;
+    using DistanceFunction = std::function<double(size_t)>;
+
+    static const size_t MAX_ENTRIES = 16;
+
+    // Пакетное построение методом STR (Sort-Tile-Recursive)
+    explicit SpatialIndex(const std::vector<Box>& boxes = {});
+
+    size_t size() const;
+    Box bounds() const;                         // Прямоугольник всех элементов
+    void insert(size_t id, const Box& box);     // Вставка со сдвигом индексов >= id
+    void remove(size_t id);                     // Удаление со сдвигом индексов > id
+    void update(size_t id, const Box& box);     // Изменение прямоугольника элемента
+    void rebuild();
+
+    void query(const Box& window, const Visitor& visitor) const;
+    void query(const Point& point, const Visitor& visitor) const;
+    // count ближайших элементов; distance уточняет расстояние до элемента (не меньше расстояния до его прямоугольника)
+    std::vector<size_t> nearest(const Point& point, size_t count, const DistanceFunction& distance = nullptr) const;
+
+private:
+    struct Node {
+        Box box;
+        size_t parent;
+        bool leaf;
+        std::vector<size_t> entries;    // Для листа - индексы элементов, иначе - индексы узлов
+    };
+
+    std::vector<Node> nodes;
+    size_t root;
+    std::vector<Box> boxes;         // Прямоугольники элементов по постоянному номеру
+    std::vector<size_t> leaves;     // Лист, содержащий элемент, по постоянному номеру
+    std::vector<size_t> slots;      // Постоянный номер элемента по его индексу
+    std::vector<size_t> positions;  // Индекс элемента по постоянному номеру
+    std::vector<size_t> free_slots; // Номера удалённых элементов для повторного использования
+    size_t removed_nodes;           // Узлы, выпавшие из дерева после удалений
+
+    size_t newNode(bool leaf);
+    void recomputeBox(size_t node);
+    void adjustUpwards(size_t node);
+    size_t chooseLeaf(const Box& box) const;
+    void split(size_t node);
+    void attach(size_t slot);
+    void detach(size_t slot);
+    void renumber(size_t from);     // Обновляет positions для индексов >= from
+};
+
+#endif // SPATIALINDEX_H
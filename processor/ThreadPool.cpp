@@ -0,0 +1,160 @@
+#include "ThreadPool.h"
+
+namespace {
+    // Пул и номер потока, в котором выполняется текущая задача
+    thread_local const ThreadPool* current_pool = nullptr;
+    thread_local size_t current_worker = 0;
+}
+
+ThreadPool::ThreadPool(size_t threads)
+    : queued(0), pending(0), next_queue(0), stopping(false) {
+    if (threads == 0)
+        threads = 1;
+    for (size_t i = 0; i < threads; ++i) {
+        queues.emplace_back(new Queue());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back(&ThreadPool::run, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::size() const {
+    return workers.size();
+}
+
+void ThreadPool::submit(Task task) {
+    size_t index = current_pool == this ? current_worker : next_queue++ % queues.size();
+    pending++;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+    done.notify_all();      // Потоки пула, ждущие в parallel_for, берут новые задачи
+}
+
+bool ThreadPool::pop(size_t worker, Task& task) {
+    // Сначала своя очередь с конца: последние добавленные задачи ещё в кэше
+    {
+        Queue& own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    // Затем перехват из начала чужих очередей
+    for (size_t i = 1; i < queues.size(); ++i) {
+        Queue& other = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty()) {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::execute(Task& task) {
+    queued--;
+    try {
+        task();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+            error = std::current_exception();
+    }
+    if (--pending == 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.notify_all();
+    }
+}
+
+void ThreadPool::run(size_t worker) {
+    current_pool = this;
+    current_worker = worker;
+
+    while (true) {
+        Task task;
+        if (pop(worker, task)) {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0)
+            return;
+    }
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+    if (error) {
+        std::exception_ptr rethrown = error;
+        error = nullptr;
+        std::rethrow_exception(rethrown);
+    }
+}
+
+// У каждого вызова свой счётчик и своё исключение: общий счётчик pending учитывает и задачу,
+// из которой вызван parallel_for, и задачи других вызывающих
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)>& body) {
+    if (count == 0)
+        return;
+    std::atomic<size_t> remaining(count);
+    std::exception_ptr failure;
+    for (size_t i = 0; i < count; ++i) {
+        submit([this, &body, &remaining, &failure, i] {
+            try {
+                body(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!failure)
+                    failure = std::current_exception();
+            }
+            if (--remaining == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        });
+    }
+
+    if (current_pool == this) {
+        // Поток пула не засыпает, пока в очередях есть задачи: иначе задачи вызова могут остаться без исполнителя
+        while (remaining > 0) {
+            Task task;
+            if (pop(current_worker, task)) {
+                execute(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this, &remaining] { return remaining == 0 || queued > 0; });
+        }
+    } else {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&remaining] { return remaining == 0; });
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (failure)
+        std::rethrow_exception(failure);
+}
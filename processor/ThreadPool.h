@@ -0,0 +1,61 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков с перехватом работы (work stealing): у каждого потока своя очередь,
+// свои задачи он берёт с конца, а при пустой очереди забирает задачи из начала чужих
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const;
+
+    // Задачи из внешнего кода распределяются по очередям по кругу, из задач пула - в очередь текущего потока
+    void submit(Task task);
+
+    // Ждёт завершения всех задач пула; первое исключение из задач, переданных через submit, пробрасывается дальше
+    void wait();
+
+    // Выполняет body(i) для i из [0, count) и ждёт только своих задач; первое исключение из body пробрасывается.
+    // Можно вызывать из нескольких потоков и из задач этого же пула: поток пула во время ожидания выполняет задачи из очередей
+    void parallel_for(size_t count, const std::function<void(size_t)>& body);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::atomic<size_t> queued;
+    std::atomic<size_t> pending;
+    std::atomic<size_t> next_queue;
+    bool stopping;
+    std::exception_ptr error;
+
+    bool pop(size_t worker, Task& task);
+    void execute(Task& task);       // Выполняет взятую из очереди задачу
+    void run(size_t worker);
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "ThreadPool.h"
+#include "TileRasterizer.h"
+#include "Trace.h"
+
+namespace {
+    const int64_t T = TileRasterizer::TILE_SIZE;
+
+    // Контуры полигона слоя (первый - внешний) и его ограничивающий прямоугольник.
+    // Компактный слой читается через PolygonView, чтобы не распаковывать его из разных потоков
+    Box contoursOf(const Layer& layer, size_t index, std::vector<ContourView>& contours) {
+        contours.clear();
+        if (layer.is_compact()) {
+            PolygonView polygon = layer.get_compact()[index];
+            contours.push_back(polygon.get_vertices());
+            for (size_t i = 0; i < polygon.hole_count(); ++i)
+                contours.push_back(polygon.get_hole(i));
+            return polygon.get_bounding_box();
+        }
+        const Polygon& polygon = layer[index];
+        contours.emplace_back(polygon.get_vertices());
+        for (const Hole& hole : polygon.get_holes())
+            contours.emplace_back(hole.get_vertices());
+        return polygon.get_bounding_box();
+    }
+
+    Box tileBox(int64_t column, int64_t row, double scale) {
+        return Box(column * T / scale, row * T / scale, (column + 1) * T / scale, (row + 1) * T / scale);
+    }
+
+    int64_t tileIndex(double coordinate, double scale) {
+        return static_cast<int64_t>(std::floor(coordinate * scale / T));
+    }
+
+    int64_t clampPixel(double value) {
+        return static_cast<int64_t>(std::min(std::max(value, -1.0), static_cast<double>(T)));
+    }
+
+    // Наложение src на dst с учётом прозрачности обоих (цвета без предварительного умножения на альфу)
+    uint32_t blend(uint32_t dst, uint32_t src) {
+        uint32_t alpha = src >> 24;
+        if (alpha == 255 || (dst >> 24) == 0)
+            return alpha ? src : dst;
+        if (alpha == 0)
+            return dst;
+        uint32_t below = (dst >> 24) * (255 - alpha) / 255;
+        uint32_t total = alpha + below;
+        uint32_t result = total << 24;
+        for (int shift = 0; shift < 24; shift += 8) {
+            uint32_t channel = (((src >> shift) & 255) * alpha + ((dst >> shift) & 255) * below + total / 2) / total;
+            result |= channel << shift;
+        }
+        return result;
+    }
+
+    // Построчная заливка по правилу чёт-нечет. Пиксель (i, j) закрашивается, если его центр
+    // (i + 0.5, j + 0.5) внутри; x и y переводятся в пиксели тайла, y растёт вниз
+    void fill(TileRasterizer::Tile& tile, const std::vector<ContourView>& contours, const Box& box,
+              double scale, uint32_t color) {
+        double origin_x = static_cast<double>(tile.column * T);
+        double origin_y = static_cast<double>((tile.row + 1) * T);
+
+        if ((box.max_x - box.min_x) * scale < 1 && (box.max_y - box.min_y) * scale < 1) {
+            // Полигон меньше пикселя: одна точка в пикселе его центра
+            int64_t i = static_cast<int64_t>(std::floor((box.min_x + box.max_x) / 2 * scale - origin_x));
+            int64_t j = static_cast<int64_t>(std::floor(origin_y - (box.min_y + box.max_y) / 2 * scale));
+            if (i >= 0 && i < T && j >= 0 && j < T)
+                tile.pixels[j * T + i] = blend(tile.pixels[j * T + i], color);
+            return;
+        }
+
+        struct Edge {
+            double x1, y1, x2, y2;
+        };
+        std::vector<Edge> edges;
+        for (const ContourView& contour : contours) {
+            for (size_t k = 0; k < contour.size(); ++k) {
+                const Point& a = contour[k];
+                const Point& b = contour[(k + 1) % contour.size()];
+                Edge edge = {a.x * scale - origin_x, origin_y - a.y * scale, b.x * scale - origin_x, origin_y - b.y * scale};
+                if (edge.y1 == edge.y2 || std::max(edge.y1, edge.y2) < 0 || std::min(edge.y1, edge.y2) > T)
+                    continue;
+                edges.push_back(edge);
+            }
+        }
+
+        int64_t first_row = std::max<int64_t>(0, clampPixel(std::ceil(origin_y - box.max_y * scale - 0.5)));
+        int64_t last_row = std::min<int64_t>(T - 1, clampPixel(std::floor(origin_y - box.min_y * scale - 0.5)));
+        std::vector<double> crossings;
+        for (int64_t j = first_row; j <= last_row; ++j) {
+            double y = j + 0.5;
+            crossings.clear();
+            for (const Edge& edge : edges) {
+                if ((edge.y1 <= y) != (edge.y2 <= y))
+                    crossings.push_back(edge.x1 + (y - edge.y1) * (edge.x2 - edge.x1) / (edge.y2 - edge.y1));
+            }
+            std::sort(crossings.begin(), crossings.end());
+            uint32_t* row = tile.pixels.data() + j * T;
+            for (size_t k = 0; k + 1 < crossings.size(); k += 2) {
+                int64_t from = std::max<int64_t>(0, clampPixel(std::ceil(crossings[k] - 0.5)));
+                int64_t to = std::min<int64_t>(T, clampPixel(std::ceil(crossings[k + 1] - 0.5)));
+                for (int64_t i = from; i < to; ++i)
+                    row[i] = blend(row[i], color);
+            }
+        }
+    }
+}
+
+size_t TileRasterizer::TileKeyHash::operator()(const std::pair<int64_t, int64_t>& key) const {
+    uint64_t hash = static_cast<uint64_t>(key.first) * 0x9e3779b97f4a7c15ULL;
+    return static_cast<size_t>(hash ^ (static_cast<uint64_t>(key.second) + 0x7f4a7c159e3779b9ULL + (hash << 6) + (hash >> 2)));
+}
+
+TileRasterizer::TileRasterizer(const LayerPack& layerpack, const std::vector<LayerStyle>& styles,
+                               double scale, size_t threads, size_t capacity)
+    : layerpack(layerpack), styles(styles), scale(1), capacity(capacity), frame(0), rendered(0) {
+    set_scale(scale);
+    if (threads > 1)
+        pool.reset(new ThreadPool(threads));
+}
+
+TileRasterizer::~TileRasterizer() = default;
+
+void TileRasterizer::set_styles(const std::vector<LayerStyle>& new_styles) {
+    styles = new_styles;
+    snapshots.clear();
+    tiles.clear();
+}
+
+void TileRasterizer::set_scale(double new_scale) {
+    if (!(new_scale > 0) || !std::isfinite(new_scale)) {
+        throw std::invalid_argument("Масштаб должен быть положительным числом");
+    }
+    scale = new_scale;
+    tiles.clear();
+}
+
+double TileRasterizer::get_scale() const {
+    return scale;
+}
+
+size_t TileRasterizer::cached_tiles() const {
+    return tiles.size();
+}
+
+size_t TileRasterizer::rendered_tiles() const {
+    return rendered;
+}
+
+void TileRasterizer::invalidate_all() {
+    tiles.clear();
+}
+
+void TileRasterizer::invalidate(const Box& region) {
+    if (region.empty() || tiles.empty())
+        return;
+    int64_t first_column = tileIndex(region.min_x, scale), last_column = tileIndex(region.max_x, scale);
+    int64_t first_row = tileIndex(region.min_y, scale), last_row = tileIndex(region.max_y, scale);
+    // Большая область: дешевле пройти по кэшу, чем по всем тайлам области
+    double area = (static_cast<double>(last_column - first_column) + 1) * (static_cast<double>(last_row - first_row) + 1);
+    if (area > static_cast<double>(tiles.size())) {
+        for (auto it = tiles.begin(); it != tiles.end();) {
+            if (it->first.first >= first_column && it->first.first <= last_column &&
+                it->first.second >= first_row && it->first.second <= last_row)
+                it = tiles.erase(it);
+            else
+                ++it;
+        }
+        return;
+    }
+    for (int64_t row = first_row; row <= last_row; ++row) {
+        for (int64_t column = first_column; column <= last_column; ++column)
+            tiles.erase({column, row});
+    }
+}
+
+// Сбрасывает тайлы под областями правок изменённых слоёв. Области берутся из журнала слоя
+// (Layer::changed_regions), поэтому правка стоит столько же, сколько изменённых полигонов, а не весь слой
+void TileRasterizer::detect_changes() {
+    std::vector<Box> regions;
+    for (const LayerStyle& style : styles) {
+        LayerSnapshot& snapshot = snapshots[style.layer];
+        bool present = layerpack.contains(style.layer);
+        const Layer* layer = present ? &layerpack[style.layer] : nullptr;
+        uint64_t version = present ? layer->get_version() : 0;
+        if (present == snapshot.present && version == snapshot.version)
+            continue;
+
+        TRACE_SCOPE("raster_detect_changes");
+        Box box = layer ? layer->get_bounding_box() : Box();
+        if (!tiles.empty()) {
+            regions.clear();
+            if (present && snapshot.present && layer->changed_regions(snapshot.version, regions)) {
+                TRACE_COUNT("changed_regions", regions.size());
+                for (const Box& region : regions)
+                    invalidate(region);
+            } else {
+                // Журнал не покрывает правку (слой заменён, переполнение журнала): перерисовывается
+                // всё, что занимал слой до и после неё
+                invalidate(snapshot.box);
+                invalidate(box);
+            }
+        }
+        snapshot.present = present;
+        snapshot.version = version;
+        snapshot.box = box;
+    }
+}
+
+void TileRasterizer::draw(Tile& tile) const {
+    tile.pixels.assign(T * T, 0);
+    Box window = tileBox(tile.column, tile.row, scale);
+    std::vector<ContourView> contours;
+    for (const LayerStyle& style : styles) {
+        if (!layerpack.contains(style.layer))
+            continue;
+        const Layer& layer = layerpack[style.layer];
+        for (size_t id : layer.query_window(window)) {
+            Box box = contoursOf(layer, id, contours);
+            fill(tile, contours, box, scale, style.color);
+        }
+    }
+}
+
+void TileRasterizer::evict() {
+    if (tiles.size() <= capacity)
+        return;
+    std::vector<std::pair<uint64_t, std::pair<int64_t, int64_t>>> old;
+    for (const auto& [key, tile] : tiles) {
+        if (tile.last_used < frame)
+            old.push_back({tile.last_used, key});
+    }
+    std::sort(old.begin(), old.end());
+    for (size_t i = 0; i < old.size() && tiles.size() > capacity; ++i)
+        tiles.erase(old[i].second);
+}
+
+std::vector<const TileRasterizer::Tile*> TileRasterizer::render(const Box& view) {
+    std::vector<const Tile*> result;
+    if (view.empty())
+        return result;
+    int64_t first_column = tileIndex(view.min_x, scale), last_column = tileIndex(view.max_x, scale);
+    int64_t first_row = tileIndex(view.min_y, scale), last_row = tileIndex(view.max_y, scale);
+    double count = (static_cast<double>(last_column - first_column) + 1) * (static_cast<double>(last_row - first_row) + 1);
+    if (count > static_cast<double>(capacity)) {
+        throw std::invalid_argument("Окно содержит больше тайлов, чем помещается в кэш");
+    }
+
+    TRACE_SCOPE("raster_render");
+    ++frame;
+    detect_changes();
+
+    // Элементы unordered_map не перемещаются при росте таблицы, поэтому указатели на новые тайлы
+    // остаются действительными до конца отрисовки
+    std::vector<Tile*> missing;
+    for (int64_t row = last_row; row >= first_row; --row) {
+        for (int64_t column = first_column; column <= last_column; ++column) {
+            auto [it, inserted] = tiles.try_emplace({column, row});
+            Tile& tile = it->second;
+            if (inserted) {
+                tile.column = column;
+                tile.row = row;
+                missing.push_back(&tile);
+            }
+            tile.last_used = frame;
+            result.push_back(&tile);
+        }
+    }
+
+    if (!missing.empty()) {
+        // R-деревья слоёв строятся лениво; строим их заранее, чтобы потоки только читали
+        for (const LayerStyle& style : styles) {
+            if (layerpack.contains(style.layer))
+                layerpack[style.layer].query_window(view);
+        }
+        if (pool && missing.size() > 1) {
+            pool->parallel_for(missing.size(), [&](size_t i) {
+                draw(*missing[i]);
+            });
+        } else {
+            for (Tile* tile : missing)
+                draw(*tile);
+        }
+        rendered += missing.size();
+    }
+    TRACE_COUNT("tiles", result.size());
+    TRACE_COUNT("rendered", missing.size());
+
+    evict();
+    return result;
+}
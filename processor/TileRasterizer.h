@@ -0,0 +1,82 @@
+#ifndef TILERASTERIZER_H
+#define TILERASTERIZER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Entity.h"
+
+class ThreadPool;
+
+// Слой и его цвет 0xAARRGGBB; слои рисуются в порядке списка поверх друг друга
+struct LayerStyle {
+    std::string layer;
+    uint32_t color;
+};
+
+// Растеризация LayerPack в кэш тайлов TILE_SIZE x TILE_SIZE пикселей для просмотра без GPU.
+//
+// Полигоны с дырками заливаются построчно (правило чёт-нечет, выборка в центрах пикселей).
+// Полигоны меньше пикселя по обеим осям не заливаются, а ставятся одной точкой.
+// Недостающие тайлы видимой области рисуются параллельно. После правки слоя перерисовываются
+// только тайлы, которых коснулись изменённые полигоны: при смене Layer::get_version их прямоугольники
+// берутся из журнала правок слоя (Layer::changed_regions).
+// Тайл (column, row) покрывает пиксели [column * TILE_SIZE, (column + 1) * TILE_SIZE) по x
+// и так же по y; ось y направлена вверх, строка 0 пикселей тайла - верхняя
+class TileRasterizer {
+public:
+    static const int64_t TILE_SIZE = 256;
+
+    struct Tile {
+        int64_t column, row;
+        std::vector<uint32_t> pixels;   // TILE_SIZE * TILE_SIZE, построчно сверху вниз
+        uint64_t last_used;
+    };
+
+    // threads <= 1 - отрисовка в вызывающем потоке. capacity - наибольшее число тайлов в кэше
+    TileRasterizer(const LayerPack& layerpack, const std::vector<LayerStyle>& styles,
+                   double scale = 1, size_t threads = 1, size_t capacity = 256);
+    ~TileRasterizer();
+
+    void set_styles(const std::vector<LayerStyle>& styles);     // Сбрасывает кэш
+    void set_scale(double scale);                                // Пикселей на единицу длины, сбрасывает кэш
+    double get_scale() const;
+
+    // Тайлы, покрывающие окно view, по строкам сверху вниз. Указатели действительны до следующего вызова render
+    std::vector<const Tile*> render(const Box& view);
+
+    void invalidate(const Box& region);
+    void invalidate_all();
+
+    size_t cached_tiles() const;
+    size_t rendered_tiles() const;      // Сколько тайлов нарисовано за всё время
+
+private:
+    struct LayerSnapshot {
+        bool present = false;
+        uint64_t version = 0;
+        Box box;                            // Прямоугольник слоя - на случай правки, которой нет в журнале
+    };
+
+    struct TileKeyHash {
+        size_t operator()(const std::pair<int64_t, int64_t>& key) const;
+    };
+
+    const LayerPack& layerpack;
+    std::vector<LayerStyle> styles;
+    double scale;
+    size_t capacity;
+    std::unique_ptr<ThreadPool> pool;
+    std::unordered_map<std::pair<int64_t, int64_t>, Tile, TileKeyHash> tiles;
+    std::unordered_map<std::string, LayerSnapshot> snapshots;
+    uint64_t frame;
+    size_t rendered;
+
+    void detect_changes();
+    void draw(Tile& tile) const;
+    void evict();
+};
+
+#endif // TILERASTERIZER_H
@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "Trace.h"
+
+namespace Trace {
+    namespace {
+        // Завершённый интервал; duration < 0 - отдельное значение счётчика вне интервалов
+        struct Event {
+            const char* name;
+            int64_t start;
+            int64_t duration;
+            const char* counter_names[MAX_COUNTERS];
+            int64_t counter_values[MAX_COUNTERS];
+            size_t counters;
+        };
+
+        // Кольцевой буфер потока. Блокировка захватывается только владельцем при записи
+        // и при чтении трассы, поэтому почти всегда свободна
+        struct Buffer {
+            size_t thread;
+            bool owned = true;  // Занят живым потоком
+            std::mutex mutex;
+            std::vector<Event> events;
+            size_t next = 0;    // Позиция следующей записи после заполнения буфера
+
+            void push(const Event& event) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (events.size() < BUFFER_CAPACITY) {
+                    events.push_back(event);
+                } else {
+                    events[next] = event;
+                    next = (next + 1) % BUFFER_CAPACITY;
+                }
+            }
+        };
+
+        std::atomic<bool> enabled(false);
+
+        // Буферы переживают свои потоки, чтобы трасса пула потоков была доступна после его остановки.
+        // Буфер завершившегося потока освобождается и достаётся следующему новому потоку вместе
+        // с накопленными событиями, поэтому буферов не больше, чем одновременно живших потоков
+        std::mutex& registryMutex() {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        std::vector<std::unique_ptr<Buffer>>& registry() {
+            static std::vector<std::unique_ptr<Buffer>> buffers;
+            return buffers;
+        }
+
+        size_t next_thread = 0;    // Номер потока для следующего нового буфера, под registryMutex
+
+        // Возвращает буфер в общий запас при завершении потока
+        struct LocalBuffer {
+            Buffer* buffer = nullptr;
+
+            ~LocalBuffer() {
+                if (buffer) {
+                    std::lock_guard<std::mutex> lock(registryMutex());
+                    buffer->owned = false;
+                }
+            }
+        };
+
+        thread_local LocalBuffer local_buffer;
+        thread_local Scope* current_scope = nullptr;
+
+        Buffer& localBuffer() {
+            if (!local_buffer.buffer) {
+                std::lock_guard<std::mutex> lock(registryMutex());
+                for (const auto& buffer : registry()) {
+                    if (!buffer->owned) {
+                        buffer->owned = true;
+                        local_buffer.buffer = buffer.get();
+                        return *local_buffer.buffer;
+                    }
+                }
+                registry().push_back(std::make_unique<Buffer>());
+                registry().back()->thread = next_thread++;
+                local_buffer.buffer = registry().back().get();
+            }
+            return *local_buffer.buffer;
+        }
+
+        int64_t now() {
+            static const auto epoch = std::chrono::steady_clock::now();
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+        }
+
+        void addCounter(const char* names[], int64_t values[], size_t& counters, const char* name, int64_t value) {
+            for (size_t i = 0; i < counters; ++i) {
+                if (names[i] == name || std::strcmp(names[i], name) == 0) {
+                    values[i] += value;
+                    return;
+                }
+            }
+            if (counters < MAX_COUNTERS) {
+                names[counters] = name;
+                values[counters++] = value;
+            }
+        }
+
+        void writeEvent(std::ostream& out, const Event& event, size_t thread) {
+            out << "{\"name\": \"" << event.name << "\", \"cat\": \"geometry\", \"pid\": 1, \"tid\": " << thread
+                << ", \"ts\": " << event.start / 1000.0;
+            if (event.duration >= 0)
+                out << ", \"ph\": \"X\", \"dur\": " << event.duration / 1000.0;
+            else
+                out << ", \"ph\": \"C\"";
+            out << ", \"args\": {";
+            for (size_t i = 0; i < event.counters; ++i)
+                out << (i ? ", " : "") << "\"" << event.counter_names[i] << "\": " << event.counter_values[i];
+            out << "}}";
+        }
+    }
+
+    void setEnabled(bool value) {
+        if (value)
+            now();      // Фиксирует начало отсчёта
+        enabled.store(value, std::memory_order_relaxed);
+    }
+
+    bool isEnabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        // Свободные буферы удаляются вместе с памятью, занятые только очищаются
+        auto& buffers = registry();
+        buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+                                     [](const std::unique_ptr<Buffer>& buffer) { return !buffer->owned; }),
+                      buffers.end());
+        for (const auto& buffer : buffers) {
+            std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+            buffer->events.clear();
+            buffer->next = 0;
+        }
+    }
+
+    size_t bufferCount() {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        return registry().size();
+    }
+
+    size_t eventCount() {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        size_t count = 0;
+        for (const auto& buffer : registry()) {
+            std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+            count += buffer->events.size();
+        }
+        return count;
+    }
+
+    void writeChromeTrace(const std::string& path) {
+        std::ofstream out(path);
+        if (!out) {
+            throw std::runtime_error("Не удалось открыть файл \"" + path + "\"");
+        }
+        out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        bool first = true;
+        std::lock_guard<std::mutex> lock(registryMutex());
+        for (const auto& buffer : registry()) {
+            std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+            // После заполнения самое старое событие лежит в позиции next
+            size_t size = buffer->events.size();
+            for (size_t i = 0; i < size; ++i) {
+                out << (first ? "\n" : ",\n");
+                writeEvent(out, buffer->events[(buffer->next + i) % size], buffer->thread);
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+        if (!out) {
+            throw std::runtime_error("Ошибка записи в файл \"" + path + "\"");
+        }
+    }
+
+    Scope::Scope(const char* name) : name(name), active(isEnabled()), start(0), parent(nullptr), counters(0) {
+        if (!active)
+            return;
+        parent = current_scope;
+        current_scope = this;
+        start = now();
+    }
+
+    Scope::~Scope() {
+        if (!active)
+            return;
+        Event event;
+        event.name = name;
+        event.start = start;
+        event.duration = now() - start;
+        event.counters = counters;
+        for (size_t i = 0; i < counters; ++i) {
+            event.counter_names[i] = counter_names[i];
+            event.counter_values[i] = counter_values[i];
+        }
+        current_scope = parent;
+        localBuffer().push(event);
+    }
+
+    void Scope::count(const char* counter, int64_t value) {
+        if (active)
+            addCounter(counter_names, counter_values, counters, counter, value);
+    }
+
+    void count(const char* name, int64_t value) {
+        if (current_scope) {
+            current_scope->count(name, value);
+        } else if (isEnabled()) {
+            Event event;
+            event.name = name;
+            event.start = now();
+            event.duration = -1;
+            event.counters = 0;
+            addCounter(event.counter_names, event.counter_values, event.counters, name, value);
+            localBuffer().push(event);
+        }
+    }
+}
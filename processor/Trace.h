@@ -0,0 +1,62 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+
+// Инструментирование горячих участков: вложенные интервалы времени со счётчиками
+// (входные и выходные трапецоиды, проверенные пары рёбер, найденные пересечения).
+// События пишутся в кольцевой буфер своего потока, при переполнении старые затираются.
+// Буфер завершившегося потока сохраняет события и переходит к следующему новому потоку.
+// Макросы TRACE_SCOPE и TRACE_COUNT раскрываются в пустоту, если не определён LAYOUT_TRACING;
+// при определённом - запись идёт, только пока трассировка включена через setEnabled
+namespace Trace {
+    const size_t BUFFER_CAPACITY = 1 << 16;    // Событий в буфере одного потока
+    const size_t MAX_COUNTERS = 6;              // Счётчиков на один интервал
+
+    void setEnabled(bool enabled);
+    bool isEnabled();
+    void clear();
+    size_t eventCount();                        // Событий во всех буферах
+    size_t bufferCount();                       // Буферов: по одному на одновременно живший поток
+
+    // Сохранение в формате Chrome trace event (chrome://tracing, Perfetto).
+    // Ошибка записи сообщается исключением std::runtime_error
+    void writeChromeTrace(const std::string& path);
+
+    // Интервал от создания до уничтожения; name должен жить до записи трассы (строковый литерал)
+    class Scope {
+    public:
+        explicit Scope(const char* name);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        void count(const char* name, int64_t value);
+
+    private:
+        const char* name;
+        bool active;
+        int64_t start;
+        Scope* parent;
+        const char* counter_names[MAX_COUNTERS];
+        int64_t counter_values[MAX_COUNTERS];
+        size_t counters;
+    };
+
+    // Добавляет value к счётчику name текущего интервала потока
+    void count(const char* name, int64_t value);
+}
+
+#ifdef LAYOUT_TRACING
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_COUNT(name, value) Trace::count(name, static_cast<int64_t>(value))
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_COUNT(name, value) ((void)0)
+#endif
+
+#endif // TRACE_H
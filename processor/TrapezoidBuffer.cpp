@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <limits>
+#include "TrapezoidBuffer.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define TRAPEZOID_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+// Реализация класса TrapezoidBuffer
+TrapezoidBuffer::TrapezoidBuffer(const std::vector<Trapezoid>& trapezoids) {
+    reserve(trapezoids.size());
+    for (const auto& trapezoid : trapezoids) {
+        push_back(trapezoid);
+    }
+}
+
+size_t TrapezoidBuffer::size() const {
+    return y_top.size();
+}
+
+bool TrapezoidBuffer::empty() const {
+    return y_top.empty();
+}
+
+void TrapezoidBuffer::reserve(size_t capacity) {
+    x1_top.reserve(capacity);
+    x2_top.reserve(capacity);
+    x1_bottom.reserve(capacity);
+    x2_bottom.reserve(capacity);
+    y_top.reserve(capacity);
+    y_bottom.reserve(capacity);
+}
+
+void TrapezoidBuffer::resize(size_t count) {
+    x1_top.resize(count);
+    x2_top.resize(count);
+    x1_bottom.resize(count);
+    x2_bottom.resize(count);
+    y_top.resize(count);
+    y_bottom.resize(count);
+}
+
+void TrapezoidBuffer::clear() {
+    resize(0);
+}
+
+void TrapezoidBuffer::push_back(const Trapezoid& trapezoid) {
+    x1_top.push_back(trapezoid.x1_top);
+    x2_top.push_back(trapezoid.x2_top);
+    x1_bottom.push_back(trapezoid.x1_bottom);
+    x2_bottom.push_back(trapezoid.x2_bottom);
+    y_top.push_back(trapezoid.y_top);
+    y_bottom.push_back(trapezoid.y_bottom);
+}
+
+Trapezoid TrapezoidBuffer::operator[](size_t index) const {
+    if (index >= size()) {
+        throw std::out_of_range("Индекс выходит за пределы допустимого диапазона");
+    }
+    return Trapezoid(x1_top[index], x2_top[index], x1_bottom[index], x2_bottom[index], y_top[index], y_bottom[index]);
+}
+
+std::vector<Trapezoid> TrapezoidBuffer::to_vector() const {
+    std::vector<Trapezoid> result;
+    result.reserve(size());
+    for (size_t i = 0; i < size(); ++i) {
+        result.emplace_back(x1_top[i], x2_top[i], x1_bottom[i], x2_bottom[i], y_top[i], y_bottom[i]);
+    }
+    return result;
+}
+
+Box TrapezoidBuffer::get_bounding_box() const {
+    Box box;
+    if (empty())
+        return box;
+
+    double min_value, max_value;
+    TrapezoidKernels::bounds(y_bottom.data(), size(), box.min_y, max_value);
+    TrapezoidKernels::bounds(y_top.data(), size(), min_value, box.max_y);
+    const AlignedVector* xs[] = {&x1_top, &x2_top, &x1_bottom, &x2_bottom};
+    for (const AlignedVector* x : xs) {
+        TrapezoidKernels::bounds(x->data(), size(), min_value, max_value);
+        box.min_x = std::min(box.min_x, min_value);
+        box.max_x = std::max(box.max_x, max_value);
+    }
+    return box;
+}
+
+namespace TrapezoidKernels {
+
+    // Указатели на массивы трапецоидов в порядке x1_top, x2_top, x1_bottom, x2_bottom, y_top, y_bottom
+    struct Columns {
+        const double* in[6];
+        double* out[6];
+    };
+
+    // Скалярные версии ядер, они же обрабатывают хвосты массивов векторных версий
+
+    void boundsScalar(const double* values, size_t n, double& min_value, double& max_value) {
+        for (size_t i = 0; i < n; ++i) {
+            min_value = std::min(min_value, values[i]);
+            max_value = std::max(max_value, values[i]);
+        }
+    }
+
+    // Обрезанные координаты считаются для всех трапецоидов, отбор непустых выполняется отдельно
+    void clipScalar(const Columns& c, double bottom, double top, size_t begin, size_t n) {
+        for (size_t i = begin; i < n; ++i) {
+            double y_top = c.in[4][i], y_bottom = c.in[5][i];
+            double clipped_top = std::min(y_top, top);
+            double clipped_bottom = std::max(y_bottom, bottom);
+            double t_top = (clipped_top - y_top) / (y_bottom - y_top);
+            double t_bottom = (clipped_bottom - y_top) / (y_bottom - y_top);
+            c.out[0][i] = c.in[0][i] + (c.in[2][i] - c.in[0][i]) * t_top;
+            c.out[1][i] = c.in[1][i] + (c.in[3][i] - c.in[1][i]) * t_top;
+            // Необрезанный низ сохраняет вершины точно: x + (x_bottom - x) * 1 может отличаться от x_bottom
+            bool keep = clipped_bottom == y_bottom;
+            c.out[2][i] = keep ? c.in[2][i] : c.in[0][i] + (c.in[2][i] - c.in[0][i]) * t_bottom;
+            c.out[3][i] = keep ? c.in[3][i] : c.in[1][i] + (c.in[3][i] - c.in[1][i]) * t_bottom;
+            c.out[4][i] = clipped_top;
+            c.out[5][i] = clipped_bottom;
+        }
+    }
+
+#ifdef TRAPEZOID_KERNELS_X86
+
+    __attribute__((target("sse2")))
+    void boundsSSE2(const double* values, size_t n, double& min_value, double& max_value) {
+        __m128d vmin = _mm_set1_pd(min_value), vmax = _mm_set1_pd(max_value);
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128d v = _mm_loadu_pd(values + i);
+            vmin = _mm_min_pd(vmin, v);
+            vmax = _mm_max_pd(vmax, v);
+        }
+        double lanes_min[2], lanes_max[2];
+        _mm_storeu_pd(lanes_min, vmin);
+        _mm_storeu_pd(lanes_max, vmax);
+        min_value = std::min(lanes_min[0], lanes_min[1]);
+        max_value = std::max(lanes_max[0], lanes_max[1]);
+        boundsScalar(values + i, n - i, min_value, max_value);
+    }
+
+    __attribute__((target("sse2")))
+    void clipSSE2(const Columns& c, double bottom, double top, size_t n) {
+        __m128d vtop = _mm_set1_pd(top), vbottom = _mm_set1_pd(bottom);
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128d y_top = _mm_loadu_pd(c.in[4] + i), y_bottom = _mm_loadu_pd(c.in[5] + i);
+            __m128d clipped_top = _mm_min_pd(y_top, vtop);
+            __m128d clipped_bottom = _mm_max_pd(y_bottom, vbottom);
+            __m128d height = _mm_sub_pd(y_bottom, y_top);
+            __m128d t_top = _mm_div_pd(_mm_sub_pd(clipped_top, y_top), height);
+            __m128d t_bottom = _mm_div_pd(_mm_sub_pd(clipped_bottom, y_top), height);
+            __m128d x1_top = _mm_loadu_pd(c.in[0] + i), x2_top = _mm_loadu_pd(c.in[1] + i);
+            __m128d x1_bottom = _mm_loadu_pd(c.in[2] + i), x2_bottom = _mm_loadu_pd(c.in[3] + i);
+            __m128d dx1 = _mm_sub_pd(x1_bottom, x1_top);
+            __m128d dx2 = _mm_sub_pd(x2_bottom, x2_top);
+            __m128d keep = _mm_cmpeq_pd(clipped_bottom, y_bottom);
+            _mm_storeu_pd(c.out[0] + i, _mm_add_pd(x1_top, _mm_mul_pd(dx1, t_top)));
+            _mm_storeu_pd(c.out[1] + i, _mm_add_pd(x2_top, _mm_mul_pd(dx2, t_top)));
+            _mm_storeu_pd(c.out[2] + i, _mm_or_pd(_mm_and_pd(keep, x1_bottom),
+                                                  _mm_andnot_pd(keep, _mm_add_pd(x1_top, _mm_mul_pd(dx1, t_bottom)))));
+            _mm_storeu_pd(c.out[3] + i, _mm_or_pd(_mm_and_pd(keep, x2_bottom),
+                                                  _mm_andnot_pd(keep, _mm_add_pd(x2_top, _mm_mul_pd(dx2, t_bottom)))));
+            _mm_storeu_pd(c.out[4] + i, clipped_top);
+            _mm_storeu_pd(c.out[5] + i, clipped_bottom);
+        }
+        clipScalar(c, bottom, top, i, n);
+    }
+
+    __attribute__((target("avx2")))
+    void boundsAVX2(const double* values, size_t n, double& min_value, double& max_value) {
+        __m256d vmin = _mm256_set1_pd(min_value), vmax = _mm256_set1_pd(max_value);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d v = _mm256_loadu_pd(values + i);
+            vmin = _mm256_min_pd(vmin, v);
+            vmax = _mm256_max_pd(vmax, v);
+        }
+        double lanes_min[4], lanes_max[4];
+        _mm256_storeu_pd(lanes_min, vmin);
+        _mm256_storeu_pd(lanes_max, vmax);
+        min_value = std::min({lanes_min[0], lanes_min[1], lanes_min[2], lanes_min[3]});
+        max_value = std::max({lanes_max[0], lanes_max[1], lanes_max[2], lanes_max[3]});
+        _mm256_zeroupper();
+        boundsScalar(values + i, n - i, min_value, max_value);
+    }
+
+    __attribute__((target("avx2")))
+    void clipAVX2(const Columns& c, double bottom, double top, size_t n) {
+        __m256d vtop = _mm256_set1_pd(top), vbottom = _mm256_set1_pd(bottom);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d y_top = _mm256_loadu_pd(c.in[4] + i), y_bottom = _mm256_loadu_pd(c.in[5] + i);
+            __m256d clipped_top = _mm256_min_pd(y_top, vtop);
+            __m256d clipped_bottom = _mm256_max_pd(y_bottom, vbottom);
+            __m256d height = _mm256_sub_pd(y_bottom, y_top);
+            __m256d t_top = _mm256_div_pd(_mm256_sub_pd(clipped_top, y_top), height);
+            __m256d t_bottom = _mm256_div_pd(_mm256_sub_pd(clipped_bottom, y_top), height);
+            __m256d x1_top = _mm256_loadu_pd(c.in[0] + i), x2_top = _mm256_loadu_pd(c.in[1] + i);
+            __m256d x1_bottom = _mm256_loadu_pd(c.in[2] + i), x2_bottom = _mm256_loadu_pd(c.in[3] + i);
+            __m256d dx1 = _mm256_sub_pd(x1_bottom, x1_top);
+            __m256d dx2 = _mm256_sub_pd(x2_bottom, x2_top);
+            __m256d keep = _mm256_cmp_pd(clipped_bottom, y_bottom, _CMP_EQ_OQ);
+            _mm256_storeu_pd(c.out[0] + i, _mm256_add_pd(x1_top, _mm256_mul_pd(dx1, t_top)));
+            _mm256_storeu_pd(c.out[1] + i, _mm256_add_pd(x2_top, _mm256_mul_pd(dx2, t_top)));
+            _mm256_storeu_pd(c.out[2] + i, _mm256_blendv_pd(_mm256_add_pd(x1_top, _mm256_mul_pd(dx1, t_bottom)), x1_bottom, keep));
+            _mm256_storeu_pd(c.out[3] + i, _mm256_blendv_pd(_mm256_add_pd(x2_top, _mm256_mul_pd(dx2, t_bottom)), x2_bottom, keep));
+            _mm256_storeu_pd(c.out[4] + i, clipped_top);
+            _mm256_storeu_pd(c.out[5] + i, clipped_bottom);
+        }
+        // Компилятор не ставит vzeroupper перед хвостовым вызовом, а грязные старшие половины
+        // регистров ymm замедляют весь последующий SSE-код процесса
+        _mm256_zeroupper();
+        clipScalar(c, bottom, top, i, n);
+    }
+
+#endif // TRAPEZOID_KERNELS_X86
+
+    Isa detectIsa() {
+#ifdef TRAPEZOID_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return Isa::AVX2;
+        if (__builtin_cpu_supports("sse2"))
+            return Isa::SSE2;
+#endif
+        return Isa::Scalar;
+    }
+
+    Isa& currentIsa() {
+        static Isa isa = detectIsa();
+        return isa;
+    }
+
+    Isa activeIsa() {
+        return currentIsa();
+    }
+
+    void setIsa(Isa isa) {
+        currentIsa() = std::min(isa, detectIsa());
+    }
+
+    void bounds(const double* values, size_t n, double& min_value, double& max_value) {
+        min_value = std::numeric_limits<double>::infinity();
+        max_value = -std::numeric_limits<double>::infinity();
+        switch (activeIsa()) {
+#ifdef TRAPEZOID_KERNELS_X86
+        case Isa::AVX2:
+            return boundsAVX2(values, n, min_value, max_value);
+        case Isa::SSE2:
+            return boundsSSE2(values, n, min_value, max_value);
+#endif
+        default:
+            return boundsScalar(values, n, min_value, max_value);
+        }
+    }
+
+    void clipBand(const TrapezoidBuffer& source, double y_bottom, double y_top, TrapezoidBuffer& target) {
+        if (&source == &target) {
+            throw std::invalid_argument("Исходный и целевой буферы должны различаться");
+        }
+        size_t n = source.size();
+        size_t base = target.size();
+        target.resize(base + n);
+
+        Columns c = {
+            {source.x1_top.data(), source.x2_top.data(), source.x1_bottom.data(), source.x2_bottom.data(),
+             source.y_top.data(), source.y_bottom.data()},
+            {target.x1_top.data() + base, target.x2_top.data() + base, target.x1_bottom.data() + base,
+             target.x2_bottom.data() + base, target.y_top.data() + base, target.y_bottom.data() + base}
+        };
+
+        switch (activeIsa()) {
+#ifdef TRAPEZOID_KERNELS_X86
+        case Isa::AVX2:
+            clipAVX2(c, y_bottom, y_top, n);
+            break;
+        case Isa::SSE2:
+            clipSSE2(c, y_bottom, y_top, n);
+            break;
+#endif
+        default:
+            clipScalar(c, y_bottom, y_top, 0, n);
+            break;
+        }
+
+        // Отбор трапецоидов, у которых после обрезки осталась ненулевая высота
+        size_t out = base;
+        for (size_t i = base; i < base + n; ++i) {
+            if (!(target.y_top[i] > target.y_bottom[i]))
+                continue;
+            if (out != i) {
+                target.x1_top[out] = target.x1_top[i];
+                target.x2_top[out] = target.x2_top[i];
+                target.x1_bottom[out] = target.x1_bottom[i];
+                target.x2_bottom[out] = target.x2_bottom[i];
+                target.y_top[out] = target.y_top[i];
+                target.y_bottom[out] = target.y_bottom[i];
+            }
+            ++out;
+        }
+        target.resize(out);
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef TRAPEZOIDBUFFER_H
+#define TRAPEZOIDBUFFER_H
+
+#include <new>
+#include <vector>
+#include "GeometryOperations.h"
+
+// Аллокатор с выравниванием для векторных загрузок
+template <typename T, size_t Alignment = 32>
+class AlignedAllocator {
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* pointer, size_t) {
+        ::operator delete(pointer, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+using AlignedVector = std::vector<double, AlignedAllocator<double>>;
+
+// Набор трапецоидов в формате структуры массивов: каждая координата хранится в отдельном выровненном массиве
+class TrapezoidBuffer {
+public:
+    AlignedVector x1_top, x2_top, x1_bottom, x2_bottom;
+    AlignedVector y_top, y_bottom;
+
+    TrapezoidBuffer() = default;
+    TrapezoidBuffer(const std::vector<Trapezoid>& trapezoids);
+
+    size_t size() const;
+    bool empty() const;
+    void reserve(size_t capacity);
+    void resize(size_t count);
+    void clear();
+    void push_back(const Trapezoid& trapezoid);
+
+    Trapezoid operator[](size_t index) const;
+    std::vector<Trapezoid> to_vector() const;
+    Box get_bounding_box() const;
+};
+
+// Векторные ядра над TrapezoidBuffer. Набор инструкций (AVX2, SSE2 или скалярный код)
+// выбирается один раз при первом вызове по возможностям процессора
+namespace TrapezoidKernels {
+    enum class Isa { Scalar, SSE2, AVX2 };
+
+    Isa activeIsa();
+    void setIsa(Isa isa);   // Принудительный выбор (не выше поддерживаемого процессором)
+
+    // Минимум и максимум массива
+    void bounds(const double* values, size_t n, double& min_value, double& max_value);
+
+    // Обрезка трапецоидов полосой [y_bottom, y_top]; трапецоиды вне полосы отбрасываются, результат дописывается в target
+    void clipBand(const TrapezoidBuffer& source, double y_bottom, double y_top, TrapezoidBuffer& target);
+}
+
+#endif // TRAPEZOIDBUFFER_H
@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "GeometryOperations.h"
+#include "AffineTransform.h"
+#include "LayoutGenerator.h"
+#include "PatternDensity.h"
+#include "ThreadPool.h"
+#include "TileRasterizer.h"
+#include "Trace.h"
+
+// Замеры производительности на синтетических слоях.
+// Запуск: benchmark [--warmup N] [--repetitions N] [--scale X] [--filter подстрока] [--json путь|-] [--trace путь]
+
+struct Options {
+    size_t warmup = 2;
+    size_t repetitions = 10;
+    double scale = 1;           // Множитель размеров сгенерированных слоёв
+    std::string filter;         // Выполняются только замеры, в имени которых есть подстрока
+    std::string json;           // Файл для результатов в JSON, "-" - стандартный вывод
+    std::string trace;          // Файл трассы Chrome (имеет смысл при сборке с LAYOUT_TRACING)
+};
+
+struct Measurement {
+    std::string name;
+    size_t items;                   // Размер входа: полигоны, трапецоиды или слои
+    std::vector<double> samples;    // Время повторений в миллисекундах
+
+    double percentile(double p) const {
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        double rank = p / 100 * (sorted.size() - 1);
+        size_t lower = static_cast<size_t>(std::floor(rank));
+        size_t upper = std::min(lower + 1, sorted.size() - 1);
+        return sorted[lower] + (sorted[upper] - sorted[lower]) * (rank - lower);
+    }
+
+    double mean() const {
+        double sum = 0;
+        for (double sample : samples)
+            sum += sample;
+        return sum / samples.size();
+    }
+};
+
+class Runner {
+public:
+    explicit Runner(const Options& options) : options(options) {}
+
+    // body возвращает размер результата, чтобы компилятор не выбросил вычисление
+    void run(const std::string& name, size_t items, const std::function<size_t()>& body) {
+        if (!options.filter.empty() && name.find(options.filter) == std::string::npos)
+            return;
+        for (size_t i = 0; i < options.warmup; ++i)
+            sink += body();
+
+        Measurement measurement{name, items, {}};
+        measurement.samples.reserve(options.repetitions);
+        for (size_t i = 0; i < options.repetitions; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            sink += body();
+            auto finish = std::chrono::steady_clock::now();
+            measurement.samples.push_back(std::chrono::duration<double, std::milli>(finish - start).count());
+        }
+
+        std::cout << std::left << std::setw(36) << name << std::right << std::setw(10) << items
+                  << std::fixed << std::setprecision(3)
+                  << "  p50 " << std::setw(10) << measurement.percentile(50)
+                  << "  p90 " << std::setw(10) << measurement.percentile(90)
+                  << "  max " << std::setw(10) << measurement.percentile(100) << " ms" << std::endl;
+        results.push_back(std::move(measurement));
+    }
+
+    void write_json(std::ostream& out) const {
+        out << std::setprecision(6) << std::fixed;
+        out << "{\n  \"warmup\": " << options.warmup << ",\n  \"repetitions\": " << options.repetitions
+            << ",\n  \"scale\": " << options.scale << ",\n  \"threads\": " << std::thread::hardware_concurrency()
+            << ",\n  \"unit\": \"ms\",\n  \"results\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Measurement& m = results[i];
+            out << (i ? "," : "") << "\n    {\"name\": \"" << m.name << "\", \"items\": " << m.items
+                << ", \"mean\": " << m.mean() << ", \"min\": " << m.percentile(0)
+                << ", \"p50\": " << m.percentile(50) << ", \"p90\": " << m.percentile(90)
+                << ", \"p99\": " << m.percentile(99) << ", \"max\": " << m.percentile(100) << ", \"samples\": [";
+            for (size_t j = 0; j < m.samples.size(); ++j)
+                out << (j ? ", " : "") << m.samples[j];
+            out << "]}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+private:
+    const Options& options;
+    std::vector<Measurement> results;
+    volatile size_t sink = 0;
+};
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        std::string value = argv[++i];
+        try {
+            if (arg == "--warmup")
+                options.warmup = std::stoul(value);
+            else if (arg == "--repetitions")
+                options.repetitions = std::stoul(value);
+            else if (arg == "--scale")
+                options.scale = std::stod(value);
+            else if (arg == "--filter")
+                options.filter = value;
+            else if (arg == "--json")
+                options.json = value;
+            else if (arg == "--trace")
+                options.trace = value;
+            else
+                return false;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    return options.repetitions > 0 && options.scale > 0;
+}
+
+size_t scaled(size_t base, double scale) {
+    return std::max<size_t>(1, static_cast<size_t>(std::lround(base * std::sqrt(scale))));
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--warmup N] [--repetitions N] [--scale X] [--filter substring] [--json path|-] [--trace path]" << std::endl;
+        return 1;
+    }
+    // Сторона сеток растёт как корень из scale, число элементов - линейно
+    size_t side = scaled(100, options.scale);
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+    Layer grid = LayoutGenerator::manhattanGrid(side, side, 1.0, 0.7, 0.2, 1);
+    Layer shifted = LayoutGenerator::manhattanGrid(side, side, 1.0, 0.7, 0.2, 2);
+    LayerOperations::transformLayer(shifted, AffineTransform::translation(0.37, 0.21));
+    Layer vias = LayoutGenerator::viaArray(2 * side, 2 * side, 0.1, 0.5);
+    Layer wires = LayoutGenerator::diagonalWires(side / 2, 2 * side, 1.0, 0.2, 1.5);
+    Layer plates = LayoutGenerator::perforatedPlates(scaled(10, options.scale), 20, 100.0);
+
+    std::vector<Trapezoid> grid_trapezoids = LayerOperations::decomposeLayer(grid);
+    std::vector<Trapezoid> shifted_trapezoids = LayerOperations::decomposeLayer(shifted);
+    std::vector<Trapezoid> via_trapezoids = LayerOperations::decomposeLayer(vias);
+
+    // Если вывод JSON идёт в stdout, таблица уходит в stderr
+    std::streambuf* table = std::cout.rdbuf();
+    if (options.json == "-")
+        std::cout.rdbuf(std::cerr.rdbuf());
+
+    Runner runner(options);
+    Trace::setEnabled(!options.trace.empty());
+
+    runner.run("decompose/manhattan", grid.size(), [&]() { return LayerOperations::decomposeLayer(grid).size(); });
+    runner.run("decompose/perforated", plates.size(), [&]() { return LayerOperations::decomposeLayer(plates).size(); });
+    runner.run("reconstruct/manhattan", grid_trapezoids.size(), [&]() {
+        Layer target;
+        LayerOperations::reconstructLayer(grid_trapezoids, target);
+        return target.size();
+    });
+
+    size_t pair_size = grid_trapezoids.size() + shifted_trapezoids.size();
+    runner.run("unite/manhattan", pair_size, [&]() { return TrapezoidOperations::unite(grid_trapezoids, shifted_trapezoids).size(); });
+    runner.run("intersect/manhattan", pair_size, [&]() { return TrapezoidOperations::intersect(grid_trapezoids, shifted_trapezoids).size(); });
+    runner.run("subtract/manhattan-via", grid_trapezoids.size() + via_trapezoids.size(), [&]() {
+        return TrapezoidOperations::subtract(grid_trapezoids, via_trapezoids).size();
+    });
+    runner.run("unite/manhattan/threads", pair_size, [&]() {
+        return TrapezoidOperations::unite(grid_trapezoids, shifted_trapezoids, threads).size();
+    });
+    ThreadPool pool(threads);
+    runner.run("unite/manhattan/pool", pair_size, [&]() {
+        return TrapezoidOperations::unite(grid_trapezoids, shifted_trapezoids, pool).size();
+    });
+
+    runner.run("size/diagonal", wires.size(), [&]() { return PolygonOperations::modifyPolygon(wires.get_polygons(), 0.05).size(); });
+    runner.run("size/perforated", plates.size(), [&]() {
+        Layer target;
+        LayerOperations::sizeLayer(plates, -0.5, target, JoinType::Square);
+        return target.size();
+    });
+    Layer via_block = LayoutGenerator::viaArray(side / 2, side / 2, 0.1, 0.5);
+    runner.run("size/via/round", via_block.size(), [&]() {
+        Layer target;
+        LayerOperations::sizeLayer(via_block, 0.05, target, JoinType::Round);
+        return target.size();
+    });
+
+    // Поворачивается собственная копия: grid ниже входит в pack, его геометрия не должна зависеть от числа повторов
+    Layer rotated(grid.get_name(), grid.get_polygons());
+    runner.run("transform/manhattan", rotated.size(), [&]() {
+        LayerOperations::transformLayer(rotated, AffineTransform::rotation(0.5));
+        return rotated.size();
+    });
+
+    size_t layer_count = scaled(1000, options.scale);
+    std::vector<Polygon> cell = LayoutGenerator::viaArray(4, 4, 0.1, 0.5).get_polygons();
+    runner.run("layerpack/append-rename-remove", layer_count, [&]() {
+        LayerPack pack;
+        for (size_t i = 0; i < layer_count; ++i)
+            pack.append_layer(Layer("L" + std::to_string(i), cell));
+        for (size_t i = 0; i < layer_count; i += 2)
+            pack.rename_layer("L" + std::to_string(i), "R" + std::to_string(i));
+        for (size_t i = 1; i < layer_count; i += 2)
+            pack.remove_layer("L" + std::to_string(i));
+        return pack.get_layers().size();
+    });
+    LayerPack pack({grid, vias, wires, plates});
+    runner.run("layerpack/copy", grid.size() + vias.size(), [&]() {
+        LayerPack target;
+        LayerOperations::copyLayerFromLayerPack(pack, target, "ManhattanGrid", "Copy");
+        LayerOperations::copyLayerFromLayerPack(pack, target, "ViaArray", "CopyVias");
+        target[0].append(Polygon({{0, 0}, {1, 0}, {1, 1}}));      // Отделение копии при записи
+        return target[0].size();
+    });
+
+    Box density_extent(0, 0, static_cast<double>(side), static_cast<double>(side));
+    runner.run("density/diagonal", wires.size(), [&]() {
+        return PatternDensity::coveredArea(wires, density_extent, 0.5, 0.5).values.size();
+    });
+    runner.run("density/diagonal/threads", wires.size(), [&]() {
+        return PatternDensity::coveredArea(wires, density_extent, 0.5, 0.5, threads).values.size();
+    });
+
+    // Окно side x side единиц при 20 пикселях на единицу: около 8 x 8 тайлов на scale 1
+    Box raster_view(0, 0, static_cast<double>(side), static_cast<double>(side));
+    double pixels = 20;
+    size_t tile_count = static_cast<size_t>(std::pow(std::ceil(side * pixels / TileRasterizer::TILE_SIZE) + 1, 2));
+    TileRasterizer raster(pack, {{"ManhattanGrid", 0xff3060c0}, {"ViaArray", 0x80c03030}}, pixels, threads, 2 * tile_count);
+    runner.run("raster/full", grid.size() + vias.size(), [&]() {
+        raster.invalidate_all();
+        return raster.render(raster_view).size();
+    });
+    runner.run("raster/edit", 1, [&]() {
+        pack["ViaArray"].append(Polygon({{0.1, 0.1}, {0.2, 0.1}, {0.2, 0.2}, {0.1, 0.2}}));
+        raster.render(raster_view);
+        pack["ViaArray"].remove(pack["ViaArray"].size() - 1);
+        return raster.render(raster_view).size();
+    });
+
+    std::cout.rdbuf(table);
+    if (!options.trace.empty()) {
+        Trace::setEnabled(false);
+        Trace::writeChromeTrace(options.trace);
+    }
+    if (options.json == "-") {
+        runner.write_json(std::cout);
+    } else if (!options.json.empty()) {
+        std::ofstream out(options.json);
+        if (!out) {
+            std::cerr << "Cannot open " << options.json << std::endl;
+            return 1;
+        }
+        runner.write_json(out);
+    }
+    return 0;
+}
@@ -1,7 +1,28 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <thread>
 #include "GeometryOperations.h"
+#include "TrapezoidBuffer.h"
+#include "AffineTransform.h"
+#include "LayoutFile.h"
+#include "GdsFile.h"
+#include "OasisFile.h"
+#include "EditJournal.h"
+#include "DesignRules.h"
+#include "ExpressionGraph.h"
+#include "Predicates.h"
+#include "LayoutGenerator.h"
+#include "Trace.h"
+#include "Cell.h"
+#include "TileRasterizer.h"
+#include "LevelOfDetail.h"
+#include "PatternDensity.h"
+#include "ThreadPool.h"
+#include "SpatialIndex.h"
 
 const double EPSILON = 1e-6;
 
@@ -32,6 +53,22 @@ void assert_equal(const std::vector<Trapezoid>& result, const std::vector<Trapez
     }
 }
 
+double total_area(const std::vector<Trapezoid>& trapezoids) {
+    double area = 0;
+    for (const auto& t : trapezoids) {
+        area += ((t.x2_top - t.x1_top) + (t.x2_bottom - t.x1_bottom)) * (t.y_top - t.y_bottom) / 2;
+    }
+    return area;
+}
+
+void assert_area(const std::vector<Trapezoid>& result, double expected, const std::string& test_name) {
+    if (std::abs(total_area(result) - expected) < EPSILON) {
+        std::cout << test_name << " passed.\n";
+    } else {
+        std::cout << test_name << " failed: area " << total_area(result) << ", expected " << expected << ".\n";
+    }
+}
+
 
 void test_unite() {
     Trapezoid t1(0, 2, 0, 2, 2, 0); // Квадратный трапецоид
@@ -100,6 +137,1321 @@ void test_subtract() {
     //assert_equal(result_subtract, expected_subtract, "Subtract Test");
 }
 
+void test_sweep_boolean() {
+    // Два квадрата 2x2 со смещением на 1, наклонная трапеция и треугольник, пересекающий оба
+    std::vector<Trapezoid> a = {Trapezoid(0, 2, 0, 2, 2, 0), Trapezoid(1, 3, 1, 3, 3, 1)};
+    std::vector<Trapezoid> b = {Trapezoid(1, 1, 0, 3, 3, 0)};
+
+    // Площадь a = 4 + 4 - 1 = 7, b = 4.5; a ∩ b: треугольник целиком внутри объединения квадратов, кроме двух уголков
+    double area_a = total_area(TrapezoidOperations::unite(a, {}));
+    double area_b = total_area(b);
+    double area_ab = total_area(TrapezoidOperations::intersect(a, b));
+
+    assert_area(TrapezoidOperations::unite(a, {}), 7, "Sweep self-union Test");
+    assert_area(TrapezoidOperations::unite(a, b), area_a + area_b - area_ab, "Sweep unite Test");
+    assert_area(TrapezoidOperations::subtract(a, b), area_a - area_ab, "Sweep subtract Test");
+    assert_area(TrapezoidOperations::intersect(b, a), area_ab, "Sweep intersect symmetry Test");
+    assert_area(TrapezoidOperations::intersect({Trapezoid(0, 2, 0, 2, 2, 0)}, {Trapezoid(1, 3, 1, 3, 3, 1)}), 1, "Sweep intersect Test");
+
+    // Наклонные стороны пересекаются, после чего округлённые x рёбер на границе полосы остаются в прежнем порядке
+    std::vector<Trapezoid> c = {Trapezoid(41.52222329794778, 63.866180350508515, 55.75228930589214, 75.92899947120124,
+                                          80.62251043015586, 69.92360546277345)};
+    std::vector<Trapezoid> d = {Trapezoid(2.4612824323459037, 83.73783163651224, 29.877102536339557, 38.32052358819204,
+                                          88.61072031094508, 69.34553786901547)};
+    assert_area(TrapezoidOperations::intersect(c, d), 73.98542253042373, "Sweep crossing intersect Test");
+    assert_area(TrapezoidOperations::unite(c, d), 1017.7126641597675, "Sweep crossing unite Test");
+}
+
+void test_decompose() {
+    // Квадрат 4x4 с квадратной дыркой 2x2 (обход по часовой стрелке) и треугольник, касающийся его вершиной
+    Polygon frame({{0, 0}, {4, 0}, {4, 4}, {0, 4}}, {Hole({{1, 1}, {1, 3}, {3, 3}, {3, 1}})});
+    Polygon triangle({{4, 4}, {6, 4}, {5, 6}});
+
+    assert_area(PolygonOperations::decompose(frame), 12, "Decompose polygon with hole Test");
+
+    Layer layer("Layer1", {frame, triangle});
+    assert_area(LayerOperations::decomposeLayer(layer), 14, "Decompose layer Test");
+
+    // Углы трапецоидов на концах наклонных рёбер совпадают с вершинами точно, вершина треугольника - без ширины
+    std::vector<Trapezoid> slanted = PolygonOperations::decompose(Polygon({{0.1, 0.1}, {2.3, 0.6}, {0.3, 2.7}}));
+    bool exact = !slanted.empty();
+    for (const auto& t : slanted) {
+        if (t.y_top == 2.7)
+            exact = exact && t.x1_top == 0.3 && t.x2_top == 0.3;
+        if (t.y_bottom == 0.6)
+            exact = exact && t.x2_bottom == 2.3;
+    }
+    std::cout << (exact ? "Decompose exact vertices Test passed.\n" : "Decompose exact vertices Test failed.\n");
+}
+
+void test_reconstruct() {
+    Polygon frame({{0, 0}, {4, 0}, {4, 4}, {0, 4}}, {Hole({{1, 1}, {1, 3}, {3, 3}, {3, 1}})});
+    Polygon triangle({{4, 4}, {6, 4}, {5, 6}});
+    Layer source("Source", {frame, triangle});
+
+    Layer target("Target");
+    LayerOperations::reconstructLayer(LayerOperations::decomposeLayer(source), target);
+
+    bool success = target.get_polygons().size() == 2;
+    size_t holes = 0;
+    for (const auto& polygon : target.get_polygons())
+        holes += polygon.get_holes().size();
+    success = success && holes == 1;
+    assert_area(LayerOperations::decomposeLayer(target), 14, "Reconstruct area Test");
+
+    // Шахматная доска 3x3 из наклонных ромбов: в общих вершинах по два продолжения контура,
+    // выбор самого левого поворота оставляет клетки раздельными
+    Layer board("Board");
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            if ((i + j) % 2 == 0)
+                board.append(Polygon({{i + 0.3 * j, j + 0.1 * i}, {i + 1 + 0.3 * j, j + 0.1 * (i + 1)},
+                                      {i + 1 + 0.3 * (j + 1), j + 1 + 0.1 * (i + 1)}, {i + 0.3 * (j + 1), j + 1 + 0.1 * i}}));
+    Layer cells("Cells");
+    LayerOperations::reconstructLayer(LayerOperations::decomposeLayer(board), cells);
+    success = success && cells.size() == 5;
+    std::cout << "Reconstruct topology Test " << (success ? "passed" : "failed") << ".\n";
+
+    // Повёрнутые прямоугольники 10x3 и самопересекающийся контур: в точках пересечения рёбер
+    // углы соседних трапецоидов расходятся на ulp, фигуры не должны пропадать
+    bool round_trip = true;
+    for (int i = 0; i < 500; ++i) {
+        double angle = i * 0.0127, c = std::cos(angle), s = std::sin(angle);
+        double cx = 0.37 * i, cy = 13.1 - 0.21 * i;
+        std::vector<Point> corners;
+        for (auto [x, y] : {std::pair(-5.0, -1.5), std::pair(5.0, -1.5), std::pair(5.0, 1.5), std::pair(-5.0, 1.5)})
+            corners.emplace_back(cx + x * c - y * s, cy + x * s + y * c);
+        Layer rotated("Rotated", {Polygon(corners)});
+        Layer restored("Restored");
+        LayerOperations::reconstructLayer(LayerOperations::decomposeLayer(rotated), restored);
+        round_trip = round_trip && restored.size() == 1 &&
+                     std::abs(total_area(LayerOperations::decomposeLayer(restored)) - 30) < EPSILON;
+    }
+    std::cout << "Reconstruct rotated round-trip Test " << (round_trip ? "passed" : "failed") << ".\n";
+
+    Layer crossing("Crossing", {Polygon({{12.693933857472222, 5.6480561131091331}, {12.058738755527056, 6.9311086658697665},
+                                         {8.6489651876274412, 1.6000362429255874}, {8.8505611875269992, 2.2460425497163166},
+                                         {9.768999041268863, 0.62623822504116333}, {10.796736899546218, 0.638060974001049},
+                                         {12.282599540103103, 2.9454627999123537}, {13.745284582497924, 3.6134054179339854}})});
+    std::vector<Trapezoid> crossing_trapezoids = LayerOperations::decomposeLayer(crossing);
+    Layer crossing_restored("Restored");
+    LayerOperations::reconstructLayer(crossing_trapezoids, crossing_restored);
+    assert_area(LayerOperations::decomposeLayer(crossing_restored), total_area(crossing_trapezoids), "Reconstruct crossing round-trip Test");
+}
+
+void test_spatial_index() {
+    // Сетка 40x40 квадратов 1x1 с шагом 2
+    Layer layer("Grid");
+    for (int i = 0; i < 40; ++i)
+        for (int j = 0; j < 40; ++j)
+            layer.append(Polygon({{2.0 * i, 2.0 * j}, {2.0 * i + 1, 2.0 * j}, {2.0 * i + 1, 2.0 * j + 1}, {2.0 * i, 2.0 * j + 1}}));
+
+    bool success = layer.query_window(Box(0, 0, 4.5, 4.5)).size() == 9;
+    success = success && layer.query_point(Point(0.5, 0.5)) == std::vector<size_t>{0};
+    success = success && layer.query_point(Point(1.5, 1.5)).empty();
+
+    // Индекс обновляется при вставке и удалении, индексы последующих полигонов сдвигаются
+    layer.insert(Polygon({{100, 100}, {101, 100}, {101, 101}, {100, 101}}), 0);
+    layer.remove(1);
+    success = success && layer.query_point(Point(100.5, 100.5)) == std::vector<size_t>{0};
+    success = success && layer.query_point(Point(0.5, 2.5)) == std::vector<size_t>{1};
+    success = success && layer.query_point(Point(0.5, 0.5)).empty();
+
+    std::vector<size_t> nearest = layer.query_nearest(Point(99, 99), 2);
+    success = success && nearest.size() == 2 && nearest[0] == 0 && layer[nearest[1]].get_vertices()[0] == Point(78, 78);
+
+    // Случайные вставки и удаления в середину сверяются с перебором
+    std::vector<Box> boxes;
+    SpatialIndex index;
+    unsigned seed = 7;
+    auto random = [&seed](unsigned range) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) % range;
+    };
+    for (int step = 0; step < 3000; ++step) {
+        if (boxes.empty() || random(3) != 0) {
+            size_t id = random(static_cast<unsigned>(boxes.size() + 1));
+            double x = random(1000), y = random(1000);
+            boxes.insert(boxes.begin() + id, Box(x, y, x + 1 + random(20), y + 1 + random(20)));
+            index.insert(id, boxes[id]);
+        } else {
+            size_t id = random(static_cast<unsigned>(boxes.size()));
+            boxes.erase(boxes.begin() + id);
+            index.remove(id);
+        }
+    }
+    Box window(200, 300, 400, 450);
+    std::vector<size_t> expected, found;
+    for (size_t i = 0; i < boxes.size(); ++i)
+        if (boxes[i].intersects(window))
+            expected.push_back(i);
+    index.query(window, [&found](size_t id) { found.push_back(id); });
+    std::sort(found.begin(), found.end());
+    success = success && index.size() == boxes.size() && found == expected;
+
+    std::cout << "Spatial index Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_trapezoid_buffer() {
+    std::vector<Trapezoid> a, b;
+    for (int i = 0; i < 37; ++i) {
+        a.emplace_back(i, i + 2, i - 1, i + 2, i + 3, i);
+        b.emplace_back(i + 1, i + 2, i + 1, i + 3, i + 2, i - 1);
+    }
+
+    // Операции над буфером совпадают с операциями над вектором
+    TrapezoidBuffer buffer_a(a), buffer_b(b);
+    assert_equal(TrapezoidOperations::subtract(buffer_a, buffer_b).to_vector(), TrapezoidOperations::subtract(a, b), "Buffer subtract Test");
+
+    // Векторная и скалярная обрезка полосой дают одинаковый результат
+    TrapezoidBuffer clipped_simd, clipped_scalar;
+    TrapezoidKernels::clipBand(buffer_a, 10.5, 20.25, clipped_simd);
+    TrapezoidKernels::Isa isa = TrapezoidKernels::activeIsa();
+    TrapezoidKernels::setIsa(TrapezoidKernels::Isa::Scalar);
+    TrapezoidKernels::clipBand(buffer_a, 10.5, 20.25, clipped_scalar);
+    TrapezoidKernels::setIsa(isa);
+    assert_equal(clipped_simd.to_vector(), clipped_scalar.to_vector(), "Buffer clip Test");
+
+    Box box = buffer_a.get_bounding_box();
+    Box clipped_box = clipped_simd.get_bounding_box();
+    bool success = box.min_x == -1 && box.max_x == 38 && box.min_y == 0 && box.max_y == 39;
+    success = success && clipped_simd.size() == 13 && clipped_box.min_y == 10.5 && clipped_box.max_y == 20.25;
+    std::cout << "Buffer bounds Test " << (success ? "passed" : "failed") << ".\n";
+
+    // Операнды перекрываются по y частично: лишние трапецоиды обрезаются до sweep, площадь не меняется
+    std::vector<Trapezoid> shifted;
+    for (const auto& t : b)
+        shifted.emplace_back(t.x1_top, t.x2_top, t.x1_bottom, t.x2_bottom, t.y_top + 20.3, t.y_bottom + 20.3);
+    TrapezoidBuffer buffer_shifted(shifted);
+    success = std::abs(total_area(TrapezoidOperations::intersect(buffer_a, buffer_shifted).to_vector())
+                       - total_area(TrapezoidOperations::intersect(a, shifted))) < EPSILON
+        && std::abs(total_area(TrapezoidOperations::subtract(buffer_a, buffer_shifted).to_vector())
+                    - total_area(TrapezoidOperations::subtract(a, shifted))) < EPSILON
+        && TrapezoidOperations::intersect(buffer_a, TrapezoidBuffer()).empty();
+
+    // Трапецоид внутри полосы проходит обрезку без изменения вершин
+    TrapezoidBuffer slanted(std::vector<Trapezoid>(5, Trapezoid(0.3, 2.9, 0.1, 2.7, 1.7, 0.1)));
+    TrapezoidBuffer kept;
+    TrapezoidKernels::clipBand(slanted, 0, 2, kept);
+    for (size_t i = 0; i < kept.size(); ++i)
+        success = success && kept.x1_bottom[i] == 0.1 && kept.x2_bottom[i] == 2.7 && kept.x1_top[i] == 0.3 && kept.x2_top[i] == 2.9;
+    std::cout << "Buffer clipped boolean Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_transform() {
+    std::vector<Polygon> polygons = {
+        Polygon({{0, 0}, {1, 0}, {1, 1}, {0, 1}}), // Квадратный полигон
+    };
+
+    // Расширение на 0.5 с углами Miter
+    std::vector<Polygon> sized = PolygonOperations::modifyPolygon(polygons, 0.5);
+    Box sized_box = sized[0].get_bounding_box();
+    bool success = sized.size() == 1 && sized[0].get_vertices().size() == 4 && sized_box.min_x == -0.5 &&
+                   sized_box.min_y == -0.5 && sized_box.max_x == 1.5 && sized_box.max_y == 1.5;
+
+    // Многопоточное преобразование слоя совпадает с последовательным
+    Layer serial("Serial");
+    for (int i = 0; i < 101; ++i)
+        serial.append(Polygon({{1.0 * i, 0}, {i + 0.5, 0}, {i + 0.5, 3}}, {Hole({{i + 0.1, 0.1}, {i + 0.2, 0.1}, {i + 0.2, 0.2}})}));
+    Layer parallel = serial;
+
+    AffineTransform transform = AffineTransform::rotation(0.3, Point(5, 5)) * AffineTransform::mirrorY(2) * AffineTransform::translation(1, -2);
+    LayerOperations::transformLayer(serial, transform);
+    LayerOperations::transformLayer(parallel, transform, 4);
+
+    for (size_t i = 0; i < serial.get_polygons().size(); ++i) {
+        const Polygon& expected = serial.get_polygons()[i];
+        const Polygon& actual = parallel.get_polygons()[i];
+        success = success && expected.get_vertices() == actual.get_vertices() &&
+                  expected.get_holes()[0].get_vertices() == actual.get_holes()[0].get_vertices();
+    }
+    Point reference = transform.apply(Point(100.5, 3));
+    success = success && std::abs(serial[100][2].x - reference.x) < EPSILON && std::abs(serial[100][2].y - reference.y) < EPSILON;
+
+    // Пакет с обычным и компактным слоем на общем пуле
+    LayerPack pack({Layer("Plain", serial.get_polygons()), Layer("Compact", CompactPolygons(serial.get_polygons()))});
+    ThreadPool pool(3);
+    LayerOperations::transformLayerPack(pack, transform, pool);
+    LayerOperations::transformLayer(serial, transform);
+    success = success && pack["Plain"].get_polygons()[57].get_vertices() == serial.get_polygons()[57].get_vertices()
+        && pack["Compact"].get_compact().to_polygons()[57].get_vertices() == serial.get_polygons()[57].get_vertices();
+
+    std::cout << "Transform Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+bool trapezoid_less(const Trapezoid& a, const Trapezoid& b) {
+    if (a.y_bottom != b.y_bottom) return a.y_bottom < b.y_bottom;
+    if (a.x1_bottom != b.x1_bottom) return a.x1_bottom < b.x1_bottom;
+    return a.y_top < b.y_top;
+}
+
+void test_parallel_boolean() {
+    // Наклонные пересекающиеся полосы, чтобы границы полос проходили через пересечения рёбер
+    std::vector<Trapezoid> a, b;
+    for (int i = 0; i < 300; ++i) {
+        double shift = (i * 37) % 101;
+        a.emplace_back(shift + 3, shift + 7, shift, shift + 5, i * 0.7 + 4, i * 0.7);
+        b.emplace_back(shift - 2, shift + 1, shift + 1, shift + 6, i * 0.5 + 6, i * 0.5);
+    }
+
+    std::vector<Trapezoid> serial = TrapezoidOperations::subtract(a, b);
+    std::vector<Trapezoid> parallel = TrapezoidOperations::subtract(a, b, 8);
+    std::sort(serial.begin(), serial.end(), trapezoid_less);
+    std::sort(parallel.begin(), parallel.end(), trapezoid_less);
+    assert_equal(parallel, serial, "Parallel subtract Test");
+
+    serial = TrapezoidOperations::unite(a, b);
+    parallel = TrapezoidOperations::unite(a, b, 3);
+    std::sort(serial.begin(), serial.end(), trapezoid_less);
+    std::sort(parallel.begin(), parallel.end(), trapezoid_less);
+    assert_equal(parallel, serial, "Parallel unite Test");
+
+    // Один пул на серию операций
+    ThreadPool pool(4);
+    bool success = true;
+    for (int i = 0; i < 3; ++i) {
+        parallel = TrapezoidOperations::unite(a, b, pool);
+        std::sort(parallel.begin(), parallel.end(), trapezoid_less);
+        success = success && are_vectors_equal(parallel, serial);
+    }
+    serial = TrapezoidOperations::intersect(a, b);
+    parallel = TrapezoidOperations::intersect(a, b, pool);
+    success = success && std::abs(total_area(parallel) - total_area(serial)) < EPSILON;
+    std::cout << "Parallel boolean on shared pool Test " << (success ? "passed" : "failed") << ".\n";
+
+    // Вложенные вызовы из задач пула и общий пул у двух потоков: исключение получает только его вызывающий
+    ThreadPool small(2);
+    std::vector<std::vector<Trapezoid>> nested(4);
+    small.parallel_for(nested.size(), [&](size_t i) { nested[i] = TrapezoidOperations::intersect(a, b, small); });
+    bool pooled = true;
+    for (const auto& result : nested)
+        pooled = pooled && std::abs(total_area(result) - total_area(serial)) < EPSILON;
+    std::atomic<size_t> finished(0);
+    bool caught = false;
+    std::thread failing([&] {
+        try {
+            small.parallel_for(8, [](size_t i) {
+                if (i == 5)
+                    throw std::runtime_error("task");
+            });
+        } catch (const std::runtime_error&) {
+            caught = true;
+        }
+    });
+    small.parallel_for(64, [&](size_t) { finished++; });
+    failing.join();
+    pooled = pooled && caught && finished == 64;
+    std::cout << "Thread pool nesting Test " << (pooled ? "passed" : "failed") << ".\n";
+}
+
+void test_layer_pack() {
+    LayerPack pack({Layer("Metal1"), Layer("Metal2"), Layer("Via1")});
+    pack.insert_layer(Layer("Poly"), 0);
+    pack["Metal2"].append(Polygon({{0, 0}, {1, 0}, {1, 1}}));
+
+    // Доступ по имени и по индексу ведёт к одному и тому же слою
+    bool success = pack[2].get_polygons().size() == 1 && &pack[2] == &pack["Metal2"];
+
+    pack.remove_layer("Metal1");
+    success = success && pack.get_layers_names() == std::vector<std::string>{"Poly", "Metal2", "Via1"};
+    success = success && pack.get_layers_index().at("Via1") == 2;
+
+    LayerOperations::copyLayerFromLayerPack(pack, "Metal2", "Metal2_copy");
+    pack.rename_layer("Metal2_copy", "Metal3");
+    success = success && pack["Metal3"].get_polygons().size() == 1 && !pack.contains("Metal2_copy");
+
+    // Переименование через ссылку на слой обновляет индекс имён пакета; присваивание имени не меняет
+    pack["Metal3"].rename("Metal4");
+    success = success && pack.contains("Metal4") && !pack.contains("Metal3") && pack["Metal4"].size() == 1;
+    pack["Via1"] = Layer("Via2", {Polygon({{0, 0}, {2, 0}, {2, 2}})});
+    success = success && pack[2].get_name() == "Via1" && pack["Via1"].size() == 1 && !pack.contains("Via2");
+    std::swap(pack["Via1"], pack["Metal4"]);
+    success = success && pack["Via1"].get_polygons()[0][1] == Point(1, 0) && pack["Metal4"].get_polygons()[0][1] == Point(2, 0);
+    pack.rename_layer("Via1", "Via2");
+    try {
+        pack["Poly"].rename("Metal2");
+        success = false;
+    } catch (const std::invalid_argument&) {
+    }
+
+    // Копия пакета переименовывает свои слои, не затрагивая исходный
+    LayerPack copy = pack;
+    copy.insert_layer(Layer("Poly2"), 0);
+    copy["Metal4"].rename("Metal5");
+    success = success && copy.contains("Metal5") && pack.contains("Metal4") && !pack.contains("Metal5");
+    success = success && copy.get_layers_names() == std::vector<std::string>{"Poly2", "Poly", "Metal2", "Via2", "Metal5"};
+
+    std::cout << "LayerPack Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_copy_on_write() {
+    LayerPack pack({Layer("Base", {Polygon({{0, 0}, {1, 0}, {1, 1}}), Polygon({{2, 0}, {3, 0}, {3, 1}})})});
+    LayerOperations::copyLayerFromLayerPack(pack, "Base", "Derived");
+
+    // Копия разделяет полигоны с исходным слоем до первого изменения
+    const Layer& base = pack["Base"];
+    bool success = &base.get_polygons() == &pack["Derived"].get_polygons() && base.is_shared();
+
+    pack["Derived"].remove(0);
+    success = success && base.get_polygons().size() == 2 && pack["Derived"].get_polygons().size() == 1;
+    success = success && !pack["Base"].is_shared() && !pack["Derived"].is_shared();
+
+    pack["Derived"][0][0].x = 10;
+    success = success && pack["Base"][1][0].x == 2;
+
+    // После копирования слоя ссылка берётся заново и изменяет только свой слой
+    Layer snapshot = pack["Derived"];
+    pack["Derived"][0][0].x = 20;
+    success = success && snapshot[0][0].x == 10 && pack["Derived"][0][0].x == 20;
+
+    std::cout << "Copy-on-write Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_compact_layer() {
+    Polygon frame({{0, 0}, {10, 0}, {10, 10}, {0, 10}}, {Hole({{2, 2}, {8, 2}, {8, 8}, {2, 8}})});
+    Layer layer("Metal1", {frame, Polygon({{20, 0}, {30, 0}, {30, 10}, {20, 10}})});
+    std::vector<Trapezoid> expected = LayerOperations::decomposeLayer(layer);
+
+    layer.compact();
+    const CompactPolygons& compact = layer.get_compact();
+    bool success = layer.is_compact() && layer.size() == 2 && compact.contour_count() == 3 && compact.vertex_count() == 12;
+    success = success && compact[0].hole_count() == 1 && compact[0].get_hole(0)[1] == Point(8, 2);
+
+    // Запросы и разбиение работают с компактным хранением без распаковки
+    success = success && layer.query_point(Point(5, 5)).empty() && layer.query_point(Point(1, 5)) == std::vector<size_t>{0};
+    success = success && std::abs(total_area(LayerOperations::decomposeLayer(layer)) - total_area(expected)) < 1e-9;
+    LayerOperations::transformLayer(layer, AffineTransform::translation(1, 0), 2);
+    success = success && layer.is_compact() && layer.query_nearest(Point(40, 5), 1) == std::vector<size_t>{1};
+
+    // Константный доступ не меняет хранение: копия через to_polygons(), get_polygons() - ошибка
+    const Layer& reader = layer;
+    success = success && reader.to_polygons()[0][0] == Point(1, 0) && layer.is_compact();
+    try {
+        reader.get_polygons();
+        success = false;
+    } catch (const std::logic_error&) {
+    }
+    success = success && layer.is_compact();
+
+    // Изменяемый доступ распаковывает слой
+    success = success && layer[0].get_holes().size() == 1 && layer[0][0] == Point(1, 0) && !layer.is_compact();
+    layer.compact();
+    layer.unpack();
+    success = success && !layer.is_compact() && reader.get_polygons()[1][0] == Point(21, 0);
+
+    std::cout << "Compact Layer Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_layout_file() {
+    Polygon frame({{0, 0}, {10, 0}, {10, 10}, {0, 10}}, {Hole({{2, 2}, {8, 2}, {8, 8}, {2, 8}})});
+    Layer packed("Metal2", {Polygon({{20, 0}, {30, 0}, {25, 10}})});
+    packed.compact();
+    LayerPack pack({Layer("Metal1", {frame, Polygon({{0, 20}, {5, 20}, {5, 25}})}), packed, Layer("Empty")});
+
+    const std::string path = "layout_file_test.lpk";
+    LayoutFile::save(pack, path);
+    bool success = true;
+    {
+        LayerPack loaded = LayoutFile::open(path);
+        success = loaded.get_layers_names() == pack.get_layers_names();
+        success = success && loaded["Metal1"].is_compact() && loaded["Metal1"].get_compact().is_external();
+        success = success && loaded["Metal1"].get_compact()[0].get_hole(0)[2] == Point(8, 8);
+        success = success && loaded["Empty"].size() == 0 && loaded["Metal2"].query_point(Point(25, 5)).size() == 1;
+
+        // Изменение копирует данные слоя из файла, сам файл остаётся прежним
+        LayerOperations::transformLayer(loaded["Metal2"], AffineTransform::translation(0, 100));
+        success = success && !loaded["Metal2"].get_compact().is_external() && loaded["Metal2"][0][2] == Point(25, 110);
+        success = success && LayoutFile::open(path)["Metal2"].get_compact()[0].get_vertices()[2] == Point(25, 10);
+
+        const Polygon& restored = loaded["Metal1"][0];
+        success = success && restored.get_vertices() == frame.get_vertices() &&
+                  restored.get_holes()[0].get_vertices() == frame.get_holes()[0].get_vertices();
+    }
+
+    // Смещение контура внутри таблицы выходит за массив вершин, крайние значения при этом верны
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        LayoutFile::Header header;
+        LayoutFile::LayerEntry entry;
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        file.seekg(static_cast<std::streamoff>(header.directory_offset));
+        file.read(reinterpret_cast<char*>(&entry), sizeof(entry));
+        uint64_t broken = entry.vertex_count + 1000;
+        file.seekp(static_cast<std::streamoff>(entry.contour_offsets_offset + sizeof(uint64_t)));
+        file.write(reinterpret_cast<const char*>(&broken), sizeof(broken));
+    }
+    try {
+        LayoutFile::open(path);
+        success = false;
+    } catch (const std::runtime_error&) {
+    }
+
+    // Повреждённый заголовок отклоняется
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.write("BROKEN", 6);
+    }
+    try {
+        LayoutFile::open(path);
+        success = false;
+    } catch (const std::runtime_error&) {
+    }
+    std::remove(path.c_str());
+
+    std::cout << "Layout file Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_gds_file() {
+    Polygon frame({{0, 0}, {10, 0}, {10, 10}, {0, 10}}, {Hole({{2, 2}, {8, 2}, {8, 8}, {2, 8}})});
+    Layer metal("Metal1", {frame, Polygon({{20, 0}, {30.0004, 0}, {25, 10}})});
+    LayerPack pack({metal, Layer("5/2", {Polygon({{0, 0}, {1, 0}, {1, 1}, {0, 1}})})});
+    GdsFile::LayerMap names = {{{1, 0}, "Metal1"}};
+
+    const std::string path = "gds_file_test.gds";
+    GdsFile::write(pack, path, names);
+    LayerPack loaded = GdsFile::read(path, names);
+    std::remove(path.c_str());
+
+    // Полигон с дыркой записывается трапецоидами, площадь при этом сохраняется
+    bool success = loaded.get_layers_names() == pack.get_layers_names() && loaded["Metal1"].is_compact();
+    success = success && std::abs(total_area(LayerOperations::decomposeLayer(loaded["Metal1"])) - 114) < 1e-9;
+    success = success && loaded["5/2"].size() == 1 && loaded["5/2"][0].get_vertices().size() == 4;
+    // Координаты округляются до единицы базы данных (1 нм)
+    success = success && loaded["Metal1"].query_point(Point(25, 5)).size() == 1;
+    bool rounded = false;
+    for (const Polygon& polygon : loaded["Metal1"].to_polygons())
+        for (const Point& p : polygon.get_vertices())
+            rounded = rounded || std::abs(p.x - 30) < 1e-12;
+    success = success && rounded;
+
+    try {
+        GdsFile::write(LayerPack({Layer("Unmapped")}), path);
+        success = false;
+    } catch (const std::invalid_argument&) {
+    }
+
+    std::cout << "GDSII Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+// Сборка файла GDSII по записям: GdsFile::write пишет только одну плоскую структуру
+class GdsBuilder {
+public:
+    void record(uint16_t type, const std::vector<unsigned char>& data = {}) {
+        put16(static_cast<uint16_t>(data.size() + 4));
+        put16(type);
+        bytes.insert(bytes.end(), data.begin(), data.end());
+    }
+
+    void int16(uint16_t type, int value) {
+        record(type, {static_cast<unsigned char>(value >> 8), static_cast<unsigned char>(value)});
+    }
+
+    void ascii(uint16_t type, std::string text) {
+        if (text.size() % 2)
+            text.push_back('\0');
+        record(type, std::vector<unsigned char>(text.begin(), text.end()));
+    }
+
+    void real8(uint16_t type, std::vector<double> values) {
+        std::vector<unsigned char> data;
+        for (double value : values) {
+            uint64_t bits = 0;
+            if (value != 0) {
+                int exponent = 64;
+                double mantissa = std::abs(value);
+                for (; mantissa >= 1; mantissa /= 16)
+                    ++exponent;
+                for (; mantissa < 1.0 / 16; mantissa *= 16)
+                    --exponent;
+                bits = uint64_t(value < 0) << 63 | uint64_t(exponent) << 56 | uint64_t(std::llround(mantissa * std::ldexp(1.0, 56)));
+            }
+            for (int i = 7; i >= 0; --i)
+                data.push_back(static_cast<unsigned char>(bits >> (8 * i)));
+        }
+        record(type, data);
+    }
+
+    void xy(const std::vector<std::pair<int32_t, int32_t>>& points) {
+        std::vector<unsigned char> data;
+        for (auto [x, y] : points) {
+            for (int32_t value : {x, y})
+                for (int i = 3; i >= 0; --i)
+                    data.push_back(static_cast<unsigned char>(static_cast<uint32_t>(value) >> (8 * i)));
+        }
+        record(0x1003, data);
+    }
+
+    void square(int32_t x, int32_t y, int32_t side) {
+        record(0x0800);
+        int16(0x0D02, 1);
+        int16(0x0E02, 0);
+        xy({{x, y}, {x + side, y}, {x + side, y + side}, {x, y + side}, {x, y}});
+        record(0x1100);
+    }
+
+    void save(const std::string& path) const {
+        std::ofstream(path, std::ios::binary).write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+
+private:
+    std::string bytes;
+
+    void put16(uint16_t value) {
+        bytes.push_back(static_cast<char>(value >> 8));
+        bytes.push_back(static_cast<char>(value));
+    }
+};
+
+void test_gds_hierarchy() {
+    // TOP: собственный квадрат, ссылка на VIA с поворотом на 90, отражённая ссылка и массив 2x3.
+    // VIA - квадрат 1x1 мкм, определён после ссылок на него
+    GdsBuilder gds;
+    gds.int16(0x0002, 600);
+    gds.record(0x0102, std::vector<unsigned char>(24));
+    gds.ascii(0x0206, "LIB");
+    gds.real8(0x0305, {1e-3, 1e-9});
+    gds.record(0x0502, std::vector<unsigned char>(24));
+    gds.ascii(0x0606, "TOP");
+    gds.square(20000, 20000, 1000);
+    gds.record(0x0A00);
+    gds.ascii(0x1206, "VIA");
+    gds.real8(0x1C05, {90});
+    gds.xy({{5000, 0}});
+    gds.record(0x1100);
+    gds.record(0x0A00);
+    gds.ascii(0x1206, "VIA");
+    gds.int16(0x1A01, 0x8000);
+    gds.xy({{0, 10000}});
+    gds.record(0x1100);
+    gds.record(0x0B00);
+    gds.ascii(0x1206, "VIA");
+    gds.record(0x1302, {0, 2, 0, 3});
+    gds.xy({{10000, 0}, {14000, 0}, {10000, 9000}});
+    gds.record(0x1100);
+    gds.record(0x0700);
+    gds.record(0x0502, std::vector<unsigned char>(24));
+    gds.ascii(0x0606, "VIA");
+    gds.square(0, 0, 1000);
+    gds.record(0x0700);
+    gds.record(0x0400);
+
+    const std::string path = "gds_hierarchy_test.gds";
+    gds.save(path);
+    LayerPack loaded = GdsFile::read(path);
+    CellLibrary library = GdsFile::readLibrary(path);
+    std::remove(path.c_str());
+
+    // 1 + 1 + 1 + 6 квадратов; сама VIA входит в TOP и отдельно не добавляется
+    bool success = loaded.get_layers_names() == std::vector<std::string>{"1/0"} && loaded["1/0"].size() == 9;
+    const Layer& layer = loaded["1/0"];
+    success = success && layer.query_point(Point(20.5, 20.5)).size() == 1
+        && layer.query_point(Point(4.5, 0.5)).size() == 1 && layer.query_point(Point(5.5, 0.5)).empty()
+        && layer.query_point(Point(0.5, 9.5)).size() == 1 && layer.query_point(Point(0.5, 0.5)).empty()
+        && layer.query_point(Point(12.5, 6.5)).size() == 1 && layer.query_point(Point(14.5, 0.5)).empty();
+    success = success && library.size() == 2 && library.top_cells() == std::vector<size_t>{library.find("TOP")}
+        && library["TOP"].get_instances().size() == 3;
+
+    // Ссылка на отсутствующую структуру
+    GdsBuilder broken;
+    broken.real8(0x0305, {1e-3, 1e-9});
+    broken.record(0x0502, std::vector<unsigned char>(24));
+    broken.ascii(0x0606, "TOP");
+    broken.record(0x0A00);
+    broken.ascii(0x1206, "MISSING");
+    broken.xy({{0, 0}});
+    broken.record(0x1100);
+    broken.record(0x0700);
+    broken.record(0x0400);
+    broken.save(path);
+    try {
+        GdsFile::read(path);
+        success = false;
+    } catch (const std::runtime_error&) {
+    }
+    std::remove(path.c_str());
+
+    std::cout << "GDSII hierarchy Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_oasis_file() {
+    // Решётка одинаковых прямоугольников, строка треугольников, октангулярный контур и полигон с дыркой
+    Layer cells("Metal1"), vias("Via1");
+    for (int i = 0; i < 10; ++i) {
+        for (int j = 0; j < 10; ++j)
+            cells.append(Polygon({{i * 5.0, j * 4.0}, {i * 5.0 + 2, j * 4.0}, {i * 5.0 + 2, j * 4.0 + 1}, {i * 5.0, j * 4.0 + 1}}));
+        vias.append(Polygon({{i * 3.0 + 0.5, 100}, {i * 3.0 + 1.5, 100}, {i * 3.0 + 1, 101.25}}));
+    }
+    vias.append(Polygon({{0, 0}, {2, 0}, {3, 1}, {3, 3}, {0, 3}}));
+    vias.append(Polygon({{50, 0}, {60, 0}, {60, 10}, {50, 10}}, {Hole({{52, 2}, {58, 2}, {58, 8}, {52, 8}})}));
+    LayerPack pack({cells, vias});
+
+    const std::string path = "oasis_file_test.oas";
+    bool success = true;
+    for (bool compress : {false, true}) {
+        OasisFile::write(pack, path, {}, 1e-3, compress);
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        long size = static_cast<long>(file.tellg());
+        LayerPack loaded = OasisFile::read(path);
+
+        success = success && loaded.get_layers_names() == pack.get_layers_names();
+        success = success && loaded["Metal1"].size() == 100 && loaded["Via1"].size() == 15;
+        for (const std::string& name : pack.get_layers_names()) {
+            double expected = total_area(LayerOperations::decomposeLayer(pack[name]));
+            success = success && std::abs(total_area(LayerOperations::decomposeLayer(loaded[name])) - expected) < 1e-6;
+        }
+        // Решётка из ста прямоугольников занимает одну запись
+        success = success && size < 600;
+    }
+
+    // Группа больше предела повторения пишется несколькими записями: 7 - части не кратны ряду решётки,
+    // 30 - три ряда на запись
+    auto corners = [](const Layer& layer) {
+        std::vector<std::pair<double, double>> result;
+        for (const Polygon& polygon : layer.to_polygons())
+            result.emplace_back(polygon.get_bounding_box().min_x, polygon.get_bounding_box().min_y);
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+    long unsplit = 0;
+    for (uint64_t limit : {OasisFile::MAX_REPETITION, uint64_t(30), uint64_t(7)}) {
+        OasisFile::write(pack, path, {}, 1e-3, false, limit);
+        long size = static_cast<long>(std::ifstream(path, std::ios::binary | std::ios::ate).tellg());
+        LayerPack loaded = OasisFile::read(path);
+        success = success && corners(loaded["Metal1"]) == corners(pack["Metal1"]) && loaded["Via1"].size() == 15;
+        if (limit == OasisFile::MAX_REPETITION)
+            unsplit = size;
+        else
+            success = success && size > unsplit;
+    }
+    try {
+        OasisFile::write(pack, path, {}, 1e-3, false, 0);
+        success = false;
+    } catch (const std::invalid_argument&) {
+    }
+
+    // Размеры из повреждённого файла не выделяются: блок на 1 ТиБ, список из 2^40 точек, решётка 2^30 x 2^30
+    auto put_uint = [](std::string& out, uint64_t value) {
+        for (; value >= 0x80; value >>= 7)
+            out.push_back(static_cast<char>(value | 0x80));
+        out.push_back(static_cast<char>(value));
+    };
+    std::string header("%SEMI-OASIS\r\n\x01\x03" "1.0" "\x00\x88\x07\x01", 22);
+    std::string block = header + "\x22";
+    put_uint(block, 0);
+    put_uint(block, uint64_t(1) << 40);
+    put_uint(block, 5);
+    block += std::string("\x01\x00\x00\xFF\xFF", 5);   // Пустой поток deflate
+    std::string polygon = header + "\x15\x20";
+    put_uint(polygon, 4);
+    put_uint(polygon, uint64_t(1) << 40);
+    std::string grid = header + "\x14\xC5";
+    put_uint(grid, 1);
+    put_uint(grid, 1);
+    put_uint(grid, 1);
+    put_uint(grid, uint64_t(1) << 30);
+    put_uint(grid, uint64_t(1) << 30);
+    for (const std::string& bytes : {block, polygon, grid}) {
+        std::ofstream(path, std::ios::binary).write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        try {
+            OasisFile::read(path);
+            success = false;
+        } catch (const std::runtime_error&) {
+        }
+    }
+    std::remove(path.c_str());
+
+    std::cout << "OASIS Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_edit_journal() {
+    LayerPack pack({Layer("Metal1", {Polygon({{0, 0}, {4, 0}, {4, 4}, {0, 4}})}), Layer("Metal2")});
+    EditJournal journal(pack, 2);
+
+    journal.begin();
+    journal.insert_vertex("Metal1", 0, Point(2, -1), 1);
+    journal.set_vertex("Metal1", 0, 3, Point(5, 5));
+    journal.append_polygon("Metal1", Polygon({{10, 10}, {11, 10}, {11, 11}}));
+    journal.commit();
+    journal.remove_layer("Metal2");
+    journal.rename_layer("Metal1", "Poly");
+
+    bool success = pack.get_layers_names() == std::vector<std::string>{"Poly"} && pack["Poly"].size() == 2;
+    success = success && pack["Poly"][0].get_vertices().size() == 5 && pack["Poly"][0][3] == Point(5, 5);
+
+    // Отмена переименования и удаления слоя
+    success = success && journal.undo() && journal.undo() && !journal.can_undo();
+    success = success && pack.get_layers_names() == std::vector<std::string>({"Metal1", "Metal2"});
+    // Транзакция с правками вершин вытеснена пределом глубины
+    success = success && pack["Metal1"].size() == 2;
+
+    success = success && journal.redo() && journal.redo() && !journal.redo();
+    success = success && pack.get_layers_names() == std::vector<std::string>{"Poly"};
+
+    // Откат открытой транзакции и сброс повторов новой правкой
+    journal.undo();
+    journal.begin();
+    journal.remove_polygon("Metal1", 1);
+    journal.remove_vertex("Metal1", 0, 4);
+    journal.rollback();
+    success = success && pack["Metal1"].size() == 2 && pack["Metal1"][0].get_vertices().size() == 5 && journal.can_redo();
+    journal.remove_polygon("Metal1", 1);
+    success = success && !journal.can_redo() && journal.undo() && pack["Metal1"][1][0] == Point(10, 10);
+
+    // Откат вложенной транзакции не затрагивает правки внешней
+    journal.begin();
+    journal.set_vertex("Metal1", 0, 0, Point(-1, -1));
+    journal.begin();
+    journal.remove_polygon("Metal1", 1);
+    journal.rollback();
+    success = success && journal.in_transaction() && pack["Metal1"].size() == 2 && pack["Metal1"][0][0] == Point(-1, -1);
+    journal.commit();
+    success = success && !journal.in_transaction() && journal.undo() && pack["Metal1"][0][0] == Point(0, 0);
+
+    std::cout << "Edit journal Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_expression_graph() {
+    LayerPack pack({Layer("A", {Polygon({{0, 0}, {4, 0}, {4, 4}, {0, 4}})}),
+                    Layer("B", {Polygon({{2, 0}, {6, 0}, {6, 4}, {2, 4}})}),
+                    Layer("C", {Polygon({{0, 1}, {6, 1}, {6, 2}, {0, 2}})}),
+                    Layer("D", {Polygon({{5, 0}, {8, 0}, {8, 8}, {5, 8}})})});
+
+    // (A ∪ B) − (C ∩ D) и (B ∪ A) ∩ D используют общий узел объединения
+    ExpressionGraph graph;
+    ExpressionGraph::Id a = graph.layer("A"), b = graph.layer("B"), c = graph.layer("C"), d = graph.layer("D");
+    ExpressionGraph::Id rule1 = graph.subtract(graph.unite(a, b), graph.intersect(c, d));
+    ExpressionGraph::Id rule2 = graph.intersect(graph.unite(b, a), d);
+    bool success = graph.size() == 8 && graph.unite(b, a) == graph.unite(a, b) && graph.layer("A") == a;
+
+    success = success && std::abs(total_area(graph.evaluate(rule1, pack)) - 23) < 1e-9;
+    success = success && std::abs(total_area(graph.evaluate(rule2, pack)) - 4) < 1e-9;
+    success = success && graph.cache_misses() == 8 && graph.cache_hits() == 2;
+
+    // Правка слоя D пересчитывает только зависящие от него узлы
+    pack["D"].remove(0);
+    graph.evaluate(rule1, pack);
+    graph.evaluate(rule2, pack);
+    success = success && graph.cache_misses() == 8 + 4 && std::abs(total_area(graph.evaluate(rule1, pack)) - 24) < 1e-9;
+
+    Layer result("Result");
+    graph.evaluate(rule1, pack, result);
+    success = success && result.size() == 1;
+
+    // Граф с пулом потоков даёт те же площади
+    ExpressionGraph threaded(4);
+    ExpressionGraph::Id rule = threaded.subtract(threaded.unite(threaded.layer("A"), threaded.layer("B")),
+                                                 threaded.intersect(threaded.layer("C"), threaded.layer("D")));
+    success = success && std::abs(total_area(threaded.evaluate(rule, pack)) - 24) < 1e-9;
+
+    std::cout << "Expression graph Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+double layerArea(const Layer& layer) {
+    double area = 0;
+    for (const Polygon& polygon : layer.get_polygons()) {
+        area += PolygonOperations::signedArea(polygon.get_vertices());
+        for (const Hole& hole : polygon.get_holes())
+            area += PolygonOperations::signedArea(hole.get_vertices());
+    }
+    return area / 2;
+}
+
+void test_size_layer() {
+    Layer square("Square", {Polygon({{0, 0}, {1, 0}, {1, 1}, {0, 1}})});
+    Layer miter, cut, round;
+    LayerOperations::sizeLayer(square, 0.5, miter);
+    LayerOperations::sizeLayer(square, 0.5, cut, JoinType::Square);
+    LayerOperations::sizeLayer(square, 0.5, round, JoinType::Round);
+    const double pi = std::acos(-1.0);
+    bool success = std::abs(layerArea(miter) - 4) < 1e-9 && miter.get_polygons()[0].get_vertices().size() == 4;
+    // Срез угла на расстоянии 0.5 от вершины, дуга вписана в окружность радиуса 0.5
+    success = success && cut.get_polygons()[0].get_vertices().size() == 8 && layerArea(cut) < 4
+        && layerArea(cut) > layerArea(round);
+    success = success && std::abs(layerArea(round) - (3 + pi / 4)) < 0.01 && layerArea(round) < 3 + pi / 4;
+
+    // Острый угол Miter (без ограничения ушёл бы на 20 от вершины) срезается на расстоянии miter_limit
+    Layer spike("Spike", {Polygon({{0, 0}, {10, 0}, {0, 1}})});
+    Layer limited;
+    LayerOperations::sizeLayer(spike, 1, limited, JoinType::Miter, 2);
+    Box limited_box = limited.get_polygons()[0].get_bounding_box();
+    success = success && limited_box.max_x > 11 && limited_box.max_x < 13;
+
+    // Сужение рамки: внешний контур сжимается, дырка растёт
+    Layer frame("Frame", {Polygon({{0, 0}, {10, 0}, {10, 10}, {0, 10}}, {Hole({{4, 4}, {6, 4}, {6, 6}, {4, 6}})})});
+    Layer shrunk;
+    LayerOperations::sizeLayer(frame, -1, shrunk);
+    success = success && shrunk.size() == 1 && shrunk.get_polygons()[0].get_holes().size() == 1
+        && std::abs(layerArea(shrunk) - 48) < 1e-9;
+    Box hole_box;
+    for (const Point& vertex : shrunk.get_polygons()[0].get_holes()[0].get_vertices())
+        hole_box.expand(vertex);
+    success = success && hole_box.min_x == 3 && hole_box.max_y == 7;
+
+    // Близкие полигоны сливаются при расширении, узкие исчезают при сужении
+    std::vector<Polygon> pair = {Polygon({{0, 0}, {1, 0}, {1, 1}, {0, 1}}), Polygon({{1.5, 0}, {2.5, 0}, {2.5, 1}, {1.5, 1}})};
+    success = success && PolygonOperations::modifyPolygon(pair, 0.3).size() == 1
+        && PolygonOperations::modifyPolygon(pair, -0.6).empty()
+        && PolygonOperations::modifyPolygon(pair, -0.25).size() == 2;
+
+    std::cout << "Size layer Test " << (success ? "passed" : "failed") << ".\n";
+
+    // Повёрнутый прямоугольник 10x3 при расширении и сужении не пропадает, площадь - как у прямоугольника
+    bool rotated = true;
+    for (int i = 0; i < 500; ++i) {
+        double angle = i * 0.0127, c = std::cos(angle), s = std::sin(angle);
+        double cx = 0.37 * i, cy = 13.1 - 0.21 * i;
+        std::vector<Point> corners;
+        for (auto [x, y] : {std::pair(-5.0, -1.5), std::pair(5.0, -1.5), std::pair(5.0, 1.5), std::pair(-5.0, 1.5)})
+            corners.emplace_back(cx + x * c - y * s, cy + x * s + y * c);
+        Layer source("Rotated", {Polygon(corners)});
+        Layer grown, shrunk_rotated;
+        LayerOperations::sizeLayer(source, 0.1, grown);
+        LayerOperations::sizeLayer(source, -0.05, shrunk_rotated);
+        rotated = rotated && grown.size() == 1 && shrunk_rotated.size() == 1
+            && std::abs(layerArea(grown) - 10.2 * 3.2) < 1e-6 && std::abs(layerArea(shrunk_rotated) - 9.9 * 2.9) < 1e-6;
+    }
+    std::cout << "Size rotated layer Test " << (rotated ? "passed" : "failed") << ".\n";
+}
+
+void test_database_units() {
+    // Слой в единицах 0.001 переводится в int32 и обратно без потерь
+    Layer layer("Metal", {Polygon({{0, 0}, {0.5, 0}, {0.5, 0.25}, {0, 0.25}}),
+                          Polygon({{1, 1}, {2, 1}, {2, 2}, {1, 2}}, {Hole({{1.25, 1.25}, {1.25, 1.75}, {1.75, 1.75}, {1.75, 1.25}})})});
+    std::vector<Polygon32> dbu = LayerOperations::toDatabaseUnits<int32_t>(layer, 1e-3);
+    bool success = sizeof(Point32) * 2 == sizeof(Point) && dbu.size() == 2
+        && dbu[0].get_vertices()[2] == Point32(500, 250) && dbu[1].get_holes().size() == 1;
+
+    // Площадь и предикаты точны: сравнения без допусков
+    success = success && PolygonOperations::signedArea(dbu[0].get_vertices()) == 2 * 500 * 250
+        && PolygonOperations::signedArea(dbu[1].get_holes()[0].get_vertices()) == -2 * 500 * 500;
+    success = success && dbu[1].contains(Point32(1100, 1100)) && !dbu[1].contains(Point32(1500, 1500))
+        && dbu[1].distance(Point32(1500, 1500)) == 250;
+
+    // Почти коллинеарные точки на краю диапазона int32: в double разность произведений теряется
+    Point32 a(-2147483647, -2147483647), b(2147483647, 2147483646), c(2147483646, 2147483645);
+    success = success && PolygonOperations::orientation(a, b, c) == -1 && PolygonOperations::orientation(a, c, b) == 1
+        && PolygonOperations::orientation(Point64(0, 0), Point64(1LL << 40, 1LL << 41), Point64(3LL << 40, 3LL << 41)) == 0;
+
+    Layer restored("Restored");
+    LayerOperations::fromDatabaseUnits(dbu, 1e-3, restored);
+    success = success && restored.size() == 2 && restored[0].get_vertices()[2] == Point(0.5, 0.25)
+        && restored[1].get_holes()[0].get_vertices()[1] == Point(1.25, 1.75);
+
+    bool overflow = false;
+    try {
+        LayerOperations::toDatabaseUnits<int32_t>(Layer("Huge", {Polygon({{0, 0}, {1e7, 0}, {0, 1}})}), 1e-3);
+    } catch (const std::out_of_range&) {
+        overflow = true;
+    }
+    success = success && overflow && LayerOperations::toDatabaseUnits<int64_t>(Layer("Huge", {Polygon({{0, 0}, {1e7, 0}, {0, 1}})}), 1e-3)[0].get_vertices()[1].x == 10000000000LL;
+
+    std::cout << "Database units Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_predicates() {
+    using Predicates::IntersectionStatus;
+    // Точки почти на одной прямой: в double определитель округляется до нуля
+    Point a(0.5, std::nextafter(0.5, 1.0)), b(12, 12), c(24, 24);
+    bool success = Predicates::orient2d(a, b, c) > 0 && Predicates::orient2d(a, c, b) < 0
+        && Predicates::orient2d(Point(0.5, 0.5), b, c) == 0 && PolygonOperations::orientation(a, b, c) == 1;
+
+    // Четыре точки на одной окружности и точка сразу за ней
+    Point p0(0, 0), p1(1, 0), p2(1, 1);
+    success = success && Predicates::incircle(p0, p1, p2, Point(0, 1)) == 0
+        && Predicates::incircle(p0, p1, p2, Point(0.5, 0.5)) > 0
+        && Predicates::incircle(p0, p1, p2, Point(0, std::nextafter(1.0, 2.0))) < 0;
+
+    // Почти параллельные направления с дробными координатами, вертикальные и совпадающие векторы
+    Point q0(0.1, 0.3), q1(0.7, 0.9), q2(0.7, std::nextafter(0.9, 1.0));
+    success = success && Predicates::cross(q0, q1, q0, q2) > 0 && Predicates::cross(q0, q2, q0, q1) < 0
+        && Predicates::cross(q0, q1, q0, q1) == 0
+        && Predicates::cross({1, 0}, {1, 5}, {2, 3}, {2, 7}) == 0
+        && Predicates::cross({1, 0}, {1, 5}, {2, 3}, {2.5, 7}) < 0;
+
+    Predicates::SegmentIntersection crossing = Predicates::intersectSegments({0, 0}, {2, 2}, {0, 2}, {2, 0});
+    Predicates::SegmentIntersection touching = Predicates::intersectSegments({0, 0}, {2, 0}, {2, 0}, {3, 5});
+    Predicates::SegmentIntersection overlap = Predicates::intersectSegments({0, 0}, {2, 0}, {3, 0}, {1, 0});
+    success = success && crossing.status == IntersectionStatus::Crossing && crossing.point == Point(1, 1)
+        && touching.status == IntersectionStatus::Crossing && touching.point == Point(2, 0)
+        && overlap.status == IntersectionStatus::Overlap && overlap.point == Point(1, 0)
+        && Predicates::intersectSegments({0, 0}, {2, 0}, {0, 1}, {2, 1}).status == IntersectionStatus::None
+        && Predicates::intersectSegments({0, 0}, {1, 0}, {2, 0}, {3, 0}).status == IntersectionStatus::None;
+
+    // Параллельные прямые не дают точки, без исключений
+    success = success && !Predicates::intersectLines({0, 0}, {1, 1}, {0, 1}, {1, 2})
+        && Predicates::intersectLines({0, 0}, {1, 1}, {0, 2}, {2, 0}) == Point(1, 1);
+
+    std::cout << "Predicates Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_layout_generator() {
+    // Генераторы детерминированы по seed и дают ожидаемую геометрию
+    Layer grid1 = LayoutGenerator::manhattanGrid(20, 20, 1.0, 0.5, 0.2, 7);
+    Layer grid2 = LayoutGenerator::manhattanGrid(20, 20, 1.0, 0.5, 0.2, 7);
+    bool success = grid1.size() > 100 && grid1.size() < 300 && grid1.size() == grid2.size()
+        && grid1[grid1.size() - 1].get_vertices() == grid2[grid2.size() - 1].get_vertices();
+
+    Layer vias = LayoutGenerator::viaArray(10, 20, 0.1, 0.5);
+    success = success && vias.size() == 200 && std::abs(total_area(LayerOperations::decomposeLayer(vias)) - 2) < 1e-9;
+
+    Layer wires = LayoutGenerator::diagonalWires(3, 10, 1.0, 0.2, 2.0);
+    success = success && wires.size() == 3 && wires[0].get_vertices().size() == 22
+        && std::abs(total_area(LayerOperations::decomposeLayer(wires)) - 3 * 10 * 0.2) < 1e-9;
+
+    Layer plates = LayoutGenerator::perforatedPlates(2, 5, 10.0);
+    success = success && plates.size() == 2 && plates[1].get_holes().size() == 25
+        && LayerOperations::decomposeLayer(plates).size() > 2 * 25;
+
+    std::cout << "Layout generator Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_trace() {
+    // Выключенная трассировка ничего не записывает
+    Trace::clear();
+    {
+        Trace::Scope scope("disabled");
+        Trace::count("ignored", 1);
+    }
+    bool success = Trace::eventCount() == 0;
+
+    // Вложенные интервалы со счётчиками из двух потоков
+    Trace::setEnabled(true);
+    {
+        Trace::Scope outer("outer");
+        Trace::count("items", 2);
+        Trace::count("items", 3);
+        {
+            Trace::Scope inner("inner");
+            Trace::count("pairs", 7);
+        }
+        std::thread worker([]() {
+            Trace::Scope scope("worker");
+        });
+        worker.join();
+    }
+    Trace::count("standalone", 1);
+    Trace::setEnabled(false);
+    success = success && Trace::eventCount() == 4;
+
+    const std::string path = "trace_test.json";
+    Trace::writeChromeTrace(path);
+    std::ifstream in(path);
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::remove(path.c_str());
+    success = success && json.find("\"traceEvents\"") != std::string::npos
+        && json.find("\"name\": \"outer\"") != std::string::npos && json.find("\"items\": 5") != std::string::npos
+        && json.find("\"pairs\": 7") != std::string::npos && json.find("\"ph\": \"C\"") != std::string::npos
+        && json.find("\"tid\": 1") != std::string::npos;
+    Trace::clear();
+    success = success && Trace::eventCount() == 0;
+
+    // Буферы завершившихся потоков переходят к новым потокам вместе с событиями
+    Trace::setEnabled(true);
+    size_t buffers = Trace::bufferCount();
+    for (int i = 0; i < 20; ++i) {
+        std::thread worker([]() {
+            Trace::Scope scope("short-lived");
+        });
+        worker.join();
+    }
+    Trace::setEnabled(false);
+    success = success && Trace::bufferCount() <= buffers + 1 && Trace::eventCount() == 20;
+    Trace::clear();
+
+    std::cout << "Trace Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_cell_hierarchy() {
+    // Одно отверстие, размещённое массивом 100 x 100 через два уровня иерархии
+    CellLibrary library;
+    size_t via = library.add_cell("Via");
+    size_t row = library.add_cell("Row");
+    size_t top = library.add_cell("Top");
+    library[via].get_layers().append_layer(Layer("V1", {Polygon({{0, 0}, {1, 0}, {1, 1}, {0, 1}})}));
+    library.add_instance(row, CellInstance(via, AffineTransform(), 100, 1, Point(2, 0)));
+    library.add_instance(top, CellInstance(row, AffineTransform(), 1, 100, Point(), Point(0, 3)));
+
+    Box box = library.get_bounding_box(top);
+    bool success = box.min_x == 0 && box.min_y == 0 && box.max_x == 199 && box.max_y == 298
+        && library.placed_count(top, "V1") == 10000 && library.top_cells() == std::vector<size_t>{top};
+
+    Layer all("All");
+    library.flatten(top, "V1", all);
+    success = success && all.size() == 10000 && std::abs(total_area(LayerOperations::decomposeLayer(all)) - 10000) < 1e-9;
+
+    // Окно задевает 3 x 2 отверстия
+    Layer window("Window");
+    library.flatten(top, "V1", Box(10.5, 9.5, 14.5, 13.5), window);
+    success = success && window.size() == 6;
+
+    // Повёрнутое и отражённое вхождение
+    size_t rotated = library.add_cell("Rotated");
+    library.add_instance(rotated, CellInstance(row, AffineTransform::rotation(std::acos(-1.0) / 2) * AffineTransform::mirrorX()));
+    Box rotated_box = library.get_bounding_box(rotated);
+    success = success && std::abs(rotated_box.min_x) < 1e-9 && std::abs(rotated_box.max_x - 1) < 1e-9
+        && std::abs(rotated_box.max_y - 199) < 1e-9;
+    Layer rotated_window("RotatedWindow");
+    library.flatten(rotated, "V1", Box(0.5, 4.5, 0.6, 6.5), rotated_window);
+    success = success && rotated_window.size() == 2;
+
+    // Изменение ячейки нижнего уровня обновляет прямоугольники предков
+    library[via].get_layers()["V1"].append(Polygon({{0, 0}, {5, 0}, {5, 1}, {0, 1}}));
+    success = success && library.get_bounding_box(top).max_x == 203 && library.placed_count(top, "V1") == 20000;
+
+    bool cycle = false;
+    try {
+        library.add_instance(via, CellInstance(top));
+    } catch (const std::invalid_argument&) {
+        cycle = true;
+    }
+    success = success && cycle;
+
+    std::cout << "Cell hierarchy Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_tile_rasterizer() {
+    // Квадрат 100 x 100 с дыркой 20 x 20 и отверстие меньше пикселя, масштаб 2 пикселя на единицу
+    LayerPack layerpack;
+    Polygon square({{0, 0}, {100, 0}, {100, 100}, {0, 100}});
+    square.add_hole(Hole({{40, 40}, {60, 40}, {60, 60}, {40, 60}}));
+    layerpack.append_layer(Layer("M1", {square, Polygon({{200.1, 10.1}, {200.3, 10.1}, {200.3, 10.3}, {200.1, 10.3}})}));
+    const uint32_t red = 0xffff0000;
+    TileRasterizer rasterizer(layerpack, {{"M1", red}}, 2, 4);
+
+    // Пиксель, содержащий точку (x, y), в тайлах окна
+    auto pixel = [](const std::vector<const TileRasterizer::Tile*>& tiles, double x, double y, double scale) -> uint32_t {
+        int64_t px = static_cast<int64_t>(std::floor(x * scale)), py = static_cast<int64_t>(std::floor(y * scale));
+        for (const TileRasterizer::Tile* tile : tiles) {
+            int64_t i = px - tile->column * TileRasterizer::TILE_SIZE;
+            int64_t j = (tile->row + 1) * TileRasterizer::TILE_SIZE - 1 - py;
+            if (i >= 0 && i < TileRasterizer::TILE_SIZE && j >= 0 && j < TileRasterizer::TILE_SIZE)
+                return tile->pixels[j * TileRasterizer::TILE_SIZE + i];
+        }
+        return 1;
+    };
+
+    Box view(0, 0, 300, 150);
+    auto tiles = rasterizer.render(view);
+    bool success = tiles.size() == 6 && rasterizer.rendered_tiles() == 6
+        && pixel(tiles, 10, 10, 2) == red && pixel(tiles, 99.9, 99.9, 2) == red
+        && pixel(tiles, 50, 50, 2) == 0 && pixel(tiles, 100.1, 50, 2) == 0
+        && pixel(tiles, 200.2, 10.2, 2) == red && pixel(tiles, 201, 10.2, 2) == 0;
+
+    // Полупрозрачный слой поверх
+    layerpack.append_layer(Layer("M2", {Polygon({{0, 0}, {10, 0}, {10, 10}, {0, 10}})}));
+    rasterizer.set_styles({{"M1", red}, {"M2", 0x800000ff}});
+    tiles = rasterizer.render(view);
+    success = success && pixel(tiles, 5, 5, 2) == 0xff7f0080 && rasterizer.rendered_tiles() == 12;
+
+    // Повторный кадр без изменений ничего не рисует, правка перерисовывает только задетый тайл
+    tiles = rasterizer.render(view);
+    success = success && rasterizer.rendered_tiles() == 12;
+    layerpack["M1"].append(Polygon({{260, 130}, {270, 130}, {270, 140}, {260, 140}}));
+    tiles = rasterizer.render(view);
+    success = success && rasterizer.rendered_tiles() == 13 && pixel(tiles, 265, 135, 2) == red;
+    layerpack["M1"][0].get_holes()[0][0] = Point(45, 45);
+    tiles = rasterizer.render(view);
+    success = success && rasterizer.rendered_tiles() == 14 && pixel(tiles, 42, 42, 2) == red;
+    // Полигон, выданный по ссылке, мог меняться через неё и после кадра, поэтому при следующей правке
+    // его тайл перерисовывается вместе с тайлом удалённого полигона
+    layerpack["M1"].remove(2);
+    tiles = rasterizer.render(view);
+    success = success && rasterizer.rendered_tiles() == 16 && pixel(tiles, 265, 135, 2) == 0;
+    // Замены слоя целиком нет в его журнале: перерисовываются тайлы под старым и новым слоем
+    layerpack["M2"] = Layer("M2", {Polygon({{210, 0}, {220, 0}, {220, 10}, {210, 10}})});
+    tiles = rasterizer.render(view);
+    success = success && rasterizer.rendered_tiles() == 18 && pixel(tiles, 5, 5, 2) == red
+        && pixel(tiles, 215, 5, 2) == 0x800000ff;
+
+    // Однопоточная отрисовка компактного слоя совпадает с параллельной
+    LayerPack compact = layerpack;
+    compact["M1"].compact();
+    TileRasterizer sequential(compact, {{"M1", red}, {"M2", 0x800000ff}}, 2);
+    auto other = sequential.render(view);
+    for (size_t i = 0; i < tiles.size(); ++i)
+        success = success && other[i]->pixels == tiles[i]->pixels;
+
+    bool thrown = false;
+    try {
+        rasterizer.render(Box(0, 0, 1e6, 1e6));
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    success = success && thrown;
+
+    std::cout << "Tile rasterizer Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_level_of_detail() {
+    // Кольцо по 2000 вершин на контур и 400 квадратов меньше допуска
+    const double pi = std::acos(-1.0);
+    std::vector<Point> outer, inner;
+    for (size_t i = 0; i < 2000; ++i) {
+        double angle = 2 * pi * i / 2000;
+        outer.emplace_back(100 * std::cos(angle), 100 * std::sin(angle));
+        inner.emplace_back(50 * std::cos(-angle), 50 * std::sin(-angle));
+    }
+    Layer layer("M1", {Polygon(outer, {Hole(inner)})});
+    for (size_t i = 0; i < 20; ++i) {
+        for (size_t j = 0; j < 20; ++j) {
+            double x = 200 + i, y = static_cast<double>(j);
+            layer.append(Polygon({{x, y}, {x + 0.1, y}, {x + 0.1, y + 0.1}, {x, y + 0.1}}));
+        }
+    }
+
+    LodPyramid pyramid(layer, 0.5, 3, 4);
+    bool success = pyramid.level_count() == 4 && pyramid.get_tolerance(2) == 2
+        && pyramid.choose_level(10) == 0 && pyramid.choose_level(1) == 1 && pyramid.choose_level(0.1) == 3;
+
+    // Квадраты объединяются по ячейкам 2 x 2, кольцо упрощается с малой потерей площади
+    const Layer& coarse = pyramid.get_level(1);
+    const Polygon& ring = coarse.get_polygons()[0];
+    double area = (std::abs(PolygonOperations::signedArea(ring.get_vertices()))
+        - std::abs(PolygonOperations::signedArea(ring.get_holes()[0].get_vertices()))) / 2;
+    success = success && coarse.size() == 101 && ring.get_vertices().size() < 100 && ring.get_holes().size() == 1
+        && std::abs(area - pi * 7500) < 0.01 * pi * 7500 && pyramid.is_current(1);
+    size_t coarse_size = coarse.size();
+
+    // Правка одного квадрата: остальные полигоны берутся из прошлого построения (ссылка coarse после этого недействительна)
+    layer[1].get_vertices()[0] = Point(199.95, -0.05);
+    success = success && !pyramid.is_current(1);
+    pyramid.get_level(1);
+    success = success && pyramid.is_current(1) && pyramid.reused_polygons(1) == 400;
+
+    // Фоновое построение: try_level не ждёт, get_level дожидается
+    const Layer* background = pyramid.try_level(3);
+    const Layer& built = pyramid.get_level(3);
+    success = success && (!background || background == &built) && pyramid.try_level(3) == &built && built.size() < coarse_size;
+
+    // Выступ высотой 0.4 с дыркой внутри: без него дырка вышла бы за контур, поэтому выступ остаётся
+    Layer bump("Bump", {Polygon({{0, 0}, {100, 0}, {100, 100}, {90, 100}, {50, 100.4}, {10, 100}, {0, 100}},
+                                {Hole({{40, 100.1}, {50, 100.3}, {60, 100.1}})})});
+    LodPyramid bump_pyramid(bump, 0.5, 1);
+    const Polygon& kept = bump_pyramid.get_level(1).get_polygons()[0];
+    success = success && kept.get_holes().size() == 1
+        && std::find(kept.get_vertices().begin(), kept.get_vertices().end(), Point(50, 100.4)) != kept.get_vertices().end();
+
+    std::cout << "Level of detail Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_pattern_density() {
+    // Квадрат (с перекрывающей копией) и треугольник на сетке 4 x 2 с шагом 5
+    Layer layer("M1", {Polygon({{0, 0}, {10, 0}, {10, 10}, {0, 10}}), Polygon({{0, 0}, {10, 0}, {10, 10}, {0, 10}}),
+                       Polygon({{10, 0}, {20, 0}, {10, 10}})});
+    PatternDensity::Grid area = PatternDensity::coveredArea(layer, Box(0, 0, 20, 10), 5, 5);
+    bool success = area.columns == 4 && area.rows == 2 && area.at(0, 0) == 25 && area.at(1, 1) == 25
+        && area.at(2, 0) == 25 && area.at(3, 0) == 12.5 && area.at(2, 1) == 12.5 && area.at(3, 1) == 0;
+
+    PatternDensity::Grid sliding = PatternDensity::slidingDensity(area, 2, 2);
+    success = success && sliding.columns == 3 && sliding.rows == 1 && sliding.window_x == 10
+        && sliding.at(0, 0) == 1 && sliding.at(1, 0) == 0.875 && sliding.at(2, 0) == 0.5;
+
+    // Наклонные провода: сумма по сетке равна площади слоя, многопоточный расчёт совпадает с однопоточным
+    Layer wires = LayoutGenerator::diagonalWires(20, 40, 1.0, 0.2, 1.5);
+    Box extent;
+    for (const Polygon& polygon : wires.get_polygons())
+        extent.expand(polygon.get_bounding_box());
+    PatternDensity::Grid sequential = PatternDensity::coveredArea(wires, extent, 0.7, 0.9);
+    PatternDensity::Grid parallel = PatternDensity::coveredArea(wires, extent, 0.7, 0.9, 4);
+    double sum = 0, difference = 0;
+    for (size_t i = 0; i < sequential.values.size(); ++i) {
+        sum += sequential.values[i];
+        difference = std::max(difference, std::abs(sequential.values[i] - parallel.values[i]));
+    }
+    double expected = total_area(LayerOperations::decomposeLayer(wires));
+    success = success && std::abs(sum - expected) < 1e-9 * expected && difference < 1e-9;
+
+    PatternDensity::Grid density = PatternDensity::density(wires, extent, 0.7, 0.9);
+    for (double value : density.values)
+        success = success && value >= 0 && value <= 1 + 1e-12;
+
+    const char* path = "test_density.csv";
+    PatternDensity::write(sliding, path, PatternDensity::GridFormat::Csv);
+    std::ifstream in(path);
+    std::string header, row;
+    std::getline(in, header);
+    std::getline(in, row);
+    in.close();
+    std::remove(path);
+    success = success && header == "# 0 0 5 5 10 10 3 1" && row == "1,0.875,0.5";
+
+    std::cout << "Pattern density Test " << (success ? "passed" : "failed") << ".\n";
+}
+
+void test_design_rules() {
+    using DesignRules::Rule;
+    // Узкая полоса шириной 1 и широкая шириной 3 с зазором 2; перекрывающиеся части широкой
+    // полосы объединяются и не дают ложного зазора. Переходное отверстие V1 отстоит от левого края
+    // широкой полосы на 0.5, второе отверстие лежит вне M1
+    LayerPack pack({Layer("M1", {Polygon({{0, 0}, {1, 0}, {1, 10}, {0, 10}}),
+                                 Polygon({{3, 0}, {6, 0}, {6, 6}, {3, 6}}),
+                                 Polygon({{3, 5}, {6, 5}, {6, 10}, {3, 10}})}),
+                    Layer("V1", {Polygon({{3.5, 1}, {4.5, 1}, {4.5, 2}, {3.5, 2}}),
+                                 Polygon({{20, 20}, {21, 20}, {21, 21}, {20, 21}})})});
+
+    std::vector<DesignRules::Violation> width = DesignRules::check(pack, Rule::width("M1", 2));
+    std::vector<DesignRules::Violation> spacing = DesignRules::check(pack, Rule::spacing("M1", 2.5));
+    std::vector<DesignRules::Violation> clean = DesignRules::check(pack, {Rule::width("M1", 1), Rule::spacing("M1", 2)});
+    std::vector<DesignRules::Violation> enclosure = DesignRules::check(pack, Rule::enclosure("V1", "M1", 0.6));
+
+    bool success = width.size() == 1 && std::abs(width[0].distance - 1) < 1e-9
+        && width[0].region.min_x == 0 && width[0].region.max_x == 1
+        && width[0].region.min_y == 0 && width[0].region.max_y == 10;
+    success = success && spacing.size() == 1 && std::abs(spacing[0].distance - 2) < 1e-9
+        && spacing[0].first.x == 1 && spacing[0].second.x == 3;
+    success = success && clean.empty();
+
+    // Недостаточный отступ слева и непокрытое отверстие
+    success = success && enclosure.size() == 2;
+    for (const DesignRules::Violation& violation : enclosure) {
+        if (violation.distance == 0) {
+            success = success && violation.region.min_x == 20 && violation.region.max_y == 21;
+        } else {
+            success = success && std::abs(violation.distance - 0.5) < 1e-9 && violation.first.x == 3.5;
+        }
+    }
+
+    // Разбиение на тайлы не теряет и не повторяет нарушений
+    std::vector<Polygon> grid;
+    for (int i = 0; i < 40; ++i) {
+        for (int j = 0; j < 40; ++j) {
+            double x = i * 3 + (j % 3) * 0.25;
+            double y = j * 3;
+            grid.push_back(Polygon({{x, y}, {x + 1 + (i % 2), y}, {x + 1 + (i % 2), y + 2}, {x, y + 2}}));
+        }
+    }
+    LayerPack dense({Layer("G", grid)});
+    std::vector<Rule> rules = {Rule::width("G", 1.5), Rule::spacing("G", 1.2)};
+    std::vector<DesignRules::Violation> sequential = DesignRules::check(dense, rules);
+    std::vector<DesignRules::Violation> parallel = DesignRules::check(dense, rules, 4);
+    success = success && !sequential.empty() && sequential.size() == parallel.size();
+    for (size_t i = 0; success && i < sequential.size(); ++i) {
+        success = sequential[i].rule == parallel[i].rule && sequential[i].first == parallel[i].first
+            && sequential[i].second == parallel[i].second;
+    }
+
+    try {
+        DesignRules::check(pack, Rule::width("M1", 0));
+        success = false;
+    } catch (const std::invalid_argument&) {
+    }
+
+    // Повёрнутая полоса 0.5x10 под произвольным углом всегда нарушает ширину 1
+    for (int i = 0; success && i < 1000; ++i) {
+        double angle = i * 0.00637, c = std::cos(angle), s = std::sin(angle);
+        double cx = 0.113 * i, cy = 50 - 0.071 * i;
+        std::vector<Point> corners;
+        for (auto [x, y] : {std::pair(-0.25, -5.0), std::pair(0.25, -5.0), std::pair(0.25, 5.0), std::pair(-0.25, 5.0)})
+            corners.emplace_back(cx + x * c - y * s, cy + x * s + y * c);
+        LayerPack strip({Layer("M1", {Polygon(corners)})});
+        std::vector<DesignRules::Violation> narrow = DesignRules::check(strip, Rule::width("M1", 1));
+        success = !narrow.empty() && std::abs(narrow[0].distance - 0.5) < 1e-9;
+    }
+
+    std::cout << "Design rules Test " << (success ? "passed" : "failed") << ".\n";
+}
+
 //void test_copy_layer() {
 //    LayerPack layerpack;
 //    layerpack.addLayer("Layer1", {Trapezoid(0, 2, 0, 2, 0, 2)});
@@ -141,6 +1493,32 @@ int main() {
     test_unite();
     test_intersect();
     test_subtract();
+    test_sweep_boolean();
+    test_decompose();
+    test_reconstruct();
+    test_spatial_index();
+    test_trapezoid_buffer();
+    test_transform();
+    test_parallel_boolean();
+    test_layer_pack();
+    test_copy_on_write();
+    test_compact_layer();
+    test_layout_file();
+    test_gds_file();
+    test_gds_hierarchy();
+    test_oasis_file();
+    test_edit_journal();
+    test_expression_graph();
+    test_design_rules();
+    test_size_layer();
+    test_database_units();
+    test_predicates();
+    test_layout_generator();
+    test_trace();
+    test_cell_hierarchy();
+    test_tile_rasterizer();
+    test_level_of_detail();
+    test_pattern_density();
     //test_copy_layer();
     //test_modifyPolygon();
     return 0;